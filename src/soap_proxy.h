@@ -40,6 +40,7 @@
 #include "sp_constants.h"
 #include "sp_svc.h"
 #include "sp_props.h"
+#include "sp_reader.h"
 #include <stdarg.h>
 
 /**
@@ -84,10 +85,13 @@ struct rp_cb_ctx_struct {
 
   const axutil_env_t *env;
 
-  // file to read from - only one of fp or st is used.
+  // file to read from - only one of fp, rd or st is used.
   FILE *fp;
 
-  // stream to read from, if file is not used.
+  // buffered reader, used in preference to st.
+  sp_reader *rd;
+
+  // stream to read from, if neither file nor reader is used.
   axutil_stream_t *st;
 
   // boundary string
@@ -105,6 +109,15 @@ struct rp_cb_ctx_struct {
 
 typedef struct rp_cb_ctx_struct Rp_cb_ctx;
 
+void init_rp_cb_ctx(
+    const axutil_env_t *env,
+    Rp_cb_ctx          *ctx);
+
+int rp_fill_buff_CB(
+    char *buffer,
+    int   size,
+    void *ctx);
+
 
 /* -------------------------- Name-value pairs ----------*/
 struct name_value_struct {
@@ -114,6 +127,14 @@ struct name_value_struct {
 
 typedef struct name_value_struct Name_value;
 
+/* -------------------------- Serialised XML ------------*/
+struct sp_xml_range_struct {
+  size_t off;
+  size_t len;
+};
+
+typedef struct sp_xml_range_struct sp_xml_range;
+
 
 /* -------------------------- Fault Generation ----------*/
 
@@ -136,19 +157,33 @@ enum sp_error_codes
 	 SP_USER_ERR_NO_HASHMATCH,
 	 SP_USER_ERR_CONTENTTYPE,
 	 SP_USER_ERR_CONTENTHEADERS,
+	 SP_USER_ERR_NOT_AUTHORIZED,
+	 SP_USER_ERR_RATE_LIMITED,
+	 SP_USER_ERR_NO_SUCH_JOB,
+	 SP_USER_ERR_JOB_NOT_READY,
+	 SP_USER_ERR_COVERAGE_TOO_LARGE,
 
 	 SP_SYS_ERR_INTERNAL,
 	 SP_SYS_ERR_MS_EXEC,
 	 SP_SYS_ERR_MS_OUT_PROCESSING,
 	 SP_SYS_ERR_PROPSLOAD,
-	 SP_SYS_ERR_NOT_IMPLEMENTED
+	 SP_SYS_ERR_NOT_IMPLEMENTED,
+	 SP_SYS_ERR_BACKEND_DRAINING,
+	 SP_SYS_ERR_BACKEND_BUSY,
+
+	 SP_ERR_CODES_END
 };
 
+#define SP_ERR_NCODES (SP_ERR_CODES_END - SP_USER_ERR_NO_INPUT)
+
 /* ---------------------- forward / external declarations ----------*/
 axiom_node_t *rp_error_elem(
     const axutil_env_t * env,
     const axis2_char_t * errorText);
 
+const char *sp_error_code_name(
+    const int code);
+
 int rp_log_error(
     const axutil_env_t *env,
     const char         *format,
@@ -157,7 +192,7 @@ int rp_log_error(
 void sp_dump_bad_content(
     const axutil_env_t *env,
     char               *contentTypeStr,
-    axutil_stream_t    *st,
+    sp_reader          *rd,
     char               *header_blob);
 
 int rp_get_contentType(char *str);
@@ -169,15 +204,35 @@ sp_process_xml_st(
     axutil_stream_t    *st,
     const char         *boundId);
 
+axiom_node_t *
+sp_process_xml_io(
+    const axutil_env_t *env,
+    int (*read_cb)(char *buffer, int size, void *ctx),
+    void               *ctx);
+
+axiom_node_t *
+sp_process_xml_rd(
+    const axutil_env_t *env,
+    sp_reader          *rd,
+    const char         *boundId);
+
 axiom_node_t *
 rp_process_xml(
     const axutil_env_t * env,
     FILE *fp,
     const char *boundId);
 
+int sp_exec_capture(
+    const axutil_env_t *env,
+    char *const         argv[],
+    char               *buf,
+    const size_t        len);
+
 int sp_execMs_dashV(
     const axutil_env_t *env,
-    const axis2_char_t *msexec);
+    const axis2_char_t *msexec,
+    char               *buf,
+    const size_t        len);
 
 axutil_stream_t *sp_execMapserv(
     const axutil_env_t * env,
@@ -191,6 +246,17 @@ axutil_stream_t *sp_backend_socket(
     const axis2_char_t *req,
     const axis2_char_t *mapfile);
 
+char *sp_backend_head(
+    const axutil_env_t *env,
+    const axis2_char_t *path,
+    const int           req_len,
+    const axis2_char_t *mapfile);
+
+axutil_stream_t *sp_sock_connect(
+    const axutil_env_t *env,
+    const axis2_char_t *host,
+    int                 port);
+
 void sp_stream_cleanup(
     const axutil_env_t *env,
     axutil_stream_t    *sstream);
@@ -244,7 +310,7 @@ char * rp_read_bin_mime_image(
 char *sp_load_binary_file(
     const axutil_env_t *env,
     char               *header_blob,
-    axutil_stream_t    *st,
+    sp_reader          *rd,
     int                *len);
 
 char * rp_load_binary_file(
@@ -265,12 +331,27 @@ sp_get_last_text_node(
     axiom_node_t       *node,
     const axutil_env_t *env);
 
+int sp_xml_children(
+    const char   *xml,
+    const size_t  len,
+    size_t       *head_len,
+    size_t       *tail_off,
+    sp_xml_range *child,
+    const int     max,
+    int          *n);
+
 axiom_node_t *rp_find_named_node(
     const axutil_env_t *env,
     axiom_node_t       *root_node,
     const axis2_char_t *local_name,
     int                 recurse);
 
+axiom_node_t *rp_find_named_node_re(
+    const axutil_env_t *env,
+    axiom_node_t       *root_node,
+    const axis2_char_t *local_name,
+    const axis2_char_t *search_str);
+
 axiom_node_t *rp_find_named_child(
     const axutil_env_t *env,
     axiom_node_t       *root_node,
@@ -341,6 +422,21 @@ sp_build_response20(
     const sp_props     *props, 
     axutil_stream_t    *st);
 
+axiom_node_t *
+sp_make_MTOM_dh_node20(
+    const axutil_env_t   *env,
+    axiom_data_handler_t *data_handler,
+    axis2_char_t         *el_name,
+    axis2_char_t         *ns_prefix,
+    axis2_char_t         *ns_uri);
+
+void
+sp_attach_dh20(
+    const axutil_env_t   *env,
+    axiom_node_t         *gml_node,
+    axiom_data_handler_t *dh,
+    const axis2_char_t   *cid);
+
 void rp_inject_soap_cap20(
     const axutil_env_t * env,
     const sp_props     *props,
@@ -374,6 +470,17 @@ char* sp_stream_getline(
 	unsigned int       size,
 	const int          delete_cr);
 
+int sp_load_header_blob(
+    const axutil_env_t *env,
+    axutil_stream_t    *st,
+    char               *buf,
+    const int           len);
+
+void scan_boundId(
+    char       *boundId,
+    const char *contentLine);
+
 time_t sp_parse_time_str(const axis2_char_t *time_str);
+int    sp_parse_iso_time(const axis2_char_t *time_str, double *t);
 
 #endif
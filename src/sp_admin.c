@@ -0,0 +1,565 @@
+/*
+ * Soap Proxy.
+ *
+ * Administrative operations.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_admin.c
+ *
+ * Operations for running the service, next to GetMsVersion and
+ * GetProxyStats, but with side effects or revealing the configuration:
+ *
+ *   PurgeCache    - remove coverage cache entries, all of them, or those
+ *                   of a <KeyPrefix> (hex digits of the cache key) or of
+ *                   a <CoverageId>.  The capabilities kept by sp_caps.c
+ *                   are dropped in any case.
+ *   GetPoolStatus - the backend and the state of the connections to it.
+ *   DrainBackend  - <State>on</State> makes requests needing the backend
+ *                   fail at once with SP_SYS_ERR_BACKEND_DRAINING, while
+ *                   cache hits are still answered; <State>off</State>
+ *                   resumes.  Applies to all processes of the service.
+ *   PrewarmCache  - runs the GetCoverage requests it contains through
+ *                   the coverage cache, fetching those not yet cached.
+ *   DumpConfig    - the effective parameters, AdminSecret masked.
+ *
+ * All of these are refused with SP_USER_ERR_NOT_AUTHORIZED unless the
+ * request carries a <Secret> matching AdminSecret, and, if AdminAllowFrom
+ * is set, comes from an address listed there.  The address is the one
+ * of sp_client_addr(), which trusts X-Forwarded-For only from the
+ * TrustedProxies.  Without AdminSecret the operations are disabled.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <axutil_property.h>
+
+#include "soap_proxy.h"
+#include "sp_admin.h"
+#include "sp_cache.h"
+#include "sp_client.h"
+#include "sp_compress.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_ADMIN_MASK_STR "********"
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int          wcs_version);
+
+static const char *sp_admin_op_names[] =
+{
+    "PurgeCache",
+    "GetPoolStatus",
+    "DrainBackend",
+    "PrewarmCache",
+    "DumpConfig",
+    NULL
+};
+
+static const char *sp_admin_level_names[] =
+{
+    "error", "warning", "info", "debug"
+};
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+// Compare without leaking the position of the first difference via timing.
+static int sp_admin_secret_ok(const char *expected, const char *given)
+{
+    const size_t len   = strlen(expected);
+    const size_t g_len = strlen(given);
+    unsigned char diff = (g_len != len);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        diff |= (unsigned char) expected[i] ^
+                (unsigned char) (i < g_len ? given[i] : 0);
+    }
+    return 0 == diff;
+}
+
+//-----------------------------------------------------------------------------
+/** Check whether the client may use the administrative operations.
+ * @param env
+ * @param props
+ * @param node the request element.
+ * @return non-zero if authorized.
+ */
+static int sp_admin_authorized(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    const char *secret = rp_getAdminSecret(env, props);
+    const char *allow  = rp_getAdminAllowFrom(env, props);
+    char        buf[SP_CLIENT_ADDR_LEN];
+    const char *peer   = sp_client_addr(env, props, buf);
+
+    // Behind a reverse proxy every client may seem to come from it, so an
+    // address alone is never enough.
+    if ('\0' == secret[0])
+    {
+        SP_LOG_WARNING("administrative operations are disabled,"
+                       " set " SP_ADMINSEC_STR ".");
+        return 0;
+    }
+
+    const axis2_char_t *given = sp_get_text_el(
+        rp_find_named_child(env, node, "Secret", 0), env);
+    if (NULL == given || ! sp_admin_secret_ok(secret, given))
+    {
+        SP_LOG_WARNING("administrative request with a wrong secret"
+                       " from %s", peer ? peer : "unknown");
+        return 0;
+    }
+
+    if ('\0' != allow[0] && ! (peer && sp_client_addr_in(peer, allow)))
+    {
+        SP_LOG_WARNING("administrative request from %s refused",
+                       peer ? peer : "unknown");
+        return 0;
+    }
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+static axiom_node_t *sp_admin_el(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    const axis2_char_t *el_name,
+    axiom_element_t   **el)
+{
+    axiom_node_t *node = NULL;
+    axiom_namespace_t *ns =
+        axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    *el = axiom_element_create(env, parent, el_name, ns, &node);
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_admin_attr(
+    const axutil_env_t *env,
+    axiom_element_t    *el,
+    axiom_node_t       *node,
+    const axis2_char_t *name,
+    const axis2_char_t *val)
+{
+    axiom_attribute_t *attr = axiom_attribute_create(env, name, val, NULL);
+    axiom_element_add_attribute(el, env, attr, node);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_admin_attr_int(
+    const axutil_env_t *env,
+    axiom_element_t    *el,
+    axiom_node_t       *node,
+    const axis2_char_t *name,
+    const int           val)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", val);
+    sp_admin_attr(env, el, node, name, buf);
+}
+
+//-----------------------------------------------------------------------------
+/** PurgeCache, response e.g.  <sopr:PurgeResult purged="12"/>
+ */
+static axiom_node_t *sp_admin_purge(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    const axis2_char_t *prefix = sp_get_text_el(
+        rp_find_named_child(env, node, "KeyPrefix", 0), env);
+    const axis2_char_t *cov_id = sp_get_text_el(
+        rp_find_named_child(env, node, "CoverageId", 0), env);
+
+    if (prefix &&
+        (strlen(prefix) > 32 || strspn(prefix, "0123456789abcdefABCDEF") != strlen(prefix)))
+    {
+        SP_ERROR(env, SP_USER_ERR_BAD_REQ);
+        rp_log_error(env, "(%s:%d) PurgeCache: KeyPrefix must be at most"
+                     " 32 hex digits.\n", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    sp_stats_set_purged();
+
+    int n = 0;
+    if (sp_cache_enabled(env, props))
+    {
+        n = sp_cache_purge(env, props, prefix, cov_id);
+        if (n < 0)
+        {
+            SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+            rp_log_error(env, "(%s:%d) PurgeCache: cache not usable.\n",
+                         __FILE__, __LINE__);
+            return NULL;
+        }
+    }
+
+    axiom_element_t *el        = NULL;
+    axiom_node_t    *resp_node = sp_admin_el(env, NULL, "PurgeResult", &el);
+    sp_admin_attr_int(env, el, resp_node, "purged", n);
+    return resp_node;
+}
+
+//-----------------------------------------------------------------------------
+/** DrainBackend, responds with the pool status.
+ */
+static axiom_node_t *sp_admin_drain(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    const axis2_char_t *state = sp_get_text_el(
+        rp_find_named_child(env, node, "State", 0), env);
+
+    if (state && (0 == axutil_strcasecmp(state, "on") ||
+                  0 == axutil_strcasecmp(state, "true")))
+    {
+        sp_stats_set_drain(1);
+    }
+    else if (state && (0 == axutil_strcasecmp(state, "off") ||
+                       0 == axutil_strcasecmp(state, "false")))
+    {
+        sp_stats_set_drain(0);
+    }
+    else
+    {
+        SP_ERROR(env, SP_USER_ERR_BAD_REQ);
+        rp_log_error(env, "(%s:%d) DrainBackend: State must be on or off.\n",
+                     __FILE__, __LINE__);
+        return NULL;
+    }
+
+    SP_LOG_INFO("backend drain mode %s", sp_stats_drain_since() ? "on" : "off");
+    return rp_getPoolStatus(env, props);
+}
+
+//-----------------------------------------------------------------------------
+/** PrewarmCache, response e.g.
+ *
+ *  <sopr:PrewarmResult cached="1" loaded="1" failed="0">
+ *    <sopr:Request index="1" result="cached" key="9f3c..."/>
+ *    <sopr:Request index="2" result="loaded" key="01ab..."/>
+ *  </sopr:PrewarmResult>
+ *
+ * Each GetCoverage must declare the namespaces it uses itself, since it
+ * is passed on to the backend on its own.
+ */
+static axiom_node_t *sp_admin_prewarm(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    const int           protocol)
+{
+    if (! sp_cache_enabled(env, props))
+    {
+        SP_ERROR(env, SP_SYS_ERR_NOT_IMPLEMENTED);
+        rp_log_error(env, "PrewarmCache: " SP_CACHEDIR_STR " not set.\n");
+        return NULL;
+    }
+
+    axiom_element_t *el        = NULL;
+    axiom_node_t    *resp_node = sp_admin_el(env, NULL, "PrewarmResult", &el);
+    int n_cached = 0, n_loaded = 0, n_failed = 0, index = 0;
+
+    axiom_node_t *req = axiom_node_get_first_child(node, env);
+    for ( ; req; req = axiom_node_get_next_sibling(req, env))
+    {
+        if (AXIOM_ELEMENT != axiom_node_get_node_type(req, env)) continue;
+        axiom_element_t *req_el = axiom_node_get_data_element(req, env);
+        if (axutil_strcmp(axiom_element_get_localname(req_el, env),
+                          "GetCoverage"))
+        {
+            continue;
+        }
+        index++;
+
+        const char  *result = "failed";
+        sp_cache_key key;
+        char         hex[36];
+        hex[0] = '\0';
+
+        if (0 == sp_cache_coverage_key(env, props, req, &key))
+        {
+            snprintf(hex, sizeof(hex), "%016llx%016llx",
+                     (unsigned long long) key.h[0],
+                     (unsigned long long) key.h[1]);
+
+            if (sp_cache_has_coverage(env, props, &key))
+            {
+                result = "cached";
+            }
+            else
+            {
+                const axis2_char_t *cov_id = sp_get_text_el(
+                    rp_find_named_child(env, req, "CoverageId", 0), env);
+                axiom_node_t *cov = rp_invokeBackend(env, req, props, protocol);
+                sp_compress_coverage(env, props, cov);
+                if (cov && 0 == sp_cache_put_coverage(env, props, &key,
+                                                      cov_id, cov))
+                {
+                    result = "loaded";
+                }
+                if (cov) axiom_node_free_tree(cov, env);
+
+                // A failed request must not fail the whole operation.
+                axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+            }
+        }
+
+        if      ('c' == result[0]) n_cached++;
+        else if ('l' == result[0]) n_loaded++;
+        else                       n_failed++;
+
+        axiom_element_t *r_el   = NULL;
+        axiom_node_t    *r_node = sp_admin_el(env, resp_node, "Request", &r_el);
+        sp_admin_attr_int(env, r_el, r_node, "index", index);
+        sp_admin_attr    (env, r_el, r_node, "result", result);
+        if (hex[0]) sp_admin_attr(env, r_el, r_node, "key", hex);
+    }
+
+    sp_admin_attr_int(env, el, resp_node, "cached", n_cached);
+    sp_admin_attr_int(env, el, resp_node, "loaded", n_loaded);
+    sp_admin_attr_int(env, el, resp_node, "failed", n_failed);
+
+    SP_LOG_INFO("prewarm: cached=%d loaded=%d failed=%d",
+                n_cached, n_loaded, n_failed);
+    return resp_node;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_admin_param(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    const axis2_char_t *name,
+    const axis2_char_t *val)
+{
+    axiom_element_t *el   = NULL;
+    axiom_node_t    *node = sp_admin_el(env, parent, "Parameter", &el);
+    sp_admin_attr(env, el, node, "name", name);
+    axiom_element_set_text(el, env, val, node);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_admin_param_int(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    const axis2_char_t *name,
+    const int           val)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", val);
+    sp_admin_param(env, parent, name, buf);
+}
+
+//-----------------------------------------------------------------------------
+/** DumpConfig, response e.g.
+ *
+ *  <sopr:Config mode="URL">
+ *    <sopr:Parameter name="BackendURL">http://127.0.0.1/ows</sopr:Parameter>
+ *    ...
+ *  </sopr:Config>
+ *
+ * Lists the values in effect, i.e. with defaults filled in.
+ */
+static axiom_node_t *sp_admin_dump_config(
+    const axutil_env_t *env,
+    const sp_props     *props)
+{
+    axiom_element_t *el        = NULL;
+    axiom_node_t    *resp_node = sp_admin_el(env, NULL, "Config", &el);
+    const int        url_mode  = rp_getUrlMode(env, props);
+    const int        level     = rp_getLogLevel(env, props);
+
+    sp_admin_attr(env, el, resp_node, "mode", url_mode ? "URL" : "Exec");
+
+    if (url_mode)
+    {
+        sp_admin_param(env, resp_node, SP_BACKENDURL_STR,
+                       rp_getBackendURL(env, props));
+    }
+    else
+    {
+        sp_admin_param(env, resp_node, SP_MAPSERVER_STR,
+                       rp_getMapserverExec(env, props));
+    }
+    sp_admin_param(env, resp_node, SP_MAPFILE_STR, rp_getMapfile(env, props));
+    sp_admin_param(env, resp_node, SP_SOAPOPSURL_STR,
+                   rp_getSoapOpsURL(env, props));
+    sp_admin_param(env, resp_node, SP_DELNONSOAP_STR,
+                   rp_getDeletingNonSoap(env, props) ? "true" : "false");
+    sp_admin_param(env, resp_node, SP_DEBUG_STR,
+                   rp_getDebugMode(env, props) ? "true" : "false");
+    sp_admin_param(env, resp_node, SP_LOGFILE_STR, rp_getLogFile(env, props));
+    sp_admin_param(env, resp_node, SP_LOGLEVEL_STR,
+                   level >= 0 && level < SP_LOG_NLEVELS ?
+                   sp_admin_level_names[level] : "");
+    sp_admin_param_int(env, resp_node, SP_LOGRATE_STR,
+                       rp_getLogRateLimit(env, props));
+    sp_admin_param_int(env, resp_node, SP_SLOWREQ_STR,
+                       rp_getSlowRequestMs(env, props));
+    sp_admin_param(env, resp_node, SP_CACHEDIR_STR, rp_getCacheDir(env, props));
+    sp_admin_param_int(env, resp_node, SP_CACHESIZE_STR,
+                       rp_getCacheSizeMB(env, props));
+    sp_admin_param(env, resp_node, SP_ADMINSEC_STR,
+                   rp_getAdminSecret(env, props)[0] ? SP_ADMIN_MASK_STR : "");
+    sp_admin_param(env, resp_node, SP_ADMINIPS_STR,
+                   rp_getAdminAllowFrom(env, props));
+    sp_admin_param(env, resp_node, SP_PROXIES_STR,
+                   rp_getTrustedProxies(env, props));
+    sp_admin_param_int(env, resp_node, SP_MTOMMIN_STR,
+                       rp_getMtomThreshold(env, props));
+    sp_admin_param_int(env, resp_node, SP_BESLOTS_STR,
+                       rp_getBackendSlots(env, props));
+    sp_admin_param(env, resp_node, SP_BELANES_STR, rp_getBackendLanes(env, props));
+    sp_admin_param_int(env, resp_node, SP_BEQUEUE_STR,
+                       rp_getBackendQueueMs(env, props));
+    sp_admin_param_int(env, resp_node, SP_BULKMB_STR,
+                       rp_getBulkCoverageMB(env, props));
+    sp_admin_param_int(env, resp_node, SP_CLREQRATE_STR,
+                       rp_getClientRequestRate(env, props));
+    sp_admin_param_int(env, resp_node, SP_CLREQBURST_STR,
+                       rp_getClientRequestBurst(env, props));
+    sp_admin_param_int(env, resp_node, SP_CLBYTERATE_STR,
+                       rp_getClientByteRateKB(env, props));
+    sp_admin_param_int(env, resp_node, SP_CLBYTEBURST_STR,
+                       rp_getClientByteBurstMB(env, props));
+    sp_admin_param(env, resp_node, SP_CLUSERPROP_STR,
+                   rp_getClientUserProperty(env, props));
+    sp_admin_param(env, resp_node, SP_ASYNCDIR_STR,
+                   rp_getAsyncSpoolDir(env, props));
+    sp_admin_param_int(env, resp_node, SP_ASYNCMAX_STR,
+                       rp_getAsyncMaxJobs(env, props));
+    sp_admin_param_int(env, resp_node, SP_ASYNCKEEP_STR,
+                       rp_getAsyncKeepHours(env, props));
+    sp_admin_param(env, resp_node, SP_ASYNCNOTIFY_STR,
+                   rp_getAsyncNotifyHosts(env, props));
+    sp_admin_param(env, resp_node, SP_SHARDS_STR,
+                   rp_getBackendShards(env, props));
+    sp_admin_param_int(env, resp_node, SP_SHARDTMO_STR,
+                       rp_getShardTimeoutMs(env, props));
+    sp_admin_param_int(env, resp_node, SP_TILESTRIPS_STR,
+                       rp_getTileStrips(env, props));
+    sp_admin_param_int(env, resp_node, SP_TILEMIN_STR,
+                       rp_getTileMinMB(env, props));
+    sp_admin_param_int(env, resp_node, SP_BATCHMAX_STR,
+                       rp_getBatchMaxItems(env, props));
+    sp_admin_param_int(env, resp_node, SP_BATCHPAR_STR,
+                       rp_getBatchParallel(env, props));
+    sp_admin_param_int(env, resp_node, SP_CAPSSECS_STR,
+                       rp_getCapabilitiesCacheSecs(env, props));
+    sp_admin_param_int(env, resp_node, SP_EOINDEXSECS_STR,
+                       rp_getEOIndexSecs(env, props));
+    sp_admin_param_int(env, resp_node, SP_MAXCOVMB_STR,
+                       rp_getMaxCoverageMB(env, props));
+    sp_admin_param_int(env, resp_node, SP_COMPLEVEL_STR,
+                       rp_getCompressLevel(env, props));
+    sp_admin_param_int(env, resp_node, SP_COMPMINKB_STR,
+                       rp_getCompressMinKB(env, props));
+    sp_admin_param_int(env, resp_node, SP_COMPTHREADS_STR,
+                       rp_getCompressThreads(env, props));
+
+    return resp_node;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @param op_name
+ * @return non-zero if op_name is one of the administrative operations.
+ */
+int sp_admin_op(const axis2_char_t *op_name)
+{
+    for (int i = 0; op_name && sp_admin_op_names[i]; i++)
+    {
+        if (0 == strcmp(op_name, sp_admin_op_names[i])) return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Run one of the administrative operations, after checking the client
+ * is authorized.
+ * @param env
+ * @param props
+ * @param op_name one for which sp_admin_op() is true.
+ * @param node the request element.
+ * @param protocol
+ * @return the response node, NULL on error.
+ */
+axiom_node_t *rp_invokeAdmin(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const axis2_char_t *op_name,
+    axiom_node_t       *node,
+    const int           protocol)
+{
+    if (! sp_admin_authorized(env, props, node))
+    {
+        SP_ERROR(env, SP_USER_ERR_NOT_AUTHORIZED);
+        return NULL;
+    }
+
+    SP_LOG_INFO("administrative operation %s", op_name);
+
+    if (0 == strcmp(op_name, "PurgeCache"))
+    {
+        return sp_admin_purge(env, props, node);
+    }
+    else if (0 == strcmp(op_name, "GetPoolStatus"))
+    {
+        return rp_getPoolStatus(env, props);
+    }
+    else if (0 == strcmp(op_name, "DrainBackend"))
+    {
+        return sp_admin_drain(env, props, node);
+    }
+    else if (0 == strcmp(op_name, "PrewarmCache"))
+    {
+        return sp_admin_prewarm(env, props, node, protocol);
+    }
+    else if (0 == strcmp(op_name, "DumpConfig"))
+    {
+        return sp_admin_dump_config(env, props);
+    }
+
+    SP_ERROR(env, SP_USER_ERR_BAD_OP);
+    return NULL;
+}
@@ -0,0 +1,50 @@
+/*
+ * Soap Proxy - administrative operations header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_admin.h
+ *
+ */
+
+#ifndef SPADMIN_H_INCLUDED
+#define SPADMIN_H_INCLUDED
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+int           sp_admin_op   (const axis2_char_t *op_name);
+
+axiom_node_t *rp_invokeAdmin(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const axis2_char_t *op_name,
+    axiom_node_t       *node,
+    const int           protocol);
+
+#endif
@@ -32,6 +32,7 @@
 #include <sys/socket.h>
 
 #include "soap_proxy.h"
+#include "sp_stats.h"
 
 
 #define SP_MIN_URL_LEN 6
@@ -43,6 +44,43 @@ sp_sock_connect(
     const axis2_char_t *host,
     int                 port);
 
+//-----------------------------------------------------------------------------
+/** Build the HTTP request head sent to a backend.
+ * @param env
+ * @param path
+ * @param req_len length of the request body.
+ * @param mapfile
+ * @return the head, to be freed with AXIS2_FREE.
+ */
+char *
+sp_backend_head(
+    const axutil_env_t *env,
+    const axis2_char_t *path,
+    const int           req_len,
+    const axis2_char_t *mapfile)
+{
+    // est. max len of fixed header strings ('POST ' ', 'Content-type:' etc.)
+    const int max_fixed_len = 160 + SP_REQ_ID_LEN;
+    int max_headers_len = max_fixed_len + strlen(path) + strlen(mapfile);
+
+    char *headers = (char*) AXIS2_MALLOC(env->allocator, max_headers_len);
+    snprintf(headers, max_headers_len,
+    		"POST %s HTTP/1.0\n"
+    		"Content-Length: %d\n"
+    		"Content-Type:   %s\n"
+    		"MS_MAPFILE:     %s\n"
+    		"X-Request-Id:   %s\n"
+    		"\n"
+    		,
+    		path,
+    		req_len,
+    		"text/xml",
+    		mapfile,
+    		sp_stats_req_id());
+
+    return headers;
+}
+
 //-----------------------------------------------------------------------------
 /** Send the request to the url.
  * @param env
@@ -82,7 +120,10 @@ sp_backend_socket(
         return NULL;
     }
 
+    sp_stamp_t t0 = sp_stats_now();
     sock_stream = sp_sock_connect(env, backend_host, backend_port);
+    sp_stats_phase(SP_PH_CONNECT, t0);
+    sp_stats_count_connect(NULL != sock_stream);
 
     if (!sock_stream)
     {
@@ -91,25 +132,12 @@ sp_backend_socket(
         return NULL;
     }
 
-    // est. max len of fixed header strings ('POST ' ', 'Content-type:' etc.)
-    const int max_fixed_len = 160;
-    int max_headers_len = max_fixed_len + strlen(backend_path) + strlen(mapfile);
-
-    char *headers = (char*) AXIS2_MALLOC(env->allocator, max_headers_len);
-    snprintf(headers, max_headers_len,
-    		"POST %s HTTP/1.0\n"
-    		"Content-Length: %d\n"
-    		"Content-Type:   %s\n"
-    		"MS_MAPFILE:     %s\n"
-    		"\n"
-    		,
-    		backend_path,
-    		req_len,
-    		"text/xml",
-    		mapfile);
+    char *headers = sp_backend_head(env, backend_path, req_len, mapfile);
+    const int headers_len = strlen(headers);
 
-    n_writ = axutil_stream_write(sock_stream, env, headers, strlen(headers));
-    if (n_writ < strlen(headers))
+    n_writ = axutil_stream_write(sock_stream, env, headers, headers_len);
+    AXIS2_FREE(env->allocator, headers);
+    if (n_writ < headers_len)
     {
     	rp_log_error(env, "stream write error");
     	sp_stream_cleanup(env, sock_stream);
@@ -123,6 +151,8 @@ sp_backend_socket(
     	sp_stream_cleanup(env, sock_stream);
     	return NULL;
     }
+    sp_stats_add_bytes_out(headers_len + req_len);
+    sp_stats_mark_sent();
 
     return sock_stream;
 }
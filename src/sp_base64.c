@@ -0,0 +1,513 @@
+/*
+ * Soap Proxy.
+ *
+ * Base64 encoding of coverages returned inline.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_base64.c
+ *
+ * Coverages are returned as MTOM attachments.  A client that did not
+ * send its request as MTOM gets the attachment inline as base64 instead,
+ * and Axis2 encodes it with a scalar loop into one string as large as the
+ * coverage plus a third.  A small coverage is better inline anyway: the
+ * MIME part with its headers and boundaries costs more than the third.
+ *
+ * sp_inline_coverage() therefore turns such attachments into inline
+ * base64 itself, before Axis2 sees them.  The text is written as a series
+ * of text nodes of at most SP_BASE64_CHUNK characters, so that there is
+ * no single allocation of the size of the encoded coverage, nor the
+ * copying of growing it, and coverages cached on disk are read in pieces
+ * rather than loaded first.  This is not streaming: all the text nodes
+ * are in the tree before it is serialised, so the response still takes
+ * the size of the coverage plus a third in memory.  Nor can it be with
+ * Axis2/C 1.6: a response that is not MTOM is serialised into the memory
+ * buffer of the XML writer as a whole before the transport sends any of
+ * it, and neither a text node nor an axiom_data_source_t can produce its
+ * text later than that, so encoding during serialisation would save
+ * nothing.
+ *
+ * The encoder uses SSSE3 or AVX2 where the CPU has them (see "Faster
+ * Base64 Encoding and Decoding Using AVX2 Instructions", W. Mula and
+ * D. Lemire, 2018), 16 or 32 output characters per step, with a scalar
+ * loop for the rest.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <axiom.h>
+#include <axutil_string.h>
+
+#include "soap_proxy.h"
+#include "sp_base64.h"
+#include "sp_client.h"
+#include "sp_log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SP_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+// Input bytes encoded at a time by sp_base64_stream(), a multiple of 3.
+#define SP_BASE64_IN_LEN (3*16*1024)
+
+#define SP_XMIME_NS_URI  "http://www.w3.org/2005/05/xmlmime"
+
+static const char sp_base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+typedef size_t (*sp_base64_fn)(char *, const unsigned char *, const size_t);
+
+// =========================  local functions ================================
+//-----------------------------------------------------------------------------
+static size_t sp_base64_scalar(
+    char                *dst,
+    const unsigned char *src,
+    const size_t         len)
+{
+    char     *o = dst;
+    size_t    i = 0;
+    uint32_t  v;
+
+    for ( ; i + 3 <= len; i += 3)
+    {
+        v = (uint32_t) src[i] << 16 | (uint32_t) src[i+1] << 8 | src[i+2];
+        o[0] = sp_base64_chars[ v >> 18      ];
+        o[1] = sp_base64_chars[(v >> 12) & 63];
+        o[2] = sp_base64_chars[(v >>  6) & 63];
+        o[3] = sp_base64_chars[ v        & 63];
+        o += 4;
+    }
+
+    if (len - i > 0)
+    {
+        v = (uint32_t) src[i] << 16;
+        if (len - i > 1) v |= (uint32_t) src[i+1] << 8;
+        o[0] = sp_base64_chars[ v >> 18      ];
+        o[1] = sp_base64_chars[(v >> 12) & 63];
+        o[2] = len - i > 1 ? sp_base64_chars[(v >> 6) & 63] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+
+    return o - dst;
+}
+
+#ifdef SP_BASE64_X86
+//-----------------------------------------------------------------------------
+// 12 input bytes in the low 12 bytes of 'in' to 16 characters: spread the
+// 4 groups of 3 bytes over 32 bit lanes, cut out the four 6 bit indices of
+// each lane with two multiplications, then map the indices to characters
+// by adding an offset that depends on the range the index is in.
+__attribute__((target("ssse3")))
+static inline __m128i sp_base64_ssse3_step(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(
+        1, 0, 2, 1,  4, 3, 5, 4,  7, 6, 8, 7,  10, 9, 11, 10));
+
+    const __m128i t0  = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1  = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2  = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3  = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i idx = _mm_or_si128(t1, t3);
+
+    // 0: a-z, 1..10: 0-9, 11: '+', 12: '/', 13: A-Z
+    __m128i       r    = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    const __m128i offsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx);
+}
+
+//-----------------------------------------------------------------------------
+__attribute__((target("ssse3")))
+static size_t sp_base64_ssse3(
+    char                *dst,
+    const unsigned char *src,
+    const size_t         len)
+{
+    char   *o = dst;
+    size_t  i = 0;
+
+    // each step loads 16 bytes and uses 12
+    for ( ; i + 16 <= len; i += 12, o += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) o, sp_base64_ssse3_step(in));
+    }
+
+    return (o - dst) + sp_base64_scalar(o, src + i, len - i);
+}
+
+//-----------------------------------------------------------------------------
+// As sp_base64_ssse3_step, on two lanes of 12 bytes each.
+__attribute__((target("avx2")))
+static inline __m256i sp_base64_avx2_step(__m256i in)
+{
+    in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+        1, 0, 2, 1,  4, 3, 5, 4,  7, 6, 8, 7,  10, 9, 11, 10,
+        1, 0, 2, 1,  4, 3, 5, 4,  7, 6, 8, 7,  10, 9, 11, 10));
+
+    const __m256i t0  = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1  = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2  = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3  = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i idx = _mm256_or_si256(t1, t3);
+
+    __m256i       r    = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+    r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, r), idx);
+}
+
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static size_t sp_base64_avx2(
+    char                *dst,
+    const unsigned char *src,
+    const size_t         len)
+{
+    char   *o = dst;
+    size_t  i = 0;
+
+    // each step loads 16 bytes at i and at i+12, and uses 24
+    for ( ; i + 28 <= len; i += 24, o += 32)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256((__m256i *) o, sp_base64_avx2_step(in));
+    }
+
+    return (o - dst) + sp_base64_scalar(o, src + i, len - i);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+static sp_base64_fn sp_base64_impl = NULL;
+static const char  *sp_base64_name = "scalar";
+
+static sp_base64_fn sp_base64_select(void)
+{
+    if (sp_base64_impl) return sp_base64_impl;
+
+    sp_base64_fn impl = sp_base64_scalar;
+#ifdef SP_BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        impl           = sp_base64_avx2;
+        sp_base64_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        impl           = sp_base64_ssse3;
+        sp_base64_name = "ssse3";
+    }
+#endif
+    sp_base64_impl = impl;
+    return impl;
+}
+
+//-----------------------------------------------------------------------------
+// Turn a chunk of base64 into a text node, the node takes over the buffer.
+static void sp_base64_flush(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    char               *out,
+    const size_t        len)
+{
+    axiom_node_t *text_node = NULL;
+
+    out[len] = '\0';
+    axutil_string_t *str = axutil_string_create_assume_buffer(env, out);
+    axiom_text_create_str(env, parent, str, &text_node);
+    axutil_string_free(str, env);
+}
+
+//-----------------------------------------------------------------------------
+static int sp_base64_file_CB(
+    char *buffer,
+    int   size,
+    void *ctx)
+{
+    return (int) fread(buffer, 1, size, (FILE *) ctx);
+}
+
+//-----------------------------------------------------------------------------
+struct sp_base64_mem_struct
+{
+    const char *data;
+    size_t      len;
+};
+
+static int sp_base64_mem_CB(
+    char *buffer,
+    int   size,
+    void *ctx)
+{
+    struct sp_base64_mem_struct *mem = ctx;
+    size_t n = mem->len < (size_t) size ? mem->len : (size_t) size;
+
+    memcpy(buffer, mem->data, n);
+    mem->data += n;
+    mem->len  -= n;
+    return (int) n;
+}
+
+//-----------------------------------------------------------------------------
+// Replace the attachment text node by inline base64 of the same data.
+// @return 0 on success, -1 if the data could not be read.
+static int sp_inline_text(
+    const axutil_env_t   *env,
+    axiom_node_t         *text_node,
+    axiom_data_handler_t *dh)
+{
+    axiom_node_t *parent   = axiom_node_get_parent(text_node, env);
+    const char   *fname    = axiom_data_handler_get_file_name(dh, env);
+    const char   *ctype    = axiom_data_handler_get_content_type(dh, env);
+    long          n        = -1;
+
+    if (NULL == parent) return -1;
+
+    // Detach first: the new text nodes are appended to the parent.
+    axiom_node_detach(text_node, env);
+
+    if (fname)
+    {
+        FILE *fp = fopen(fname, "rb");
+        if (fp)
+        {
+            n = sp_base64_stream(env, parent, sp_base64_file_CB, fp);
+            fclose(fp);
+        }
+    }
+    else
+    {
+        struct sp_base64_mem_struct mem;
+        mem.data = (const char *) axiom_data_handler_get_input_stream(dh, env);
+        mem.len  = axiom_data_handler_get_input_stream_len(dh, env);
+        n = sp_base64_stream(env, parent, sp_base64_mem_CB, &mem);
+    }
+
+    if (n < 0)
+    {
+        axiom_node_add_child(parent, env, text_node);
+        return -1;
+    }
+
+    if (ctype && AXIOM_ELEMENT == axiom_node_get_node_type(parent, env))
+    {
+        axiom_element_t   *el = axiom_node_get_data_element(parent, env);
+        axiom_namespace_t *ns =
+            sp_find_or_create_ns(env, parent, SP_XMIME_NS_URI, "xmime");
+        axiom_element_add_attribute(el, env,
+            axiom_attribute_create(env, "contentType", ctype, ns), parent);
+    }
+
+    // frees the data handler and with it the binary data
+    axiom_node_free_tree(text_node, env);
+    return 0;
+}
+
+// =========================  public functions ===============================
+//-----------------------------------------------------------------------------
+/** @return the length of the base64 encoding of len bytes, with padding.
+ */
+size_t sp_base64_len(const size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
+
+//-----------------------------------------------------------------------------
+/** Encode len bytes, padded, without line breaks.
+ * @param dst room for sp_base64_len(len) characters, not NUL terminated.
+ * @param src
+ * @param len
+ * @return the number of characters written.
+ */
+size_t sp_base64_encode(
+    char                *dst,
+    const unsigned char *src,
+    const size_t         len)
+{
+    return sp_base64_select()(dst, src, len);
+}
+
+//-----------------------------------------------------------------------------
+/** @return "avx2", "ssse3" or "scalar", the encoder in use.
+ */
+const char *sp_base64_impl_name(void)
+{
+    sp_base64_select();
+    return sp_base64_name;
+}
+
+//-----------------------------------------------------------------------------
+/** Encode everything read_cb delivers as base64, appending text nodes of
+ *  at most SP_BASE64_CHUNK characters to parent.
+ * @param env
+ * @param parent
+ * @param read_cb as for axiom_xml_reader_create_for_io(), returns 0 at
+ *   the end, < 0 on error.
+ * @param ctx passed to read_cb.
+ * @return the number of bytes encoded, -1 on error.
+ */
+long sp_base64_stream(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    int (*read_cb)(char *buffer, int size, void *ctx),
+    void               *ctx)
+{
+    unsigned char  in[SP_BASE64_IN_LEN];
+    size_t         have  = 0;
+    long           total = 0;
+    char          *out   = NULL;
+    size_t         olen  = 0;
+    int            eof   = 0;
+
+    sp_base64_fn encode = sp_base64_select();
+
+    while (!eof)
+    {
+        int r = read_cb((char *) in + have, sizeof(in) - have, ctx);
+        if (r < 0)
+        {
+            if (out) AXIS2_FREE(env->allocator, out);
+            return -1;
+        }
+        if (0 == r) eof = 1;
+        have  += r;
+        total += r;
+
+        // keep a partial group of 3 for the next round, unless at the end
+        size_t take = eof ? have : have - have % 3;
+        if (0 == take) continue;
+
+        if (out && olen + sp_base64_len(take) > SP_BASE64_CHUNK)
+        {
+            sp_base64_flush(env, parent, out, olen);
+            out = NULL;
+        }
+        if (NULL == out)
+        {
+            out  = (char *) AXIS2_MALLOC(env->allocator, SP_BASE64_CHUNK + 1);
+            olen = 0;
+            if (NULL == out) return -1;
+        }
+        olen += encode(out + olen, in, take);
+
+        memmove(in, in + take, have - take);
+        have -= take;
+    }
+    if (out) sp_base64_flush(env, parent, out, olen);
+
+    return total;
+}
+
+//-----------------------------------------------------------------------------
+/** Put the attachments in node inline as base64 where that is better:
+ *  all of them if the client does not do MTOM, else those smaller than
+ *  MtomThreshold bytes.
+ * @param env
+ * @param props
+ * @param node the response, e.g. of GetCoverage.
+ * @return the number of attachments put inline.
+ */
+int sp_inline_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    const long threshold = rp_getMtomThreshold(env, props);
+    int        mtom      = -1;      // not yet known
+    int        n_inline  = 0;
+
+    while (node)
+    {
+        axiom_node_t *next  = axiom_node_get_next_sibling(node, env);
+        axiom_types_t tt    = axiom_node_get_node_type(node, env);
+
+        if (AXIOM_ELEMENT == tt)
+        {
+            n_inline += sp_inline_coverage(
+                env, props, axiom_node_get_first_child(node, env));
+        }
+        else if (AXIOM_TEXT == tt)
+        {
+            axiom_text_t         *text = axiom_node_get_data_element(node, env);
+            axiom_data_handler_t *dh   =
+                text ? axiom_text_get_data_handler(text, env) : NULL;
+            if (NULL == dh)
+            {
+                node = next;
+                continue;
+            }
+
+            long        size  = -1;
+            const char *fname = axiom_data_handler_get_file_name(dh, env);
+            struct stat st;
+            if (fname)
+            {
+                if (0 == stat(fname, &st)) size = (long) st.st_size;
+            }
+            else
+            {
+                size = (long) axiom_data_handler_get_input_stream_len(dh, env);
+            }
+
+            if (mtom < 0) mtom = sp_client_mtom(env, props);
+            if (!mtom || (size >= 0 && size < threshold))
+            {
+                if (0 == sp_inline_text(env, node, dh))
+                {
+                    n_inline++;
+                    SP_LOG_DEBUG("coverage of %ld bytes inline, %s base64",
+                                 size, sp_base64_impl_name());
+                }
+            }
+        }
+        node = next;
+    }
+
+    return n_inline;
+}
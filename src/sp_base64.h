@@ -0,0 +1,66 @@
+/*
+ * Soap Proxy - base64 encoding of coverages header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_base64.h
+ *
+ */
+
+#ifndef SPBASE64_H_INCLUDED
+#define SPBASE64_H_INCLUDED
+
+#include <stddef.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+// Max. length of the text of one text node of inline base64.
+#define SP_BASE64_CHUNK  (1024*1024)
+
+size_t sp_base64_len(const size_t len);
+
+size_t sp_base64_encode(
+    char                *dst,
+    const unsigned char *src,
+    const size_t         len);
+
+const char *sp_base64_impl_name(void);
+
+long sp_base64_stream(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    int (*read_cb)(char *buffer, int size, void *ctx),
+    void               *ctx);
+
+int sp_inline_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node);
+
+#endif
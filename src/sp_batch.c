@@ -0,0 +1,456 @@
+/*
+ * Soap Proxy.
+ *
+ * Several WCS requests in one envelope.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_batch.c
+ *
+ * Clients needing many DescribeCoverage or small GetCoverage requests pay
+ * for an envelope, an HTTP request and the Axis2 dispatch with each.  A
+ * Batch carries any number of them, up to BatchMaxItems, e.g.
+ *
+ *  <sopr:Batch>
+ *    <wcs:DescribeCoverage service="WCS" version="2.0.0">...
+ *    <wcs:GetCoverage service="WCS" version="2.0.0">...
+ *  </sopr:Batch>
+ *
+ * and is answered with the response to each, in the same order:
+ *
+ *  <sopr:BatchResult items="2" failed="1">
+ *    <sopr:Item index="1" operation="DescribeCoverage">
+ *      <wcs:CoverageDescriptions>...
+ *    </sopr:Item>
+ *    <sopr:Item index="2" operation="GetCoverage">
+ *      <sopr:Fault code="SP_SYS_ERR_MS_EXEC">...</sopr:Fault>
+ *    </sopr:Item>
+ *  </sopr:BatchResult>
+ *
+ * A request that fails gets a Fault in place of its response, the others
+ * are not affected.  A coverage is attached as an MTOM part of its own,
+ * or inlined, just as for a GetCoverage on its own.  Each request must
+ * declare the namespaces it uses itself, since it is passed on to the
+ * backend on its own.
+ *
+ * Every request goes through rp_dispatch_op(), and so through the
+ * coverage cache, lineage and the rest.  In URL mode the backend requests
+ * are sent ahead, BatchParallel at a time, with sp_shard_scatter(), and
+ * their responses spooled; rp_invokeBackend() then takes a response from
+ * here, see sp_batch_response(), rather than asking the backend.  Each
+ * request of a round takes a backend slot, see sp_sched_acquire_more(),
+ * so a round is cut short if there are not enough free slots, and all of
+ * it must have answered within ShardTimeoutMs.  A request whose response
+ * could not be fetched ahead is sent to the backend on its own when its
+ * turn comes, as are all requests in exec mode.
+ *
+ * A sharded DescribeEOCoverageSet and a GetCoverage that may be split
+ * into strips fan out by themselves, see sp_shard.c and sp_tile.c, and
+ * are not fetched ahead, nor is a GetCoverage over MaxCoverageMB, see
+ * sp_estimate.c.  Neither are requests which may be answered from a
+ * cache without asking the backend as they are: DescribeCoverage with
+ * the cache on (sp_describe.c), GetCapabilities with the capabilities
+ * cached (sp_caps.c) and DescribeEOCoverageSet with the EO index
+ * (sp_eoindex.c).
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "soap_proxy.h"
+#include "sp_batch.h"
+#include "sp_cache.h"
+#include "sp_caps.h"
+#include "sp_eoindex.h"
+#include "sp_estimate.h"
+#include "sp_shard.h"
+#include "sp_tile.h"
+#include "sp_log.h"
+#include "sp_sched.h"
+#include "sp_stats.h"
+
+//
+// A round of requests sent ahead, see sp_batch_fetch().
+//
+struct sp_batch_round_struct
+{
+    int           n;
+    axiom_node_t *items [SP_SHARD_MAX];
+    axis2_char_t *reqs  [SP_SHARD_MAX];
+    sp_shard      shards[SP_SHARD_MAX];
+};
+
+typedef struct sp_batch_round_struct sp_batch_round;
+
+// The round of the Batch in progress in this thread, NULL if none.
+static __thread sp_batch_round *sp_batch_curr = NULL;
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_dispatch_op(
+    const axutil_env_t *env,
+    sp_props           *props,
+    axis2_char_t       *op_name,
+    axiom_node_t       *node,
+    const int          protocol);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static axis2_char_t *sp_batch_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the next element among node and its siblings, NULL if none.
+ */
+static axiom_node_t *sp_batch_next(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    for (; node; node = axiom_node_get_next_sibling(node, env))
+    {
+    	if (AXIOM_ELEMENT == axiom_node_get_node_type(node, env)) return node;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return non-zero if op_name is an operation a Batch may contain.
+ */
+static int sp_batch_allowed(const axis2_char_t *op_name)
+{
+    switch (sp_stats_op_id(op_name))
+    {
+    case SP_OP_GETCAPABILITIES:
+    case SP_OP_DESCRIBECOVERAGE:
+    case SP_OP_DESCRIBEEOCOVERAGESET:
+    case SP_OP_GETCOVERAGE:
+    	return 1;
+    default:
+    	return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** @return non-zero if the request goes to the backend through
+ *  rp_invokeBackend(), so that its response can be fetched ahead.
+ */
+static int sp_batch_fetchable(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *item)
+{
+    switch (sp_stats_op_id(sp_batch_localname(env, item)))
+    {
+    case SP_OP_GETCAPABILITIES:
+    	return ! sp_caps_enabled(env, props);
+    case SP_OP_DESCRIBECOVERAGE:
+    	return ! sp_cache_enabled(env, props);
+    case SP_OP_DESCRIBEEOCOVERAGESET:
+    	return ! sp_eoindex_enabled(env, props) && ! sp_shard_enabled(env, props);
+    case SP_OP_GETCOVERAGE:
+    	// One too large is refused when its turn comes, see sp_estimate.c.
+    	if (sp_estimate_check(env, props, item))
+    	{
+    		axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+    		return 0;
+    	}
+    	return ! sp_tile_enabled(env, props);
+    default:
+    	return 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Send the requests of a round to the backend at once, and spool the
+ *  responses.  Those not fetched are left to rp_invokeBackend().
+ * @param env
+ * @param props
+ * @param round with n and items set; n is cut to the backend slots got.
+ */
+static void sp_batch_fetch(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_batch_round     *round)
+{
+    int k;
+
+    if (sp_stats_drain_since()) return;
+
+    sp_sched_ticket ticket;
+    if (sp_sched_acquire(env, props, round->items[0], &ticket))
+    {
+    	// The requests wait for a slot each on their own.
+    	axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+    	return;
+    }
+    // The round's bytes are not those of its first CoverageId.
+    ticket.cov_key = 0;
+
+    sp_sched_ticket more[SP_SHARD_MAX - 1];
+    const int extra = sp_sched_acquire_more(env, props, &ticket, more,
+    		round->n - 1);
+    round->n = 1 + extra;
+
+    sp_stamp_t t0 = sp_stats_now();
+    for (k = 0; k < round->n; k++)
+    {
+    	round->reqs[k] = axiom_node_to_string(round->items[k], env);
+    }
+    sp_stats_phase(SP_PH_SERIALIZE, t0);
+
+    for (k = 0; k < round->n; k++)
+    {
+    	const axis2_char_t *req = round->reqs[k] ? round->reqs[k] : "";
+    	char label[64];
+    	snprintf(label, sizeof(label), "batch request %d", k + 1);
+    	sp_shard_setup(env, props, &round->shards[k], label,
+    			rp_getBackendHost(env, props), rp_getBackendPort(env, props),
+    			rp_getBackendPath(env, props), req, strlen(req));
+    }
+
+    // Any request not done here is sent again on its own.
+    sp_shard_scatter(env, round->shards, round->n,
+    		rp_getShardTimeoutMs(env, props));
+    for (k = 0; k < extra; k++) sp_sched_release(env, &more[k]);
+    sp_sched_release(env, &ticket);
+}
+
+//-----------------------------------------------------------------------------
+/** Release what sp_batch_fetch() took.
+ */
+static void sp_batch_cleanup(const axutil_env_t *env, sp_batch_round *round)
+{
+    int k;
+    for (k = 0; k < round->n; k++)
+    {
+    	if (round->shards[k].head) sp_shard_cleanup(env, &round->shards[k]);
+    	if (round->reqs[k]) AXIS2_FREE(env->allocator, round->reqs[k]);
+    }
+    memset(round, 0, sizeof(*round));
+}
+
+//-----------------------------------------------------------------------------
+/** Dispatch one request of a Batch and add its Item to the result.
+ * @param env
+ * @param props
+ * @param resp_node the BatchResult.
+ * @param item the request.
+ * @param index of the request, from 1.
+ * @param protocol
+ * @return 0 on success, 1 if the request failed.
+ */
+static int sp_batch_item(
+    const axutil_env_t *env,
+    sp_props           *props,
+    axiom_node_t       *resp_node,
+    axiom_node_t       *item,
+    const int           index,
+    const int           protocol)
+{
+    axis2_char_t *op_name = sp_batch_localname(env, item);
+    axiom_node_t *i_node  = NULL;
+    axiom_node_t *r_node  = NULL;
+    char          buf[16];
+
+    axiom_namespace_t *ns =
+    		axiom_namespace_create(env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    axiom_element_t *i_el =
+    		axiom_element_create(env, resp_node, "Item", ns, &i_node);
+    snprintf(buf, sizeof(buf), "%d", index);
+    axiom_element_add_attribute(i_el, env,
+    		axiom_attribute_create(env, "index", buf, NULL), i_node);
+    axiom_element_add_attribute(i_el, env,
+    		axiom_attribute_create(env, "operation", op_name, NULL), i_node);
+
+    axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+    if (sp_batch_allowed(op_name))
+    {
+    	r_node = rp_dispatch_op(env, props, op_name, item, protocol);
+    }
+    else
+    {
+    	SP_ERROR(env, SP_USER_ERR_BAD_OP);
+    }
+
+    if (r_node)
+    {
+    	axiom_node_add_child(i_node, env, r_node);
+    	return 0;
+    }
+
+    const int code = env->error->error_number;
+    const axis2_char_t *msg = axutil_error_get_message(env->error);
+    axiom_node_t    *f_node = NULL;
+    axiom_element_t *f_el   =
+    		axiom_element_create(env, i_node, "Fault", ns, &f_node);
+    axiom_element_add_attribute(f_el, env, axiom_attribute_create(env,
+    		"code", sp_error_code_name(code), NULL), f_node);
+    if (msg) axiom_element_set_text(f_el, env, msg, f_node);
+
+    SP_LOG_DEBUG("batch request %d (%s) failed: %s",
+    		index, op_name ? op_name : "?", sp_error_code_name(code));
+
+    // A failed request must not fail the whole Batch.
+    axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+    axutil_error_set_error_number(env->error, AXIS2_ERROR_NONE);
+    return 1;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/** Batch, see the top of the file.
+ * @param env
+ * @param props
+ * @param node the Batch request.
+ * @param protocol
+ * @return the BatchResult, NULL on error.
+ */
+axiom_node_t *sp_batch_invoke(
+    const axutil_env_t *env,
+    sp_props           *props,
+    axiom_node_t       *node,
+    const int           protocol)
+{
+    axiom_node_t *first = sp_batch_next(env, axiom_node_get_first_child(node, env));
+    axiom_node_t *item;
+    int           n = 0, k;
+
+    for (item = first; item;
+    	 item = sp_batch_next(env, axiom_node_get_next_sibling(item, env)))
+    {
+    	n++;
+    }
+    if (n > rp_getBatchMaxItems(env, props))
+    {
+    	SP_ERROR(env, SP_USER_ERR_BAD_REQ);
+    	rp_log_error(env, "Batch: %d requests, more than " SP_BATCHMAX_STR
+    			" (%d).\n", n, rp_getBatchMaxItems(env, props));
+    	return NULL;
+    }
+
+    int parallel = rp_getBatchParallel(env, props);
+    if (parallel > SP_SHARD_MAX)    parallel = SP_SHARD_MAX;
+    if (! rp_getUrlMode(env, props)) parallel = 1;
+
+    sp_batch_round *round = AXIS2_MALLOC(env->allocator, sizeof(sp_batch_round));
+    if (NULL == round)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	return NULL;
+    }
+    memset(round, 0, sizeof(*round));
+
+    axiom_node_t    *resp_node = NULL;
+    axiom_namespace_t *ns      =
+    		axiom_namespace_create(env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    axiom_element_t *el        =
+    		axiom_element_create(env, NULL, "BatchResult", ns, &resp_node);
+    int index = 0, failed = 0;
+
+    item = first;
+    while (item)
+    {
+    	// A round: up to 'parallel' requests, those that can be fetched
+    	// ahead sent at once.
+    	axiom_node_t *todo[SP_SHARD_MAX];
+    	int           n_todo = 0;
+    	for (; item && n_todo < (parallel > 1 ? parallel : 1);
+    		 item = sp_batch_next(env, axiom_node_get_next_sibling(item, env)))
+    	{
+    		todo[n_todo++] = item;
+    		if (parallel > 1 && sp_batch_fetchable(env, props, item))
+    		{
+    			round->items[round->n++] = item;
+    		}
+    	}
+
+    	if (round->n > 1)
+    	{
+    		sp_batch_fetch(env, props, round);
+    		sp_batch_curr = round;
+    	}
+    	for (k = 0; k < n_todo; k++)
+    	{
+    		failed += sp_batch_item(env, props, resp_node, todo[k],
+    				++index, protocol);
+    	}
+    	sp_batch_curr = NULL;
+    	sp_batch_cleanup(env, round);
+    }
+    AXIS2_FREE(env->allocator, round);
+
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", index);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "items", buf, NULL), resp_node);
+    snprintf(buf, sizeof(buf), "%d", failed);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "failed", buf, NULL), resp_node);
+
+    SP_LOG_DEBUG("batch of %d requests, %d failed", index, failed);
+    return resp_node;
+}
+
+//-----------------------------------------------------------------------------
+/** The response to a request of the Batch in progress, if it has been
+ *  fetched ahead, for rp_invokeBackend().
+ * @param env
+ * @param node the request.
+ * @return a stream to read the response from, to be released with
+ *  sp_stream_cleanup(), NULL if it has not been fetched.
+ */
+axutil_stream_t *sp_batch_response(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    sp_batch_round *round = sp_batch_curr;
+    int             k;
+
+    for (k = 0; round && k < round->n; k++)
+    {
+    	sp_shard *sh = &round->shards[k];
+    	if (round->items[k] != node) continue;
+    	if (SP_SHARD_DONE != sh->state || sh->tmp_fd < 0) return NULL;
+
+    	lseek(sh->tmp_fd, 0, SEEK_SET);
+    	FILE *fp = fdopen(sh->tmp_fd, "r");
+    	if (NULL == fp) return NULL;
+    	sh->tmp_fd = -1;
+
+    	axutil_stream_t *st = axutil_stream_create_file(env, fp);
+    	if (NULL == st) fclose(fp);
+    	return st;
+    }
+    return NULL;
+}
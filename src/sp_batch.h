@@ -0,0 +1,49 @@
+/*
+ * Soap Proxy - Batch operation header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_batch.h
+ *
+ */
+
+#ifndef SPBATCH_H_INCLUDED
+#define SPBATCH_H_INCLUDED
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+axiom_node_t    *sp_batch_invoke  (const axutil_env_t *env,
+                                   sp_props           *props,
+                                   axiom_node_t       *node,
+                                   const int           protocol);
+
+axutil_stream_t *sp_batch_response(const axutil_env_t *env,
+                                   axiom_node_t       *node);
+
+#endif
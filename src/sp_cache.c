@@ -0,0 +1,976 @@
+/*
+ * Soap Proxy.
+ *
+ * On-disk cache of GetCoverage results.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_cache.c
+ *
+ * Binary GetCoverage responses (the ones returned as an MTOM attachment)
+ * are kept in the directory CoverageCacheDir, one file per coverage,
+ * named after the 128 bit key of the request.  The key is a hash of the
+ * canonical form of the GetCoverage request (see sp_canon.c) together
+ * with the backend identity (BackendURL, or MapServ and MapFile).
+ *
+ * A file is written under a temporary name and renamed into place, so a
+ * reader never sees a partial coverage.  A hit is answered with a data
+ * handler that refers to the file, so Axis2 streams the attachment from
+ * disk when the response is sent instead of loading it into memory.
+ *
+ * The directory holds a fixed-size index file, mapped into every process
+ * using the cache.  It is an open addressing hash table of the entries,
+ * with their size, content type and time of last use, so lookups need
+ * neither a directory scan nor a stat of more than one file.  The table
+ * is protected by a robust process-shared mutex which lives in the
+ * mapping itself.
+ *
+ * Entries may be removed on demand by the PurgeCache operation, see
+ * sp_cache_purge().  For that the CoverageId of the request is kept with
+ * each entry, or a hash of it if it is too long, see sp_cache_covid().
+ *
+ * The same directory keeps the CoverageDescription of each coverage
+ * returned by DescribeCoverage, see sp_describe.c, as entries of type
+ * text/xml keyed by the backend identity and the CoverageId.  They are
+ * purged by CoverageId together with the coverages.  Other modules may
+ * keep binary entries of their own, see sp_cache_put_blob().
+ *
+ * When the total size would exceed CoverageCacheSizeMB the least recently
+ * used entries are removed.  Entries used within the last
+ * SP_CACHE_GRACE_SECS are spared, since a response referring to the file
+ * may still be on its way out; the budget may be exceeded briefly
+ * because of this.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "soap_proxy.h"
+#include "sp_cache.h"
+#include "sp_canon.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_CACHE_MAGIC       0x53504331u       // "SPC1"
+#define SP_CACHE_VERSION     4
+#define SP_CACHE_NSLOTS      16384             // must be a power of 2
+#define SP_CACHE_MAX_FILLED  (SP_CACHE_NSLOTS / 4 * 3)
+#define SP_CACHE_CTYPE_LEN   80
+#define SP_CACHE_COVID_LEN   96
+#define SP_CACHE_GRACE_SECS  120
+#define SP_CACHE_INDEX_NAME  "index"
+#define SP_CACHE_SUFFIX      ".cov"
+#define SP_CACHE_PATH_LEN    (SP_MAX_MPATHS_LEN + 48)
+
+#define SP_CACHE_SLOT_EMPTY   0
+#define SP_CACHE_SLOT_USED    1
+#define SP_CACHE_SLOT_DELETED 2
+
+struct sp_cache_slot_struct
+{
+    sp_cache_key key;
+    uint64_t     size;
+    uint32_t     atime;
+    uint32_t     state;
+    char         ctype[SP_CACHE_CTYPE_LEN];
+    char         coverage_id[SP_CACHE_COVID_LEN];   // see sp_cache_covid()
+};
+
+typedef struct sp_cache_slot_struct sp_cache_slot;
+
+struct sp_cache_index_struct
+{
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        nslots;
+    uint32_t        nused;      // slots in state USED
+    uint32_t        nfilled;    // slots in state USED or DELETED
+    uint64_t        total;      // bytes in all USED entries
+    pthread_mutex_t lock;
+    sp_cache_slot   slots[SP_CACHE_NSLOTS];
+};
+
+typedef struct sp_cache_index_struct sp_cache_index;
+
+static sp_cache_index *volatile sp_cache_idx = NULL;
+static char             sp_cache_dir[SP_MAX_MPATHS_LEN];
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static void sp_cache_path(char *buf, const sp_cache_key *key)
+{
+    snprintf(buf, SP_CACHE_PATH_LEN, "%s/%016llx%016llx" SP_CACHE_SUFFIX,
+             sp_cache_dir,
+             (unsigned long long) key->h[0],
+             (unsigned long long) key->h[1]);
+}
+
+//-----------------------------------------------------------------------------
+// Remove coverage and temporary files left over from a previous index.
+static void sp_cache_clear_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (NULL == d) return;
+
+    struct dirent *de;
+    char path[SP_CACHE_PATH_LEN];
+    while (NULL != (de = readdir(d)))
+    {
+        const size_t n = strlen(de->d_name);
+        const size_t sl = strlen(SP_CACHE_SUFFIX);
+        if ((n > sl && 0 == strcmp(de->d_name + n - sl, SP_CACHE_SUFFIX)) ||
+            0 == strncmp(de->d_name, "tmp.", 4))
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+//-----------------------------------------------------------------------------
+/** Map the index of the cache in 'dir', creating the directory and the
+ * index if needed.  Only one cache directory is used per process.
+ * @param dir
+ * @return the index, NULL if the cache is not usable.
+ */
+static sp_cache_index *sp_cache_open(const char *dir)
+{
+    static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+    static int failed = 0;
+
+    sp_cache_index *idx = sp_cache_idx;
+    if (NULL != idx)
+    {
+        return strcmp(dir, sp_cache_dir) ? NULL : idx;
+    }
+
+    pthread_mutex_lock(&open_lock);
+    if (NULL != sp_cache_idx || failed)
+    {
+        idx = sp_cache_idx;
+        pthread_mutex_unlock(&open_lock);
+        return (idx && 0 == strcmp(dir, sp_cache_dir)) ? idx : NULL;
+    }
+    failed = 1;
+
+    char path[SP_CACHE_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/" SP_CACHE_INDEX_NAME, dir);
+
+    int fd = -1;
+    if ((mkdir(dir, 0755) && EEXIST != errno) ||
+        (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    {
+        SP_LOG_ERROR("Coverage cache %s not usable: %s", path, strerror(errno));
+        pthread_mutex_unlock(&open_lock);
+        return NULL;
+    }
+
+    // Serialise the initialisation between processes.
+    flock(fd, LOCK_EX);
+
+    struct stat sb;
+    fstat(fd, &sb);
+    if (0 == sb.st_size)
+    {
+        ftruncate(fd, sizeof(sp_cache_index));
+    }
+    else if (sizeof(sp_cache_index) != sb.st_size)
+    {
+        SP_LOG_ERROR("Coverage cache index %s has an unexpected size,"
+                     " remove it to reset the cache.", path);
+        close(fd);
+        pthread_mutex_unlock(&open_lock);
+        return NULL;
+    }
+
+    idx = mmap(NULL, sizeof(sp_cache_index), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (MAP_FAILED == idx)
+    {
+        SP_LOG_ERROR("Cannot map %s: %s", path, strerror(errno));
+        close(fd);
+        pthread_mutex_unlock(&open_lock);
+        return NULL;
+    }
+
+    if (SP_CACHE_MAGIC   != idx->magic   ||
+        SP_CACHE_VERSION != idx->version ||
+        SP_CACHE_NSLOTS  != idx->nslots)
+    {
+        sp_cache_clear_dir(dir);
+        memset(idx, 0, sizeof(sp_cache_index));
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&idx->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        idx->version = SP_CACHE_VERSION;
+        idx->nslots  = SP_CACHE_NSLOTS;
+        __sync_synchronize();
+        idx->magic   = SP_CACHE_MAGIC;
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    strncpy(sp_cache_dir, dir, SP_MAX_MPATHS_LEN - 1);
+    __sync_synchronize();
+    sp_cache_idx = idx;
+    failed = 0;
+
+    pthread_mutex_unlock(&open_lock);
+    return idx;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_cache_lock(sp_cache_index *idx)
+{
+    // A process died holding the lock.  The table is updated field by field
+    // and at worst holds an entry whose file is missing, which lookups
+    // cope with, so carry on.
+    if (EOWNERDEAD == pthread_mutex_lock(&idx->lock))
+    {
+        pthread_mutex_consistent(&idx->lock);
+    }
+}
+
+//-----------------------------------------------------------------------------
+static void sp_cache_unlock(sp_cache_index *idx)
+{
+    pthread_mutex_unlock(&idx->lock);
+}
+
+//-----------------------------------------------------------------------------
+/** Look up a key.  Must be called with the lock held.
+ * @param idx
+ * @param key
+ * @param free_slot if not NULL, set to the slot where the key could be
+ *        inserted, -1 if the table is full.
+ * @return slot of the key, -1 if not present.
+ */
+static int sp_cache_find(
+    sp_cache_index     *idx,
+    const sp_cache_key *key,
+    int                *free_slot)
+{
+    const uint32_t mask = SP_CACHE_NSLOTS - 1;
+    uint32_t i = (uint32_t) key->h[0] & mask;
+    int avail = -1;
+
+    for (int probe = 0; probe < SP_CACHE_NSLOTS; probe++, i = (i + 1) & mask)
+    {
+        sp_cache_slot *s = &idx->slots[i];
+        if (SP_CACHE_SLOT_EMPTY == s->state)
+        {
+            if (avail < 0) avail = i;
+            break;
+        }
+        if (SP_CACHE_SLOT_DELETED == s->state)
+        {
+            if (avail < 0) avail = i;
+            continue;
+        }
+        if (s->key.h[0] == key->h[0] && s->key.h[1] == key->h[1])
+        {
+            if (free_slot) *free_slot = avail;
+            return i;
+        }
+    }
+
+    if (free_slot) *free_slot = avail;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Remove the entry in slot i and its file.  Lock held.
+static void sp_cache_drop(sp_cache_index *idx, const int i)
+{
+    sp_cache_slot *s = &idx->slots[i];
+    char path[SP_CACHE_PATH_LEN];
+
+    sp_cache_path(path, &s->key);
+    unlink(path);
+
+    idx->total -= s->size;
+    idx->nused--;
+    s->state = SP_CACHE_SLOT_DELETED;
+}
+
+//-----------------------------------------------------------------------------
+/** Remove least recently used entries until 'need' more bytes fit into
+ * the budget and, if need_slot is set, there is room for one more entry
+ * in the table.  Lock held.
+ */
+static void sp_cache_evict(
+    sp_cache_index *idx,
+    const uint64_t  need,
+    const int       need_slot,
+    const uint64_t  budget,
+    const uint32_t  now)
+{
+    while (idx->total + need > budget ||
+           (need_slot && idx->nused >= SP_CACHE_MAX_FILLED))
+    {
+        int      lru   = -1;
+        uint32_t oldest = now - SP_CACHE_GRACE_SECS;
+        for (int i = 0; i < SP_CACHE_NSLOTS; i++)
+        {
+            sp_cache_slot *s = &idx->slots[i];
+            if (SP_CACHE_SLOT_USED == s->state && s->atime <= oldest)
+            {
+                oldest = s->atime;
+                lru    = i;
+            }
+        }
+        if (lru < 0) break;
+        sp_cache_drop(idx, lru);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Rebuild the table in place once deleted slots make probing slow.
+ * Lock held.
+ */
+static void sp_cache_rehash(sp_cache_index *idx)
+{
+    sp_cache_slot *used =
+        (sp_cache_slot *) malloc(idx->nused * sizeof(sp_cache_slot) + 1);
+    if (NULL == used) return;
+
+    int n = 0;
+    for (int i = 0; i < SP_CACHE_NSLOTS; i++)
+    {
+        if (SP_CACHE_SLOT_USED == idx->slots[i].state)
+            used[n++] = idx->slots[i];
+    }
+
+    memset(idx->slots, 0, sizeof(idx->slots));
+    for (int k = 0; k < n; k++)
+    {
+        int slot = -1;
+        sp_cache_find(idx, &used[k].key, &slot);
+        idx->slots[slot] = used[k];
+    }
+    idx->nfilled = n;
+
+    free(used);
+}
+
+//-----------------------------------------------------------------------------
+// write() all of buf.
+static int sp_cache_write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** The CoverageId as kept with an entry: itself, or if that is too long,
+ *  '#' and its hash, which no CoverageId (an NCName) can be.
+ * @param coverage_id may be NULL.
+ * @param buf SP_CACHE_COVID_LEN characters.
+ * @return buf, empty for NULL.
+ */
+static const char *sp_cache_covid(const char *coverage_id, char *buf)
+{
+    if (NULL == coverage_id)
+    {
+        buf[0] = '\0';
+    }
+    else if (strlen(coverage_id) < SP_CACHE_COVID_LEN)
+    {
+        strcpy(buf, coverage_id);
+    }
+    else
+    {
+        uint64_t h[2];
+        sp_murmur3_128(coverage_id, strlen(coverage_id), 0, h);
+        snprintf(buf, SP_CACHE_COVID_LEN, "#%016llx%016llx",
+                 (unsigned long long) h[0], (unsigned long long) h[1]);
+    }
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Store an entry in the cache.
+ * @param env
+ * @param props
+ * @param key
+ * @param coverage_id may be NULL.
+ * @param ctype
+ * @param data
+ * @param len
+ * @return 0 if stored, -1 otherwise.
+ */
+static int sp_cache_store(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *coverage_id,
+    const char         *ctype,
+    const char         *data,
+    const size_t        len)
+{
+    // No single entry may take more than a quarter of the budget.
+    const uint64_t budget = (uint64_t) rp_getCacheSizeMB(env, props) << 20;
+    if (NULL == data || 0 == len || len > budget / 4) return -1;
+    if (NULL == ctype || strlen(ctype) >= SP_CACHE_CTYPE_LEN) return -1;
+    char covid[SP_CACHE_COVID_LEN];
+    coverage_id = sp_cache_covid(coverage_id, covid);
+
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return -1;
+
+    char tmp_path[SP_CACHE_PATH_LEN];
+    char path[SP_CACHE_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/tmp.XXXXXX", sp_cache_dir);
+    sp_cache_path(path, key);
+
+    int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd < 0)
+    {
+        SP_LOG_WARNING("coverage cache: cannot create %s: %s",
+                       tmp_path, strerror(errno));
+        return -1;
+    }
+    fchmod(fd, 0644);
+
+    int failed = sp_cache_write_all(fd, data, len);
+    failed |= close(fd);
+    if (failed || rename(tmp_path, path))
+    {
+        SP_LOG_WARNING("coverage cache: cannot store %s: %s",
+                       path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    const uint32_t now = (uint32_t) time(NULL);
+    int stored = 0;
+
+    sp_cache_lock(idx);
+
+    int i = sp_cache_find(idx, key, NULL);
+    if (i >= 0)
+    {
+        // Replaced: already on disk under the same name.
+        sp_cache_slot *s = &idx->slots[i];
+        idx->total -= s->size;
+        s->size  = len;
+        s->atime = now;
+        idx->total += len;
+        strcpy(s->ctype, ctype);
+        strcpy(s->coverage_id, coverage_id);
+        sp_cache_evict(idx, 0, 0, budget, now);
+    }
+    else
+    {
+        sp_cache_evict(idx, len, 1, budget, now);
+        if (idx->nfilled >= SP_CACHE_MAX_FILLED) sp_cache_rehash(idx);
+
+        int slot = -1;
+        sp_cache_find(idx, key, &slot);
+        if (slot < 0 || idx->nused >= SP_CACHE_MAX_FILLED)
+        {
+            // Table full of recently used entries.
+            unlink(path);
+            stored = -1;
+        }
+        else
+        {
+            sp_cache_slot *s = &idx->slots[slot];
+            if (SP_CACHE_SLOT_EMPTY == s->state) idx->nfilled++;
+            s->key   = *key;
+            s->size  = len;
+            s->atime = now;
+            strcpy(s->ctype, ctype);
+            strcpy(s->coverage_id, coverage_id);
+            s->state = SP_CACHE_SLOT_USED;
+            idx->nused++;
+            idx->total += len;
+        }
+    }
+
+    sp_cache_unlock(idx);
+    return stored;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Find the data handler of a coverage returned as an MTOM attachment.
+ * @param env
+ * @param resp_node
+ * @return the data handler, NULL if resp_node is anything else.
+ */
+axiom_data_handler_t *sp_cache_coverage_dh(
+    const axutil_env_t *env,
+    axiom_node_t       *resp_node)
+{
+    if (NULL == resp_node ||
+        AXIOM_ELEMENT != axiom_node_get_node_type(resp_node, env))
+    {
+        return NULL;
+    }
+
+    axiom_element_t *el = axiom_node_get_data_element(resp_node, env);
+    if (NULL == el ||
+        axutil_strcmp(axiom_element_get_localname(el, env), "Coverage"))
+    {
+        return NULL;
+    }
+
+    axiom_node_t *t_node = axiom_node_get_first_child(resp_node, env);
+    if (NULL == t_node || AXIOM_TEXT != axiom_node_get_node_type(t_node, env))
+    {
+        return NULL;
+    }
+
+    axiom_text_t *text = axiom_node_get_data_element(t_node, env);
+    return text ? axiom_text_get_data_handler(text, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if the coverage cache is configured.
+ */
+int sp_cache_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return '\0' != rp_getCacheDir(env, props)[0] &&
+           rp_getCacheSizeMB(env, props) > 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Compute the cache key of a GetCoverage request.  A coverage is cached
+ *  as it is sent, compressed or not by CompressLevel and CompressMinKB
+ *  (see sp_compress.c), so they are part of the key.
+ * @param env
+ * @param props
+ * @param req_node the GetCoverage element.
+ * @param key set on success.
+ * @return 0 on success, -1 on failure.
+ */
+int sp_cache_coverage_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *req_node,
+    sp_cache_key       *key)
+{
+    const char *ident[5];
+    char        deflate[32];
+    if (rp_getUrlMode(env, props))
+    {
+        ident[0] = rp_getBackendURL(env, props);
+    }
+    else
+    {
+        ident[0] = rp_getMapserverExec(env, props);
+    }
+    ident[1] = rp_getMapfile(env, props);
+    ident[2] = "coverage";
+    ident[3] = NULL;
+    if (rp_getCompressLevel(env, props) > 0)
+    {
+        snprintf(deflate, sizeof(deflate), "deflate %d %d",
+                 rp_getCompressLevel(env, props),
+                 rp_getCompressMinKB(env, props));
+        ident[3] = deflate;
+        ident[4] = NULL;
+    }
+
+    return sp_canon_hash(env, req_node, ident, key->h);
+}
+
+//-----------------------------------------------------------------------------
+/** Look up a coverage in the cache.
+ * @param env
+ * @param props
+ * @param key from sp_cache_coverage_key().
+ * @return a Coverage node whose attachment is streamed from the cache
+ *         file, NULL on a miss.
+ */
+axiom_node_t *sp_cache_get_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key)
+{
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return NULL;
+
+    char     ctype[SP_CACHE_CTYPE_LEN];
+    uint64_t size = 0;
+
+    sp_cache_lock(idx);
+    int i = sp_cache_find(idx, key, NULL);
+    if (i >= 0)
+    {
+        sp_cache_slot *s = &idx->slots[i];
+        s->atime = (uint32_t) time(NULL);
+        size     = s->size;
+        memcpy(ctype, s->ctype, SP_CACHE_CTYPE_LEN);
+    }
+    sp_cache_unlock(idx);
+
+    if (i < 0)
+    {
+        sp_stats_cache("coverage", 0);
+        return NULL;
+    }
+
+    char path[SP_CACHE_PATH_LEN];
+    sp_cache_path(path, key);
+
+    struct stat sb;
+    if (stat(path, &sb) || (uint64_t) sb.st_size != size)
+    {
+        // Removed behind our back, or replaced in the meantime.
+        sp_cache_lock(idx);
+        i = sp_cache_find(idx, key, NULL);
+        if (i >= 0 && idx->slots[i].size == size) sp_cache_drop(idx, i);
+        sp_cache_unlock(idx);
+
+        sp_stats_cache("coverage", 0);
+        return NULL;
+    }
+
+    axiom_data_handler_t *data_handler =
+        axiom_data_handler_create(env, path, ctype);
+    if (NULL == data_handler) return NULL;
+
+    sp_stats_cache("coverage", 1);
+    SP_LOG_DEBUG("coverage cache hit %s", path);
+
+    return sp_make_MTOM_dh_node20(env, data_handler,
+                                  "Coverage",
+                                  "wcs",
+                                  "http://www.opengis.net/wcs/2.0");
+}
+
+//-----------------------------------------------------------------------------
+/** Store a coverage in the cache.  Anything but a binary coverage response,
+ * e.g. an exception report, is ignored.
+ * @param env
+ * @param props
+ * @param key from sp_cache_coverage_key().
+ * @param coverage_id CoverageId of the request, may be NULL.
+ * @param resp_node the response from the backend.
+ * @return 0 if the coverage was stored, -1 otherwise.
+ */
+int sp_cache_put_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *coverage_id,
+    axiom_node_t       *resp_node)
+{
+    axiom_data_handler_t *dh = sp_cache_coverage_dh(env, resp_node);
+    if (NULL == dh) return -1;
+
+    const char  *data  = (const char *) axiom_data_handler_get_input_stream(dh, env);
+    const size_t len   = axiom_data_handler_get_input_stream_len(dh, env);
+    const char  *ctype = axiom_data_handler_get_content_type(dh, env);
+
+    return sp_cache_store(env, props, key, coverage_id, ctype, data, len);
+}
+
+//-----------------------------------------------------------------------------
+/** Check whether a coverage is in the cache, without using it.
+ * @param env
+ * @param props
+ * @param key from sp_cache_coverage_key().
+ * @return non-zero if present.
+ */
+int sp_cache_has_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key)
+{
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return 0;
+
+    sp_cache_lock(idx);
+    int i = sp_cache_find(idx, key, NULL);
+    sp_cache_unlock(idx);
+
+    return i >= 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Compute the cache key of the CoverageDescription of a coverage.
+ * @param env
+ * @param props
+ * @param coverage_id
+ * @param key set.
+ */
+void sp_cache_description_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *coverage_id,
+    sp_cache_key       *key)
+{
+    char ident[SP_MAX_MPATHS_LEN * 3];
+    snprintf(ident, sizeof(ident), "%s|%s|description|%s",
+             rp_getUrlMode(env, props) ?
+                 rp_getBackendURL(env, props) : rp_getMapserverExec(env, props),
+             rp_getMapfile(env, props),
+             coverage_id);
+    sp_murmur3_128(ident, strlen(ident), 0, key->h);
+}
+
+//-----------------------------------------------------------------------------
+/** Look up a CoverageDescription in the cache.
+ * @param env
+ * @param props
+ * @param key from sp_cache_description_key().
+ * @param len set to the length of the text.
+ * @return the text kept by sp_cache_put_description(), malloc()ed and
+ *         NUL terminated, NULL on a miss.
+ */
+char *sp_cache_get_description(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    size_t             *len)
+{
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return NULL;
+
+    uint64_t size = 0;
+
+    sp_cache_lock(idx);
+    int i = sp_cache_find(idx, key, NULL);
+    if (i >= 0)
+    {
+        idx->slots[i].atime = (uint32_t) time(NULL);
+        size = idx->slots[i].size;
+    }
+    sp_cache_unlock(idx);
+
+    char  path[SP_CACHE_PATH_LEN];
+    char *buf = NULL;
+    sp_cache_path(path, key);
+
+    FILE       *fp = i >= 0 ? fopen(path, "r") : NULL;
+    struct stat sb;
+    if (fp)
+    {
+        // Replaced in the meantime, by one of another size: a miss, not
+        //  a prefix of the new one.
+        if (0 == fstat(fileno(fp), &sb) && (uint64_t) sb.st_size == size)
+        {
+            buf = malloc(size + 1);
+        }
+        if (buf && 1 != fread(buf, size, 1, fp))
+        {
+            // Removed in the meantime.
+            free(buf);
+            buf = NULL;
+        }
+        fclose(fp);
+    }
+
+    sp_stats_cache("description", NULL != buf);
+    if (NULL == buf) return NULL;
+
+    buf[size] = '\0';
+    *len = size;
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Store a CoverageDescription in the cache.
+ * @param env
+ * @param props
+ * @param key from sp_cache_description_key().
+ * @param coverage_id
+ * @param xml the text to keep.
+ * @param len
+ * @return 0 if stored, -1 otherwise.
+ */
+int sp_cache_put_description(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *coverage_id,
+    const char         *xml,
+    const size_t        len)
+{
+    return sp_cache_store(env, props, key, coverage_id, "text/xml", xml, len);
+}
+
+//-----------------------------------------------------------------------------
+/** Store an entry of some other module, e.g. the index of sp_eoindex.c.
+ * @param env
+ * @param props
+ * @param key chosen by the caller, not to clash with the other keys.
+ * @param ctype tells the entry apart in the index.
+ * @param data
+ * @param len
+ * @return 0 if stored, -1 otherwise.
+ */
+int sp_cache_put_blob(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *ctype,
+    const void         *data,
+    const size_t        len)
+{
+    return sp_cache_store(env, props, key, NULL, ctype, (const char *) data, len);
+}
+
+//-----------------------------------------------------------------------------
+/** Map an entry stored by sp_cache_put_blob() read-only.
+ * @param env
+ * @param props
+ * @param key
+ * @param len set to the size of the entry.
+ * @return the mapping, to be released with sp_cache_unmap_blob(), NULL on
+ *         a miss.  A replaced entry stays mapped as it was.
+ */
+const void *sp_cache_map_blob(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    size_t             *len)
+{
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return NULL;
+
+    sp_cache_lock(idx);
+    int i = sp_cache_find(idx, key, NULL);
+    if (i >= 0) idx->slots[i].atime = (uint32_t) time(NULL);
+    sp_cache_unlock(idx);
+    if (i < 0) return NULL;
+
+    char path[SP_CACHE_PATH_LEN];
+    sp_cache_path(path, key);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat sb;
+    void *map = MAP_FAILED;
+    if (0 == fstat(fd, &sb) && sb.st_size > 0)
+    {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (MAP_FAILED == map) return NULL;
+
+    *len = sb.st_size;
+    return map;
+}
+
+//-----------------------------------------------------------------------------
+void sp_cache_unmap_blob(const void *map, const size_t len)
+{
+    if (map) munmap((void *) map, len);
+}
+
+//-----------------------------------------------------------------------------
+/** Remove entries from the cache.  With neither filter given all entries
+ * are removed.  Unlike eviction this does not spare recently used entries,
+ * so a response being sent from one of the files at the time may fail.
+ * @param env
+ * @param props
+ * @param key_prefix if not NULL, remove entries whose key, as 32 hex
+ *        digits, starts with this (case insensitive).
+ * @param coverage_id if not NULL, remove entries of this CoverageId.
+ * @return the number of entries removed, -1 if the cache is not usable.
+ */
+int sp_cache_purge(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *key_prefix,
+    const char         *coverage_id)
+{
+    sp_cache_index *idx = sp_cache_open(rp_getCacheDir(env, props));
+    if (NULL == idx) return -1;
+
+    const size_t prefix_len = key_prefix ? strlen(key_prefix) : 0;
+    char hex[36];
+    char covid[SP_CACHE_COVID_LEN];
+    int  n = 0;
+
+    if (coverage_id) coverage_id = sp_cache_covid(coverage_id, covid);
+
+    sp_cache_lock(idx);
+    for (int i = 0; i < SP_CACHE_NSLOTS; i++)
+    {
+        sp_cache_slot *s = &idx->slots[i];
+        if (SP_CACHE_SLOT_USED != s->state) continue;
+
+        if (key_prefix)
+        {
+            snprintf(hex, sizeof(hex), "%016llx%016llx",
+                     (unsigned long long) s->key.h[0],
+                     (unsigned long long) s->key.h[1]);
+            if (strncasecmp(hex, key_prefix, prefix_len)) continue;
+        }
+        if (coverage_id && strcmp(s->coverage_id, coverage_id)) continue;
+
+        sp_cache_drop(idx, i);
+        n++;
+    }
+    if (idx->nfilled >= SP_CACHE_MAX_FILLED) sp_cache_rehash(idx);
+    sp_cache_unlock(idx);
+
+    SP_LOG_INFO("coverage cache: purged %d entries", n);
+    return n;
+}
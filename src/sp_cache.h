@@ -0,0 +1,127 @@
+/*
+ * Soap Proxy - coverage cache header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_cache.h
+ *
+ */
+
+#ifndef SPCACHE_H_INCLUDED
+#define SPCACHE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+/**
+ * 128 bit key of a cache entry.
+ */
+struct sp_cache_key_struct
+{
+    uint64_t h[2];
+};
+
+typedef struct sp_cache_key_struct sp_cache_key;
+
+int           sp_cache_enabled    (const axutil_env_t *env,
+                                   const sp_props     *props);
+
+int           sp_cache_coverage_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *req_node,
+    sp_cache_key       *key);
+
+axiom_node_t *sp_cache_get_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key);
+
+int           sp_cache_put_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *coverage_id,
+    axiom_node_t       *resp_node);
+
+int           sp_cache_has_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key);
+
+axiom_data_handler_t *sp_cache_coverage_dh(
+    const axutil_env_t *env,
+    axiom_node_t       *resp_node);
+
+void          sp_cache_description_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *coverage_id,
+    sp_cache_key       *key);
+
+char         *sp_cache_get_description(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    size_t             *len);
+
+int           sp_cache_put_description(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *coverage_id,
+    const char         *xml,
+    const size_t        len);
+
+int           sp_cache_put_blob(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    const char         *ctype,
+    const void         *data,
+    const size_t        len);
+
+const void   *sp_cache_map_blob(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_cache_key *key,
+    size_t             *len);
+
+void          sp_cache_unmap_blob(
+    const void   *map,
+    const size_t  len);
+
+int           sp_cache_purge(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *key_prefix,
+    const char         *coverage_id);
+
+#endif
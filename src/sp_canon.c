@@ -0,0 +1,506 @@
+/*
+ * Soap Proxy.
+ *
+ * Canonical form and hash of request elements, for cache keys.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_canon.c
+ *
+ * Two requests which differ only in namespace prefixes, attribute order,
+ * insignificant white space or the spelling of numbers ask for the same
+ * thing.  sp_canon_node() walks the AXIOM tree of a request and writes a
+ * form in which such differences are gone:
+ *   - elements and attributes are named by namespace URI and local name,
+ *     the prefixes and namespace declarations are dropped,
+ *   - attributes are sorted,
+ *   - text is trimmed, white space only text is dropped, comments and
+ *     processing instructions are dropped,
+ *   - the numbers in subset bounds (TrimLow, TrimHigh, SlicePoint, ...) are
+ *     rewritten in one notation, so that 10, 10.0 and 1e1 are the same.
+ *     Anything that is not a number, e.g. a time stamp, is kept as is.
+ *
+ * Every item is written with its length in front, so that no two
+ * different trees have the same form.  The form is not XML; it is only
+ * meant to be hashed, see sp_canon_hash().
+ *
+ * The hash is MurmurHash3 x64 128 by Austin Appleby (public domain), which
+ * runs at several GB/s, far faster than the XML parser that built the tree.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <axiom.h>
+
+#include "soap_proxy.h"
+#include "sp_canon.h"
+
+#define SP_CANON_SEED      0x53504331u
+#define SP_CANON_MAX_ATTRS 32
+
+// Elements whose text holds (lists of) numeric subset bounds.
+static const char *sp_canon_numeric_els[] =
+{
+    "TrimLow",
+    "TrimHigh",
+    "SlicePoint",
+    "LowerBound",
+    "UpperBound",
+    "lowerCorner",
+    "upperCorner",
+    NULL
+};
+
+struct sp_canon_attr_struct
+{
+    const char *uri;
+    const char *name;
+    const char *value;
+};
+
+typedef struct sp_canon_attr_struct sp_canon_attr;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static int sp_canon_is_numeric_el(const char *name)
+{
+    for (int i = 0; NULL != sp_canon_numeric_els[i]; i++)
+    {
+        if (0 == strcmp(name, sp_canon_numeric_els[i])) return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_canon_attr_cmp(const void *a, const void *b)
+{
+    const sp_canon_attr *x = (const sp_canon_attr *) a;
+    const sp_canon_attr *y = (const sp_canon_attr *) b;
+    int c = strcmp(x->uri, y->uri);
+    return c ? c : strcmp(x->name, y->name);
+}
+
+//-----------------------------------------------------------------------------
+// Append a tag character and a length-prefixed string.
+static void sp_canon_item(
+    const axutil_env_t *env,
+    sp_canon_buf       *buf,
+    const char          tag,
+    const char         *str,
+    const size_t        len)
+{
+    char pre[24];
+    int  n = snprintf(pre, sizeof(pre), "%c%lu:", tag, (unsigned long) len);
+    sp_canon_append(env, buf, pre, n);
+    sp_canon_append(env, buf, str, len);
+}
+
+//-----------------------------------------------------------------------------
+/** Rewrite the numbers in a white space separated list into one notation,
+ * then append it as a text item.
+ */
+static void sp_canon_numeric_text(
+    const axutil_env_t *env,
+    sp_canon_buf       *buf,
+    const char         *txt,
+    const size_t        len)
+{
+    char   one[64];
+    char   out[512];
+    size_t olen = 0;
+    size_t i    = 0;
+
+    while (i < len)
+    {
+        while (i < len && (unsigned char) txt[i] <= ' ') i++;
+        size_t start = i;
+        while (i < len && (unsigned char) txt[i] >  ' ') i++;
+        size_t tlen = i - start;
+        if (0 == tlen) break;
+
+        const char *tok = txt + start;
+        char        num[40];
+        if (tlen < sizeof(one))
+        {
+            memcpy(one, tok, tlen);
+            one[tlen] = '\0';
+
+            char  *end = NULL;
+            double d   = strtod(one, &end);
+            if (end == one + tlen && isfinite(d))
+            {
+                if (0.0 == d) d = 0.0;      // -0 is 0
+                tlen = snprintf(num, sizeof(num), "%.17g", d);
+                tok  = num;
+            }
+        }
+
+        if (olen + tlen + 1 > sizeof(out))
+        {
+            // Unusually long, keep it as it is.
+            sp_canon_item(env, buf, 'T', txt, len);
+            return;
+        }
+        if (olen > 0) out[olen++] = ' ';
+        memcpy(out + olen, tok, tlen);
+        olen += tlen;
+    }
+
+    sp_canon_item(env, buf, 'T', out, olen);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_canon_attrs(
+    const axutil_env_t *env,
+    sp_canon_buf       *buf,
+    axiom_element_t    *el)
+{
+    axutil_hash_t *attrs = axiom_element_get_all_attributes(el, env);
+    if (NULL == attrs) return;
+
+    sp_canon_attr  local[SP_CANON_MAX_ATTRS];
+    sp_canon_attr *list = local;
+    int            max  = SP_CANON_MAX_ATTRS;
+    int            n    = 0;
+
+    axutil_hash_index_t *hi;
+    for (hi = axutil_hash_first(attrs, env); hi; hi = axutil_hash_next(env, hi))
+    {
+        void *val = NULL;
+        axutil_hash_this(hi, NULL, NULL, &val);
+        axiom_attribute_t *attr = (axiom_attribute_t *) val;
+        if (NULL == attr) continue;
+
+        if (n == max)
+        {
+            sp_canon_attr *bigger = (sp_canon_attr *)
+                AXIS2_MALLOC(env->allocator, 2 * max * sizeof(sp_canon_attr));
+            if (NULL == bigger)
+            {
+                buf->failed = 1;
+                break;
+            }
+            memcpy(bigger, list, n * sizeof(sp_canon_attr));
+            if (list != local) AXIS2_FREE(env->allocator, list);
+            list = bigger;
+            max *= 2;
+        }
+
+        axiom_namespace_t *ns  = axiom_attribute_get_namespace(attr, env);
+        const char        *uri = ns ? axiom_namespace_get_uri(ns, env) : NULL;
+        const char        *nm  = axiom_attribute_get_localname(attr, env);
+        const char        *v   = axiom_attribute_get_value(attr, env);
+
+        list[n].uri   = uri ? uri : "";
+        list[n].name  = nm  ? nm  : "";
+        list[n].value = v   ? v   : "";
+        n++;
+    }
+    // An early break leaves the iterator allocated; axutil_hash_next frees
+    //  it only at the end.
+    if (hi) AXIS2_FREE(env->allocator, hi);
+
+    qsort(list, n, sizeof(sp_canon_attr), sp_canon_attr_cmp);
+
+    for (int i = 0; i < n; i++)
+    {
+        sp_canon_item(env, buf, 'A', list[i].uri,   strlen(list[i].uri));
+        sp_canon_item(env, buf, 'N', list[i].name,  strlen(list[i].name));
+        sp_canon_item(env, buf, 'V', list[i].value, strlen(list[i].value));
+    }
+
+    if (list != local) AXIS2_FREE(env->allocator, list);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_canon_walk(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_canon_buf       *buf,
+    const int           numeric)
+{
+    switch (axiom_node_get_node_type(node, env))
+    {
+    case AXIOM_ELEMENT:
+    {
+        axiom_element_t *el = axiom_node_get_data_element(node, env);
+        if (NULL == el) return;
+
+        axiom_namespace_t *ns   = axiom_element_get_namespace(el, env, node);
+        const char        *uri  = ns ? axiom_namespace_get_uri(ns, env) : NULL;
+        const char        *name = axiom_element_get_localname(el, env);
+        if (NULL == uri)  uri  = "";
+        if (NULL == name) name = "";
+
+        sp_canon_item(env, buf, 'E', uri,  strlen(uri));
+        sp_canon_item(env, buf, 'N', name, strlen(name));
+        sp_canon_attrs(env, buf, el);
+
+        const int child_numeric = sp_canon_is_numeric_el(name);
+        for (axiom_node_t *c = axiom_node_get_first_child(node, env);
+             NULL != c;
+             c = axiom_node_get_next_sibling(c, env))
+        {
+            sp_canon_walk(env, c, buf, child_numeric);
+        }
+        sp_canon_append(env, buf, "/", 1);
+        break;
+    }
+
+    case AXIOM_TEXT:
+    {
+        axiom_text_t *text = axiom_node_get_data_element(node, env);
+        const char   *txt  = text ? axiom_text_get_value(text, env) : NULL;
+        if (NULL == txt) return;
+
+        size_t len = strlen(txt);
+        while (len > 0 && (unsigned char) txt[len-1] <= ' ') len--;
+        while (len > 0 && (unsigned char) txt[0]     <= ' ') { txt++; len--; }
+        if (0 == len) return;
+
+        if (numeric) sp_canon_numeric_text(env, buf, txt, len);
+        else         sp_canon_item(env, buf, 'T', txt, len);
+        break;
+    }
+
+    default:
+        // comments, processing instructions, doctype
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+static inline uint64_t sp_rotl64(const uint64_t x, const int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+//-----------------------------------------------------------------------------
+static inline uint64_t sp_fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Prepare an empty buffer.
+ * @param buf
+ */
+void sp_canon_init(sp_canon_buf *buf)
+{
+    buf->data   = buf->local;
+    buf->len    = 0;
+    buf->size   = SP_CANON_INIT_LEN;
+    buf->failed = 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Release the heap memory of a buffer, if any.
+ * @param env
+ * @param buf
+ */
+void sp_canon_free(const axutil_env_t *env, sp_canon_buf *buf)
+{
+    if (buf->data != buf->local) AXIS2_FREE(env->allocator, buf->data);
+    sp_canon_init(buf);
+}
+
+//-----------------------------------------------------------------------------
+/** Append raw bytes to a buffer.
+ * @param env
+ * @param buf
+ * @param str
+ * @param len
+ */
+void sp_canon_append(
+    const axutil_env_t *env,
+    sp_canon_buf       *buf,
+    const char         *str,
+    const size_t        len)
+{
+    if (buf->failed) return;
+
+    if (buf->len + len > buf->size)
+    {
+        size_t size = buf->size * 2;
+        while (size < buf->len + len) size *= 2;
+
+        char *data = (char *) AXIS2_MALLOC(env->allocator, size);
+        if (NULL == data)
+        {
+            buf->failed = 1;
+            return;
+        }
+        memcpy(data, buf->data, buf->len);
+        if (buf->data != buf->local) AXIS2_FREE(env->allocator, buf->data);
+        buf->data = data;
+        buf->size = size;
+    }
+
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+}
+
+//-----------------------------------------------------------------------------
+/** Write the canonical form of the tree under node to buf.
+ * @param env
+ * @param node
+ * @param buf initialised with sp_canon_init().
+ * @return 0 on success, -1 if out of memory.
+ */
+int sp_canon_node(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_canon_buf       *buf)
+{
+    if (NULL == node) return -1;
+    sp_canon_walk(env, node, buf, 0);
+    return buf->failed ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** MurmurHash3_x64_128.
+ * @param key
+ * @param len
+ * @param seed
+ * @param out the 128 bit hash.
+ */
+void sp_murmur3_128(
+    const void    *key,
+    const size_t   len,
+    const uint32_t seed,
+    uint64_t       out[2])
+{
+    const uint8_t *data    = (const uint8_t *) key;
+    const size_t   nblocks = len / 16;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16,     8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = sp_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = sp_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = sp_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = sp_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + nblocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    switch (len & 15)
+    {
+    case 15: k2 ^= (uint64_t) tail[14] << 48;
+    case 14: k2 ^= (uint64_t) tail[13] << 40;
+    case 13: k2 ^= (uint64_t) tail[12] << 32;
+    case 12: k2 ^= (uint64_t) tail[11] << 24;
+    case 11: k2 ^= (uint64_t) tail[10] << 16;
+    case 10: k2 ^= (uint64_t) tail[ 9] << 8;
+    case  9: k2 ^= (uint64_t) tail[ 8];
+             k2 *= c2; k2 = sp_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    case  8: k1 ^= (uint64_t) tail[ 7] << 56;
+    case  7: k1 ^= (uint64_t) tail[ 6] << 48;
+    case  6: k1 ^= (uint64_t) tail[ 5] << 40;
+    case  5: k1 ^= (uint64_t) tail[ 4] << 32;
+    case  4: k1 ^= (uint64_t) tail[ 3] << 24;
+    case  3: k1 ^= (uint64_t) tail[ 2] << 16;
+    case  2: k1 ^= (uint64_t) tail[ 1] << 8;
+    case  1: k1 ^= (uint64_t) tail[ 0];
+             k1 *= c1; k1 = sp_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = sp_fmix64(h1);
+    h2 = sp_fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+//-----------------------------------------------------------------------------
+/** Hash the canonical form of the tree under node, followed by the strings
+ * in 'extra' (e.g. the identity of the backend).
+ * @param env
+ * @param node
+ * @param extra NULL terminated list of strings, may be NULL.
+ * @param out the 128 bit hash.
+ * @return 0 on success, -1 on failure.
+ */
+int sp_canon_hash(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char * const *extra,
+    uint64_t            out[2])
+{
+    sp_canon_buf buf;
+    sp_canon_init(&buf);
+
+    int ret = sp_canon_node(env, node, &buf);
+    for (int i = 0; 0 == ret && extra && NULL != extra[i]; i++)
+    {
+        sp_canon_item(env, &buf, 'X', extra[i], strlen(extra[i]));
+    }
+
+    if (0 == ret && ! buf.failed)
+    {
+        sp_murmur3_128(buf.data, buf.len, SP_CANON_SEED, out);
+    }
+    else
+    {
+        ret = -1;
+    }
+
+    sp_canon_free(env, &buf);
+    return ret;
+}
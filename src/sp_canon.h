@@ -0,0 +1,86 @@
+/*
+ * Soap Proxy - request canonicalisation header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_canon.h
+ *
+ */
+
+#ifndef SPCANON_H_INCLUDED
+#define SPCANON_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sp_svc.h"
+
+#define SP_CANON_INIT_LEN 2048
+
+//
+// Growable output buffer of the canonicaliser.  Starts out in 'local',
+// moves to the heap (env->allocator) if that is too small.
+//
+struct sp_canon_buf_struct
+{
+    char   *data;
+    size_t  len;
+    size_t  size;
+    int     failed;     // out of memory, contents incomplete
+    char    local[SP_CANON_INIT_LEN];
+};
+
+typedef struct sp_canon_buf_struct sp_canon_buf;
+
+void sp_canon_init (sp_canon_buf *buf);
+void sp_canon_free (const axutil_env_t *env, sp_canon_buf *buf);
+
+int  sp_canon_node(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_canon_buf       *buf);
+
+void sp_canon_append(
+    const axutil_env_t *env,
+    sp_canon_buf       *buf,
+    const char         *str,
+    const size_t        len);
+
+void sp_murmur3_128(
+    const void    *key,
+    const size_t   len,
+    const uint32_t seed,
+    uint64_t       out[2]);
+
+int  sp_canon_hash(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char * const *extra,
+    uint64_t            out[2]);
+
+#endif
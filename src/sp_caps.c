@@ -0,0 +1,652 @@
+/*
+ * Soap Proxy.
+ *
+ * GetCapabilities answered from a cached document.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_caps.c
+ *
+ * Clients ask for the capabilities over and over, often for some Sections
+ * only, e.g. ServiceMetadata or Contents.  If CapabilitiesCacheSecs is
+ * set, the whole document is fetched from the backend and rewritten once
+ * (see rp_inject_soap_cap20() and the rest in rp_dispatch_op()), and kept
+ * for that many seconds.  A GetCapabilities is then answered from it:
+ *
+ *  - Sections picks the top-level sections of the document, all if it is
+ *    absent or holds All,
+ *  - an updateSequence equal to that of the document gets the document
+ *    without any section, to tell the client its copy is current, one
+ *    greater than it the OWS InvalidUpdateSequence exception,
+ *  - AcceptVersions must list the version of the document, and
+ *    AcceptFormats text/xml.
+ *
+ * Anything else, e.g. AcceptLanguages, an unknown section or a version
+ * the document does not have, is passed on to the backend as before, so
+ * that it answers with the right exception.  While the document is
+ * fresh such a request goes to the backend as it is, the document is
+ * not fetched again for it.
+ *
+ * The document is kept serialised, together with the byte ranges of its
+ * top-level sections, see sp_xml_children().  A response is the start
+ * tag of the root, which declares the namespaces, followed by the
+ * sections asked for and the end tag, parsed into a new tree.
+ *
+ * The document is kept by each Apache process on its own, for the
+ * backend (BackendURL or MapServ, and MapFile) it was fetched from, and
+ * shared by its threads under a mutex, held only while a response is
+ * copied out of it.  A PurgeCache drops it in all processes, see
+ * sp_stats_purged().
+ * A response from it carries an ETag and Last-Modified, so that a client
+ * polling with If-None-Match gets 304 Not Modified, see sp_cond.c.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "soap_proxy.h"
+#include "sp_caps.h"
+#include "sp_canon.h"
+#include "sp_cond.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_CAPS_MAX_SECTIONS 16
+#define SP_CAPS_NAME_LEN     48
+#define SP_CAPS_SEQ_LEN      96
+
+//
+// A top-level section of the document.
+//
+struct sp_caps_section_struct
+{
+    char   name[SP_CAPS_NAME_LEN];   // local name
+    size_t off;
+    size_t len;
+};
+
+typedef struct sp_caps_section_struct sp_caps_section;
+
+//
+// The cached capabilities document.
+//
+struct sp_caps_doc_struct
+{
+    uint64_t        key[2];          // of the backend, see sp_caps_key()
+    time_t          fetched;
+    time_t          changed;         // last fetched different, see sp_cond.c
+    char           *xml;             // malloc()ed, NULL if none
+    size_t          len;
+    size_t          head_len;        // the start tag of the root
+    size_t          tail_off;        // its end tag
+    int             n;
+    sp_caps_section sect[SP_CAPS_MAX_SECTIONS];
+    char            version[16];
+    char            update_seq[SP_CAPS_SEQ_LEN];
+};
+
+typedef struct sp_caps_doc_struct sp_caps_doc;
+
+static sp_caps_doc     sp_caps_curr;
+static pthread_mutex_t sp_caps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The sections of OWS 2.0 and WCS 2.0 capabilities.
+static const char *sp_caps_section_names[] =
+{
+    "ServiceIdentification",
+    "ServiceProvider",
+    "OperationsMetadata",
+    "ServiceMetadata",
+    "Contents",
+    "All",
+    NULL
+};
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** The key of the backend the document comes from.
+ */
+static void sp_caps_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    uint64_t           *key)
+{
+    char ident[SP_MAX_MPATHS_LEN * 2 + 16];
+    snprintf(ident, sizeof(ident), "%s|%s|%s",
+    		rp_getUrlMode(env, props) ? "url" : "exec",
+    		rp_getUrlMode(env, props) ?
+    				rp_getBackendURL(env, props) : rp_getMapserverExec(env, props),
+    		rp_getMapfile(env, props));
+    sp_murmur3_128(ident, strlen(ident), 0, key);
+}
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_caps_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Copy the local name of the tag starting at p.
+ */
+static void sp_caps_tag_name(const char *p, const char *end, char *name)
+{
+    const char *s = ++p;
+    while (p < end && ! strchr(" \t\r\n/>", *p))
+    {
+    	if (':' == *p) s = p + 1;
+    	p++;
+    }
+    snprintf(name, SP_CAPS_NAME_LEN, "%.*s", (int) (p - s), s);
+}
+
+//-----------------------------------------------------------------------------
+/** Find the root tags and the top-level sections of a serialised document.
+ * @param doc with xml and len set.
+ * @return 0 on success, -1 if the text cannot be made sense of.
+ */
+static int sp_caps_index(sp_caps_doc *doc)
+{
+    sp_xml_range range[SP_CAPS_MAX_SECTIONS];
+    int          i;
+
+    if (sp_xml_children(doc->xml, doc->len, &doc->head_len, &doc->tail_off,
+    		range, SP_CAPS_MAX_SECTIONS, &doc->n))
+    {
+    	return -1;
+    }
+    for (i = 0; i < doc->n; i++)
+    {
+    	sp_caps_tag_name(doc->xml + range[i].off, doc->xml + doc->len,
+    			doc->sect[i].name);
+    	doc->sect[i].off = range[i].off;
+    	doc->sect[i].len = range[i].len;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Compare two updateSequence values: numerically if both are numbers,
+ *  else as strings, which orders ISO 8601 time stamps.
+ * @return <0, 0 or >0 as a is before, the same as or after b.
+ */
+static int sp_caps_seq_cmp(const char *a, const char *b)
+{
+    const size_t la = strlen(a);
+    const size_t lb = strlen(b);
+
+    if (la > 0 && lb > 0 &&
+    	la == strspn(a, "0123456789") && lb == strspn(b, "0123456789"))
+    {
+    	while ('0' == a[0] && a[1]) a++;
+    	while ('0' == b[0] && b[1]) b++;
+    	if (strlen(a) != strlen(b)) return strlen(a) < strlen(b) ? -1 : 1;
+    }
+    return strcmp(a, b);
+}
+
+//-----------------------------------------------------------------------------
+/** The OWS exception for an updateSequence newer than the document's.
+ * @param env
+ * @return the ExceptionReport, NULL if out of memory.
+ */
+static axiom_node_t *sp_caps_invalid_seq(const axutil_env_t *env)
+{
+    axiom_node_t      *report_node = NULL;
+    axiom_node_t      *exc_node    = NULL;
+    axiom_node_t      *text_node   = NULL;
+    axiom_namespace_t *ows_ns      = axiom_namespace_create(
+    		env, SP_OWS_NAMESPACE_STR, "ows");
+
+    axiom_element_t *el = axiom_element_create(
+    		env, NULL, "ExceptionReport", ows_ns, &report_node);
+    if (NULL == el) return NULL;
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "version", "2.0.0", NULL), report_node);
+
+    el = axiom_element_create(env, report_node, "Exception", ows_ns, &exc_node);
+    axiom_element_add_attribute(el, env, axiom_attribute_create(
+    		env, "exceptionCode", "InvalidUpdateSequence", NULL), exc_node);
+    axiom_element_add_attribute(el, env, axiom_attribute_create(
+    		env, "locator", "updateSequence", NULL), exc_node);
+
+    el = axiom_element_create(env, exc_node, "ExceptionText", ows_ns, &text_node);
+    axiom_element_set_text(el, env,
+    		"updateSequence is greater than that of the server.", text_node);
+    return report_node;
+}
+
+//-----------------------------------------------------------------------------
+/** Find out which sections of the document a request asks for.
+ * @param env
+ * @param node the GetCapabilities request.
+ * @param doc the document, NULL to check only whether the request could
+ *  be answered from a document at all.
+ * @param sel set for each section of doc, non-zero if asked for.
+ * @param current set non-zero if the updateSequence of the request is
+ *  that of the document.
+ * @return 0 if the request can be answered from doc, -1 if not, 1 if
+ *  its updateSequence is newer than that of doc.
+ */
+static int sp_caps_select(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_caps_doc  *doc,
+    int                *sel,
+    int                *current)
+{
+    axiom_element_t *el    = axiom_node_get_data_element(node, env);
+    axiom_node_t    *child = axiom_node_get_first_child(node, env);
+    int              all   = 1;
+    int              i;
+
+    *current = 0;
+    for (i = 0; doc && i < doc->n; i++) sel[i] = 0;
+
+    const axis2_char_t *seq = el ?
+    		axiom_element_get_attribute_value_by_name(el, env, "updateSequence") :
+    		NULL;
+    if (seq && doc && doc->update_seq[0])
+    {
+    	const int cmp = sp_caps_seq_cmp(seq, doc->update_seq);
+    	if (cmp > 0) return 1;
+    	*current = 0 == cmp;
+    }
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const axis2_char_t *name  = sp_caps_localname(env, child);
+    	axiom_node_t       *value = axiom_node_get_first_child(child, env);
+    	int                 found = 0;
+
+    	if (0 == axutil_strcmp(name, "Sections"))
+    	{
+    		all = 0;
+    		for (; value; value = axiom_node_get_next_sibling(value, env))
+    		{
+    			if (AXIOM_ELEMENT != axiom_node_get_node_type(value, env)) continue;
+    			const axis2_char_t *s = sp_get_text_el(value, env);
+    			int k;
+    			for (k = 0; sp_caps_section_names[k]; k++)
+    			{
+    				if (0 == axutil_strcmp(s, sp_caps_section_names[k])) break;
+    			}
+    			if (NULL == sp_caps_section_names[k]) return -1;
+    			if (0 == strcmp(s, "All")) all = 1;
+    			for (i = 0; doc && i < doc->n; i++)
+    			{
+    				if (0 == strcmp(s, doc->sect[i].name)) sel[i] = 1;
+    			}
+    			found = 1;
+    		}
+    		// An empty Sections is left to the backend.
+    		if (! found) return -1;
+    	}
+    	else if (0 == axutil_strcmp(name, "AcceptVersions"))
+    	{
+    		for (; value; value = axiom_node_get_next_sibling(value, env))
+    		{
+    			if (AXIOM_ELEMENT != axiom_node_get_node_type(value, env)) continue;
+    			found |= NULL == doc ||
+    					0 == axutil_strcmp(sp_get_text_el(value, env), doc->version);
+    		}
+    		if (! found) return -1;
+    	}
+    	else if (0 == axutil_strcmp(name, "AcceptFormats"))
+    	{
+    		for (; value; value = axiom_node_get_next_sibling(value, env))
+    		{
+    			if (AXIOM_ELEMENT != axiom_node_get_node_type(value, env)) continue;
+    			found |= 0 == axutil_strcmp(sp_get_text_el(value, env), "text/xml");
+    		}
+    		if (! found) return -1;
+    	}
+    	else
+    	{
+    		// AcceptLanguages, extensions
+    		return -1;
+    	}
+    }
+
+    for (i = 0; all && doc && i < doc->n; i++) sel[i] = 1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Copy the text of a response out of the document, with sp_caps_lock held.
+ * @param doc
+ * @param sel the sections to include.
+ * @param current non-zero for none at all.
+ * @param len set to the length of the text.
+ * @return the text, to be freed, NULL if out of memory.
+ */
+static char *sp_caps_text(
+    const sp_caps_doc  *doc,
+    const int          *sel,
+    const int           current,
+    size_t             *len_out)
+{
+    size_t len = doc->head_len + (doc->len - doc->tail_off);
+    int    i;
+
+    for (i = 0; ! current && i < doc->n; i++)
+    {
+    	if (sel[i]) len += doc->sect[i].len;
+    }
+
+    char *buf = malloc(len);
+    if (NULL == buf) return NULL;
+
+    char *p = buf;
+    memcpy(p, doc->xml, doc->head_len);
+    p += doc->head_len;
+    for (i = 0; ! current && i < doc->n; i++)
+    {
+    	if (! sel[i]) continue;
+    	memcpy(p, doc->xml + doc->sect[i].off, doc->sect[i].len);
+    	p += doc->sect[i].len;
+    }
+    memcpy(p, doc->xml + doc->tail_off, doc->len - doc->tail_off);
+
+    *len_out = len;
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Build a response from the text of sp_caps_text(), with its validators.
+ * @param env
+ * @param props
+ * @param buf the text, freed.
+ * @param len
+ * @param changed when the document last changed.
+ * @return the response, NULL on error.
+ */
+static axiom_node_t *sp_caps_assemble(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    char               *buf,
+    const size_t        len,
+    const time_t        changed)
+{
+    if (NULL == buf) return NULL;
+
+    char etag[SP_COND_ETAG_LEN];
+    sp_cond_etag(buf, len, etag);
+    sp_cond_answer(env, props, SP_OP_GETCAPABILITIES, etag, changed);
+
+    axiom_node_t *node = NULL;
+    FILE         *fp   = fmemopen(buf, len, "r");
+    if (fp)
+    {
+    	node = rp_process_xml(env, fp, NULL);
+    	fclose(fp);
+    }
+    free(buf);
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+/** Make a document of a rewritten Capabilities response.
+ * @param env
+ * @param resp_node
+ * @param doc filled in, except key and fetched.
+ * @return 0 on success, -1 if it is not a usable document.
+ */
+static int sp_caps_load(
+    const axutil_env_t *env,
+    axiom_node_t       *resp_node,
+    sp_caps_doc        *doc)
+{
+    memset(doc, 0, sizeof(*doc));
+    if (NULL == resp_node ||
+    	AXIOM_ELEMENT != axiom_node_get_node_type(resp_node, env) ||
+    	axutil_strcmp(sp_caps_localname(env, resp_node), "Capabilities"))
+    {
+    	return -1;
+    }
+
+    axiom_element_t    *el  = axiom_node_get_data_element(resp_node, env);
+    const axis2_char_t *ver = axiom_element_get_attribute_value_by_name(
+    		el, env, "version");
+    const axis2_char_t *seq = axiom_element_get_attribute_value_by_name(
+    		el, env, "updateSequence");
+    snprintf(doc->version,    sizeof(doc->version),    "%s", ver ? ver : "");
+    snprintf(doc->update_seq, sizeof(doc->update_seq), "%s", seq ? seq : "");
+
+    axis2_char_t *xml = axiom_node_to_string(resp_node, env);
+    if (NULL == xml) return -1;
+    doc->len = strlen(xml);
+    doc->xml = malloc(doc->len + 1);
+    if (doc->xml) memcpy(doc->xml, xml, doc->len + 1);
+    AXIS2_FREE(env->allocator, xml);
+
+    if (NULL == doc->xml || sp_caps_index(doc))
+    {
+    	free(doc->xml);
+    	doc->xml = NULL;
+    	return -1;
+    }
+    return 0;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if the capabilities are cached.
+ */
+int sp_caps_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return rp_getCapabilitiesCacheSecs(env, props) > 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Answer a GetCapabilities from the cached document.
+ * @param env
+ * @param props
+ * @param node the request.
+ * @param fresh set non-zero if there is a fresh document, whether or not
+ *  it answers the request.
+ * @return the response, NULL if there is no fresh document or the request
+ *  cannot be answered from it, the error is not set then.
+ */
+axiom_node_t *sp_caps_get(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    int                *fresh)
+{
+    const sp_caps_doc *doc  = &sp_caps_curr;
+    char              *text = NULL;
+    size_t             len  = 0;
+    time_t             changed = 0;
+    uint64_t           key[2];
+    int                sel[SP_CAPS_MAX_SECTIONS];
+    int                current;
+    int                fits;
+
+    *fresh = 0;
+    if (! sp_caps_enabled(env, props)) return NULL;
+    sp_caps_key(env, props, key);
+
+    pthread_mutex_lock(&sp_caps_lock);
+    if (NULL == doc->xml || key[0] != doc->key[0] || key[1] != doc->key[1] ||
+    	time(NULL) - doc->fetched >= rp_getCapabilitiesCacheSecs(env, props) ||
+    	doc->fetched <= sp_stats_purged())
+    {
+    	const int had = NULL != doc->xml;
+    	if (had && doc->fetched <= sp_stats_purged())
+    	{
+    		free(sp_caps_curr.xml);
+    		memset(&sp_caps_curr, 0, sizeof(sp_caps_curr));
+    	}
+    	pthread_mutex_unlock(&sp_caps_lock);
+    	if (had) sp_stats_cache("capabilities", 0);
+    	return NULL;
+    }
+    *fresh = 1;
+    fits   = sp_caps_select(env, node, doc, sel, &current);
+    if (0 == fits)
+    {
+    	text    = sp_caps_text(doc, sel, current, &len);
+    	changed = doc->changed;
+    }
+    pthread_mutex_unlock(&sp_caps_lock);
+    if (fits > 0)
+    {
+    	SP_LOG_DEBUG("capabilities: updateSequence newer than the server's");
+    	sp_stats_cache("capabilities", 1);
+    	return sp_caps_invalid_seq(env);
+    }
+    if (fits < 0) return NULL;
+
+    axiom_node_t *resp_node = sp_caps_assemble(env, props, text, len, changed);
+    sp_stats_cache("capabilities", NULL != resp_node);
+    if (resp_node && current) SP_LOG_DEBUG("capabilities current");
+    return resp_node;
+}
+
+//-----------------------------------------------------------------------------
+/** A request for the whole capabilities, to fill the cache with, if the
+ *  request node could be answered from them.
+ * @param env
+ * @param props
+ * @param node the request.
+ * @return the request, to be freed by the caller, NULL if the request is
+ *  to be passed on as it is.
+ */
+axiom_node_t *sp_caps_full_request(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    int current;
+
+    if (! sp_caps_enabled(env, props) ||
+    	0 != sp_caps_select(env, node, NULL, NULL, &current))
+    {
+    	return NULL;
+    }
+
+    axiom_node_t      *req_node = NULL;
+    axiom_namespace_t *wcs_ns   = axiom_namespace_create(
+    		env, "http://www.opengis.net/wcs/2.0", "wcs");
+    axiom_element_t   *el       = axiom_element_create(
+    		env, NULL, "GetCapabilities", wcs_ns, &req_node);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "service", "WCS", NULL), req_node);
+    return req_node;
+}
+
+//-----------------------------------------------------------------------------
+/** Keep the response to sp_caps_full_request(), and answer the request
+ *  from it.
+ * @param env
+ * @param props
+ * @param node the request.
+ * @param resp_node the rewritten response, it is freed if it can be kept.
+ * @return the response to node, resp_node itself if it cannot be kept,
+ *  e.g. because it is an exception; NULL if it was kept but does not
+ *  answer node, e.g. for another version in AcceptVersions: node is to
+ *  be sent to the backend as it is then.  An updateSequence newer than
+ *  that of the document gets the InvalidUpdateSequence exception.
+ */
+axiom_node_t *sp_caps_put(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    axiom_node_t       *resp_node)
+{
+    sp_caps_doc doc;
+
+    if (sp_caps_load(env, resp_node, &doc))
+    {
+    	if (resp_node) SP_LOG_DEBUG("capabilities not cached");
+    	return resp_node;
+    }
+    sp_caps_key(env, props, doc.key);
+    doc.fetched = time(NULL);
+    doc.changed = doc.fetched;
+
+    int    sel[SP_CAPS_MAX_SECTIONS];
+    int    current;
+    char  *text = NULL;
+    size_t len  = 0;
+
+    pthread_mutex_lock(&sp_caps_lock);
+    const sp_caps_doc *old = &sp_caps_curr;
+    if (old->xml && old->len == doc.len &&
+    	old->key[0] == doc.key[0] && old->key[1] == doc.key[1] &&
+    	0 == memcmp(old->xml, doc.xml, doc.len))
+    {
+    	doc.changed = old->changed;
+    }
+    free(sp_caps_curr.xml);
+    sp_caps_curr = doc;
+
+    const int fits = sp_caps_select(env, node, &sp_caps_curr, sel, &current);
+    if (0 == fits) text = sp_caps_text(&sp_caps_curr, sel, current, &len);
+    pthread_mutex_unlock(&sp_caps_lock);
+
+    SP_LOG_DEBUG("capabilities cached, %d sections, %lu bytes",
+    		doc.n, (unsigned long) doc.len);
+    if (fits > 0)
+    {
+    	axiom_node_free_tree(resp_node, env);
+    	return sp_caps_invalid_seq(env);
+    }
+    if (fits < 0)
+    {
+    	SP_LOG_DEBUG("capabilities do not answer the request");
+    	axiom_node_free_tree(resp_node, env);
+    	return NULL;
+    }
+
+    axiom_node_t *answer = sp_caps_assemble(env, props, text, len, doc.changed);
+    if (NULL == answer) return resp_node;
+
+    axiom_node_free_tree(resp_node, env);
+    return answer;
+}
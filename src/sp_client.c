@@ -0,0 +1,658 @@
+/*
+ * Soap Proxy.
+ *
+ * Per-client accounting and rate limits.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_client.c
+ *
+ * Every request is accounted to a client: the user name a security
+ * module such as Rampart authenticated, if ClientUserProperty names the
+ * message context property it is kept in, otherwise the address of the
+ * client, see sp_client_addr().  A wsse:Username no module checked is
+ * not used, since a client could send a new one with every request to
+ * escape its limits and crowd the others out of the table.  Up to
+ * SP_CLIENT_MAX clients are tracked in a shared memory table, the least
+ * recently seen idle one making room for a new one, so that the limits
+ * hold across Apache children.
+ *
+ * Two token buckets are kept per client:
+ *
+ *   requests - ClientRequestRate per second, up to ClientRequestBurst
+ *              in a row.
+ *   bytes    - ClientByteRateKB kilobytes per second read from the
+ *              backend, up to ClientByteBurstMB.  The size of a
+ *              response is only known at the end, so it is charged
+ *              then; a client may run into debt, and its next request
+ *              is refused until the debt is paid off.
+ *
+ * A request over either limit fails at once with
+ * SP_USER_ERR_RATE_LIMITED.  The administrative operations and the
+ * statistics operations are neither limited nor counted.
+ *
+ * Requests which pass are queued for the backend by the scheduler
+ * (sp_sched.c), which takes turns between the clients waiting in a lane
+ * by deficit round robin, see sp_client_current().
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <axutil_property.h>
+#include <axis2_http_header.h>
+
+#include "soap_proxy.h"
+#include "sp_client.h"
+#include "sp_admin.h"
+#include "sp_stats.h"
+#include "sp_log.h"
+
+struct sp_client_entry_struct
+{
+    uint64_t   key;                     // 0 if the entry is unused
+    char       name[SP_CLIENT_NAME_LEN];
+    double     req_tokens;
+    double     byte_tokens;
+    sp_stamp_t refill;                  // time of the last refill
+    time_t     last_seen;
+    int        in_flight;
+    uint64_t   requests;
+    uint64_t   bytes;
+    uint64_t   limited_req;
+    uint64_t   limited_bytes;
+};
+
+typedef struct sp_client_entry_struct sp_client_entry;
+
+struct sp_client_struct
+{
+    volatile int    init_state;   // see sp_setup_shared()
+    pthread_mutex_t mutex;
+    sp_client_entry clients[SP_CLIENT_MAX];
+};
+
+static struct sp_client_struct  sp_client_local;
+static struct sp_client_struct *sp_client = &sp_client_local;
+
+// The client of the request in this thread, see sp_client_admit().
+static __thread int      sp_curr_slot = -1;
+static __thread uint64_t sp_curr_key  = 0;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Set up the mutex, see sp_client_setup().
+ * @param arg the sp_client_struct.
+ */
+static void sp_client_setup_once(void *arg)
+{
+    struct sp_client_struct *c = arg;
+    pthread_mutexattr_t      ma;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&c->mutex, &ma);
+    pthread_mutexattr_destroy(&ma);
+}
+
+//-----------------------------------------------------------------------------
+/** Set up the mutex, once for all processes.
+ * @param c
+ */
+static void sp_client_setup(struct sp_client_struct *c)
+{
+    if (SP_SHARED_READY == c->init_state) return;
+    sp_setup_shared(&c->init_state, sp_client_setup_once, c);
+}
+
+//-----------------------------------------------------------------------------
+static int sp_client_lock(struct sp_client_struct *c)
+{
+    int rc = pthread_mutex_lock(&c->mutex);
+    if (EOWNERDEAD == rc)
+    {
+    	pthread_mutex_consistent(&c->mutex);
+    	rc = 0;
+    }
+    return rc;
+}
+
+//-----------------------------------------------------------------------------
+/** Match an address against one entry of an address list.
+ * @param addr
+ * @param entry an address, or an IPv4 network a.b.c.d/n.
+ * @return non-zero on a match.
+ */
+static int sp_client_addr_match(const char *addr, const char *entry)
+{
+    const char *slash = strchr(entry, '/');
+    if (NULL == slash) return 0 == strcmp(addr, entry);
+
+    char net_str[INET_ADDRSTRLEN];
+    const size_t net_len = slash - entry;
+    const int    bits    = atoi(slash + 1);
+    if (net_len >= sizeof(net_str) || bits < 0 || bits > 32) return 0;
+    memcpy(net_str, entry, net_len);
+    net_str[net_len] = '\0';
+
+    struct in_addr net, a;
+    if (1 != inet_pton(AF_INET, net_str, &net) ||
+    	1 != inet_pton(AF_INET, addr, &a))
+    {
+    	return 0;
+    }
+
+    const uint32_t mask = bits ? htonl(0xffffffffu << (32 - bits)) : 0;
+    return (net.s_addr & mask) == (a.s_addr & mask);
+}
+
+//-----------------------------------------------------------------------------
+/** Copy an address, without the IPv6 prefix of an IPv4 client and
+ *  surrounding blanks.
+ * @param buf SP_CLIENT_ADDR_LEN characters.
+ * @param addr
+ * @param len of addr, it need not be NUL terminated.
+ * @return buf, NULL if addr is not an IPv4 or IPv6 address.
+ */
+static const char *sp_client_addr_norm(char *buf, const char *addr, size_t len)
+{
+    while (len && strchr(" \t", *addr)) addr++, len--;
+    while (len && strchr(" \t", addr[len - 1])) len--;
+    if (len >= SP_CLIENT_ADDR_LEN) return NULL;
+    memcpy(buf, addr, len);
+    buf[len] = '\0';
+
+    // Same client over IPv4 and IPv4-mapped IPv6.
+    if (0 == strncmp(buf, "::ffff:", 7) && strchr(buf, '.'))
+    {
+    	memmove(buf, buf + 7, len - 6);
+    }
+
+    unsigned char a[sizeof(struct in6_addr)];
+    return (1 == inet_pton(AF_INET, buf, a) || 1 == inet_pton(AF_INET6, buf, a)) ?
+    		buf : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Work out who sent the request: the user authenticated by a security
+ *  module, see ClientUserProperty, else the address of the client.
+ * @param env
+ * @param props
+ * @param name buffer of SP_CLIENT_NAME_LEN for the client name.
+ */
+static void sp_client_identify(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    char               *name)
+{
+    axis2_msg_ctx_t   *msg_ctx   = (axis2_msg_ctx_t *) props->msg_ctx;
+    const char        *user_prop = rp_getClientUserProperty(env, props);
+    axutil_property_t *prop      = msg_ctx && user_prop[0] ?
+    		axis2_msg_ctx_get_property(msg_ctx, env, user_prop) : NULL;
+    const char        *user      = prop ?
+    		(const char *) axutil_property_get_value(prop, env) : NULL;
+    char               addr[SP_CLIENT_ADDR_LEN];
+
+    if (user && user[0])
+    {
+    	snprintf(name, SP_CLIENT_NAME_LEN, "user:%s", user);
+
+    	// The name goes into log records and metric labels.
+    	for (char *p = name; *p; p++)
+    	{
+    		if ((unsigned char) *p < ' ' || '"' == *p || '\\' == *p) *p = '_';
+    	}
+    	return;
+    }
+
+    snprintf(name, SP_CLIENT_NAME_LEN, "%s",
+    		sp_client_addr(env, props, addr) ? addr : "unknown");
+}
+
+//-----------------------------------------------------------------------------
+// FNV-1a, never 0.
+static uint64_t sp_client_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++)
+    {
+    	h ^= (unsigned char) *s;
+    	h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+//-----------------------------------------------------------------------------
+/** Find the entry of a client, or make one.  Called with the lock held.
+ * @param c
+ * @param key
+ * @param name
+ * @param now
+ * @param req_burst
+ * @param byte_burst
+ * @return index of the entry.
+ */
+static int sp_client_slot(
+    struct sp_client_struct *c,
+    const uint64_t           key,
+    const char              *name,
+    const sp_stamp_t         now,
+    const double             req_burst,
+    const double             byte_burst)
+{
+    int victim = -1;
+    for (int i = 0; i < SP_CLIENT_MAX; i++)
+    {
+    	const sp_client_entry *ce = &c->clients[i];
+    	if (ce->key == key && 0 == strcmp(ce->name, name)) return i;
+
+    	if (0 == ce->key)
+    	{
+    		if (victim < 0 || c->clients[victim].key) victim = i;
+    	}
+    	else if (ce->in_flight <= 0 && (victim < 0 ||
+    			(c->clients[victim].key &&
+    			 ce->last_seen < c->clients[victim].last_seen)))
+    	{
+    		victim = i;
+    	}
+    }
+
+    // All entries busy: share the one of the hash.
+    if (victim < 0) return (int) (key % SP_CLIENT_MAX);
+
+    sp_client_entry *ce = &c->clients[victim];
+    memset(ce, 0, sizeof(*ce));
+    ce->key         = key;
+    ce->req_tokens  = req_burst;
+    ce->byte_tokens = byte_burst;
+    ce->refill      = now;
+    snprintf(ce->name, SP_CLIENT_NAME_LEN, "%s", name);
+    return victim;
+}
+
+//-----------------------------------------------------------------------------
+// A transport header of the request, by its name in any case.
+static const char *sp_transport_header(
+    const axutil_env_t *env,
+    axutil_hash_t      *headers,
+    const char         *name)
+{
+    axutil_hash_index_t *hi;
+
+    for (hi = axutil_hash_first(headers, env); hi;
+    	 hi = axutil_hash_next(env, hi))
+    {
+    	const void *key = NULL;
+    	void       *val = NULL;
+    	axutil_hash_this(hi, &key, NULL, &val);
+    	if (key && val && 0 == strcasecmp((const char *) key, name))
+    	{
+    		return axis2_http_header_get_value(
+    			(const axis2_http_header_t *) val, env);
+    	}
+    }
+    return NULL;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Is an address in a list such as AdminAllowFrom?
+ * @param addr as from sp_client_addr().
+ * @param list comma separated addresses, or IPv4 networks a.b.c.d/n.
+ * @return non-zero if it is.
+ */
+int sp_client_addr_in(const char *addr, const char *list)
+{
+    char  buf[SP_MAX_MPATHS_LEN];
+    char *save  = NULL;
+    int   found = 0;
+
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *entry = strtok_r(buf, ", \t\n", &save);
+    	 entry && ! found;
+    	 entry = strtok_r(NULL, ", \t\n", &save))
+    {
+    	found = sp_client_addr_match(addr, entry);
+    }
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+/** Did the client send its request as MTOM (or say it accepts MTOM)?
+ *  Axis2 answers such a client with MTOM, any other inline.  If the
+ *  transport does not tell, MTOM is assumed.
+ * @param env
+ * @param props
+ * @return non-zero if the response goes out as MTOM.
+ */
+int sp_client_mtom(
+    const axutil_env_t *env,
+    const sp_props     *props)
+{
+    axis2_msg_ctx_t *msg_ctx = (axis2_msg_ctx_t *) props->msg_ctx;
+    axutil_hash_t   *headers =
+    	msg_ctx ? axis2_msg_ctx_get_transport_headers(msg_ctx, env) : NULL;
+
+    if (NULL == headers) return 1;
+
+    const char *ctype  = sp_transport_header(env, headers, "Content-Type");
+    const char *accept = sp_transport_header(env, headers, "Accept");
+    if (NULL == ctype) return 1;
+
+    return NULL != strstr(ctype, "application/xop+xml") ||
+    		(accept && (strstr(accept, "application/xop+xml") ||
+    		            strstr(accept, "multipart/related")));
+}
+
+//-----------------------------------------------------------------------------
+/** Get an HTTP header of the request.
+ * @param env
+ * @param props
+ * @param name e.g. "If-None-Match", in any case.
+ * @return its value, NULL if the client did not send it.
+ */
+const char *sp_client_header(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *name)
+{
+    axis2_msg_ctx_t *msg_ctx = (axis2_msg_ctx_t *) props->msg_ctx;
+    axutil_hash_t   *headers =
+    	msg_ctx ? axis2_msg_ctx_get_transport_headers(msg_ctx, env) : NULL;
+
+    return headers ? sp_transport_header(env, headers, name) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the address of the client.  That is the peer of the connection,
+ *  unless the peer is one of the TrustedProxies: then X-Forwarded-For is
+ *  followed back from its end, over the trusted proxies listed there,
+ *  to the first address that is not one.  Addresses a client put into
+ *  the header itself come before that, and are not looked at.
+ * @param env
+ * @param props
+ * @param buf SP_CLIENT_ADDR_LEN characters for the address.
+ * @return buf, NULL if the address is not known.
+ */
+const char *sp_client_addr(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    char               *buf)
+{
+    axis2_msg_ctx_t   *msg_ctx = (axis2_msg_ctx_t *) props->msg_ctx;
+    axutil_property_t *prop    = msg_ctx ? axis2_msg_ctx_get_property(
+    		msg_ctx, env, AXIS2_SVR_PEER_IP_ADDR) : NULL;
+    const char        *peer    = prop ?
+    		(const char *) axutil_property_get_value(prop, env) : NULL;
+    const char        *proxies = rp_getTrustedProxies(env, props);
+
+    if (NULL == peer || NULL == sp_client_addr_norm(buf, peer, strlen(peer)))
+    {
+    	return NULL;
+    }
+    if ('\0' == proxies[0] || ! sp_client_addr_in(buf, proxies)) return buf;
+
+    const char *xff = sp_client_header(env, props, "X-Forwarded-For");
+    size_t      end = xff ? strlen(xff) : 0;
+    while (end > 0)
+    {
+    	size_t start = end;
+    	while (start > 0 && ',' != xff[start - 1]) start--;
+
+    	char hop[SP_CLIENT_ADDR_LEN];
+    	if (NULL == sp_client_addr_norm(hop, xff + start, end - start)) break;
+    	strcpy(buf, hop);
+    	if (! sp_client_addr_in(buf, proxies)) break;
+    	end = start ? start - 1 : 0;
+    }
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Called once per process from rpSvc_init.
+ * @param env
+ */
+void sp_client_init(const axutil_env_t *env)
+{
+    if (sp_client == &sp_client_local)
+    {
+    	struct sp_client_struct *shared =
+    			sp_map_shared(env, "clients", sizeof(struct sp_client_struct));
+    	if (shared) sp_client = shared;
+    }
+
+    sp_client_setup(sp_client);
+}
+
+//-----------------------------------------------------------------------------
+/** Account a new request to its client, and check the client's limits.
+ * The client becomes the current one of this thread until sp_client_end().
+ * @param env
+ * @param props
+ * @param op_name
+ * @return 0 if the request may go ahead, non-zero (and the error set)
+ *         if the client is over one of its limits.
+ */
+int sp_client_admit(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const axis2_char_t *op_name)
+{
+    struct sp_client_struct *c = sp_client;
+    const int op = sp_stats_op_id(op_name);
+
+    sp_curr_slot = -1;
+    sp_curr_key  = 0;
+    if (sp_admin_op(op_name) ||
+    	SP_OP_GETPROXYSTATS == op || SP_OP_GETPROXYMETRICS == op)
+    {
+    	return 0;
+    }
+
+    char name[SP_CLIENT_NAME_LEN];
+    sp_client_identify(env, props, name);
+    const uint64_t key = sp_client_hash(name);
+
+    const double req_rate   = rp_getClientRequestRate(env, props);
+    const double req_burst  = rp_getClientRequestBurst(env, props) > 0 ?
+    		rp_getClientRequestBurst(env, props) : 1;
+    const double byte_rate  = rp_getClientByteRateKB(env, props) * 1024.0;
+    const double byte_burst = rp_getClientByteBurstMB(env, props) * 1048576.0;
+    const sp_stamp_t now    = sp_stats_now();
+
+    sp_client_setup(c);
+    if (sp_client_lock(c))
+    {
+    	SP_LOG_ERROR("client table lock failed, request not accounted");
+    	return 0;
+    }
+
+    const int        slot = sp_client_slot(c, key, name, now,
+    		req_burst, byte_burst);
+    sp_client_entry *ce   = &c->clients[slot];
+    const double     secs = (double) (now - ce->refill) / 1e9;
+
+    ce->refill    = now;
+    ce->last_seen = time(NULL);
+    ce->req_tokens += secs * req_rate;
+    if (ce->req_tokens > req_burst) ce->req_tokens = req_burst;
+    ce->byte_tokens += secs * byte_rate;
+    if (ce->byte_tokens > byte_burst || byte_rate <= 0)
+    {
+    	// No debt is carried over from before the limit was set.
+    	ce->byte_tokens = byte_burst;
+    }
+
+    int limited = 0;
+    if (req_rate > 0 && ce->req_tokens < 1.0)
+    {
+    	ce->limited_req++;
+    	limited = 1;
+    }
+    else if (byte_rate > 0 && ce->byte_tokens <= 0)
+    {
+    	ce->limited_bytes++;
+    	limited = 2;
+    }
+    else
+    {
+    	if (req_rate > 0) ce->req_tokens -= 1.0;
+    	ce->requests++;
+    	ce->in_flight++;
+    	sp_curr_slot = slot;
+    	sp_curr_key  = key;
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    if (limited)
+    {
+    	SP_ERROR(env, SP_USER_ERR_RATE_LIMITED);
+    	SP_LOG_WARNING("%s refused for %s: %s limit", op_name ? op_name : "",
+    			name, 1 == limited ? "request rate" : "byte rate");
+    	return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Finish the request of the current client of this thread.
+ * @param bytes read from the backend for the request.
+ */
+void sp_client_end(const uint64_t bytes)
+{
+    struct sp_client_struct *c = sp_client;
+    const int slot = sp_curr_slot;
+
+    sp_client_charge(bytes);
+
+    sp_curr_slot = -1;
+    sp_curr_key  = 0;
+    if (slot < 0 || sp_client_lock(c)) return;
+
+    sp_client_entry *ce = &c->clients[slot];
+    if (ce->in_flight > 0) ce->in_flight--;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+//-----------------------------------------------------------------------------
+/** Charge bytes read from the backend to the current client of this thread,
+ *  without finishing its request.  Used by asynchronous jobs, which run on
+ *  after the request which started them has ended.
+ * @param bytes
+ */
+void sp_client_charge(const uint64_t bytes)
+{
+    struct sp_client_struct *c = sp_client;
+    const int slot = sp_curr_slot;
+
+    if (slot < 0 || 0 == bytes || sp_client_lock(c)) return;
+
+    sp_client_entry *ce = &c->clients[slot];
+    if (ce->key == sp_curr_key)
+    {
+    	ce->bytes       += bytes;
+    	ce->byte_tokens -= (double) bytes;
+    }
+    pthread_mutex_unlock(&c->mutex);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return a key identifying the client of the request in this thread,
+ *         0 if none.
+ */
+uint64_t sp_client_current(void)
+{
+    return sp_curr_key;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the name of the client of the request in this thread, "" if none.
+ *         Only valid while the request is in progress.
+ */
+const char *sp_client_name(void)
+{
+    return sp_curr_slot >= 0 ? sp_client->clients[sp_curr_slot].name : "";
+}
+
+//-----------------------------------------------------------------------------
+/** Print the per-client counters in the Prometheus text format,
+ *  see rp_getProxyMetrics().
+ * @param fp
+ */
+void sp_client_metrics(FILE *fp)
+{
+    const struct sp_client_struct *c = sp_client;
+    int i;
+
+    fprintf(fp,
+    		"# HELP soap_proxy_client_requests_total Requests admitted, by client.\n"
+    		"# TYPE soap_proxy_client_requests_total counter\n");
+    for (i = 0; i < SP_CLIENT_MAX; i++)
+    {
+    	if (0 == c->clients[i].key) continue;
+    	fprintf(fp, "soap_proxy_client_requests_total{client=\"%s\"} %llu\n",
+    			c->clients[i].name,
+    			(unsigned long long) c->clients[i].requests);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_client_bytes_total Bytes read from the backend, by client.\n"
+    		"# TYPE soap_proxy_client_bytes_total counter\n");
+    for (i = 0; i < SP_CLIENT_MAX; i++)
+    {
+    	if (0 == c->clients[i].key) continue;
+    	fprintf(fp, "soap_proxy_client_bytes_total{client=\"%s\"} %llu\n",
+    			c->clients[i].name,
+    			(unsigned long long) c->clients[i].bytes);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_client_limited_total Requests refused by the client limits.\n"
+    		"# TYPE soap_proxy_client_limited_total counter\n");
+    for (i = 0; i < SP_CLIENT_MAX; i++)
+    {
+    	const sp_client_entry *ce = &c->clients[i];
+    	if (0 == ce->key || 0 == ce->limited_req + ce->limited_bytes) continue;
+    	fprintf(fp, "soap_proxy_client_limited_total{client=\"%s\",limit=\"requests\"} %llu\n"
+    			"soap_proxy_client_limited_total{client=\"%s\",limit=\"bytes\"} %llu\n",
+    			ce->name, (unsigned long long) ce->limited_req,
+    			ce->name, (unsigned long long) ce->limited_bytes);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Soap Proxy - per-client accounting header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_client.h
+ *
+ */
+
+#ifndef SPCLIENT_H_INCLUDED
+#define SPCLIENT_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+#define SP_CLIENT_MAX      256
+#define SP_CLIENT_NAME_LEN 64
+#define SP_CLIENT_ADDR_LEN 48
+
+int         sp_client_addr_in(const char *addr, const char *list);
+const char *sp_client_addr   (const axutil_env_t *env,
+                              const sp_props     *props,
+                              char               *buf);
+int         sp_client_mtom   (const axutil_env_t *env,
+                              const sp_props     *props);
+const char *sp_client_header (const axutil_env_t *env,
+                              const sp_props     *props,
+                              const char         *name);
+void        sp_client_init   (const axutil_env_t *env);
+int         sp_client_admit  (const axutil_env_t *env,
+                              const sp_props     *props,
+                              const axis2_char_t *op_name);
+void        sp_client_end    (const uint64_t bytes);
+void        sp_client_charge (const uint64_t bytes);
+uint64_t    sp_client_current(void);
+const char *sp_client_name   (void);
+void        sp_client_metrics(FILE *fp);
+
+#endif
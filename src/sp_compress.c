@@ -0,0 +1,336 @@
+/*
+ * Soap Proxy.
+ *
+ * Deflate compression of TIFF coverages.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_compress.c
+ *
+ * Mapserver writes GeoTIFF coverages uncompressed, and the attachment
+ * goes out as it is: Axis2 sends MTOM parts with no content coding, and
+ * httpd compressing the whole multipart response would have to hold it
+ * back until it is deflated.  Elevation models and other raster data
+ * often deflate to half their size or less, which counts more than the
+ * CPU time for clients on slow links.
+ *
+ * So if CompressLevel is set, an uncompressed TIFF coverage of at least
+ * CompressMinKB kilobytes is rewritten as a TIFF with Deflate compression
+ * (Compression 8), at zlib level CompressLevel.  The image is cut into
+ * strips of about SP_COMPRESS_STRIP_LEN bytes, which are compressed
+ * independently by up to CompressThreads threads.  The tags are kept,
+ * save those for the strips, see sp_tiff_write().
+ *
+ * This is not an HTTP content coding: the attachment is still image/tiff,
+ * and every client gets the compressed TIFF, whatever its Accept-Encoding
+ * (which nearly all clients send anyway).  The clients must read
+ * compressed TIFFs, as GDAL, libtiff and the like do, so it is a choice
+ * made for the service, off by default.
+ *
+ * A TIFF that is already compressed, tiled or otherwise not understood by
+ * sp_tiff_open() is sent unchanged, as is one that does not get smaller.
+ *
+ * A GetCoverage response is compressed before it goes into the coverage
+ * cache, which keys it by CompressLevel and CompressMinKB, so that a
+ * cache hit is sent as it is, see sp_cache_coverage_key().
+ *
+ * The XML of responses is left to mod_deflate, see soap_proxy_httpd.conf.
+ *
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "soap_proxy.h"
+#include "sp_compress.h"
+#include "sp_cache.h"
+#include "sp_log.h"
+#include "sp_tiff.h"
+
+#define SP_COMPRESS_STRIP_LEN (256 * 1024)
+#define SP_COMPRESS_THREADS   16
+
+//
+// A compressed strip.
+//
+struct sp_zstrip_struct
+{
+    unsigned char *out;       // malloc()ed, NULL if not compressed (yet)
+    uLongf         out_len;
+};
+
+typedef struct sp_zstrip_struct sp_zstrip;
+
+//
+// The work shared by the threads compressing one coverage.
+//
+struct sp_zwork_struct
+{
+    const sp_tiff *t;
+    const unsigned char *pix;       // the rows, contiguous
+    uint32_t       rows;            // per output strip
+    uint32_t       n_strips;
+    int            level;
+    sp_zstrip     *strips;
+    volatile uint32_t next;         // the next strip to take
+    volatile int   failed;
+};
+
+typedef struct sp_zwork_struct sp_zwork;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Compress strips until there are none left.
+ * @param arg the sp_zwork.
+ * @return NULL.
+ */
+static void *sp_compress_worker(void *arg)
+{
+    sp_zwork *w = (sp_zwork *) arg;
+    uint32_t  s;
+
+    while (! w->failed &&
+    	(s = __sync_fetch_and_add(&w->next, 1)) < w->n_strips)
+    {
+    	const uint32_t first = s * w->rows;
+    	const uint32_t n     = w->t->height - first < w->rows ?
+    			w->t->height - first : w->rows;
+    	const uLong    len   = (uLong) n * w->t->row_len;
+    	sp_zstrip     *z     = &w->strips[s];
+
+    	z->out_len = compressBound(len);
+    	z->out     = malloc(z->out_len);
+    	if (NULL == z->out ||
+    		Z_OK != compress2(z->out, &z->out_len,
+    				w->pix + (size_t) first * w->t->row_len, len, w->level))
+    	{
+    		w->failed = 1;
+    	}
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Find where the rows of an uncompressed TIFF are, if they are one block
+ *  in order, as mapserver writes them.
+ * @param t
+ * @return the first row, NULL if the strips are scattered.
+ */
+static const unsigned char *sp_compress_rows(const sp_tiff *t)
+{
+    const long long off0 = sp_tiff_get(t, SP_TIFF_OFFSETS, 0, -1);
+    uint32_t        s;
+
+    if (off0 < 0 || (uint64_t) off0 + (uint64_t) t->height * t->row_len > t->len)
+    {
+    	return NULL;
+    }
+    for (s = 1; s < t->n_strips; s++)
+    {
+    	if (sp_tiff_get(t, SP_TIFF_OFFSETS, s, -1) !=
+    		off0 + (long long) s * t->rows * t->row_len)
+    	{
+    		return NULL;
+    	}
+    }
+    return t->p + off0;
+}
+
+//-----------------------------------------------------------------------------
+/** Compress a TIFF.
+ * @param env
+ * @param props
+ * @param t the uncompressed TIFF.
+ * @param len set to the length of the result.
+ * @return the compressed TIFF, to be freed with AXIS2_FREE, NULL if it
+ *  cannot be compressed or does not get smaller.
+ */
+static unsigned char *sp_compress_tiff(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const sp_tiff      *t,
+    size_t             *len)
+{
+    const unsigned char *pix = sp_compress_rows(t);
+    if (NULL == pix) return NULL;
+
+    sp_zwork w;
+    memset(&w, 0, sizeof(w));
+    w.t        = t;
+    w.pix      = pix;
+    w.rows     = t->row_len < SP_COMPRESS_STRIP_LEN ?
+    		SP_COMPRESS_STRIP_LEN / t->row_len : 1;
+    w.n_strips = (t->height + w.rows - 1) / w.rows;
+    w.level    = rp_getCompressLevel(env, props);
+    if (w.n_strips > INT_MAX / 8) return NULL;
+    w.strips   = calloc(w.n_strips, sizeof(sp_zstrip));
+    if (NULL == w.strips) return NULL;
+
+    // This thread is one of the workers.
+    pthread_t threads[SP_COMPRESS_THREADS];
+    int       n_threads = rp_getCompressThreads(env, props);
+    int       i;
+    if (n_threads > SP_COMPRESS_THREADS) n_threads = SP_COMPRESS_THREADS;
+    if (n_threads > w.n_strips)          n_threads = w.n_strips;
+    for (i = 1; i < n_threads; i++)
+    {
+    	if (pthread_create(&threads[i], NULL, sp_compress_worker, &w)) break;
+    }
+    n_threads = i;
+    sp_compress_worker(&w);
+    for (i = 1; i < n_threads; i++) pthread_join(threads[i], NULL);
+
+    // Compression, strip offsets, rows per strip and strip byte counts.
+    const int      be     = t->be;
+    uint64_t       z_len  = 0;
+    uint32_t       s;
+    unsigned char *vals   = w.failed ? NULL :
+    		AXIS2_MALLOC(env->allocator, 8 + 8 * w.n_strips);
+    unsigned char *buf    = NULL;
+    const char    *why    = NULL;
+
+    if (vals)
+    {
+    	sp_tiff_put16(be, vals,     SP_TIFF_DEFLATE);
+    	sp_tiff_put32(be, vals + 4, w.rows);
+    	for (s = 0; s < w.n_strips; s++)
+    	{
+    		sp_tiff_put32(be, vals + 8 + 4 * s, 8 + z_len);
+    		sp_tiff_put32(be, vals + 8 + 4 * (w.n_strips + s), w.strips[s].out_len);
+    		z_len += w.strips[s].out_len;
+    	}
+    }
+    if (vals && z_len + 8 * w.n_strips < t->len)
+    {
+    	const sp_tiff_entry added[4] = {
+    		{SP_TIFF_COMPRESSION, SP_TIFF_SHORT, 1,  vals,         2},
+    		{SP_TIFF_OFFSETS, SP_TIFF_LONG, w.n_strips, vals + 8,  4 * w.n_strips},
+    		{SP_TIFF_ROWS,    SP_TIFF_LONG, 1,          vals + 4,  4},
+    		{SP_TIFF_COUNTS,  SP_TIFF_LONG, w.n_strips,
+    				vals + 8 + 4 * w.n_strips, 4 * w.n_strips}
+    	};
+    	buf = sp_tiff_write(env, t, added, 4, z_len, len, &why);
+    	if (why) SP_LOG_DEBUG("coverage not compressed: %s", why);
+    }
+
+    unsigned char *dst = buf ? buf + 8 : NULL;
+    for (s = 0; s < w.n_strips; s++)
+    {
+    	if (dst)
+    	{
+    		memcpy(dst, w.strips[s].out, w.strips[s].out_len);
+    		dst += w.strips[s].out_len;
+    	}
+    	free(w.strips[s].out);
+    }
+    free(w.strips);
+    if (vals) AXIS2_FREE(env->allocator, vals);
+
+    return buf;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/** Replace an uncompressed TIFF coverage with a Deflate compressed one, if
+ *  CompressLevel is set and it is worth it.
+ * @param env
+ * @param props
+ * @param resp_node the response, e.g. of GetCoverage.
+ * @return 1 if the coverage was compressed, else 0.
+ */
+int sp_compress_coverage(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *resp_node)
+{
+    if (rp_getCompressLevel(env, props) <= 0) return 0;
+
+    axiom_data_handler_t *dh = sp_cache_coverage_dh(env, resp_node);
+    const char *ctype = dh ? axiom_data_handler_get_content_type(dh, env) : NULL;
+    if (NULL == ctype || strncasecmp(ctype, "image/tiff", 10)) return 0;
+
+    // A coverage from the cache is a file, see sp_cache_get_coverage().
+    const char          *fname = axiom_data_handler_get_file_name(dh, env);
+    const unsigned char *data  = NULL;
+    size_t               len   = 0;
+    void                *map   = MAP_FAILED;
+    if (fname)
+    {
+    	struct stat st;
+    	int fd = open(fname, O_RDONLY);
+    	if (fd < 0) return 0;
+    	if (0 == fstat(fd, &st) && st.st_size > 0)
+    	{
+    		len = st.st_size;
+    		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    	}
+    	close(fd);
+    	if (MAP_FAILED == map) return 0;
+    	data = map;
+    }
+    else
+    {
+    	data = (const unsigned char *) axiom_data_handler_get_input_stream(dh, env);
+    	len  = axiom_data_handler_get_input_stream_len(dh, env);
+    }
+
+    unsigned char *buf   = NULL;
+    size_t         z_len = 0;
+    sp_tiff        t;
+    if (data && len >= (size_t) rp_getCompressMinKB(env, props) * 1024 &&
+    	NULL == sp_tiff_open(&t, data, len))
+    {
+    	buf = sp_compress_tiff(env, props, &t, &z_len);
+    }
+    if (MAP_FAILED != map) munmap(map, len);
+    if (NULL == buf) return 0;
+
+    SP_LOG_DEBUG("coverage of %lu bytes compressed to %lu",
+    		(unsigned long) len, (unsigned long) z_len);
+
+    // The new data handler frees buf, and the old one its data.
+    axiom_node_t         *t_node = axiom_node_get_first_child(resp_node, env);
+    axiom_node_t         *z_node = NULL;
+    axiom_data_handler_t *z_dh   = axiom_data_handler_create(env, NULL, ctype);
+    axiom_data_handler_set_binary_data(z_dh, env, (axis2_byte_t *) buf, z_len);
+    axiom_node_detach(t_node, env);
+    axiom_text_t *z_text =
+    		axiom_text_create_with_data_handler(env, resp_node, z_dh, &z_node);
+    axiom_text_set_optimize(z_text, env, AXIS2_TRUE);
+    axiom_node_free_tree(t_node, env);
+
+    return 1;
+}
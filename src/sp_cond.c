@@ -0,0 +1,202 @@
+/*
+ * Soap Proxy.
+ *
+ * Conditional requests: ETag, Last-Modified and 304 Not Modified.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_cond.c
+ *
+ * Clients poll GetCapabilities and DescribeCoverage to find out whether
+ * the catalogue changed, and fetch the whole document each time.  A
+ * response put together from the caches, see sp_caps.c and
+ * sp_describe.c, therefore carries a strong validator:
+ *
+ *  - ETag, a hash of the response as sent, see sp_cond_etag(),
+ *  - Last-Modified, for the capabilities, the time the cached document
+ *    last came back different from the backend.
+ *
+ * A request with If-None-Match listing that ETag, or without
+ * If-None-Match and with an If-Modified-Since not before Last-Modified,
+ * is answered with 304 Not Modified and no content.  Only responses put
+ * together from the caches are validated, mostly without asking the
+ * backend at all; one passed on from the backend as it is goes out as
+ * before, without validators.
+ *
+ * The status and headers are set on the outgoing message context, which
+ * the HTTP transport takes them from; the operation context has it by the
+ * time the service is invoked.  The response is still built, so that a
+ * transport ignoring them sends the document as it would have without.
+ *
+ * Neither is done for a Capabilities or DescribeCoverage made on the way
+ * to another response, e.g. an item of a Batch.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <axis2_http_header.h>
+#include <axis2_op_ctx.h>
+
+#include "soap_proxy.h"
+#include "sp_cond.h"
+#include "sp_canon.h"
+#include "sp_client.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_COND_DATE_FMT  "%a, %d %b %Y %H:%M:%S GMT"
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Does an If-None-Match list an ETag?  W/ is ignored, as the weak
+ *  comparison of RFC 7232 has it.
+ * @param list the header value.
+ * @param etag quoted.
+ * @return non-zero if it does, or the list is "*".
+ */
+static int sp_cond_match(const char *list, const char *etag)
+{
+    const size_t len = strlen(etag);
+
+    while (*list)
+    {
+    	list += strspn(list, " \t,");
+    	if ('*' == *list) return 1;
+    	if (0 == strncmp(list, "W/", 2)) list += 2;
+
+    	const size_t n = strcspn(list, " \t,");
+    	if (n == len && 0 == strncmp(list, etag, len)) return 1;
+    	list += n;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Is a date no earlier than the time of the last change?
+ * @param date an HTTP date, only the preferred format is understood.
+ * @param modified
+ * @return non-zero if it is.
+ */
+static int sp_cond_since(const char *date, const time_t modified)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, SP_COND_DATE_FMT, &tm);
+    return end && '\0' == end[strspn(end, " \t")] && modified <= timegm(&tm);
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/** Make the ETag of a response.
+ * @param data the response, serialised.
+ * @param len
+ * @param etag room for SP_COND_ETAG_LEN characters.
+ */
+void sp_cond_etag(const char *data, const size_t len, char *etag)
+{
+    uint64_t h[2];
+
+    sp_murmur3_128(data, len, 0, h);
+    snprintf(etag, SP_COND_ETAG_LEN, "\"%016llx%016llx\"",
+    		(unsigned long long) h[0], (unsigned long long) h[1]);
+}
+
+//-----------------------------------------------------------------------------
+/** Set the validators of a response, and answer 304 Not Modified if the
+ *  client's copy is current.
+ * @param env
+ * @param props
+ * @param op the operation answered, e.g. SP_OP_GETCAPABILITIES; nothing is
+ *  done unless it is the one of the request.
+ * @param etag from sp_cond_etag().
+ * @param modified time of the last change, 0 if not known.
+ * @return non-zero if 304 is answered.
+ */
+int sp_cond_answer(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const int           op,
+    const char         *etag,
+    const time_t        modified)
+{
+    axis2_msg_ctx_t    *in_ctx  = (axis2_msg_ctx_t *) props->msg_ctx;
+    axis2_op_ctx_t     *op_ctx  = in_ctx ?
+    		axis2_msg_ctx_get_op_ctx(in_ctx, env) : NULL;
+    axis2_msg_ctx_t    *msg_ctx = op_ctx ? axis2_op_ctx_get_msg_ctx(
+    		op_ctx, env, AXIS2_WSDL_MESSAGE_LABEL_OUT) : NULL;
+    const sp_req_stats *rs      = sp_stats_current();
+
+    if (NULL == msg_ctx || NULL == rs || rs->op != op) return 0;
+
+    axutil_array_list_t *headers = axutil_array_list_create(env, 2);
+    if (NULL == headers) return 0;
+    axutil_array_list_add(headers, env,
+    		axis2_http_header_create(env, "ETag", etag));
+
+    char date[40] = "";
+    struct tm tm;
+    if (modified > 0 && gmtime_r(&modified, &tm))
+    {
+    	strftime(date, sizeof(date), SP_COND_DATE_FMT, &tm);
+    	axutil_array_list_add(headers, env,
+    			axis2_http_header_create(env, "Last-Modified", date));
+    }
+    axis2_msg_ctx_set_http_output_headers(msg_ctx, env, headers);
+
+    const char *inm = sp_client_header(env, props, "If-None-Match");
+    const char *ims = sp_client_header(env, props, "If-Modified-Since");
+    int         current;
+    if (inm)
+    {
+    	current = sp_cond_match(inm, etag);
+    }
+    else if (ims && date[0])
+    {
+    	current = sp_cond_since(ims, modified);
+    }
+    else
+    {
+    	return 0;
+    }
+    sp_stats_cache("conditional", current);
+    if (! current) return 0;
+
+    axis2_msg_ctx_set_status_code(msg_ctx, env, 304);
+    axis2_msg_ctx_set_no_content(msg_ctx, env, AXIS2_TRUE);
+    SP_LOG_DEBUG("%s not modified, %s", sp_stats_op_name(op), etag);
+    return 1;
+}
@@ -63,6 +63,12 @@
 
 #define SP_IMG_BUF_SIZE 4096
 
+/**
+ * max. buffer allocated ahead for a coverage of a known size, it grows
+ * from there as needed
+ */
+#define SP_IMG_PREALLOC_MAX (64 * 1024 * 1024)
+
 #define SP_MAX_LOCAL_STR_LEN 512
 
 #define MAPSERV_ID_STR "mapserv"
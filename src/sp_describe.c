@@ -0,0 +1,401 @@
+/*
+ * Soap Proxy.
+ *
+ * DescribeCoverage assembled from cached descriptions.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_describe.c
+ *
+ * A DescribeCoverage usually lists several CoverageIds, and clients such
+ * as catalogue browsers ask for overlapping but rarely identical sets.
+ * With the coverage cache configured (CoverageCacheDir), the
+ * CoverageDescription of each coverage is therefore kept on its own, see
+ * sp_cache_put_description().  A request is then answered by
+ *
+ *  - taking the descriptions of the CoverageIds found in the cache,
+ *  - asking the backend, in one DescribeCoverage, for the others only,
+ *    and keeping their descriptions,
+ *  - putting the descriptions together in the order of the request.
+ *
+ * A description is kept as a small document: the start tag of the
+ * CoverageDescriptions it came with, which declares the namespaces, the
+ * CoverageDescription and the end tag.  The response is put together as
+ * text, so this is only done if all the pieces have the same start tag;
+ * otherwise, or if the backend answers with an exception or without some
+ * of the coverages, the request is passed on as it is.
+ *
+ * Requests with anything but CoverageIds, e.g. extensions, go straight to
+ * the backend.
+ *
+ * A response put together carries an ETag, see sp_cond.c.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "soap_proxy.h"
+#include "sp_describe.h"
+#include "sp_cache.h"
+#include "sp_cond.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_DESCRIBE_MAX_IDS 256
+
+//
+// A CoverageId of the request.
+//
+struct sp_describe_item_struct
+{
+    const axis2_char_t *id;
+    char               *doc;     // malloc()ed, NULL if not known yet
+    size_t              len;
+    size_t              head_len;
+    sp_xml_range        desc;
+    size_t              tail_off;
+};
+
+typedef struct sp_describe_item_struct sp_describe_item;
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_describe_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Collect the CoverageIds of a request.
+ * @return the number of ids, -1 if the request has anything else.
+ */
+static int sp_describe_ids(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_describe_item   *items)
+{
+    axiom_node_t *child = axiom_node_get_first_child(node, env);
+    int           n     = 0;
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+    	if (axutil_strcmp(sp_describe_localname(env, child), "CoverageId") ||
+    		n >= SP_DESCRIBE_MAX_IDS)
+    	{
+    		return -1;
+    	}
+    	const axis2_char_t *id = sp_get_text_el(child, env);
+    	if (NULL == id || '\0' == *id) return -1;
+
+    	memset(&items[n], 0, sizeof(sp_describe_item));
+    	items[n++].id = id;
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+/** Find the pieces of a kept description.
+ * @return 0 on success, -1 if it is not a single description.
+ */
+static int sp_describe_index(sp_describe_item *item)
+{
+    int n = 0;
+    return sp_xml_children(item->doc, item->len, &item->head_len,
+    		&item->tail_off, &item->desc, 1, &n) || 1 != n ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** A DescribeCoverage for the CoverageIds not found in the cache.
+ * @return the request, to be freed by the caller.
+ */
+static axiom_node_t *sp_describe_reduced(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_describe_item   *items,
+    const int           n)
+{
+    axiom_element_t    *req_el  = axiom_node_get_data_element(node, env);
+    const axis2_char_t *version = axiom_element_get_attribute_value_by_name(
+    		req_el, env, "version");
+
+    axiom_node_t      *red_node = NULL;
+    axiom_namespace_t *wcs_ns   = axiom_namespace_create(
+    		env, "http://www.opengis.net/wcs/2.0", "wcs");
+    axiom_element_t   *red_el   = axiom_element_create(
+    		env, NULL, "DescribeCoverage", wcs_ns, &red_node);
+    axiom_element_add_attribute(red_el, env,
+    		axiom_attribute_create(env, "service", "WCS", NULL), red_node);
+    axiom_element_add_attribute(red_el, env,
+    		axiom_attribute_create(env, "version", version ? version : "2.0.1",
+    				NULL), red_node);
+
+    int i, k;
+    for (i = 0; i < n; i++)
+    {
+    	if (items[i].doc) continue;
+    	// Each id once only.
+    	for (k = 0; k < i; k++)
+    	{
+    		if (NULL == items[k].doc && 0 == strcmp(items[k].id, items[i].id))
+    			break;
+    	}
+    	if (k < i) continue;
+
+    	axiom_node_t    *id_node = NULL;
+    	axiom_element_t *id_el   = axiom_element_create(
+    			env, red_node, "CoverageId", wcs_ns, &id_node);
+    	axiom_element_set_text(id_el, env, items[i].id, id_node);
+    }
+    return red_node;
+}
+
+//-----------------------------------------------------------------------------
+/** Keep the descriptions of a backend response, and hand them to the
+ *  items still missing theirs.
+ * @return 0 if the response is a CoverageDescriptions that could be
+ *  taken apart, -1 otherwise.
+ */
+static int sp_describe_store(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *resp_node,
+    sp_describe_item   *items,
+    const int           n)
+{
+    if (NULL == resp_node ||
+    	AXIOM_ELEMENT != axiom_node_get_node_type(resp_node, env) ||
+    	axutil_strcmp(sp_describe_localname(env, resp_node),
+    			"CoverageDescriptions"))
+    {
+    	return -1;
+    }
+
+    axis2_char_t *xml = axiom_node_to_string(resp_node, env);
+    if (NULL == xml) return -1;
+
+    const size_t  len = strlen(xml);
+    sp_xml_range  range[SP_DESCRIBE_MAX_IDS];
+    size_t        head_len;
+    size_t        tail_off;
+    int           nr;
+    int           status = -1;
+
+    if (0 == sp_xml_children(xml, len, &head_len, &tail_off,
+    		range, SP_DESCRIBE_MAX_IDS, &nr))
+    {
+    	axiom_node_t *child = axiom_node_get_first_child(resp_node, env);
+    	int           k     = 0;
+
+    	status = 0;
+    	for (; child && k < nr; child = axiom_node_get_next_sibling(child, env))
+    	{
+    		if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    		const axis2_char_t *id = sp_get_text_el(
+    				rp_find_named_child(env, child, "CoverageId", 0), env);
+    		const size_t doc_len = head_len + range[k].len + (len - tail_off);
+    		char        *doc     = id ? malloc(doc_len + 1) : NULL;
+    		if (NULL == doc)
+    		{
+    			status = -1;
+    			break;
+    		}
+    		memcpy(doc, xml, head_len);
+    		memcpy(doc + head_len, xml + range[k].off, range[k].len);
+    		memcpy(doc + head_len + range[k].len, xml + tail_off, len - tail_off);
+    		doc[doc_len] = '\0';
+    		k++;
+
+    		sp_cache_key key;
+    		sp_cache_description_key(env, props, id, &key);
+    		sp_cache_put_description(env, props, &key, id, doc, doc_len);
+
+    		int i;
+    		for (i = 0; i < n; i++)
+    		{
+    			if (items[i].doc || strcmp(items[i].id, id)) continue;
+    			items[i].doc = malloc(doc_len + 1);
+    			if (NULL == items[i].doc) continue;
+    			memcpy(items[i].doc, doc, doc_len + 1);
+    			items[i].len = doc_len;
+    			sp_describe_index(&items[i]);
+    		}
+    		free(doc);
+    	}
+    	if (child && k < nr) status = -1;
+    }
+
+    AXIS2_FREE(env->allocator, xml);
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+/** Put the descriptions together, and set the ETag of the response.
+ * @return the CoverageDescriptions, NULL if the pieces do not fit.
+ */
+static axiom_node_t *sp_describe_assemble(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_describe_item   *items,
+    const int           n)
+{
+    const sp_describe_item *first = &items[0];
+    size_t                  len;
+    int                     i;
+
+    len = first->head_len + (first->len - first->tail_off);
+    for (i = 0; i < n; i++)
+    {
+    	if (NULL == items[i].doc ||
+    		items[i].head_len != first->head_len ||
+    		memcmp(items[i].doc, first->doc, first->head_len))
+    	{
+    		return NULL;
+    	}
+    	len += items[i].desc.len;
+    }
+
+    char *buf = malloc(len);
+    if (NULL == buf) return NULL;
+
+    char *p = buf;
+    memcpy(p, first->doc, first->head_len);
+    p += first->head_len;
+    for (i = 0; i < n; i++)
+    {
+    	memcpy(p, items[i].doc + items[i].desc.off, items[i].desc.len);
+    	p += items[i].desc.len;
+    }
+    memcpy(p, first->doc + first->tail_off, first->len - first->tail_off);
+
+    char etag[SP_COND_ETAG_LEN];
+    sp_cond_etag(buf, len, etag);
+    sp_cond_answer(env, props, SP_OP_DESCRIBECOVERAGE, etag, 0);
+
+    axiom_node_t *node = NULL;
+    FILE         *fp   = fmemopen(buf, len, "r");
+    if (fp)
+    {
+    	node = rp_process_xml(env, fp, NULL);
+    	fclose(fp);
+    }
+    free(buf);
+    return node;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/** Answer a DescribeCoverage from the cached descriptions and the backend.
+ * @param env
+ * @param node the DescribeCoverage request.
+ * @param props
+ * @param wcs_version
+ * @return the response.
+ */
+axiom_node_t *sp_describe_invoke(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version)
+{
+    sp_describe_item items[SP_DESCRIBE_MAX_IDS];
+    const int        n = sp_describe_ids(env, node, items);
+    int              nhit = 0;
+    int              i;
+
+    if (n < 1) return rp_invokeBackend(env, node, props, wcs_version);
+
+    for (i = 0; i < n; i++)
+    {
+    	sp_cache_key key;
+    	sp_cache_description_key(env, props, items[i].id, &key);
+    	items[i].doc = sp_cache_get_description(env, props, &key, &items[i].len);
+    	if (items[i].doc && sp_describe_index(&items[i]))
+    	{
+    		free(items[i].doc);
+    		items[i].doc = NULL;
+    	}
+    	if (items[i].doc) nhit++;
+    }
+
+    axiom_node_t *resp_node = NULL;
+
+    if (0 == nhit)
+    {
+    	// Nothing to put together, just keep the descriptions.
+    	resp_node = rp_invokeBackend(env, node, props, wcs_version);
+    	sp_describe_store(env, props, resp_node, items, n);
+    }
+    else
+    {
+    	if (nhit < n)
+    	{
+    		axiom_node_t *red_node = sp_describe_reduced(env, node, items, n);
+    		resp_node = rp_invokeBackend(env, red_node, props, wcs_version);
+    		axiom_node_free_tree(red_node, env);
+
+    		// An exception is about the ids sent, pass it on.
+    		if (sp_describe_store(env, props, resp_node, items, n))
+    		{
+    			for (i = 0; i < n; i++) free(items[i].doc);
+    			return resp_node;
+    		}
+    	}
+
+    	axiom_node_t *desc_node = sp_describe_assemble(env, props, items, n);
+    	if (desc_node)
+    	{
+    		SP_LOG_DEBUG("DescribeCoverage: %d of %d descriptions cached",
+    				nhit, n);
+    		if (resp_node) axiom_node_free_tree(resp_node, env);
+    		resp_node = desc_node;
+    	}
+    	else
+    	{
+    		SP_LOG_DEBUG("DescribeCoverage: descriptions do not fit together");
+    		if (resp_node) axiom_node_free_tree(resp_node, env);
+    		resp_node = rp_invokeBackend(env, node, props, wcs_version);
+    	}
+    }
+
+    for (i = 0; i < n; i++) free(items[i].doc);
+    return resp_node;
+}
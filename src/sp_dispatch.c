@@ -43,6 +43,21 @@
 #include "soap_proxy.h"
 #include "sp_svc.h"
 #include "sp_props.h"
+#include "sp_stats.h"
+#include "sp_log.h"
+#include "sp_cache.h"
+#include "sp_admin.h"
+#include "sp_base64.h"
+#include "sp_sched.h"
+#include "sp_job.h"
+#include "sp_shard.h"
+#include "sp_tile.h"
+#include "sp_batch.h"
+#include "sp_caps.h"
+#include "sp_describe.h"
+#include "sp_eoindex.h"
+#include "sp_estimate.h"
+#include "sp_compress.h"
 
 //  ==================== Forward declarations ================================
 axiom_node_t *rp_getMsVers(
@@ -69,30 +84,126 @@ rp_dispatch_op(
 
     if (op_name && axutil_strlen(op_name) < SP_MAX_OP_LEN)
     {
-        if (
-        		axutil_strcmp(op_name, "DescribeCoverage"      ) == 0 ||
-        		axutil_strcmp(op_name, "DescribeEOCoverageSet" ) == 0
-        )
+        if ( axutil_strcmp(op_name, "DescribeCoverage" ) == 0 )
         {
-            return_node = rp_invokeBackend(env, node, props, protocol);
+            return_node = sp_cache_enabled(env, props) ?
+            		sp_describe_invoke(env, node, props, protocol) :
+            		rp_invokeBackend(env, node, props, protocol);
+        }
+        else if ( axutil_strcmp(op_name, "DescribeEOCoverageSet" ) == 0 )
+        {
+            if (sp_eoindex_enabled(env, props))
+            {
+                return_node = sp_eoindex_invoke(env, node, props, protocol);
+            }
+            else
+            {
+                return_node = sp_shard_enabled(env, props) ?
+                		sp_shard_invoke(env, node, props, protocol) :
+                		rp_invokeBackend(env, node, props, protocol);
+            }
         }
         else if ( axutil_strcmp(op_name, "GetCoverage" ) == 0 )
         {
+            // Too large to be answered, see sp_estimate.c.
+            if (sp_estimate_check(env, props, node)) return NULL;
+
             time_t request_time = time(NULL);
-            return_node = rp_invokeBackend(env, node, props, protocol);
+            sp_cache_key key;
+            const int cacheable = sp_cache_enabled(env, props) &&
+            		0 == sp_cache_coverage_key(env, props, node, &key);
+
+            sp_stamp_t t_zip = 0;  // counted with the rewrite below
+            return_node = cacheable ?
+            		sp_cache_get_coverage(env, props, &key) : NULL;
+            if (NULL == return_node)
+            {
+                return_node = sp_tile_enabled(env, props) ?
+                		sp_tile_invoke(env, node, props, protocol) :
+                		rp_invokeBackend(env, node, props, protocol);
+                // Cached compressed, so that a hit is not deflated again.
+                const sp_stamp_t tz = sp_stats_now();
+                sp_compress_coverage(env, props, return_node);
+                t_zip = sp_stats_now() - tz;
+                if (cacheable)
+                {
+                    const axis2_char_t *cov_id = sp_get_text_el(
+                    		rp_find_named_child(env, node, "CoverageId", 0), env);
+                    sp_cache_put_coverage(env, props, &key, cov_id, return_node);
+                }
+            }
+            sp_stamp_t t0 = sp_stats_now();
             sp_update_lineage(env, props, return_node, node, request_time);
+            sp_inline_coverage(env, props, return_node);
+            sp_stats_phase(SP_PH_REWRITE, t0 - t_zip);
         }
         else if ( axutil_strcmp(op_name, "GetCapabilities" ) == 0 )
         {
-            return_node = rp_invokeBackend(env, node, props, protocol);
-            rp_inject_soap_cap20(env, props, return_node);
-            if (rp_getDeletingNonSoap(env, props)) rp_delete_nonsoap (env, return_node);
-            sp_add_soapurl(env, props, return_node);
+            int fresh = 0;
+            return_node = sp_caps_get(env, props, node, &fresh);
+            if (NULL == return_node)
+            {
+                // Fetch all of it if the cache can answer the request and
+                // has nothing fresh; a fresh document that does not fit
+                // leaves the request to the backend as it is.
+                axiom_node_t *full_node = fresh ?
+                		NULL : sp_caps_full_request(env, props, node);
+                for (;;)
+                {
+                    return_node = rp_invokeBackend(
+                    		env, full_node ? full_node : node, props, protocol);
+                    sp_stamp_t t0 = sp_stats_now();
+                    rp_inject_soap_cap20(env, props, return_node);
+                    if (rp_getDeletingNonSoap(env, props)) rp_delete_nonsoap (env, return_node);
+                    sp_add_soapurl(env, props, return_node);
+                    sp_stats_phase(SP_PH_REWRITE, t0);
+                    if (NULL == full_node) break;
+
+                    axiom_node_t *full_resp = return_node;
+                    return_node = sp_caps_put(env, props, node, full_resp);
+                    axiom_node_free_tree(full_node, env);
+                    full_node = NULL;
+
+                    // Kept, but not what was asked for, e.g. another
+                    // version: ask the backend for the request itself.
+                    if (return_node || NULL == full_resp) break;
+                }
+            }
+        }
+        else if ( axutil_strcmp(op_name, "AsyncGetCoverage" ) == 0 )
+        {
+            return_node = sp_job_submit(env, props, node, protocol);
+        }
+        else if ( axutil_strcmp(op_name, "GetJobStatus" ) == 0 )
+        {
+            return_node = sp_job_status(env, props, node);
+        }
+        else if ( axutil_strcmp(op_name, "FetchJobResult" ) == 0 )
+        {
+            return_node = sp_job_fetch(env, props, node);
+            sp_compress_coverage(env, props, return_node);
+            sp_inline_coverage(env, props, return_node);
+        }
+        else if ( axutil_strcmp(op_name, "Batch" ) == 0 )
+        {
+            return_node = sp_batch_invoke(env, props, node, protocol);
         }
         else if ( axutil_strcmp(op_name, "GetMsVersion" ) == 0 )
         {
             return_node = rp_getMsVers(env, props);
         }
+        else if ( axutil_strcmp(op_name, "GetProxyStats" ) == 0 )
+        {
+            return_node = rp_getProxyStats(env, props);
+        }
+        else if ( axutil_strcmp(op_name, "GetProxyMetrics" ) == 0 )
+        {
+            return_node = rp_getProxyMetrics(env, props);
+        }
+        else if ( sp_admin_op(op_name) )
+        {
+            return_node = rp_invokeAdmin(env, props, op_name, node, protocol);
+        }
         else
         {
             SP_ERROR(env, SP_USER_ERR_BAD_OP);
@@ -118,16 +229,38 @@ rp_invokeBackend(
 {
     AXIS2_ENV_CHECK(env, NULL);
 
+    // DrainBackend: fail fast rather than queue up on the backend.
+    if (sp_stats_drain_since())
+    {
+        SP_ERROR(env, SP_SYS_ERR_BACKEND_DRAINING);
+        SP_LOG_DEBUG("backend draining, request refused");
+        return NULL;
+    }
+
+    // A Batch may have fetched the response already, see sp_batch.c.
+    axutil_stream_t *r_stream    = sp_batch_response(env, node);
+    const int        fetched     = NULL != r_stream;
+
+    // Wait for a backend slot, see sp_sched.c.
+    sp_sched_ticket ticket;
+    if (! fetched && sp_sched_acquire(env, props, node, &ticket))
+    {
+        return NULL;
+    }
+
+    sp_stamp_t      t0           = sp_stats_now();
     axiom_node_t   *return_node  = NULL;
-    axis2_char_t   *req_string   = axiom_node_to_string(node, env);
-    axutil_stream_t *r_stream    = NULL;
+    axis2_char_t   *req_string   = fetched ? NULL : axiom_node_to_string(node, env);
     const axis2_char_t *mapfile  = rp_getMapfile(env, props);
 
-	if (rp_getUrlMode(env, props))
+    sp_stats_phase(SP_PH_SERIALIZE, t0);
+    if (req_string) sp_stats_note_request(req_string, strlen(req_string));
+
+	if (! fetched && rp_getUrlMode(env, props))
 	{
             r_stream = sp_backend_socket(env, props, req_string, mapfile);
 	}
-	else
+	else if (! fetched)
 	{
             r_stream = sp_execMapserv(env, props, req_string, mapfile);
 	}
@@ -165,7 +298,8 @@ rp_invokeBackend(
           sp_stream_cleanup(env, r_stream);
 	}
 
-	AXIS2_FREE(env->allocator, req_string);
+	if (req_string) AXIS2_FREE(env->allocator, req_string);
+	if (! fetched) sp_sched_release(env, &ticket);
 
 	return return_node;
 }
@@ -0,0 +1,1510 @@
+/*
+ * Soap Proxy.
+ *
+ * DescribeEOCoverageSet answered from a local index.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_eoindex.c
+ *
+ * Catalogue clients send DescribeEOCoverageSet over and over with
+ * different spatial and temporal subsets of the same dataset series,
+ * while the series change only when data is ingested.  If EOIndexSecs
+ * is set (and the coverage cache, CoverageCacheDir, is configured), the
+ * proxy answers such requests itself:
+ *
+ *  - once per EOIndexSecs, the whole set of the requested eoIds is
+ *    asked from the backend, without subsets,
+ *  - the footprint (eop:Footprint) and phenomenonTime of each
+ *    CoverageDescription are taken from the response and put into a
+ *    packed R-tree, whose nodes also hold the time span of what is
+ *    below them, so one search prunes on both,
+ *  - the index, the response text and the byte ranges of the
+ *    descriptions in it are kept as one entry of the coverage cache,
+ *    mapped when used, so all processes share it,
+ *  - a request is answered by searching the index and putting the
+ *    matching descriptions together, in the order of the backend.
+ *
+ * The R-tree is built bottom up in one go (Sort-Tile-Recursive), as the
+ * set is only ever replaced as a whole.  Overlaps is decided on the
+ * footprint polygons themselves, contains on their bounding boxes,
+ * which is the same thing.  Footprints are taken to be in EPSG:4326,
+ * with posList in latitude, longitude order, as EOxServer writes them.
+ *
+ * Only what the harvested response shows how to answer is answered
+ * locally; anything else goes to the backend as it is:
+ *
+ *  - subsets other than Long, Lat and phenomenonTime, slices, Sections
+ *    other than All, containment other than overlaps and contains,
+ *  - a count below the number of matches,
+ *  - footprints with holes among the candidates of a spatial subset,
+ *  - dataset series other than the requested eoIds themselves, when
+ *    there are subsets: the backend returns the requested series
+ *    whatever the subset, but how it filters nested ones is not known.
+ *
+ * numberMatched counts the series or not as the harvested response did.
+ * A set that cannot be indexed, e.g. because the backend cut it short or
+ * a coverage has no footprint, is not asked for again for EOIndexSecs.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "soap_proxy.h"
+#include "sp_eoindex.h"
+#include "sp_cache.h"
+#include "sp_canon.h"
+#include "sp_log.h"
+#include "sp_shard.h"
+#include "sp_stats.h"
+
+#define SP_EOI_MAGIC     0x53504549u       // "SPEI"
+#define SP_EOI_VERSION   1
+#define SP_EOI_FANOUT    16
+#define SP_EOI_STACK     256
+#define SP_EOI_MAX_IDS   64
+#define SP_EOI_ID_LEN    128
+#define SP_EOI_CTYPE     "application/x-sp-eoindex"
+
+//
+// Longitude, latitude and time span of an entry, or of an R-tree node.
+//
+struct sp_eoi_box_struct
+{
+    double x0, y0, x1, y1;
+    double t0, t1;
+};
+
+typedef struct sp_eoi_box_struct sp_eoi_box;
+
+//
+// A CoverageDescription.
+//
+struct sp_eoi_cov_struct
+{
+    sp_eoi_box box;
+    uint64_t   off;              // of the description in the text
+    uint64_t   len;
+    uint32_t   ring;             // first ring of the footprint
+    uint32_t   nring;
+    uint32_t   exact;            // 0 if the footprint has holes
+    uint32_t   pad;
+};
+
+typedef struct sp_eoi_cov_struct sp_eoi_cov;
+
+//
+// A DatasetSeriesDescription.
+//
+struct sp_eoi_series_struct
+{
+    uint64_t off;
+    uint64_t len;
+    char     id[SP_EOI_ID_LEN];
+};
+
+typedef struct sp_eoi_series_struct sp_eoi_series;
+
+struct sp_eoi_ring_struct
+{
+    uint32_t vert;               // first vertex
+    uint32_t nvert;
+};
+
+typedef struct sp_eoi_ring_struct sp_eoi_ring;
+
+//
+// R-tree node, its entries are perm[first ..] for a leaf, else the nodes
+// node[first ..].
+//
+struct sp_eoi_node_struct
+{
+    sp_eoi_box box;
+    uint32_t   first;
+    uint32_t   count;
+    uint32_t   leaf;
+    uint32_t   pad;
+};
+
+typedef struct sp_eoi_node_struct sp_eoi_node;
+
+//
+// A section of the response, offsets into the text.
+//
+struct sp_eoi_sect_struct
+{
+    uint64_t off;
+    uint64_t head_len;           // of its start tag
+    uint64_t tail_off;           // of its end tag
+    uint64_t len;
+    uint32_t present;
+    uint32_t pad;
+};
+
+typedef struct sp_eoi_sect_struct sp_eoi_sect;
+
+//
+// Start of the cache entry, followed by the arrays and the text.
+//
+struct sp_eoi_head_struct
+{
+    uint32_t    magic;
+    uint32_t    version;
+    int64_t     harvested;
+    uint32_t    ncov;
+    uint32_t    nseries;
+    uint32_t    nnode;
+    uint32_t    nring;
+    uint32_t    nvert;
+    uint32_t    root;
+    uint32_t    count_series;    // numberMatched counts the series
+    uint32_t    pad;
+    uint64_t    cov_off;
+    uint64_t    series_off;
+    uint64_t    node_off;
+    uint64_t    perm_off;
+    uint64_t    ring_off;
+    uint64_t    vert_off;        // longitude, latitude pairs
+    uint64_t    text_off;
+    uint64_t    text_len;
+    uint64_t    head_len;        // of the start tag of the root
+    uint64_t    tail_off;        // of its end tag
+    sp_eoi_sect cov_sect;
+    sp_eoi_sect series_sect;
+};
+
+typedef struct sp_eoi_head_struct sp_eoi_head;
+
+//
+// An index in memory, built or mapped.
+//
+struct sp_eoi_view_struct
+{
+    const sp_eoi_head   *head;
+    const sp_eoi_cov    *cov;
+    const sp_eoi_series *series;
+    const sp_eoi_node   *node;
+    const uint32_t      *perm;
+    const sp_eoi_ring   *ring;
+    const double        *vert;
+    const char          *text;
+};
+
+typedef struct sp_eoi_view_struct sp_eoi_view;
+
+//
+// What a DescribeEOCoverageSet asks for.
+//
+struct sp_eoi_query_struct
+{
+    const axis2_char_t *ids[SP_EOI_MAX_IDS];
+    int                 nids;
+    int                 contains;
+    int                 spatial;     // there is a Long or Lat subset
+    int                 temporal;
+    sp_eoi_box          box;
+    long                count;       // -1 if none
+};
+
+typedef struct sp_eoi_query_struct sp_eoi_query;
+
+//
+// Arrays being filled while harvesting.
+//
+struct sp_eoi_build_struct
+{
+    sp_eoi_cov    *cov;
+    int            ncov, acov;
+    sp_eoi_series *series;
+    int            nseries, aseries;
+    sp_eoi_ring   *ring;
+    int            nring, aring;
+    double        *vert;
+    int            nvert, avert;
+};
+
+typedef struct sp_eoi_build_struct sp_eoi_build;
+
+// A set that could not be indexed, not to be asked for again too soon.
+// Shared by the threads of a worker MPM child, under sp_eoi_failed_lock.
+static struct
+{
+    sp_cache_key key;
+    time_t       until;
+} sp_eoi_failed;
+
+static pthread_mutex_t sp_eoi_failed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_eoi_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_eoi_attr(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char         *name)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_attribute_value_by_name(el, env,
+    		(axis2_char_t *) name) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Send a request to the backend, or the shards.
+ */
+static axiom_node_t *sp_eoi_backend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version)
+{
+    return sp_shard_enabled(env, props) ?
+    		sp_shard_invoke(env, node, props, wcs_version) :
+    		rp_invokeBackend(env, node, props, wcs_version);
+}
+
+//-----------------------------------------------------------------------------
+/** Make room for one more element of an array.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int sp_eoi_grow(void **arr, int *alloc, const int n, const size_t size)
+{
+    if (n < *alloc) return 0;
+
+    const int a = *alloc ? *alloc * 2 : 64;
+    void *p = realloc(*arr, a * size);
+    if (NULL == p) return -1;
+    *arr   = p;
+    *alloc = a;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_eoi_box_empty(sp_eoi_box *b)
+{
+    b->x0 = b->y0 = b->t0 =  DBL_MAX;
+    b->x1 = b->y1 = b->t1 = -DBL_MAX;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_eoi_box_add(sp_eoi_box *b, const sp_eoi_box *a)
+{
+    if (a->x0 < b->x0) b->x0 = a->x0;
+    if (a->y0 < b->y0) b->y0 = a->y0;
+    if (a->t0 < b->t0) b->t0 = a->t0;
+    if (a->x1 > b->x1) b->x1 = a->x1;
+    if (a->y1 > b->y1) b->y1 = a->y1;
+    if (a->t1 > b->t1) b->t1 = a->t1;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_eoi_box_meets(const sp_eoi_box *a, const sp_eoi_box *b)
+{
+    return a->x0 <= b->x1 && b->x0 <= a->x1 &&
+           a->y0 <= b->y1 && b->y0 <= a->y1 &&
+           a->t0 <= b->t1 && b->t0 <= a->t1;
+}
+
+//-----------------------------------------------------------------------------
+// Whether a is inside b.
+static int sp_eoi_box_within(const sp_eoi_box *a, const sp_eoi_box *b)
+{
+    return a->x0 >= b->x0 && a->x1 <= b->x1 &&
+           a->y0 >= b->y0 && a->y1 <= b->y1 &&
+           a->t0 >= b->t0 && a->t1 <= b->t1;
+}
+
+//-----------------------------------------------------------------------------
+/** Parse a time of the response or the request, surrounding quotes as in
+ *  KVP requests are allowed.
+ * @return 0 on success, -1 on failure.
+ */
+static int sp_eoi_time(const axis2_char_t *s, double *t)
+{
+    char buf[64];
+    if (NULL == s) return -1;
+
+    while (' ' == *s || '\t' == *s || '\n' == *s || '\r' == *s) s++;
+    size_t len = strlen(s);
+    while (len > 0 && strchr(" \t\r\n", s[len - 1])) len--;
+    if (len >= 2 && ('"' == *s || '\'' == *s) && s[len - 1] == *s)
+    {
+    	s++;
+    	len -= 2;
+    }
+    if (len >= sizeof(buf)) return -1;
+    snprintf(buf, sizeof(buf), "%.*s", (int) len, s);
+
+    return sp_parse_iso_time(buf, t);
+}
+
+//-----------------------------------------------------------------------------
+static int sp_eoi_number(const axis2_char_t *s, double *d)
+{
+    char *end;
+    if (NULL == s) return -1;
+    *d = strtod(s, &end);
+    while (' ' == *end || '\t' == *end || '\n' == *end || '\r' == *end) end++;
+    return end == s || *end || ! isfinite(*d) ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Find out what a DescribeEOCoverageSet asks for.
+ * @return 0 if it may be answered from an index, -1 if not.
+ */
+static int sp_eoi_parse(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_eoi_query       *q)
+{
+    axiom_node_t *child = axiom_node_get_first_child(node, env);
+    int           seen_x = 0, seen_y = 0;
+
+    memset(q, 0, sizeof(*q));
+    q->box.x0 = q->box.y0 = q->box.t0 = -DBL_MAX;
+    q->box.x1 = q->box.y1 = q->box.t1 =  DBL_MAX;
+
+    const axis2_char_t *count = sp_eoi_attr(env, node, "count");
+    q->count = count ? atol(count) : -1;
+    if (count && q->count < 0) return -1;
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const axis2_char_t *name = sp_eoi_localname(env, child);
+    	if (0 == axutil_strcmp(name, "eoId"))
+    	{
+    		const axis2_char_t *id = sp_get_text_el(child, env);
+    		if (NULL == id || '\0' == *id || strlen(id) >= SP_EOI_ID_LEN ||
+    			q->nids >= SP_EOI_MAX_IDS)
+    		{
+    			return -1;
+    		}
+    		q->ids[q->nids++] = id;
+    	}
+    	else if (0 == axutil_strcmp(name, "containment"))
+    	{
+    		const axis2_char_t *c = sp_get_text_el(child, env);
+    		if (c && 0 == strcasecmp(c, "contains")) q->contains = 1;
+    		else if (NULL == c || strcasecmp(c, "overlaps")) return -1;
+    	}
+    	else if (0 == axutil_strcmp(name, "Sections"))
+    	{
+    		axiom_node_t *s = axiom_node_get_first_child(child, env);
+    		for (; s; s = axiom_node_get_next_sibling(s, env))
+    		{
+    			if (AXIOM_ELEMENT != axiom_node_get_node_type(s, env)) continue;
+    			if (axutil_strcmp(sp_get_text_el(s, env), "All")) return -1;
+    		}
+    	}
+    	else if (0 == axutil_strcmp(name, "DimensionTrim"))
+    	{
+    		const axis2_char_t *dim = sp_get_text_el(
+    				rp_find_named_child(env, child, "Dimension", 0), env);
+    		axiom_node_t *lo_node = rp_find_named_child(env, child, "TrimLow",  0);
+    		axiom_node_t *hi_node = rp_find_named_child(env, child, "TrimHigh", 0);
+    		const axis2_char_t *lo = lo_node ? sp_get_text_el(lo_node, env) : NULL;
+    		const axis2_char_t *hi = hi_node ? sp_get_text_el(hi_node, env) : NULL;
+    		double *low, *high;
+    		int     is_time = 0;
+
+    		if (NULL == dim) return -1;
+    		if (0 == strcasecmp(dim, "Long") || 0 == strcasecmp(dim, "Lon"))
+    		{
+    			if (seen_x++) return -1;
+    			low  = &q->box.x0;
+    			high = &q->box.x1;
+    			q->spatial = 1;
+    		}
+    		else if (0 == strcasecmp(dim, "Lat"))
+    		{
+    			if (seen_y++) return -1;
+    			low  = &q->box.y0;
+    			high = &q->box.y1;
+    			q->spatial = 1;
+    		}
+    		else if (0 == strcmp(dim, "phenomenonTime"))
+    		{
+    			if (q->temporal++) return -1;
+    			low     = &q->box.t0;
+    			high    = &q->box.t1;
+    			is_time = 1;
+    		}
+    		else
+    		{
+    			return -1;
+    		}
+
+    		// A bound that is there must be understood.
+    		if ((lo_node && (is_time ? sp_eoi_time(lo, low) : sp_eoi_number(lo, low))) ||
+    			(hi_node && (is_time ? sp_eoi_time(hi, high) : sp_eoi_number(hi, high))))
+    		{
+    			return -1;
+    		}
+    	}
+    	else
+    	{
+    		// DimensionSlice, Extension
+    		return -1;
+    	}
+    }
+
+    return q->nids > 0 ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_eoi_strcmp(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+//-----------------------------------------------------------------------------
+/** The key of the index of a set of eoIds on this backend.  Sorts and
+ *  thins out q->ids.
+ */
+static void sp_eoi_key(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_eoi_query       *q,
+    uint64_t           *key)
+{
+    int i, n = 0;
+
+    qsort(q->ids, q->nids, sizeof(q->ids[0]), sp_eoi_strcmp);
+    for (i = 0; i < q->nids; i++)
+    {
+    	if (0 == n || strcmp(q->ids[n - 1], q->ids[i])) q->ids[n++] = q->ids[i];
+    }
+    q->nids = n;
+
+    const char *backend = rp_getUrlMode(env, props) ?
+    		rp_getBackendURL(env, props) : rp_getMapserverExec(env, props);
+    const char *shards  = sp_shard_enabled(env, props) ?
+    		rp_getBackendShards(env, props) : "";
+    const char *mapfile = rp_getMapfile(env, props);
+
+    size_t len = strlen(backend) + strlen(shards) + strlen(mapfile) + 16;
+    for (i = 0; i < n; i++) len += strlen(q->ids[i]) + 1;
+
+    char *ident = malloc(len);
+    if (NULL == ident)
+    {
+    	key[0] = key[1] = 0;
+    	return;
+    }
+    char *p = ident + sprintf(ident, "%s|%s|%s|eoindex", backend, shards, mapfile);
+    for (i = 0; i < n; i++) p += sprintf(p, "\n%s", q->ids[i]);
+
+    sp_murmur3_128(ident, p - ident, 0, key);
+    free(ident);
+}
+
+//-----------------------------------------------------------------------------
+/** A DescribeEOCoverageSet for the whole set of the eoIds.
+ * @return the request, to be freed by the caller.
+ */
+static axiom_node_t *sp_eoi_harvest_request(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_eoi_query *q)
+{
+    const axis2_char_t *version = sp_eoi_attr(env, node, "version");
+
+    axiom_node_t      *req_node = NULL;
+    axiom_namespace_t *eo_ns    = axiom_namespace_create(
+    		env, "http://www.opengis.net/wcseo/1.0", "wcseo");
+    axiom_element_t   *req_el   = axiom_element_create(
+    		env, NULL, "DescribeEOCoverageSet", eo_ns, &req_node);
+    axiom_element_add_attribute(req_el, env,
+    		axiom_attribute_create(env, "service", "WCS", NULL), req_node);
+    axiom_element_add_attribute(req_el, env,
+    		axiom_attribute_create(env, "version", version ? version : "2.0.1",
+    				NULL), req_node);
+
+    int i;
+    for (i = 0; i < q->nids; i++)
+    {
+    	axiom_node_t    *id_node = NULL;
+    	axiom_element_t *id_el   = axiom_element_create(
+    			env, req_node, "eoId", eo_ns, &id_node);
+    	axiom_element_set_text(id_el, env, q->ids[i], id_node);
+    }
+    return req_node;
+}
+
+//-----------------------------------------------------------------------------
+/** Add a footprint ring from a gml:posList.
+ * @return 0 on success, -1 if it cannot be read.
+ */
+static int sp_eoi_add_ring(
+    sp_eoi_build       *b,
+    sp_eoi_cov         *cov,
+    const axis2_char_t *pos_list)
+{
+    const char *p = pos_list;
+    int         n = 0;
+    char       *end;
+
+    if (NULL == p) return -1;
+    if (sp_eoi_grow((void **) &b->ring, &b->aring, b->nring, sizeof(sp_eoi_ring)))
+    {
+    	return -1;
+    }
+
+    const int first = b->nvert;
+    for (;;)
+    {
+    	const double lat = strtod(p, &end);
+    	if (end == p) break;
+    	p = end;
+    	const double lon = strtod(p, &end);
+    	if (end == p || ! isfinite(lat) || ! isfinite(lon)) return -1;
+    	p = end;
+
+    	if (sp_eoi_grow((void **) &b->vert, &b->avert, b->nvert * 2 + 1,
+    			sizeof(double)))
+    	{
+    		return -1;
+    	}
+    	b->vert[2 * b->nvert]     = lon;
+    	b->vert[2 * b->nvert + 1] = lat;
+    	b->nvert++;
+    	n++;
+
+    	if (lon < cov->box.x0) cov->box.x0 = lon;
+    	if (lon > cov->box.x1) cov->box.x1 = lon;
+    	if (lat < cov->box.y0) cov->box.y0 = lat;
+    	if (lat > cov->box.y1) cov->box.y1 = lat;
+    }
+    while (' ' == *p || '\t' == *p || '\n' == *p || '\r' == *p) p++;
+    if (*p || n < 3) return -1;
+
+    b->ring[b->nring].vert  = first;
+    b->ring[b->nring].nvert = n;
+    b->nring++;
+    cov->nring++;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Collect the rings of a footprint.
+ * @return 0 on success, -1 if the footprint is not understood.
+ */
+static int sp_eoi_footprint(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_eoi_build       *b,
+    sp_eoi_cov         *cov)
+{
+    axiom_node_t *child = axiom_node_get_first_child(node, env);
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const axis2_char_t *name = sp_eoi_localname(env, child);
+    	const axis2_char_t *srs  = sp_eoi_attr(env, child, "srsName");
+    	if (srs && NULL == strstr(srs, "4326")) return -1;
+
+    	if (0 == axutil_strcmp(name, "interior"))
+    	{
+    		cov->exact = 0;
+    	}
+    	else if (0 == axutil_strcmp(name, "posList"))
+    	{
+    		if (sp_eoi_add_ring(b, cov, sp_get_text_el(child, env))) return -1;
+    	}
+    	else if (0 == axutil_strcmp(name, "pos") ||
+    			 0 == axutil_strcmp(name, "coordinates"))
+    	{
+    		return -1;
+    	}
+    	else if (sp_eoi_footprint(env, child, b, cov))
+    	{
+    		return -1;
+    	}
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Take the begin and end of a time period, or a time instant.
+ * @return 0 on success, -1 if there is none.
+ */
+static int sp_eoi_period(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    double             *t0,
+    double             *t1)
+{
+    axiom_node_t *begin = rp_find_named_child(env, node, "beginPosition", 1);
+    axiom_node_t *end   = rp_find_named_child(env, node, "endPosition",   1);
+
+    if (NULL == begin && NULL == end)
+    {
+    	begin = end = rp_find_named_child(env, node, "timePosition", 1);
+    }
+    if (NULL == begin || NULL == end ||
+    	sp_eoi_time(sp_get_text_el(begin, env), t0) ||
+    	sp_eoi_time(sp_get_text_el(end,   env), t1) ||
+    	*t1 < *t0)
+    {
+    	return -1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Index the descriptions of one section of the harvested response.
+ * @param env
+ * @param sect_node CoverageDescriptions or DatasetSeriesDescriptions.
+ * @param text the serialised response.
+ * @param sect set to the ranges of the section, off and len set already.
+ * @param b
+ * @param series non-zero for DatasetSeriesDescriptions.
+ * @return 0 on success, -1 if it cannot be indexed.
+ */
+static int sp_eoi_harvest_section(
+    const axutil_env_t *env,
+    axiom_node_t       *sect_node,
+    const char         *text,
+    sp_eoi_sect        *sect,
+    sp_eoi_build       *b,
+    const int           series)
+{
+    axiom_node_t *child;
+    int           m = 0;
+
+    for (child = axiom_node_get_first_child(sect_node, env); child;
+    	 child = axiom_node_get_next_sibling(child, env))
+    {
+    	m += AXIOM_ELEMENT == axiom_node_get_node_type(child, env);
+    }
+
+    sp_xml_range *range = malloc((m + 1) * sizeof(sp_xml_range));
+    int           k;
+    if (NULL == range ||
+    	sp_xml_children(text + sect->off, sect->len, &sect->head_len,
+    			&sect->tail_off, range, m + 1, &k) ||
+    	k != m)
+    {
+    	free(range);
+    	return -1;
+    }
+    sect->present = 1;
+
+    int failed = 0;
+    k = 0;
+    for (child = axiom_node_get_first_child(sect_node, env); child;
+    	 child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const uint64_t off = sect->off + range[k].off;
+    	const uint64_t len = range[k].len;
+    	k++;
+
+    	if (series)
+    	{
+    		const axis2_char_t *id = sp_get_text_el(
+    				rp_find_named_child(env, child, "DatasetSeriesId", 0), env);
+    		if (NULL == id || strlen(id) >= SP_EOI_ID_LEN ||
+    			sp_eoi_grow((void **) &b->series, &b->aseries, b->nseries,
+    					sizeof(sp_eoi_series)))
+    		{
+    			failed = 1;
+    			break;
+    		}
+    		sp_eoi_series *s = &b->series[b->nseries];
+
+    		memset(s, 0, sizeof(*s));
+    		strcpy(s->id, id);
+    		s->off = off;
+    		s->len = len;
+    		b->nseries++;
+    		continue;
+    	}
+
+    	if (sp_eoi_grow((void **) &b->cov, &b->acov, b->ncov, sizeof(sp_eoi_cov)))
+    	{
+    		failed = 1;
+    		break;
+    	}
+    	sp_eoi_cov *cov = &b->cov[b->ncov];
+    	memset(cov, 0, sizeof(*cov));
+    	sp_eoi_box_empty(&cov->box);
+    	cov->off   = off;
+    	cov->len   = len;
+    	cov->ring  = b->nring;
+    	cov->exact = 1;
+
+    	axiom_node_t *fp_node = rp_find_named_child(env, child, "Footprint", 1);
+    	axiom_node_t *pt_node = rp_find_named_child(env, child, "phenomenonTime", 1);
+    	if (NULL == fp_node || NULL == pt_node ||
+    		sp_eoi_footprint(env, fp_node, b, cov) || 0 == cov->nring ||
+    		sp_eoi_period(env, pt_node, &cov->box.t0, &cov->box.t1))
+    	{
+    		SP_LOG_DEBUG("eoindex: no footprint or time in description %d", k);
+    		failed = 1;
+    		break;
+    	}
+    	b->ncov++;
+    }
+
+    free(range);
+    return failed ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** qsort_r() order of the entries of a tile: by the centre of their boxes
+ *  in x, or in y.
+ */
+static int sp_eoi_cmp_x(const void *a, const void *b, void *arg)
+{
+    const sp_eoi_box *box = arg;
+    const sp_eoi_box *ba  = &box[*(const uint32_t *) a];
+    const sp_eoi_box *bb  = &box[*(const uint32_t *) b];
+    const double ca = ba->x0 + ba->x1, cb = bb->x0 + bb->x1;
+    return ca < cb ? -1 : ca > cb;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_eoi_cmp_y(const void *a, const void *b, void *arg)
+{
+    const sp_eoi_box *box = arg;
+    const sp_eoi_box *ba  = &box[*(const uint32_t *) a];
+    const sp_eoi_box *bb  = &box[*(const uint32_t *) b];
+    const double ca = ba->y0 + ba->y1, cb = bb->y0 + bb->y1;
+    return ca < cb ? -1 : ca > cb;
+}
+
+//-----------------------------------------------------------------------------
+/** Sort-Tile-Recursive order of n boxes: in vertical slices by x, each
+ *  slice by y, so that runs of SP_EOI_FANOUT are close together.
+ */
+static void sp_eoi_str_order(const sp_eoi_box *box, uint32_t *order, const int n)
+{
+    int i;
+    for (i = 0; i < n; i++) order[i] = i;
+
+    const int pages  = (n + SP_EOI_FANOUT - 1) / SP_EOI_FANOUT;
+    const int slices = (int) ceil(sqrt((double) pages));
+    const int slice  = slices * SP_EOI_FANOUT;
+
+    qsort_r(order, n, sizeof(uint32_t), sp_eoi_cmp_x, (void *) box);
+    for (i = 0; i < n; i += slice)
+    {
+    	const int len = n - i < slice ? n - i : slice;
+    	qsort_r(order + i, len, sizeof(uint32_t), sp_eoi_cmp_y, (void *) box);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Build the R-tree over the coverages, level by level.
+ * @param cov
+ * @param ncov at least 1.
+ * @param perm set to the order of the coverages in the leaves.
+ * @param nnode set to the number of nodes, the root is the last one.
+ * @return the nodes, malloc()ed, NULL if out of memory.
+ */
+static sp_eoi_node *sp_eoi_pack(
+    const sp_eoi_cov *cov,
+    const int         ncov,
+    uint32_t         *perm,
+    int              *nnode)
+{
+    sp_eoi_box  *box   = malloc(ncov * sizeof(sp_eoi_box));
+    uint32_t    *order = malloc(ncov * sizeof(uint32_t));
+    sp_eoi_node *node  = malloc((ncov + 1) * sizeof(sp_eoi_node));
+    int          i, k, n = 0;
+
+    if (NULL == box || NULL == order || NULL == node)
+    {
+    	free(box);
+    	free(order);
+    	free(node);
+    	return NULL;
+    }
+
+    // Leaves.
+    for (i = 0; i < ncov; i++) box[i] = cov[i].box;
+    sp_eoi_str_order(box, perm, ncov);
+    for (i = 0; i < ncov; i += SP_EOI_FANOUT)
+    {
+    	sp_eoi_node *nd = &node[n++];
+    	memset(nd, 0, sizeof(*nd));
+    	sp_eoi_box_empty(&nd->box);
+    	nd->first = i;
+    	nd->count = ncov - i < SP_EOI_FANOUT ? ncov - i : SP_EOI_FANOUT;
+    	nd->leaf  = 1;
+    	for (k = 0; k < (int) nd->count; k++)
+    	{
+    		sp_eoi_box_add(&nd->box, &cov[perm[i + k]].box);
+    	}
+    }
+
+    // Upper levels, each level's nodes put in STR order before their
+    // parents are made.
+    int level = 0, nlevel = n;
+    while (nlevel > 1)
+    {
+    	sp_eoi_node *tmp = malloc(nlevel * sizeof(sp_eoi_node));
+    	if (NULL == tmp)
+    	{
+    		free(node);
+    		node = NULL;
+    		break;
+    	}
+    	for (i = 0; i < nlevel; i++) box[i] = node[level + i].box;
+    	sp_eoi_str_order(box, order, nlevel);
+    	memcpy(tmp, node + level, nlevel * sizeof(sp_eoi_node));
+    	for (i = 0; i < nlevel; i++) node[level + i] = tmp[order[i]];
+    	free(tmp);
+
+    	const int parents = n;
+    	for (i = 0; i < nlevel; i += SP_EOI_FANOUT)
+    	{
+    		sp_eoi_node *nd = &node[n++];
+    		memset(nd, 0, sizeof(*nd));
+    		sp_eoi_box_empty(&nd->box);
+    		nd->first = level + i;
+    		nd->count = nlevel - i < SP_EOI_FANOUT ? nlevel - i : SP_EOI_FANOUT;
+    		for (k = 0; k < (int) nd->count; k++)
+    		{
+    			sp_eoi_box_add(&nd->box, &node[level + i + k].box);
+    		}
+    	}
+    	level  = parents;
+    	nlevel = n - parents;
+    }
+
+    free(box);
+    free(order);
+    *nnode = n;
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+/** Find a quoted attribute value in a start tag.
+ * @return the offset of the opening quote, 0 if not found.
+ */
+static size_t sp_eoi_find_attr(const char *tag, const size_t len, const char *name)
+{
+    const size_t nl = strlen(name);
+    size_t       i;
+
+    for (i = 1; i + nl + 2 < len; i++)
+    {
+    	if (! strchr(" \t\r\n", tag[i - 1]) || strncmp(tag + i, name, nl) ||
+    		'=' != tag[i + nl] ||
+    		('"' != tag[i + nl + 1] && '\'' != tag[i + nl + 1]))
+    	{
+    		continue;
+    	}
+    	return i + nl + 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Check that the entry is sound and set up a view of it.
+ * @return 0 on success, -1 if not usable.
+ */
+static int sp_eoi_view_init(const void *data, const size_t len, sp_eoi_view *v)
+{
+    const sp_eoi_head *h = data;
+
+    if (len < sizeof(sp_eoi_head) ||
+    	SP_EOI_MAGIC != h->magic || SP_EOI_VERSION != h->version ||
+    	h->text_off > len || h->text_len > len - h->text_off ||
+    	h->vert_off + (uint64_t) h->nvert * 2 * sizeof(double) > h->text_off ||
+    	h->tail_off > h->text_len || h->head_len > h->tail_off ||
+    	(h->ncov > 0 && h->root >= h->nnode))
+    {
+    	return -1;
+    }
+
+    const char *base = data;
+    v->head   = h;
+    v->cov    = (const sp_eoi_cov *)    (base + h->cov_off);
+    v->series = (const sp_eoi_series *) (base + h->series_off);
+    v->node   = (const sp_eoi_node *)   (base + h->node_off);
+    v->perm   = (const uint32_t *)      (base + h->perm_off);
+    v->ring   = (const sp_eoi_ring *)   (base + h->ring_off);
+    v->vert   = (const double *)        (base + h->vert_off);
+    v->text   = base + h->text_off;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Lay out the index as a cache entry.
+ * @return the entry, malloc()ed, NULL on failure.
+ */
+static void *sp_eoi_layout(
+    sp_eoi_build      *b,
+    const sp_eoi_head *proto,
+    const sp_eoi_node *node,
+    const int          nnode,
+    const uint32_t    *perm,
+    const char        *text,
+    size_t            *len)
+{
+    sp_eoi_head h = *proto;
+    uint64_t    off = sizeof(sp_eoi_head);
+
+#define SP_EOI_PLACE(field, n, size) \
+    h.field = off; off += (uint64_t) (n) * (size); off = (off + 7) & ~7ULL;
+
+    SP_EOI_PLACE(cov_off,    b->ncov,    sizeof(sp_eoi_cov));
+    SP_EOI_PLACE(series_off, b->nseries, sizeof(sp_eoi_series));
+    SP_EOI_PLACE(node_off,   nnode,      sizeof(sp_eoi_node));
+    SP_EOI_PLACE(perm_off,   b->ncov,    sizeof(uint32_t));
+    SP_EOI_PLACE(ring_off,   b->nring,   sizeof(sp_eoi_ring));
+    SP_EOI_PLACE(vert_off,   b->nvert,   2 * sizeof(double));
+    SP_EOI_PLACE(text_off,   h.text_len, 1);
+#undef SP_EOI_PLACE
+
+    h.magic   = SP_EOI_MAGIC;
+    h.version = SP_EOI_VERSION;
+    h.ncov    = b->ncov;
+    h.nseries = b->nseries;
+    h.nnode   = nnode;
+    h.nring   = b->nring;
+    h.nvert   = b->nvert;
+    h.root    = nnode > 0 ? nnode - 1 : 0;
+
+    char *data = calloc(1, off);
+    if (NULL == data) return NULL;
+
+    memcpy(data, &h, sizeof(h));
+    if (b->ncov)    memcpy(data + h.cov_off,    b->cov,    b->ncov * sizeof(sp_eoi_cov));
+    if (b->nseries) memcpy(data + h.series_off, b->series, b->nseries * sizeof(sp_eoi_series));
+    if (nnode)      memcpy(data + h.node_off,   node,      nnode * sizeof(sp_eoi_node));
+    if (b->ncov)    memcpy(data + h.perm_off,   perm,      b->ncov * sizeof(uint32_t));
+    if (b->nring)   memcpy(data + h.ring_off,   b->ring,   b->nring * sizeof(sp_eoi_ring));
+    if (b->nvert)   memcpy(data + h.vert_off,   b->vert,   b->nvert * 2 * sizeof(double));
+    memcpy(data + h.text_off, text, h.text_len);
+
+    *len = off;
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+/** Index a harvested EOCoverageSetDescription.
+ * @param env
+ * @param resp_node
+ * @param len set to the size of the entry.
+ * @return the cache entry, malloc()ed, NULL if the response cannot be
+ *  indexed.
+ */
+static void *sp_eoi_harvest(
+    const axutil_env_t *env,
+    axiom_node_t       *resp_node,
+    size_t             *len)
+{
+    if (NULL == resp_node ||
+    	AXIOM_ELEMENT != axiom_node_get_node_type(resp_node, env) ||
+    	axutil_strcmp(sp_eoi_localname(env, resp_node), "EOCoverageSetDescription"))
+    {
+    	return NULL;
+    }
+
+    const axis2_char_t *nm_str = sp_eoi_attr(env, resp_node, "numberMatched");
+    const axis2_char_t *nr_str = sp_eoi_attr(env, resp_node, "numberReturned");
+    if (NULL == nm_str || NULL == nr_str || atol(nm_str) != atol(nr_str))
+    {
+    	SP_LOG_DEBUG("eoindex: the backend did not return the whole set");
+    	return NULL;
+    }
+
+    axis2_char_t *text = axiom_node_to_string(resp_node, env);
+    if (NULL == text) return NULL;
+
+    sp_eoi_head  h;
+    sp_eoi_build b;
+    sp_xml_range top[2];
+    int          ntop = 0;
+    void        *data = NULL;
+
+    memset(&h, 0, sizeof(h));
+    memset(&b, 0, sizeof(b));
+    h.harvested = time(NULL);
+    h.text_len  = strlen(text);
+
+    int failed = sp_xml_children(text, h.text_len, &h.head_len, &h.tail_off,
+    		top, 2, &ntop) ||
+    		0 == sp_eoi_find_attr(text, h.head_len, "numberMatched") ||
+    		0 == sp_eoi_find_attr(text, h.head_len, "numberReturned");
+
+    axiom_node_t *child = axiom_node_get_first_child(resp_node, env);
+    int           k     = 0;
+    for (; ! failed && child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const axis2_char_t *name = sp_eoi_localname(env, child);
+    	const int series = 0 == axutil_strcmp(name, "DatasetSeriesDescriptions");
+    	sp_eoi_sect *sect = series ? &h.series_sect : &h.cov_sect;
+
+    	if (k >= ntop || sect->present ||
+    		(! series && axutil_strcmp(name, "CoverageDescriptions")))
+    	{
+    		failed = 1;
+    		break;
+    	}
+    	sect->off = top[k].off;
+    	sect->len = top[k].len;
+    	k++;
+    	failed = sp_eoi_harvest_section(env, child, text, sect, &b, series);
+    }
+    failed |= k != ntop;
+
+    // Which way does the backend count?
+    const long nm = atol(nm_str);
+    if (! failed && nm == b.ncov)
+    {
+    	h.count_series = 0;
+    }
+    else if (! failed && nm == b.ncov + b.nseries)
+    {
+    	h.count_series = 1;
+    }
+    else
+    {
+    	failed = 1;
+    }
+
+    if (! failed)
+    {
+    	uint32_t    *perm  = malloc((b.ncov + 1) * sizeof(uint32_t));
+    	sp_eoi_node *node  = NULL;
+    	int          nnode = 0;
+
+    	if (perm && b.ncov > 0) node = sp_eoi_pack(b.cov, b.ncov, perm, &nnode);
+    	if (perm && (node || 0 == b.ncov))
+    	{
+    		data = sp_eoi_layout(&b, &h, node, nnode, perm, text, len);
+    	}
+    	free(node);
+    	free(perm);
+    }
+
+    SP_LOG_DEBUG("eoindex: %d coverages, %d series %s",
+    		b.ncov, b.nseries, data ? "indexed" : "not indexable");
+
+    free(b.cov);
+    free(b.series);
+    free(b.ring);
+    free(b.vert);
+    AXIS2_FREE(env->allocator, text);
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+/** Whether the segment a-b meets the rectangle r (Liang-Barsky).
+ */
+static int sp_eoi_segment_meets(
+    const double      *a,
+    const double      *b,
+    const sp_eoi_box  *r)
+{
+    double       t0 = 0.0, t1 = 1.0;
+    const double dx = b[0] - a[0], dy = b[1] - a[1];
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { a[0] - r->x0, r->x1 - a[0], a[1] - r->y0, r->y1 - a[1] };
+    int          i;
+
+    for (i = 0; i < 4; i++)
+    {
+    	if (0.0 == p[i])
+    	{
+    		if (q[i] < 0.0) return 0;
+    		continue;
+    	}
+    	const double t = q[i] / p[i];
+    	if (p[i] < 0.0)
+    	{
+    		if (t > t1) return 0;
+    		if (t > t0) t0 = t;
+    	}
+    	else
+    	{
+    		if (t < t0) return 0;
+    		if (t < t1) t1 = t;
+    	}
+    }
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+/** Whether a ring meets the rectangle r, which must be finite.
+ */
+static int sp_eoi_ring_meets(
+    const double     *v,
+    const int         n,
+    const sp_eoi_box *r)
+{
+    int i, j, inside = 0;
+
+    for (i = 0; i < n; i++)
+    {
+    	if (v[2 * i]     >= r->x0 && v[2 * i]     <= r->x1 &&
+    		v[2 * i + 1] >= r->y0 && v[2 * i + 1] <= r->y1)
+    	{
+    		return 1;
+    	}
+    }
+    for (i = 0, j = n - 1; i < n; j = i++)
+    {
+    	if (sp_eoi_segment_meets(&v[2 * j], &v[2 * i], r)) return 1;
+
+    	// Crossings of a ray from a corner of r.
+    	const double yi = v[2 * i + 1], yj = v[2 * j + 1];
+    	if ((yi > r->y0) != (yj > r->y0) &&
+    		r->x0 < (v[2 * j] - v[2 * i]) * (r->y0 - yi) / (yj - yi) + v[2 * i])
+    	{
+    		inside = ! inside;
+    	}
+    }
+    return inside;
+}
+
+//-----------------------------------------------------------------------------
+/** Whether a coverage matches the query.
+ * @return 1 if so, 0 if not, -1 if it cannot be decided here.
+ */
+static int sp_eoi_match(
+    const sp_eoi_view  *v,
+    const sp_eoi_cov   *cov,
+    const sp_eoi_query *q)
+{
+    // For contains the bounding box decides: all the vertices are in.
+    if (q->contains) return sp_eoi_box_within(&cov->box, &q->box);
+
+    if (! sp_eoi_box_meets(&cov->box, &q->box)) return 0;
+    if (! q->spatial) return 1;
+    if (! cov->exact) return -1;
+
+    // Polygons meet r if and only if they meet r cut down to their box.
+    sp_eoi_box r = q->box;
+    if (r.x0 < cov->box.x0) r.x0 = cov->box.x0;
+    if (r.x1 > cov->box.x1) r.x1 = cov->box.x1;
+    if (r.y0 < cov->box.y0) r.y0 = cov->box.y0;
+    if (r.y1 > cov->box.y1) r.y1 = cov->box.y1;
+
+    uint32_t i;
+    for (i = 0; i < cov->nring; i++)
+    {
+    	const sp_eoi_ring *ring = &v->ring[cov->ring + i];
+    	if (sp_eoi_ring_meets(&v->vert[2 * ring->vert], ring->nvert, &r)) return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_eoi_u32cmp(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+//-----------------------------------------------------------------------------
+/** Find the matching coverages.
+ * @param v
+ * @param q
+ * @param hits set to the matches, in the order of the response.
+ * @return the number of matches, -1 if the index cannot answer.
+ */
+static int sp_eoi_search(
+    const sp_eoi_view  *v,
+    const sp_eoi_query *q,
+    uint32_t           *hits)
+{
+    uint32_t stack[SP_EOI_STACK];
+    int      top = 0, n = 0;
+    uint32_t k;
+
+    if (0 == v->head->ncov) return 0;
+    stack[top++] = v->head->root;
+
+    while (top > 0)
+    {
+    	const sp_eoi_node *nd = &v->node[stack[--top]];
+    	if (! sp_eoi_box_meets(&nd->box, &q->box)) continue;
+
+    	for (k = nd->first; k < nd->first + nd->count; k++)
+    	{
+    		if (nd->leaf)
+    		{
+    			const int r = sp_eoi_match(v, &v->cov[v->perm[k]], q);
+    			if (r < 0) return -1;
+    			if (r) hits[n++] = v->perm[k];
+    		}
+    		else if (top < SP_EOI_STACK)
+    		{
+    			stack[top++] = k;
+    		}
+    		else
+    		{
+    			return -1;
+    		}
+    	}
+    }
+
+    qsort(hits, n, sizeof(uint32_t), sp_eoi_u32cmp);
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+/** Copy the start tag of the root with numberMatched and numberReturned
+ *  set.
+ * @return the end of what has been written.
+ */
+static char *sp_eoi_put_head(
+    char        *p,
+    const char  *head,
+    const size_t len,
+    const long   matched)
+{
+    const char *attrs[2] = { "numberMatched", "numberReturned" };
+    size_t      done = 0;
+    int         i;
+
+    for (i = 0; i < 2; i++)
+    {
+    	const size_t q = sp_eoi_find_attr(head, len, attrs[i]);
+    	const char  *close = q ? memchr(head + q + 1, head[q], len - q - 1) : NULL;
+    	if (NULL == close || q < done) continue;
+
+    	memcpy(p, head + done, q + 1 - done);
+    	p += q + 1 - done;
+    	p += sprintf(p, "%ld", matched);
+    	done = close - head;
+    }
+    memcpy(p, head + done, len - done);
+    return p + len - done;
+}
+
+//-----------------------------------------------------------------------------
+/** Answer a query from an index.
+ * @return the EOCoverageSetDescription, NULL if the index cannot answer.
+ */
+static axiom_node_t *sp_eoi_answer(
+    const axutil_env_t *env,
+    const sp_eoi_view  *v,
+    const sp_eoi_query *q)
+{
+    const sp_eoi_head *h    = v->head;
+    uint32_t          *hits = malloc((h->ncov + 1) * sizeof(uint32_t));
+    uint32_t           i;
+    int                k;
+
+    const int ncov = hits ? sp_eoi_search(v, q, hits) : -1;
+    const int nser = h->nseries;
+
+    // All series are returned: the requested ones whatever the subsets,
+    // nested ones are left to the backend if there are subsets.
+    for (i = 0; (q->spatial || q->temporal) && i < h->nseries; i++)
+    {
+    	for (k = 0; k < q->nids; k++)
+    	{
+    		if (0 == strcmp(v->series[i].id, q->ids[k])) break;
+    	}
+    	if (k == q->nids) break;
+    }
+
+    const long matched = ncov + (h->count_series ? nser : 0);
+    if (ncov < 0 || i < h->nseries ||
+    	(q->count >= 0 && q->count < ncov + nser))
+    {
+    	free(hits);
+    	return NULL;
+    }
+
+    size_t len = h->head_len + (h->text_len - h->tail_off) + 64;
+    if (ncov > 0) len += h->cov_sect.head_len + (h->cov_sect.len - h->cov_sect.tail_off);
+    if (nser > 0) len += h->series_sect.head_len + (h->series_sect.len - h->series_sect.tail_off);
+    for (k = 0; k < ncov; k++) len += v->cov[hits[k]].len;
+    for (i = 0; i < (uint32_t) nser; i++) len += v->series[i].len;
+
+    char *buf = malloc(len);
+    char *p   = buf;
+    if (buf)
+    {
+    	p = sp_eoi_put_head(p, v->text, h->head_len, matched);
+    	if (ncov > 0)
+    	{
+    		const sp_eoi_sect *s = &h->cov_sect;
+    		memcpy(p, v->text + s->off, s->head_len);
+    		p += s->head_len;
+    		for (k = 0; k < ncov; k++)
+    		{
+    			memcpy(p, v->text + v->cov[hits[k]].off, v->cov[hits[k]].len);
+    			p += v->cov[hits[k]].len;
+    		}
+    		memcpy(p, v->text + s->off + s->tail_off, s->len - s->tail_off);
+    		p += s->len - s->tail_off;
+    	}
+    	if (nser > 0)
+    	{
+    		const sp_eoi_sect *s = &h->series_sect;
+    		memcpy(p, v->text + s->off, s->head_len);
+    		p += s->head_len;
+    		for (i = 0; i < (uint32_t) nser; i++)
+    		{
+    			memcpy(p, v->text + v->series[i].off, v->series[i].len);
+    			p += v->series[i].len;
+    		}
+    		memcpy(p, v->text + s->off + s->tail_off, s->len - s->tail_off);
+    		p += s->len - s->tail_off;
+    	}
+    	memcpy(p, v->text + h->tail_off, h->text_len - h->tail_off);
+    	p += h->text_len - h->tail_off;
+    }
+
+    axiom_node_t *node = NULL;
+    FILE         *fp   = buf ? fmemopen(buf, p - buf, "r") : NULL;
+    if (fp)
+    {
+    	node = rp_process_xml(env, fp, NULL);
+    	fclose(fp);
+    }
+    SP_LOG_DEBUG("eoindex: %d of %u coverages match", ncov, h->ncov);
+
+    free(buf);
+    free(hits);
+    return node;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if DescribeEOCoverageSet is answered from an index.
+ */
+int sp_eoindex_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return rp_getEOIndexSecs(env, props) > 0 && sp_cache_enabled(env, props);
+}
+
+//-----------------------------------------------------------------------------
+/** Answer a DescribeEOCoverageSet from the index of its eoIds, harvesting
+ *  it first if need be, or else from the backend.
+ * @param env
+ * @param node the request.
+ * @param props
+ * @param wcs_version
+ * @return the response.
+ */
+axiom_node_t *sp_eoindex_invoke(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version)
+{
+    sp_eoi_query q;
+    sp_eoi_view  v;
+    sp_cache_key key;
+    size_t       len  = 0;
+    const time_t now  = time(NULL);
+    const int    secs = rp_getEOIndexSecs(env, props);
+
+    if (sp_eoi_parse(env, node, &q))
+    {
+    	return sp_eoi_backend(env, node, props, wcs_version);
+    }
+    sp_eoi_key(env, props, &q, key.h);
+
+    const void *map = sp_cache_map_blob(env, props, &key, &len);
+    if (map && 0 == sp_eoi_view_init(map, len, &v) &&
+    	now - v.head->harvested < secs)
+    {
+    	axiom_node_t *resp_node = sp_eoi_answer(env, &v, &q);
+    	sp_cache_unmap_blob(map, len);
+    	sp_stats_cache("eoindex", NULL != resp_node);
+    	return resp_node ? resp_node : sp_eoi_backend(env, node, props, wcs_version);
+    }
+    sp_cache_unmap_blob(map, len);
+    sp_stats_cache("eoindex", 0);
+
+    pthread_mutex_lock(&sp_eoi_failed_lock);
+    const int failed = key.h[0] == sp_eoi_failed.key.h[0] &&
+    		key.h[1] == sp_eoi_failed.key.h[1] && now < sp_eoi_failed.until;
+    pthread_mutex_unlock(&sp_eoi_failed_lock);
+    if (failed) return sp_eoi_backend(env, node, props, wcs_version);
+
+    axiom_node_t *harvest_node = sp_eoi_harvest_request(env, node, &q);
+    axiom_node_t *full_node    = sp_eoi_backend(env, harvest_node, props, wcs_version);
+    axiom_node_free_tree(harvest_node, env);
+
+    void *data = sp_eoi_harvest(env, full_node, &len);
+    if (full_node) axiom_node_free_tree(full_node, env);
+    if (NULL == data)
+    {
+    	pthread_mutex_lock(&sp_eoi_failed_lock);
+    	sp_eoi_failed.key    = key;
+    	sp_eoi_failed.until  = now + secs;
+    	pthread_mutex_unlock(&sp_eoi_failed_lock);
+    	return sp_eoi_backend(env, node, props, wcs_version);
+    }
+
+    sp_cache_put_blob(env, props, &key, SP_EOI_CTYPE, data, len);
+
+    axiom_node_t *resp_node = NULL;
+    if (0 == sp_eoi_view_init(data, len, &v)) resp_node = sp_eoi_answer(env, &v, &q);
+    free(data);
+
+    return resp_node ? resp_node : sp_eoi_backend(env, node, props, wcs_version);
+}
@@ -0,0 +1,701 @@
+/*
+ * Soap Proxy.
+ *
+ * Pre-flight size estimate of GetCoverage responses.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_estimate.c
+ *
+ * A GetCoverage of a whole scene at full resolution may have the backend
+ * produce gigabytes, and is only found to be that large once it has been
+ * answered.  With the coverage cache configured (CoverageCacheDir) the
+ * size of the response is therefore estimated before the backend is
+ * asked, from the CoverageDescription of the coverage as kept by
+ * sp_describe.c:
+ *
+ *  - the number of pixels along each axis of the Envelope, from the
+ *    GridEnvelope, the grid axes being matched to the Envelope axes by
+ *    their offsetVectors,
+ *  - the bytes per pixel, from the swe:interval of each band: 1 within
+ *    -128..255, 2 within 16 bits, 4 within 32 bits or for reals, 8 for
+ *    reals beyond float; 1 for a band without an interval,
+ *
+ * and from the request:
+ *
+ *  - a DimensionTrim keeps its share of the Envelope, a DimensionSlice a
+ *    single pixel,
+ *  - scal:ScaleByFactor, ScaleAxesByFactor (output = input * factor),
+ *    ScaleToSize and ScaleToExtent change the number of pixels,
+ *  - rsub:RangeSubset picks the bands.
+ *
+ * The estimate is the size of the pixels uncompressed; formats such as
+ * image/png come out smaller.  A request with a subset on an axis the
+ * Envelope does not have, with a bound that is not a number or with a
+ * subsettingCrs is not estimated, nor is a coverage without a description.
+ *
+ * The estimate is used to
+ *
+ *  - refuse requests larger than MaxCoverageMB with
+ *    SP_USER_ERR_COVERAGE_TOO_LARGE before the backend is asked.  With
+ *    MaxCoverageMB set, the description of a coverage not in the cache
+ *    yet is fetched first, with a DescribeCoverage of its own,
+ *  - choose the lane of the request, see sp_sched_classify(), and whether
+ *    to split it into strips, see sp_tile_plan(), in place of the sizes
+ *    seen before for the same CoverageId, which say little about a
+ *    request with a different trim or scaling,
+ *  - size the buffer the coverage is read into, see sp_load_binary_file().
+ *
+ * It is kept in the sp_req_stats of the request, see sp_estimate_bytes().
+ *
+ */
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "soap_proxy.h"
+#include "sp_estimate.h"
+#include "sp_cache.h"
+#include "sp_describe.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_EST_MAX_AXES   8
+#define SP_EST_MAX_BANDS  256
+#define SP_EST_LABEL_LEN  64
+
+//
+// What the estimate needs of a CoverageDescription, with the subsets and
+// scaling of the request applied.
+//
+struct sp_est_struct
+{
+    int                 n_axes;
+    char                labels[SP_EST_MAX_AXES][SP_EST_LABEL_LEN];
+    double              lower [SP_EST_MAX_AXES];
+    double              upper [SP_EST_MAX_AXES];
+    double              pixels[SP_EST_MAX_AXES];
+    double              scale [SP_EST_MAX_AXES];   // scaling factor
+    double              size  [SP_EST_MAX_AXES];   // target size, 0 if none
+
+    int                 n_bands;
+    const axis2_char_t *band_names[SP_EST_MAX_BANDS];
+    int                 band_bytes[SP_EST_MAX_BANDS];
+    double              pixel_bytes;               // of the bands requested
+};
+
+typedef struct sp_est_struct sp_est;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_est_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = AXIOM_ELEMENT == axiom_node_get_node_type(node, env) ?
+    		axiom_node_get_data_element(node, env) : NULL;
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Parse numbers separated by white space.
+ * @param s
+ * @param v set to the numbers.
+ * @param max
+ * @return the number of numbers, -1 if s is NULL or has anything else.
+ */
+static int sp_est_numbers(const axis2_char_t *s, double *v, const int max)
+{
+    int n = 0;
+
+    if (NULL == s) return -1;
+    while (1)
+    {
+    	while (isspace((unsigned char) *s)) s++;
+    	if ('\0' == *s) return n;
+    	if (n >= max) return -1;
+
+    	char *end;
+    	v[n] = strtod(s, &end);
+    	if (end == s || ! isfinite(v[n])) return -1;
+    	s = end;
+    	n++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** @return 0 if s is a single number, set to v, -1 otherwise.
+ */
+static int sp_est_number(const axis2_char_t *s, double *v)
+{
+    return 1 == sp_est_numbers(s, v, 1) ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+/** Find a name in a list, ignoring white space around it.
+ * @return the index of name, -1 if it is not there.
+ */
+static int sp_est_find(
+    const axis2_char_t *name,
+    const char * const *list,
+    const int           n)
+{
+    int i;
+
+    if (NULL == name) return -1;
+    while (isspace((unsigned char) *name)) name++;
+    const size_t len = strcspn(name, " \t\r\n");
+
+    for (i = 0; i < n; i++)
+    {
+    	if (list[i] && 0 == strncmp(list[i], name, len) && '\0' == list[i][len])
+    		return i;
+    }
+    for (i = 0; i < n; i++)
+    {
+    	if (list[i] && 0 == strncasecmp(list[i], name, len) && '\0' == list[i][len])
+    		return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the index of the axis called dim, -1 if there is none.  An axis
+ *  given as a URI, as in scaling, is known by the last part of it.
+ */
+static int sp_est_axis(const sp_est *est, const axis2_char_t *dim)
+{
+    const char *labels[SP_EST_MAX_AXES];
+    int         j;
+
+    if (NULL == dim) return -1;
+    const char *slash = strrchr(dim, '/');
+    if (slash && slash[1]) dim = slash + 1;
+
+    for (j = 0; j < est->n_axes; j++) labels[j] = est->labels[j];
+    return sp_est_find(dim, labels, est->n_axes);
+}
+
+//-----------------------------------------------------------------------------
+/** @return the index of the band called name, -1 if there is none.
+ */
+static int sp_est_band(const sp_est *est, const axis2_char_t *name)
+{
+    return sp_est_find(name, (const char * const *) est->band_names, est->n_bands);
+}
+
+//-----------------------------------------------------------------------------
+/** Guess the size of the values of a band from the range it allows.
+ * @param interval the text of its swe:interval, may be NULL.
+ * @return bytes.
+ */
+static int sp_est_band_bytes(const axis2_char_t *interval)
+{
+    double v[2];
+
+    if (2 != sp_est_numbers(interval, v, 2)) return 1;
+    const double lo = fmin(v[0], v[1]);
+    const double hi = fmax(v[0], v[1]);
+
+    if (floor(lo) == lo && floor(hi) == hi)
+    {
+    	if (lo >= -128.0 && hi <= 255.0) return 1;
+    	if (lo >= -32768.0 && hi <= 65535.0) return 2;
+    	if (lo >= -2147483648.0 && hi <= 4294967295.0) return 4;
+    }
+    // The float range is printed rounded.
+    return fmax(-lo, hi) > FLT_MAX * (1.0 + 1e-6) ? 8 : 4;
+}
+
+//-----------------------------------------------------------------------------
+/** Take what the estimate needs from a CoverageDescription.
+ * @return 0 on success, -1 if something is missing.
+ */
+static int sp_est_describe(
+    const axutil_env_t *env,
+    axiom_node_t       *desc,
+    sp_est             *est)
+{
+    memset(est, 0, sizeof(*est));
+
+    // Axes of the Envelope.
+    axiom_node_t    *env_node = rp_find_named_child(env, desc, "Envelope", 1);
+    axiom_element_t *env_el   = env_node ?
+    		axiom_node_get_data_element(env_node, env) : NULL;
+    const axis2_char_t *labels = env_el ?
+    		axiom_element_get_attribute_value_by_name(env_el, env, "axisLabels") :
+    		NULL;
+    int n = 0;
+
+    while (labels && *labels)
+    {
+    	while (isspace((unsigned char) *labels)) labels++;
+    	const size_t len = strcspn(labels, " \t\r\n");
+    	if (0 == len) break;
+    	if (n >= SP_EST_MAX_AXES || len >= SP_EST_LABEL_LEN) return -1;
+    	memcpy(est->labels[n], labels, len);
+    	est->labels[n][len] = '\0';
+    	labels += len;
+    	n++;
+    }
+    est->n_axes = n;
+
+    if (0 == n ||
+    	n != sp_est_numbers(sp_get_text_el(rp_find_named_child(
+    			env, env_node, "lowerCorner", 0), env), est->lower, n) ||
+    	n != sp_est_numbers(sp_get_text_el(rp_find_named_child(
+    			env, env_node, "upperCorner", 0), env), est->upper, n))
+    {
+    	return -1;
+    }
+
+    // Grid size.
+    axiom_node_t *grid_node = rp_find_named_child(env, desc, "GridEnvelope", 1);
+    double        low [SP_EST_MAX_AXES];
+    double        high[SP_EST_MAX_AXES];
+
+    if (NULL == grid_node ||
+    	n != sp_est_numbers(sp_get_text_el(rp_find_named_child(
+    			env, grid_node, "low", 0), env), low, n) ||
+    	n != sp_est_numbers(sp_get_text_el(rp_find_named_child(
+    			env, grid_node, "high", 0), env), high, n))
+    {
+    	return -1;
+    }
+
+    // Grid axis i runs along the Envelope axis its offsetVector moves
+    // most in, if they tell; otherwise the axes are in the same order.
+    int           axis_of[SP_EST_MAX_AXES];
+    unsigned      used = 0;
+    int           i, j, k = 0;
+    axiom_node_t *off = rp_find_named_child(env, desc, "offsetVector", 1);
+
+    for (; off && k < n; off = axiom_node_get_next_sibling(off, env))
+    {
+    	if (axutil_strcmp(sp_est_localname(env, off), "offsetVector")) continue;
+
+    	double v[SP_EST_MAX_AXES];
+    	if (n != sp_est_numbers(sp_get_text_el(off, env), v, n)) break;
+    	for (j = 1, axis_of[k] = 0; j < n; j++)
+    	{
+    		if (fabs(v[j]) > fabs(v[axis_of[k]])) axis_of[k] = j;
+    	}
+    	used |= 1u << axis_of[k++];
+    }
+    if (k != n || used != (1u << n) - 1)
+    {
+    	for (i = 0; i < n; i++) axis_of[i] = i;
+    }
+    for (i = 0; i < n; i++)
+    {
+    	est->pixels[axis_of[i]] = high[i] - low[i] + 1;
+    	est->scale[i]           = 1.0;
+    }
+
+    // Bands.
+    axiom_node_t *rec   = rp_find_named_child(env, desc, "DataRecord", 1);
+    axiom_node_t *field = rec ? axiom_node_get_first_child(rec, env) : NULL;
+
+    for (; field; field = axiom_node_get_next_sibling(field, env))
+    {
+    	if (axutil_strcmp(sp_est_localname(env, field), "field")) continue;
+    	if (est->n_bands >= SP_EST_MAX_BANDS) return -1;
+
+    	axiom_element_t *el = axiom_node_get_data_element(field, env);
+    	est->band_names[est->n_bands] =
+    			axiom_element_get_attribute_value_by_name(el, env, "name");
+    	est->band_bytes[est->n_bands] = sp_est_band_bytes(sp_get_text_el(
+    			rp_find_named_child(env, field, "interval", 1), env));
+    	est->pixel_bytes += est->band_bytes[est->n_bands++];
+    }
+    if (0 == est->n_bands) est->pixel_bytes = 1;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Apply a RangeSubset.
+ * @return 0 on success, -1 if a band is not known.
+ */
+static int sp_est_range(
+    const axutil_env_t *env,
+    axiom_node_t       *rsub,
+    sp_est             *est)
+{
+    axiom_node_t *item  = axiom_node_get_first_child(rsub, env);
+    double        bytes = 0;
+
+    for (; item; item = axiom_node_get_next_sibling(item, env))
+    {
+    	if (axutil_strcmp(sp_est_localname(env, item), "RangeItem")) continue;
+
+    	axiom_node_t *comp  = rp_find_named_child(env, item, "RangeComponent", 0);
+    	axiom_node_t *range = rp_find_named_child(env, item, "RangeInterval", 0);
+    	int           first, last;
+
+    	if (comp)
+    	{
+    		first = last = sp_est_band(est, sp_get_text_el(comp, env));
+    	}
+    	else if (range)
+    	{
+    		first = sp_est_band(est, sp_get_text_el(
+    				rp_find_named_child(env, range, "startComponent", 0), env));
+    		last  = sp_est_band(est, sp_get_text_el(
+    				rp_find_named_child(env, range, "endComponent", 0), env));
+    	}
+    	else
+    	{
+    		return -1;
+    	}
+    	if (first < 0 || last < first) return -1;
+
+    	for (; first <= last; first++) bytes += est->band_bytes[first];
+    }
+
+    if (bytes > 0) est->pixel_bytes = bytes;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Apply the scaling of one axis, a ScaleAxis, TargetAxisSize or
+ *  TargetAxisExtent.
+ * @return 0 on success, -1 if it cannot be applied.
+ */
+static int sp_est_scale_axis(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char         *kind,
+    sp_est             *est)
+{
+    const int j = sp_est_axis(est, sp_get_text_el(
+    		rp_find_named_child(env, node, "axis", 0), env));
+    double    v, w;
+
+    if (j < 0) return -1;
+
+    if (0 == strcmp(kind, "ScaleAxis"))
+    {
+    	if (sp_est_number(sp_get_text_el(
+    			rp_find_named_child(env, node, "scaleFactor", 0), env), &v) ||
+    		v <= 0)
+    	{
+    		return -1;
+    	}
+    	est->scale[j] = v;
+    }
+    else if (0 == strcmp(kind, "TargetAxisSize"))
+    {
+    	if (sp_est_number(sp_get_text_el(
+    			rp_find_named_child(env, node, "targetSize", 0), env), &v) ||
+    		v <= 0)
+    	{
+    		return -1;
+    	}
+    	est->size[j] = v;
+    }
+    else
+    {
+    	if (sp_est_number(sp_get_text_el(
+    			rp_find_named_child(env, node, "low",  0), env), &v) ||
+    		sp_est_number(sp_get_text_el(
+    			rp_find_named_child(env, node, "high", 0), env), &w) ||
+    		w < v)
+    	{
+    		return -1;
+    	}
+    	est->size[j] = w - v + 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Apply the extensions of a GetCoverage that change its size.
+ * @return 0 on success, -1 if the request cannot be estimated.
+ */
+static int sp_est_extension(
+    const axutil_env_t *env,
+    axiom_node_t       *ext,
+    sp_est             *est)
+{
+    axiom_node_t *child = axiom_node_get_first_child(ext, env);
+    int           j;
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	const axis2_char_t *name = sp_est_localname(env, child);
+    	if (NULL == name) continue;
+
+    	if (0 == strcmp(name, "ScaleByFactor"))
+    	{
+    		double v;
+    		if (sp_est_number(sp_get_text_el(
+    				rp_find_named_child(env, child, "scaleFactor", 0), env), &v) ||
+    			v <= 0)
+    		{
+    			return -1;
+    		}
+    		for (j = 0; j < est->n_axes; j++) est->scale[j] = v;
+    	}
+    	else if (0 == strcmp(name, "ScaleAxesByFactor") ||
+    			 0 == strcmp(name, "ScaleToSize") ||
+    			 0 == strcmp(name, "ScaleToExtent"))
+    	{
+    		axiom_node_t *axis = axiom_node_get_first_child(child, env);
+    		for (; axis; axis = axiom_node_get_next_sibling(axis, env))
+    		{
+    			const axis2_char_t *kind = sp_est_localname(env, axis);
+    			if (kind && sp_est_scale_axis(env, axis, kind, est)) return -1;
+    		}
+    	}
+    	else if (0 == strcmp(name, "RangeSubset"))
+    	{
+    		if (sp_est_range(env, child, est)) return -1;
+    	}
+    	else if (0 == strcmp(name, "subsettingCrs"))
+    	{
+    		return -1;
+    	}
+    	// outputCrs, Interpolation etc. keep the size about the same.
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Apply the subsets and extensions of a GetCoverage.
+ * @return 0 on success, -1 if the request cannot be estimated.
+ */
+static int sp_est_request(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    sp_est             *est)
+{
+    axiom_node_t *child = axiom_node_get_first_child(node, env);
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	const axis2_char_t *name = sp_est_localname(env, child);
+    	if (NULL == name) continue;
+
+    	if (0 == strcmp(name, "DimensionSlice"))
+    	{
+    		const int j = sp_est_axis(est, sp_get_text_el(
+    				rp_find_named_child(env, child, "Dimension", 0), env));
+    		if (j < 0) return -1;
+    		est->pixels[j] = 1;
+    	}
+    	else if (0 == strcmp(name, "DimensionTrim"))
+    	{
+    		const int j = sp_est_axis(est, sp_get_text_el(
+    				rp_find_named_child(env, child, "Dimension", 0), env));
+    		if (j < 0) return -1;
+
+    		axiom_node_t *lo_node = rp_find_named_child(env, child, "TrimLow",  0);
+    		axiom_node_t *hi_node = rp_find_named_child(env, child, "TrimHigh", 0);
+    		double        lo      = est->lower[j];
+    		double        hi      = est->upper[j];
+
+    		if ((lo_node && sp_est_number(sp_get_text_el(lo_node, env), &lo)) ||
+    			(hi_node && sp_est_number(sp_get_text_el(hi_node, env), &hi)))
+    		{
+    			return -1;
+    		}
+    		lo = fmax(lo, est->lower[j]);
+    		hi = fmin(hi, est->upper[j]);
+
+    		const double extent = est->upper[j] - est->lower[j];
+    		if (extent > 0)
+    		{
+    			est->pixels[j] = hi > lo ?
+    					ceil(est->pixels[j] * (hi - lo) / extent) : 1;
+    		}
+    	}
+    	else if (0 == strcmp(name, "Extension"))
+    	{
+    		if (sp_est_extension(env, child, est)) return -1;
+    	}
+    	// CoverageId, format, mediaType
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the estimated size of the response, in bytes.
+ */
+static double sp_est_total(const sp_est *est)
+{
+    double pixels = 1;
+    int    j;
+
+    for (j = 0; j < est->n_axes; j++)
+    {
+    	pixels *= est->size[j] > 0 ? est->size[j] :
+    			fmax(1, ceil(est->pixels[j] * est->scale[j]));
+    }
+    return pixels * est->pixel_bytes;
+}
+
+//-----------------------------------------------------------------------------
+/** Ask for the description of a coverage, keeping it in the cache.
+ * @return the CoverageDescriptions, NULL on error.
+ */
+static axiom_node_t *sp_est_fetch(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    const axis2_char_t *cov_id)
+{
+    axiom_element_t    *req_el  = axiom_node_get_data_element(node, env);
+    const axis2_char_t *version = axiom_element_get_attribute_value_by_name(
+    		req_el, env, "version");
+
+    axiom_node_t      *dc_node = NULL;
+    axiom_node_t      *id_node = NULL;
+    axiom_namespace_t *wcs_ns  = axiom_namespace_create(
+    		env, "http://www.opengis.net/wcs/2.0", "wcs");
+    axiom_element_t   *dc_el   = axiom_element_create(
+    		env, NULL, "DescribeCoverage", wcs_ns, &dc_node);
+    axiom_element_add_attribute(dc_el, env,
+    		axiom_attribute_create(env, "service", "WCS", NULL), dc_node);
+    axiom_element_add_attribute(dc_el, env,
+    		axiom_attribute_create(env, "version", version ? version : "2.0.1",
+    				NULL), dc_node);
+    axiom_element_t   *id_el   = axiom_element_create(
+    		env, dc_node, "CoverageId", wcs_ns, &id_node);
+    axiom_element_set_text(id_el, env, cov_id, id_node);
+
+    axiom_node_t *resp_node = sp_describe_invoke(env, dc_node, props, SP_WCS_V200);
+    axiom_node_free_tree(dc_node, env);
+
+    // A failure is for the GetCoverage itself to report.
+    axutil_error_set_status_code(env->error, AXIS2_SUCCESS);
+    return resp_node;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/** Estimate the size of the response to a GetCoverage, keep the estimate
+ *  for the request and refuse it if it is larger than MaxCoverageMB.
+ * @param env
+ * @param props
+ * @param node the GetCoverage request.
+ * @return 0 if the request may go ahead, -1 if it is refused, with
+ *  SP_USER_ERR_COVERAGE_TOO_LARGE set.
+ */
+int sp_estimate_check(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    sp_req_stats *rs = sp_stats_current();
+    if (rs)
+    {
+    	rs->est_node  = node;
+    	rs->est_bytes = 0;
+    }
+
+    const axis2_char_t *cov_id = sp_get_text_el(
+    		rp_find_named_child(env, node, "CoverageId", 0), env);
+    if (NULL == cov_id || ! sp_cache_enabled(env, props)) return 0;
+
+    const int      max_mb  = rp_getMaxCoverageMB(env, props);
+    const uint64_t max_len = max_mb > 0 ? (uint64_t) max_mb << 20 : 0;
+
+    // The description, from the cache or, if there is a limit, the backend.
+    sp_cache_key  key;
+    size_t        len  = 0;
+    axiom_node_t *root = NULL;
+
+    sp_cache_description_key(env, props, cov_id, &key);
+    char *doc = sp_cache_get_description(env, props, &key, &len);
+    if (doc)
+    {
+    	FILE *fp = fmemopen(doc, len, "r");
+    	if (fp)
+    	{
+    		root = rp_process_xml(env, fp, NULL);
+    		fclose(fp);
+    	}
+    	free(doc);
+    }
+    else if (max_len > 0)
+    {
+    	root = sp_est_fetch(env, props, node, cov_id);
+    }
+
+    axiom_node_t *desc  = root ?
+    		rp_find_named_child(env, root, "CoverageDescription", 0) : NULL;
+    double        bytes = -1;
+    sp_est        est;
+
+    if (desc && 0 == sp_est_describe(env, desc, &est) &&
+    	0 == sp_est_request(env, node, &est))
+    {
+    	bytes = sp_est_total(&est);
+    }
+    if (root) axiom_node_free_tree(root, env);
+
+    if (bytes < 0)
+    {
+    	SP_LOG_DEBUG("GetCoverage of %s: size not estimated", cov_id);
+    	return 0;
+    }
+
+    const uint64_t est_len = bytes < (double) UINT64_MAX ?
+    		(uint64_t) bytes : UINT64_MAX;
+    if (rs) rs->est_bytes = est_len > 0 ? est_len : 1;
+
+    if (max_len > 0 && est_len > max_len)
+    {
+    	SP_ERROR(env, SP_USER_ERR_COVERAGE_TOO_LARGE);
+    	SP_LOG_WARNING("GetCoverage of %s refused, about %llu MB", cov_id,
+    			(unsigned long long) (est_len >> 20));
+    	return -1;
+    }
+
+    SP_LOG_DEBUG("GetCoverage of %s: about %llu bytes", cov_id,
+    		(unsigned long long) est_len);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** The size of the response to a request, as estimated by
+ *  sp_estimate_check().
+ * @param node the request.
+ * @return bytes, 0 if not known.
+ */
+uint64_t sp_estimate_bytes(axiom_node_t *node)
+{
+    const sp_req_stats *rs = sp_stats_current();
+    return (rs && node && rs->est_node == node) ? rs->est_bytes : 0;
+}
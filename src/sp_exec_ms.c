@@ -36,6 +36,10 @@
  * 
  */
 
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +49,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #ifndef __USE_GNU
 #  define __USE_GNU
@@ -53,6 +58,7 @@
 
 
 #include "soap_proxy.h"
+#include "sp_stats.h"
 
 #include <axis2_svc.h>
 
@@ -65,49 +71,109 @@ void do_child(
     int rrpipe[],
     int wwpipe[]);
 
+//-----------------------------------------------------------------------------
 /**
- * Executes "mapserv -v", to get version info.
- * The response from mapserv is stored in a temp file.
- * The file is already unlinked on return - it can be used until
- * closed,  It is the responsibility of the caller to close the file.
- * In case of error the method returns -1.
+ * Executes a program directly (no shell) and collects its standard output.
+ * argv[0] is looked up in PATH if it contains no '/'.  Output beyond
+ * len-1 bytes is discarded.
  *
- * @return filedescriptor of response file, or -1 on error.
+ * @param env
+ * @param argv NULL terminated argument vector.
+ * @param buf receives the output, NUL terminated.
+ * @param len size of buf.
+ * @return number of bytes in buf, or -1 on error.
  */
 int
-sp_execMs_dashV(
+sp_exec_capture(
     const axutil_env_t *env,
-    const axis2_char_t *msexec)
+    char *const         argv[],
+    char               *buf,
+    const size_t        len)
 {
-    char tmpFname[32];
-    char exec_str[SP_MAX_MPATHS_LEN+32+8];
+    int out[2];
 
-    int  tmp_fd = -1;
+    buf[0] = '\0';
+    if (pipe2(out, O_CLOEXEC) == -1)
+    {
+        rp_log_error(env, "(%s:%d) pipe: %s\n",
+                     __FILE__, __LINE__, strerror(errno));
+        return -1;
+    }
 
-    if (strlen(msexec) > SP_MAX_MPATHS_LEN)
+    pid_t cpid = fork();
+    if (-1 == cpid)
     {
-    	rp_log_error(env, "Msexec string too long (%d)\n", strlen(msexec));
+        rp_log_error(env, "(%s:%d) fork: %s\n",
+                     __FILE__, __LINE__, strerror(errno));
+        close(out[0]);
+        close(out[1]);
         return -1;
     }
 
-    strcpy(tmpFname, "/tmp/msvtXXXXXX");
-    tmp_fd = mkostemp(tmpFname, O_CLOEXEC);
-    if (tmp_fd < 0)
+    if (0 == cpid)
+    {
+        // dup2 clears close-on-exec of the new descriptor.
+        dup2(out[1], STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(out[1]);
+
+    size_t  n_got = 0;
+    ssize_t n_read;
+    while (n_got < len - 1 &&
+           (n_read = read(out[0], buf + n_got, len - 1 - n_got)) != 0)
+    {
+        if (n_read < 0)
+        {
+            if (EINTR == errno) continue;
+            break;
+        }
+        n_got += n_read;
+    }
+    buf[n_got] = '\0';
+    close(out[0]);
+
+    int status = 0;
+    while (waitpid(cpid, &status, 0) < 0 && EINTR == errno)
+        ;
+
+    // Left to the caller to report, e.g. svnversion may be missing.
+    if (0 == n_got && ! (WIFEXITED(status) && 0 == WEXITSTATUS(status)))
     {
-        perror("mkstemp in rp_execMs_dashV");
         return -1;
     }
+    return (int) n_got;
+}
 
-    sprintf(exec_str, "%s -v >%s", msexec, tmpFname);
-    int retval=system(exec_str);
-    if (retval < 0)
+//-----------------------------------------------------------------------------
+/**
+ * Executes "mapserv -v", to get version info.
+ *
+ * @param env
+ * @param msexec path of the mapserv executable.
+ * @param buf receives the output, NUL terminated.
+ * @param len size of buf.
+ * @return number of bytes in buf, or -1 on error.
+ */
+int
+sp_execMs_dashV(
+    const axutil_env_t *env,
+    const axis2_char_t *msexec,
+    char               *buf,
+    const size_t        len)
+{
+    if (strlen(msexec) > SP_MAX_MPATHS_LEN)
     {
-    	rp_log_error(env, "system call failed.\n");
-        unlink(tmpFname);
+    	rp_log_error(env, "Msexec string too long (%d)\n", strlen(msexec));
         return -1;
     }
-    unlink(tmpFname);
-    return tmp_fd;
+
+    char *const argv[] = { (char *) msexec, "-v", NULL };
+    return sp_exec_capture(env, argv, buf, len);
 }
 
 /**
@@ -163,6 +229,8 @@ sp_execMapserv(
     }
 
 
+    sp_stamp_t t0 = sp_stats_now();
+
     if (pipe(rrpipe) == -1 ||
         pipe(wwpipe)== -1 )
     {
@@ -193,6 +261,8 @@ sp_execMapserv(
     else
     {
       /* ---- parent -------*/
+      sp_stats_phase(SP_PH_CONNECT, t0);
+      sp_stats_count_spawn();
 
       close(rrpipe[0]);          /* Close unused read end */
       close(wwpipe[1]);
@@ -200,6 +270,8 @@ sp_execMapserv(
       /* send the request to mapserver's stdin */
       write(rrpipe[1], req, reqLen);
       close(rrpipe[1]);          /* Reader will see EOF */
+      sp_stats_add_bytes_out(reqLen);
+      sp_stats_mark_sent();
       
       axis2_char_t *tempBuf = (axis2_char_t *)AXIS2_MALLOC(env->allocator, SP_BUF_READSIZE);
 
@@ -235,6 +307,7 @@ sp_execMapserv(
               nRead  = read(wwpipe[0], tempBuf, SP_BUF_READSIZE);
           }
       }
+      sp_stats_first_byte();
       while (nRead > 0)
       {
           response_size += nRead;
@@ -281,6 +354,8 @@ void do_child(
      *     REQUEST_METHOD=POST
      *     CONTENT_LENGTH=<size-of-request>
      *     MS_MAPFILE=<path-to-mapfile>
+     *  and, as a CGI server would for an X-Request-Id header:
+     *     HTTP_X_REQUEST_ID=<id-of-the-soap-request>
      *
      *  Then execute mapserver, sending input via stdin, e.g.:
      *     cat <request-text> | $MAPSERVER_BINARY
@@ -306,10 +381,15 @@ void do_child(
     char *mapfStr   = (char*) AXIS2_MALLOC(env->allocator, mapfBufSize);
     snprintf(mapfStr, mapfBufSize, "MS_MAPFILE=%s", mapfile);
 
+    char reqIdStr[SP_REQ_ID_LEN + 20];
+    snprintf(reqIdStr, sizeof(reqIdStr), "HTTP_X_REQUEST_ID=%s",
+             sp_stats_req_id());
+
     char *msenviron[] = {
         "REQUEST_METHOD=POST",
         contStr,
         mapfStr,
+        reqIdStr,
         NULL
     };
 
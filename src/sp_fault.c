@@ -39,11 +39,40 @@
 #include <stdarg.h>
 #include <axutil_error.h>
 #include "soap_proxy.h"
+#include "sp_log.h"
 
-#define SP_SELF_ID_STRING "soap_proxy"
 
 static int rp_errors_initialized = 0;
 
+// Symbolic names of sp_error_codes, in the same order as the enum.
+static const char *sp_error_code_names[] =
+{
+	"SP_USER_ERR_NO_INPUT",
+	"SP_USER_ERR_BAD_OP",
+	"SP_USER_ERR_BAD_REQ",
+	"SP_USER_ERR_IMAGE_FAILED",
+	"SP_USER_ERR_DATA_LOAD",
+	"SP_USER_ERR_E0_PARSE_MS_OUT",
+	"SP_USER_ERR_E1_PARSE_MS_OUT",
+	"SP_USER_ERR_EMPTY_XML",
+	"SP_USER_ERR_NO_HASHMATCH",
+	"SP_USER_ERR_CONTENTTYPE",
+	"SP_USER_ERR_CONTENTHEADERS",
+	"SP_USER_ERR_NOT_AUTHORIZED",
+	"SP_USER_ERR_RATE_LIMITED",
+	"SP_USER_ERR_NO_SUCH_JOB",
+	"SP_USER_ERR_JOB_NOT_READY",
+	"SP_USER_ERR_COVERAGE_TOO_LARGE",
+
+	"SP_SYS_ERR_INTERNAL",
+	"SP_SYS_ERR_MS_EXEC",
+	"SP_SYS_ERR_MS_OUT_PROCESSING",
+	"SP_SYS_ERR_PROPSLOAD",
+	"SP_SYS_ERR_NOT_IMPLEMENTED",
+	"SP_SYS_ERR_BACKEND_DRAINING",
+	"SP_SYS_ERR_BACKEND_BUSY"
+};
+
 extern const axis2_char_t* axutil_error_messages[];
 
 void rp_init_errors()
@@ -72,6 +101,16 @@ void rp_init_errors()
 			"Unrecognised Content-type. See error log.";
 	axutil_error_messages[SP_USER_ERR_CONTENTHEADERS] =
 			"Error parsing Mapserver response headers";
+	axutil_error_messages[SP_USER_ERR_NOT_AUTHORIZED] =
+			"Not authorized for administrative operations.";
+	axutil_error_messages[SP_USER_ERR_RATE_LIMITED] =
+			"Request limit of this client exceeded, try again later.";
+	axutil_error_messages[SP_USER_ERR_NO_SUCH_JOB] =
+			"Unknown JobId.";
+	axutil_error_messages[SP_USER_ERR_JOB_NOT_READY] =
+			"Job has not finished successfully, see GetJobStatus.";
+	axutil_error_messages[SP_USER_ERR_COVERAGE_TOO_LARGE] =
+			"Requested coverage is too large, subset or scale it down.";
 
 	axutil_error_messages[SP_SYS_ERR_INTERNAL] =
 			"Internal Processing Error";
@@ -83,10 +122,26 @@ void rp_init_errors()
 			"Failed to load required properties.";
 	axutil_error_messages[SP_SYS_ERR_NOT_IMPLEMENTED] =
 			"Not Implemented.";
+	axutil_error_messages[SP_SYS_ERR_BACKEND_DRAINING] =
+			"Backend is being drained, try again later.";
+	axutil_error_messages[SP_SYS_ERR_BACKEND_BUSY] =
+			"Backend is busy, try again later.";
 
 	rp_errors_initialized = 1;
 }
 
+//-----------------------------------------------------------------------------
+/** Get the symbolic name of one of sp_error_codes.
+ * @param code
+ * @return name of the code, or "OTHER" if code is not one of ours.
+ */
+const char *sp_error_code_name(const int code)
+{
+	int i = code - SP_USER_ERR_NO_INPUT;
+	if (i < 0 || i >= SP_ERR_NCODES) return "OTHER";
+	return sp_error_code_names[i];
+}
+
 //-----------------------------------------------------------------------------
 axiom_node_t *
 rp_error_elem(
@@ -125,18 +180,12 @@ int rp_log_error(
 {
 	va_list args;
 	int ret = 0;
-	axis2_char_t *buf = NULL;
-
-	int buf_len = strlen(format) + strlen(SP_SELF_ID_STRING) + 9;
-	buf = (axis2_char_t *) AXIS2_MALLOC(env->allocator, buf_len);
-	sprintf(buf," *** %s: %s", SP_SELF_ID_STRING, format);
 
+	// The format string identifies the call site for rate limiting.
 	va_start (args, format);
-	ret = vfprintf(stderr, (char *)buf, args);
+	ret = sp_log_vwrite(SP_LOG_LEVEL_ERROR, NULL, 0, format, format, args);
 	va_end (args);
-	fflush(stderr);
 
-	AXIS2_FREE(env->allocator, buf);
 	return ret;
 }
 
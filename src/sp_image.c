@@ -41,7 +41,9 @@
 //#define NDEBUG
 
 #include <assert.h>
+#include <limits.h>
 #include "soap_proxy.h"
+#include "sp_stats.h"
 
 #include <axutil_linked_list.h>
 
@@ -76,10 +78,10 @@ char * compose_buffer(
             if (NULL != ts)
             {
                 memcpy(ip, ts->buf, ts->size);
-                ip += ts->size;
+                ip    += ts->size;
+                check += ts->size;
                 AXIS2_FREE(env->allocator, ts);
                 le->data = NULL;
-                check += ts->size;
             }
             le = le->next;
         }
@@ -90,16 +92,99 @@ char * compose_buffer(
 }
 
 //-----------------------------------------------------------------------------
-// Reads arbitrary binary data from the file fp.
-//  fp is positioned at the start of the file.
+// Reads binary data from the reader rd, up to the end of input, straight
+// into the buffer bin_data of the expected size, grown if needed, but not
+// beyond INT_MAX bytes.
+//
+static char *sp_load_binary_sized(
+    const axutil_env_t *env,
+    char               *header_blob,
+    sp_reader          *rd,
+    int                *len,
+    char               *bin_data,
+    size_t              size)
+{
+    const size_t hdr_size = header_blob ? strlen(header_blob) : 0;
+    size_t       fill     = hdr_size;
+
+    if (hdr_size > SP_IMG_BUF_SIZE)
+    {
+        // failsafe - should never happen.
+        AXIS2_FREE(env->allocator, bin_data);
+        return NULL;
+    }
+    if (hdr_size) memcpy(bin_data, header_blob, hdr_size);
+
+    while ( 1 )
+    {
+        if (size - fill < SP_IMG_BUF_SIZE && size < INT_MAX)
+        {
+            const size_t new_size = size < INT_MAX / 2 ? 2 * size : INT_MAX;
+            char *p = (char *)AXIS2_REALLOC(env->allocator, bin_data, new_size);
+            if (NULL == p)
+            {
+                AXIS2_FREE(env->allocator, bin_data);
+                *len = 0;
+                return NULL;
+            }
+            bin_data = p;
+            size     = new_size;
+        }
+        if (fill == size)
+        {
+            rp_log_error(env, "(%s:%d) binary data larger than %d bytes.\n",
+                         __FILE__, __LINE__, INT_MAX);
+            AXIS2_FREE(env->allocator, bin_data);
+            *len = 0;
+            return NULL;
+        }
+
+        int n_read = sp_reader_read(rd, bin_data + fill, size - fill);
+        if (0 == n_read) break;
+
+        fill += n_read;
+        sp_stats_add_bytes_in(n_read);
+    }
+
+    if (0 == fill)
+    {
+        AXIS2_FREE(env->allocator, bin_data);
+        return NULL;
+    }
+    // Give back what a compressed format did not need.
+    if (size > 2 * fill)
+    {
+        char *p = (char *)AXIS2_REALLOC(env->allocator, bin_data, fill);
+        if (p) bin_data = p;
+    }
+
+    *len = (int) fill;
+    return bin_data;
+}
+
+//-----------------------------------------------------------------------------
+// Reads arbitrary binary data from the reader rd, up to the end of input.
 //
 char *sp_load_binary_file(
     const axutil_env_t *env,
     char               *header_blob,
-    axutil_stream_t    *st,
+    sp_reader          *rd,
     int                *len)
 {
     *len                            = 0;
+
+    // The size of a GetCoverage may be known ahead, see sp_estimate.c, but
+    // a large one is not allocated in one go: the estimate may be far off.
+    const sp_req_stats *rs   = sp_stats_current();
+    const size_t        size = rs ? (size_t) (rs->est_bytes < SP_IMG_PREALLOC_MAX ?
+    		rs->est_bytes : SP_IMG_PREALLOC_MAX) + 2 * SP_IMG_BUF_SIZE : 0;
+    char               *buf  = (rs && rs->est_bytes > 0 && size > 0) ?
+    		(char *)AXIS2_MALLOC(env->allocator, size) : NULL;
+    if (buf)
+    {
+        return sp_load_binary_sized(env, header_blob, rd, len, buf, size);
+    }
+
     char                 *bin_data  = NULL;
     TmpStore             *ts        = NULL;
     axutil_linked_list_t *ll        = axutil_linked_list_create(env);
@@ -126,16 +211,31 @@ char *sp_load_binary_file(
     while ( 1 )
     {
         ts = (TmpStore *)AXIS2_MALLOC(env->allocator, sizeof(TmpStore));
-        n_read = axutil_stream_read(st, env, ts->buf, SP_IMG_BUF_SIZE);
+        n_read = sp_reader_read(rd, ts->buf, SP_IMG_BUF_SIZE);
         if (0 == n_read) 
         {
             AXIS2_FREE(env->allocator, ts);
             break;
         }
+        if (n_read > INT_MAX - *len)
+        {
+            rp_log_error(env, "(%s:%d) binary data larger than %d bytes.\n",
+                         __FILE__, __LINE__, INT_MAX);
+            AXIS2_FREE(env->allocator, ts);
+            entry_t *le = axutil_linked_list_get_entry(ll, env, 0);
+            for (; le != NULL; le = le->next)
+            {
+                if (le->data) AXIS2_FREE(env->allocator, le->data);
+            }
+            axutil_linked_list_free(ll, env);
+            *len = 0;
+            return NULL;
+        }
 
         ts->size = n_read;
         *len    += n_read;
         axutil_linked_list_add (ll, env, (void *)ts);
+        sp_stats_add_bytes_in(n_read);
     }
 
     bin_data = compose_buffer(env, *len, ll);
@@ -0,0 +1,1185 @@
+/*
+ * Soap Proxy.
+ *
+ * Asynchronous GetCoverage jobs, spooled to disk.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_job.c
+ *
+ * Very large GetCoverage requests can take minutes, holding an Apache
+ * worker and the client's connection all the while, and are lost on
+ * any client timeout.  They may instead be run as jobs:
+ *
+ *   AsyncGetCoverage - takes a GetCoverage request, starts it in the
+ *                      background and returns a Job element with the
+ *                      job id at once.
+ *   GetJobStatus     - <JobId>: the Job element, with the status queued,
+ *                      running, done or failed.
+ *   FetchJobResult   - <JobId>: the GetCoverage response of a job that
+ *                      is done.  A binary coverage is streamed from the
+ *                      spool file as an MTOM attachment, and so are the
+ *                      binary parts of a multipart one.
+ *
+ * If the AsyncGetCoverage request carries a WS-Addressing ReplyTo with
+ * an http address on one of the AsyncNotifyHosts, the Job element is
+ * also POSTed there, in a SOAP 1.1 envelope, when the job has finished.
+ * Any other ReplyTo is ignored, so that the proxy cannot be made to send
+ * requests to hosts of the client's choosing; without AsyncNotifyHosts
+ * nobody is notified.
+ *
+ * Jobs are kept in AsyncSpoolDir, one directory per job named after the
+ * job id, 128 random bits from /dev/urandom in hex.  The
+ * directory holds the file 'status' (key=value lines, replaced by
+ * rename) and the result, 'result.bin' for a binary coverage or
+ * 'result.xml' for anything else.  The attachments of an XML result,
+ * e.g. the parts of a multipart coverage, are written to files 'part.N'
+ * and replaced by cid: references in the XML, as in gml:fileReference;
+ * the file 'parts' lists them, one line 'part.N cid content-type' each.
+ * Finished jobs are removed
+ * AsyncKeepHours after they finished; the spool is swept on every
+ * AsyncGetCoverage.  Anyone knowing a job id may fetch its result.
+ *
+ * The job runs in a process of its own, double-forked from the Apache
+ * child and in its own session, so that neither the end of the request
+ * nor the recycling of the Apache child stops it.  It goes through the
+ * same backend path as GetCoverage, including sp_tile.c, and so through
+ * the backend scheduler and the limits of the client.  A request larger
+ * than MaxCoverageMB is refused at once, see sp_estimate.c.  At most
+ * AsyncMaxJobs jobs may be queued or running at a time, further ones are
+ * refused with SP_SYS_ERR_BACKEND_BUSY.  A job whose process has gone
+ * away is reported as failed.  The spool must not be shared between
+ * hosts, since this relies on process ids.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <axutil_url.h>
+
+#include "soap_proxy.h"
+#include "sp_job.h"
+#include "sp_cache.h"
+#include "sp_client.h"
+#include "sp_estimate.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+#include "sp_tile.h"
+
+#define SP_JOB_ID_BYTES    16
+#define SP_JOB_ID_LEN      (2 * SP_JOB_ID_BYTES + 1)
+#define SP_JOB_PATH_LEN    (SP_MAX_MPATHS_LEN + 64)
+#define SP_JOB_STATE_LEN   12
+#define SP_JOB_CTYPE_LEN   80
+#define SP_JOB_MSG_LEN     256
+#define SP_JOB_START_SECS  60     // a queued job not started by then is lost
+#define SP_JOB_STATUS_NAME "status"
+#define SP_JOB_BIN_NAME    "result.bin"
+#define SP_JOB_XML_NAME    "result.xml"
+#define SP_JOB_PARTS_NAME  "parts"
+#define SP_JOB_PART_FMT    "part.%d"
+#define SP_JOB_LINE_LEN    1024
+
+//
+// The contents of a job's status file.
+//
+struct sp_job_struct
+{
+    char     id[SP_JOB_ID_LEN];
+    char     state[SP_JOB_STATE_LEN];  // queued, running, done, failed
+    pid_t    pid;                      // process running the job, 0 if none
+    time_t   submitted;
+    time_t   finished;
+    uint64_t size;                     // of the result
+    char     ctype[SP_JOB_CTYPE_LEN];  // of a binary result, else empty
+    char     message[SP_JOB_MSG_LEN];  // why it failed
+    char     reply_to[SP_MAX_MPATHS_LEN];
+};
+
+typedef struct sp_job_struct sp_job;
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @return non-zero if id is of the form of a job id: 32 hex digits.
+ */
+static int sp_job_valid_id(const char *id)
+{
+    int i;
+    for (i = 0; id && i < SP_JOB_ID_LEN - 1; i++)
+    {
+    	if (! isxdigit((unsigned char) id[i])) return 0;
+    }
+    return id && '\0' == id[i];
+}
+
+//-----------------------------------------------------------------------------
+/** Make up a job id.  It must not be guessed, since the id is all that is
+ *  needed to fetch a result.
+ * @param id SP_JOB_ID_LEN characters.
+ * @return 0 on success, -1 if /dev/urandom cannot be read.
+ */
+static int sp_job_new_id(char *id)
+{
+    unsigned char rnd[SP_JOB_ID_BYTES];
+    size_t        got = 0;
+
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    while (got < sizeof(rnd))
+    {
+    	ssize_t n = read(fd, rnd + got, sizeof(rnd) - got);
+    	if (n <= 0 && ! (n < 0 && EINTR == errno)) break;
+    	if (n > 0) got += n;
+    }
+    close(fd);
+    if (got < sizeof(rnd)) return -1;
+
+    for (size_t i = 0; i < sizeof(rnd); i++)
+    {
+    	sprintf(id + 2 * i, "%02x", rnd[i]);
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_job_path(
+    char          *buf,
+    const char    *spool,
+    const char    *id,
+    const char    *file)
+{
+    if (file)
+    {
+    	snprintf(buf, SP_JOB_PATH_LEN, "%s/%s/%s", spool, id, file);
+    }
+    else
+    {
+    	snprintf(buf, SP_JOB_PATH_LEN, "%s/%s", spool, id);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Keep a value on one line of the status file.
+static void sp_job_set_message(sp_job *job, const char *msg)
+{
+    snprintf(job->message, SP_JOB_MSG_LEN, "%s", msg ? msg : "");
+    for (char *p = job->message; *p; p++)
+    {
+    	if ('\n' == *p || '\r' == *p) *p = ' ';
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Write the status file of a job.
+ * @param spool
+ * @param job
+ * @return 0 on success.
+ */
+static int sp_job_write_status(const char *spool, const sp_job *job)
+{
+    char path[SP_JOB_PATH_LEN];
+    char tmp [SP_JOB_PATH_LEN + 16];
+
+    sp_job_path(path, spool, job->id, SP_JOB_STATUS_NAME);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    if (NULL == fp) return -1;
+
+    fprintf(fp, "state=%s\npid=%d\nsubmitted=%ld\nfinished=%ld\n"
+    		"size=%llu\nctype=%s\nmessage=%s\nreply_to=%s\n",
+    		job->state, (int) job->pid,
+    		(long) job->submitted, (long) job->finished,
+    		(unsigned long long) job->size,
+    		job->ctype, job->message, job->reply_to);
+
+    if (fclose(fp) || rename(tmp, path))
+    {
+    	unlink(tmp);
+    	return -1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Read the status file of a job.
+ * @param spool
+ * @param id
+ * @param job
+ * @return 0 on success, -1 if there is no such job.
+ */
+static int sp_job_read_status(const char *spool, const char *id, sp_job *job)
+{
+    char path[SP_JOB_PATH_LEN];
+    char line[SP_MAX_MPATHS_LEN + 16];
+
+    memset(job, 0, sizeof(*job));
+    snprintf(job->id, SP_JOB_ID_LEN, "%s", id);
+
+    sp_job_path(path, spool, id, SP_JOB_STATUS_NAME);
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp) return -1;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+    	char *val = strchr(line, '=');
+    	if (NULL == val) continue;
+    	*val++ = '\0';
+    	val[strcspn(val, "\n")] = '\0';
+
+    	if      (0 == strcmp(line, "state"))
+    		snprintf(job->state, SP_JOB_STATE_LEN, "%s", val);
+    	else if (0 == strcmp(line, "pid"))       job->pid       = atoi(val);
+    	else if (0 == strcmp(line, "submitted")) job->submitted = atol(val);
+    	else if (0 == strcmp(line, "finished"))  job->finished  = atol(val);
+    	else if (0 == strcmp(line, "size"))      job->size      = strtoull(val, NULL, 10);
+    	else if (0 == strcmp(line, "ctype"))
+    		snprintf(job->ctype, SP_JOB_CTYPE_LEN, "%s", val);
+    	else if (0 == strcmp(line, "message"))
+    		snprintf(job->message, SP_JOB_MSG_LEN, "%s", val);
+    	else if (0 == strcmp(line, "reply_to"))
+    		snprintf(job->reply_to, SP_MAX_MPATHS_LEN, "%s", val);
+    }
+    fclose(fp);
+
+    return '\0' == job->state[0] ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return non-zero if the job has not finished yet.
+ */
+static int sp_job_active(const sp_job *job)
+{
+    return 0 == strcmp(job->state, "queued") ||
+           0 == strcmp(job->state, "running");
+}
+
+//-----------------------------------------------------------------------------
+/** Mark a job failed if the process which should be running it is gone.
+ * @param spool
+ * @param job
+ */
+static void sp_job_check_alive(const char *spool, sp_job *job)
+{
+    if (! sp_job_active(job)) return;
+
+    const time_t now = time(NULL);
+    const char  *why = NULL;
+    if (job->pid > 0)
+    {
+    	if (0 != kill(job->pid, 0) && ESRCH == errno) why = "job process exited";
+    }
+    else if (now - job->submitted > SP_JOB_START_SECS)
+    {
+    	why = "job never started";
+    }
+
+    if (why)
+    {
+    	strcpy(job->state, "failed");
+    	job->finished = now;
+    	sp_job_set_message(job, why);
+    	sp_job_write_status(spool, job);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Remove a job directory and whatever is in it.
+static void sp_job_remove(const char *spool, const char *id)
+{
+    char path[SP_JOB_PATH_LEN];
+    char file[SP_JOB_PATH_LEN + 64];
+
+    sp_job_path(path, spool, id, NULL);
+    DIR *d = opendir(path);
+    if (d)
+    {
+    	struct dirent *de;
+    	while ((de = readdir(d)))
+    	{
+    		if ('.' == de->d_name[0]) continue;
+    		snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+    		unlink(file);
+    	}
+    	closedir(d);
+    }
+    rmdir(path);
+}
+
+//-----------------------------------------------------------------------------
+/** Remove the jobs which finished more than AsyncKeepHours ago, and count
+ *  those not finished yet.
+ * @param env
+ * @param props
+ * @param spool
+ * @return number of queued or running jobs.
+ */
+static int sp_job_sweep(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *spool)
+{
+    const time_t keep   = (time_t) rp_getAsyncKeepHours(env, props) * 3600;
+    const time_t now    = time(NULL);
+    int          active = 0, removed = 0;
+
+    DIR *d = opendir(spool);
+    if (NULL == d) return 0;
+
+    struct dirent *de;
+    while ((de = readdir(d)))
+    {
+    	if (! sp_job_valid_id(de->d_name)) continue;
+
+    	sp_job job;
+    	if (sp_job_read_status(spool, de->d_name, &job))
+    	{
+    		// Half-made, or left over from a crash.
+    		char path[SP_JOB_PATH_LEN];
+    		struct stat sb;
+    		sp_job_path(path, spool, de->d_name, NULL);
+    		if (0 == stat(path, &sb) && now - sb.st_mtime > keep)
+    		{
+    			sp_job_remove(spool, de->d_name);
+    			removed++;
+    		}
+    		continue;
+    	}
+
+    	sp_job_check_alive(spool, &job);
+    	if (sp_job_active(&job))
+    	{
+    		active++;
+    	}
+    	else if (now - job.finished > keep)
+    	{
+    		sp_job_remove(spool, de->d_name);
+    		removed++;
+    	}
+    }
+    closedir(d);
+
+    if (removed) SP_LOG_DEBUG("%d expired jobs removed from %s", removed, spool);
+    return active;
+}
+
+//-----------------------------------------------------------------------------
+// Write a file of the job under a temporary name and rename it into place.
+static int sp_job_write_file(
+    const char *spool,
+    const char *id,
+    const char *name,
+    const char *data,
+    size_t      len)
+{
+    char path[SP_JOB_PATH_LEN];
+    char tmp [SP_JOB_PATH_LEN + 8];
+
+    sp_job_path(path, spool, id, name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    int failed = 0;
+    while (len > 0 && ! failed)
+    {
+    	ssize_t n = write(fd, data, len);
+    	if (n < 0)
+    	{
+    		if (EINTR != errno) failed = 1;
+    		continue;
+    	}
+    	data += n;
+    	len  -= n;
+    }
+    failed |= close(fd);
+
+    if (failed || rename(tmp, path))
+    {
+    	unlink(tmp);
+    	return -1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Write the attachments below node, and its siblings, to files of their
+ *  own and put cid: references to them in their place.
+ * @param env
+ * @param spool
+ * @param job
+ * @param node
+ * @param list gets a line for each attachment written.
+ * @param n number of attachments written so far, updated.
+ * @param size their total size, updated.
+ * @return 0 on success.
+ */
+static int sp_job_store_parts(
+    const axutil_env_t *env,
+    const char         *spool,
+    const sp_job       *job,
+    axiom_node_t       *node,
+    FILE               *list,
+    int                *n,
+    uint64_t           *size)
+{
+    axiom_node_t *next;
+
+    for (; node; node = next)
+    {
+    	next = axiom_node_get_next_sibling(node, env);
+
+    	const axiom_types_t tt = axiom_node_get_node_type(node, env);
+    	if (AXIOM_ELEMENT == tt)
+    	{
+    		if (sp_job_store_parts(env, spool, job,
+    				axiom_node_get_first_child(node, env), list, n, size))
+    		{
+    			return -1;
+    		}
+    		continue;
+    	}
+    	if (AXIOM_TEXT != tt) continue;
+
+    	axiom_text_t         *text = axiom_node_get_data_element(node, env);
+    	axiom_data_handler_t *dh   =
+    			text ? axiom_text_get_data_handler(text, env) : NULL;
+    	if (NULL == dh) continue;
+
+    	const char  *data  = (const char *) axiom_data_handler_get_input_stream(dh, env);
+    	const size_t len   = axiom_data_handler_get_input_stream_len(dh, env);
+    	const char  *ctype = axiom_data_handler_get_content_type(dh, env);
+    	const char  *cid   = axiom_text_get_content_id(text, env);
+    	char         name   [32];
+    	char         own_cid[64];
+
+    	snprintf(name, sizeof(name), SP_JOB_PART_FMT, *n);
+    	if (NULL == cid)
+    	{
+    		snprintf(own_cid, sizeof(own_cid), "%s@%s", name, job->id);
+    		cid = own_cid;
+    	}
+    	if (NULL == ctype) ctype = "application/octet-stream";
+    	if (NULL == data || strpbrk(cid, " \t\r\n") || strpbrk(ctype, "\r\n") ||
+    		strlen(cid) + strlen(ctype) + sizeof(name) + 2 > SP_JOB_LINE_LEN ||
+    		sp_job_write_file(spool, job->id, name, data, len))
+    	{
+    		return -1;
+    	}
+    	fprintf(list, "%s %s %s\n", name, cid, ctype);
+
+    	char ref[SP_JOB_LINE_LEN];
+    	axiom_node_t *ref_node = NULL;
+    	snprintf(ref, sizeof(ref), "cid:%s", cid);
+    	axiom_text_create(env, NULL, ref, &ref_node);
+    	if (NULL == ref_node) return -1;
+    	axiom_node_insert_sibling_before(node, env, ref_node);
+    	axiom_node_free_tree(axiom_node_detach(node, env), env);
+
+    	(*n)++;
+    	*size += len;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Put the attachments listed in the 'parts' file of a job back in place
+ *  of their references, see sp_job_store_parts().  They are streamed from
+ *  their files as the response is sent.
+ * @param env
+ * @param spool
+ * @param id
+ * @param resp_node the result, parsed from 'result.xml'.
+ * @return 0 on success, also if there are none.
+ */
+static int sp_job_load_parts(
+    const axutil_env_t *env,
+    const char         *spool,
+    const char         *id,
+    axiom_node_t       *resp_node)
+{
+    char path[SP_JOB_PATH_LEN];
+    char line[SP_JOB_LINE_LEN];
+    int  failed = 0;
+
+    sp_job_path(path, spool, id, SP_JOB_PARTS_NAME);
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp) return ENOENT == errno ? 0 : -1;
+
+    while (! failed && fgets(line, sizeof(line), fp))
+    {
+    	line[strcspn(line, "\r\n")] = '\0';
+    	char *cid   = strchr(line, ' ');
+    	char *ctype = cid ? strchr(cid + 1, ' ') : NULL;
+    	if (NULL == ctype || strchr(line, '/'))
+    	{
+    		failed = 1;
+    		break;
+    	}
+    	*cid++   = '\0';
+    	*ctype++ = '\0';
+
+    	sp_job_path(path, spool, id, line);
+    	axiom_data_handler_t *dh = axiom_data_handler_create(env, path, ctype);
+    	if (NULL == dh)
+    	{
+    		failed = 1;
+    		break;
+    	}
+    	sp_attach_dh20(env, resp_node, dh, cid);
+    }
+    fclose(fp);
+    return failed ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Spool the response of a job.
+ * @param env
+ * @param spool
+ * @param resp_node
+ * @param job updated with the size and content type of the result.
+ * @return 0 on success.
+ */
+static int sp_job_store(
+    const axutil_env_t *env,
+    const char         *spool,
+    axiom_node_t       *resp_node,
+    sp_job             *job)
+{
+    axiom_data_handler_t *dh = sp_cache_coverage_dh(env, resp_node);
+    if (dh)
+    {
+    	const char  *data  = (const char *) axiom_data_handler_get_input_stream(dh, env);
+    	const size_t len   = axiom_data_handler_get_input_stream_len(dh, env);
+    	const char  *ctype = axiom_data_handler_get_content_type(dh, env);
+
+    	if (data && ctype && strlen(ctype) < SP_JOB_CTYPE_LEN &&
+    		0 == sp_job_write_file(spool, job->id, SP_JOB_BIN_NAME, data, len))
+    	{
+    		strcpy(job->ctype, ctype);
+    		job->size = len;
+    		return 0;
+    	}
+    	return -1;
+    }
+
+    // Attachments are not inlined as base64, see sp_job_store_parts().
+    char    *list_buf = NULL;
+    size_t   list_len = 0;
+    int      n_parts  = 0;
+    uint64_t size     = 0;
+    FILE    *list     = open_memstream(&list_buf, &list_len);
+    if (NULL == list) return -1;
+
+    int failed = sp_job_store_parts(
+    		env, spool, job, resp_node, list, &n_parts, &size);
+    failed |= 0 != fclose(list);
+    if (! failed && n_parts > 0)
+    {
+    	failed = sp_job_write_file(
+    			spool, job->id, SP_JOB_PARTS_NAME, list_buf, list_len);
+    }
+    free(list_buf);
+    if (failed) return -1;
+
+    axis2_char_t *xml = axiom_node_to_string(resp_node, env);
+    if (NULL == xml) return -1;
+
+    const size_t len = strlen(xml);
+    failed = sp_job_write_file(spool, job->id, SP_JOB_XML_NAME, xml, len);
+    AXIS2_FREE(env->allocator, xml);
+
+    job->ctype[0] = '\0';
+    job->size     = len + size;
+    return failed;
+}
+
+//-----------------------------------------------------------------------------
+// Copy s to buf, escaped for an XML attribute value.
+static void sp_job_xml_escape(char *buf, const size_t size, const char *s)
+{
+    size_t n = 0;
+    for (; *s && n + 7 < size; s++)
+    {
+    	switch (*s)
+    	{
+    	case '&': n += sprintf(buf + n, "&amp;");  break;
+    	case '<': n += sprintf(buf + n, "&lt;");   break;
+    	case '>': n += sprintf(buf + n, "&gt;");   break;
+    	case '"': n += sprintf(buf + n, "&quot;"); break;
+    	default:  buf[n++] = *s;
+    	}
+    }
+    buf[n] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+/** Check the WS-Addressing ReplyTo of a job against AsyncNotifyHosts.  An
+ *  entry host allows any port of the host, host:port only that one.
+ * @param env
+ * @param props
+ * @param addr the ReplyTo address.
+ * @return non-zero if addr may be notified.
+ */
+static int sp_job_notify_allowed(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *addr)
+{
+    const char *hosts = rp_getAsyncNotifyHosts(env, props);
+    if ('\0' == hosts[0] || strncmp(addr, "http://", 7)) return 0;
+
+    axutil_url_t *url = axutil_url_parse_string(env, addr);
+    if (NULL == url) return 0;
+    const char *host = axutil_url_get_host(url, env);
+    const int   port = axutil_url_get_port(url, env);
+
+    char  buf[SP_MAX_MPATHS_LEN];
+    char *save  = NULL;
+    int   found = 0;
+
+    snprintf(buf, sizeof(buf), "%s", hosts);
+    for (char *entry = strtok_r(buf, ", \t\n", &save);
+    	 entry && host && ! found;
+    	 entry = strtok_r(NULL, ", \t\n", &save))
+    {
+    	char *colon = strrchr(entry, ':');
+    	if (colon) *colon = '\0';
+    	found = 0 == strcasecmp(entry, host) &&
+    			(NULL == colon || atoi(colon + 1) == port);
+    }
+    axutil_url_free(url, env);
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+/** Tell the WS-Addressing ReplyTo of a job that it has finished, by POSTing
+ *  its Job element.  Failures are only logged.
+ * @param env
+ * @param job
+ */
+static void sp_job_notify(const axutil_env_t *env, const sp_job *job)
+{
+    if (strncmp(job->reply_to, "http://", 7))
+    {
+    	SP_LOG_WARNING("job %s: ReplyTo '%s' not supported, only http",
+    			job->id, job->reply_to);
+    	return;
+    }
+
+    axutil_url_t *url = axutil_url_parse_string(env, job->reply_to);
+    if (NULL == url)
+    {
+    	SP_LOG_WARNING("job %s: bad ReplyTo '%s'", job->id, job->reply_to);
+    	return;
+    }
+
+    char message[SP_JOB_MSG_LEN * 6];
+    char ctype  [SP_JOB_CTYPE_LEN * 6];
+    sp_job_xml_escape(message, sizeof(message), job->message);
+    sp_job_xml_escape(ctype,   sizeof(ctype),   job->ctype);
+
+    char body[2048];
+    int  body_len = snprintf(body, sizeof(body),
+    		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    		"<soapenv:Envelope"
+    		" xmlns:soapenv=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+    		"<soapenv:Body>"
+    		"<sopr:Job xmlns:sopr=\"%s\" id=\"%s\" status=\"%s\""
+    		" submitted=\"%ld\" finished=\"%ld\" size=\"%llu\""
+    		" contentType=\"%s\" message=\"%s\"/>"
+    		"</soapenv:Body></soapenv:Envelope>",
+    		SP_WCSPROXY_NAMESPACE_STR, job->id, job->state,
+    		(long) job->submitted, (long) job->finished,
+    		(unsigned long long) job->size, ctype, message);
+
+    const char *path = axutil_url_get_path(url, env);
+    char head[SP_MAX_MPATHS_LEN + 256];
+    int  head_len = snprintf(head, sizeof(head),
+    		"POST %s HTTP/1.0\r\n"
+    		"Host: %s\r\n"
+    		"Content-Type: text/xml; charset=UTF-8\r\n"
+    		"SOAPAction: \"\"\r\n"
+    		"Content-Length: %d\r\n"
+    		"\r\n",
+    		path && path[0] ? path : "/",
+    		axutil_url_get_host(url, env), body_len);
+
+    axutil_stream_t *st = sp_sock_connect(env,
+    		axutil_url_get_host(url, env), axutil_url_get_port(url, env));
+    int ok = st &&
+    		axutil_stream_write(st, env, head, head_len) == head_len &&
+    		axutil_stream_write(st, env, body, body_len) == body_len;
+
+    char status[64];
+    int  n = ok ? axutil_stream_read(st, env, status, sizeof(status) - 1) : -1;
+    if (n > 0)
+    {
+    	status[n] = '\0';
+    	status[strcspn(status, "\r\n")] = '\0';
+    }
+    if (st) sp_stream_cleanup(env, st);
+    axutil_url_free(url, env);
+
+    if (n > 0)
+    {
+    	SP_LOG_INFO("job %s: notified %s: %s", job->id, job->reply_to, status);
+    }
+    else
+    {
+    	SP_LOG_WARNING("job %s: cannot notify %s", job->id, job->reply_to);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Close the sockets inherited from Apache, the client's connection above all,
+// so that it is not kept open by the job.
+static void sp_job_close_sockets(void)
+{
+    DIR *d = opendir("/proc/self/fd");
+    if (NULL == d) return;
+
+    const int      dfd = dirfd(d);
+    struct dirent *de;
+    while ((de = readdir(d)))
+    {
+    	struct stat sb;
+    	int fd = atoi(de->d_name);
+    	if (fd > STDERR_FILENO && fd != dfd &&
+    		0 == fstat(fd, &sb) && S_ISSOCK(sb.st_mode))
+    	{
+    		close(fd);
+    	}
+    }
+    closedir(d);
+}
+
+//-----------------------------------------------------------------------------
+/** Run a job, in its own process.
+ * @param env
+ * @param props
+ * @param req the GetCoverage request.
+ * @param protocol
+ * @param spool
+ * @param job
+ */
+static void sp_job_run(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *req,
+    const int           protocol,
+    const char         *spool,
+    sp_job             *job)
+{
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sp_job_close_sockets();
+
+    job->pid = getpid();
+    strcpy(job->state, "running");
+    sp_job_write_status(spool, job);
+
+    sp_req_stats rs;
+    sp_stats_begin(&rs, sp_stats_now());
+    rs.op      = SP_OP_GETCOVERAGE;
+    rs.backend = rp_getUrlMode(env, props) ? SP_BE_URL : SP_BE_EXEC;
+    rs.slow_ms = rp_getSlowRequestMs(env, props);
+    SP_LOG_INFO("job %s started", job->id);
+
+    time_t        request_time = time(NULL);
+    axiom_node_t *resp_node    = NULL;
+    if (0 == sp_estimate_check(env, props, req))
+    {
+    	resp_node = sp_tile_enabled(env, props) ?
+    			sp_tile_invoke(env, req, props, protocol) :
+    			rp_invokeBackend(env, req, props, protocol);
+    }
+    int           failed       = 1;
+
+    if (resp_node)
+    {
+    	sp_update_lineage(env, props, resp_node, req, request_time);
+    	failed = sp_job_store(env, spool, resp_node, job);
+    	if (failed) sp_job_set_message(job, "cannot write the result");
+    }
+    else
+    {
+    	sp_job_set_message(job, env->error ?
+    			axutil_error_get_message(env->error) : "backend request failed");
+    }
+
+    sp_client_charge(rs.bytes_in);
+    sp_stats_end(env, &rs, failed);
+
+    job->finished = time(NULL);
+    strcpy(job->state, failed ? "failed" : "done");
+    sp_job_write_status(spool, job);
+    SP_LOG_INFO("job %s %s, %llu bytes", job->id, job->state,
+    		(unsigned long long) job->size);
+
+    if (job->reply_to[0]) sp_job_notify(env, job);
+}
+
+//-----------------------------------------------------------------------------
+/** Build a Job element, e.g.:
+ *
+ *   <sopr:Job id="5f0c0e9d7a3b2c11e4a0f8d26b1c7390" status="done" submitted="1340000000"
+ *             finished="1340000420" size="734003200"
+ *             contentType="image/tiff"/>
+ *
+ * @param env
+ * @param job
+ * @return the node.
+ */
+static axiom_node_t *sp_job_el(const axutil_env_t *env, const sp_job *job)
+{
+    axiom_node_t *node = NULL;
+    char          buf[24];
+
+    axiom_namespace_t *ns =
+    		axiom_namespace_create(env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    axiom_element_t *el = axiom_element_create(env, NULL, "Job", ns, &node);
+
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "id", job->id, NULL), node);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "status", job->state, NULL), node);
+    snprintf(buf, sizeof(buf), "%ld", (long) job->submitted);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "submitted", buf, NULL), node);
+
+    if (! sp_job_active(job))
+    {
+    	snprintf(buf, sizeof(buf), "%ld", (long) job->finished);
+    	axiom_element_add_attribute(el, env,
+    			axiom_attribute_create(env, "finished", buf, NULL), node);
+    }
+    if (0 == strcmp(job->state, "done"))
+    {
+    	snprintf(buf, sizeof(buf), "%llu", (unsigned long long) job->size);
+    	axiom_element_add_attribute(el, env,
+    			axiom_attribute_create(env, "size", buf, NULL), node);
+    	axiom_element_add_attribute(el, env, axiom_attribute_create(env,
+    			"contentType", job->ctype[0] ? job->ctype : "text/xml", NULL),
+    			node);
+    }
+    if (job->message[0])
+    {
+    	axiom_element_add_attribute(el, env,
+    			axiom_attribute_create(env, "message", job->message, NULL), node);
+    }
+
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+/** Find the job named by the JobId element of a request.
+ * @param env
+ * @param props
+ * @param node the request.
+ * @param job filled in.
+ * @return 0 on success, non-zero (and the error set) otherwise.
+ */
+static int sp_job_find(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    sp_job             *job)
+{
+    if (! sp_job_enabled(env, props))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_NOT_IMPLEMENTED);
+    	rp_log_error(env, "Async jobs: " SP_ASYNCDIR_STR " not set.\n");
+    	return -1;
+    }
+
+    const axis2_char_t *id = sp_get_text_el(
+    		rp_find_named_child(env, node, "JobId", 0), env);
+    const char *spool = rp_getAsyncSpoolDir(env, props);
+
+    if (! sp_job_valid_id(id) || sp_job_read_status(spool, id, job))
+    {
+    	SP_ERROR(env, SP_USER_ERR_NO_SUCH_JOB);
+    	SP_LOG_DEBUG("no job '%s'", id ? id : "");
+    	return -1;
+    }
+
+    sp_job_check_alive(spool, job);
+    return 0;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if asynchronous jobs are configured.
+ */
+int sp_job_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return '\0' != rp_getAsyncSpoolDir(env, props)[0] &&
+           rp_getAsyncMaxJobs(env, props) > 0;
+}
+
+//-----------------------------------------------------------------------------
+/** The AsyncGetCoverage operation: start a job for the GetCoverage request
+ * contained in node.
+ * @param env
+ * @param props
+ * @param node the AsyncGetCoverage element.
+ * @param protocol
+ * @return the Job element of the new job, NULL on error.
+ */
+axiom_node_t *sp_job_submit(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    const int           protocol)
+{
+    if (! sp_job_enabled(env, props))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_NOT_IMPLEMENTED);
+    	rp_log_error(env, "AsyncGetCoverage: " SP_ASYNCDIR_STR " not set.\n");
+    	return NULL;
+    }
+
+    axiom_node_t *req = rp_find_named_child(env, node, "GetCoverage", 0);
+    if (NULL == req)
+    {
+    	SP_ERROR(env, SP_USER_ERR_BAD_REQ);
+    	SP_LOG_DEBUG("AsyncGetCoverage without GetCoverage");
+    	return NULL;
+    }
+    if (sp_estimate_check(env, props, req)) return NULL;
+
+    const char *spool = rp_getAsyncSpoolDir(env, props);
+    if (mkdir(spool, 0755) && EEXIST != errno)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) cannot create %s: %s\n",
+    			__FILE__, __LINE__, spool, strerror(errno));
+    	return NULL;
+    }
+
+    const int active = sp_job_sweep(env, props, spool);
+    if (active >= rp_getAsyncMaxJobs(env, props))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_BACKEND_BUSY);
+    	SP_LOG_WARNING("AsyncGetCoverage refused, %d jobs active", active);
+    	return NULL;
+    }
+
+    sp_job job;
+    memset(&job, 0, sizeof(job));
+    if (sp_job_new_id(job.id))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) cannot read /dev/urandom: %s\n",
+    			__FILE__, __LINE__, strerror(errno));
+    	return NULL;
+    }
+    strcpy(job.state, "queued");
+    job.submitted = time(NULL);
+
+    if (props->msg_ctx)
+    {
+    	axis2_endpoint_ref_t *reply_to =
+    			axis2_msg_ctx_get_reply_to(props->msg_ctx, env);
+    	const axis2_char_t *addr = reply_to ?
+    			axis2_endpoint_ref_get_address(reply_to, env) : NULL;
+    	if (addr && ! strstr(addr, "/addressing/anonymous") &&
+    		! strstr(addr, "/addressing/none") &&
+    		! strstr(addr, "/role/anonymous"))
+    	{
+    		if (sp_job_notify_allowed(env, props, addr))
+    		{
+    			snprintf(job.reply_to, SP_MAX_MPATHS_LEN, "%s", addr);
+    		}
+    		else
+    		{
+    			SP_LOG_WARNING("job %s: ReplyTo '%s' not in "
+    					SP_ASYNCNOTIFY_STR ", ignored", job.id, addr);
+    		}
+    	}
+    }
+
+    char dir[SP_JOB_PATH_LEN];
+    sp_job_path(dir, spool, job.id, NULL);
+    if (! sp_job_valid_id(job.id) || mkdir(dir, 0755) ||
+    	sp_job_write_status(spool, &job))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) cannot create job %s: %s\n",
+    			__FILE__, __LINE__, dir, strerror(errno));
+    	return NULL;
+    }
+
+    // Double fork: the job is not a child of this process, so needs no
+    // reaping, and is in a session of its own.
+    pid_t cpid = fork();
+    if (0 == cpid)
+    {
+    	setsid();
+    	pid_t gpid = fork();
+    	if (0 == gpid)
+    	{
+    		sp_job_run(env, props, req, protocol, spool, &job);
+    		sp_log_flush();   // _exit() skips the atexit() flush
+    		_exit(0);
+    	}
+    	_exit(gpid < 0 ? 1 : 0);
+    }
+
+    int status = 0;
+    if (cpid > 0)
+    {
+    	while (waitpid(cpid, &status, 0) < 0 && EINTR == errno)
+    		;
+    }
+    if (cpid < 0 || (WIFEXITED(status) && 0 != WEXITSTATUS(status)))
+    {
+    	strcpy(job.state, "failed");
+    	job.finished = time(NULL);
+    	sp_job_set_message(&job, "cannot start the job");
+    	sp_job_write_status(spool, &job);
+
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) fork: %s\n",
+    			__FILE__, __LINE__, strerror(errno));
+    	return NULL;
+    }
+
+    SP_LOG_INFO("job %s queued%s%s", job.id,
+    		job.reply_to[0] ? ", reply to " : "", job.reply_to);
+    return sp_job_el(env, &job);
+}
+
+//-----------------------------------------------------------------------------
+/** The GetJobStatus operation.
+ * @param env
+ * @param props
+ * @param node the GetJobStatus element.
+ * @return the Job element, NULL on error.
+ */
+axiom_node_t *sp_job_status(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    sp_job job;
+    return sp_job_find(env, props, node, &job) ? NULL : sp_job_el(env, &job);
+}
+
+//-----------------------------------------------------------------------------
+/** The FetchJobResult operation.
+ * @param env
+ * @param props
+ * @param node the FetchJobResult element.
+ * @return the GetCoverage response of the job, NULL on error.
+ */
+axiom_node_t *sp_job_fetch(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node)
+{
+    sp_job job;
+    if (sp_job_find(env, props, node, &job)) return NULL;
+
+    if (strcmp(job.state, "done"))
+    {
+    	SP_ERROR(env, SP_USER_ERR_JOB_NOT_READY);
+    	SP_LOG_DEBUG("job %s is %s", job.id, job.state);
+    	return NULL;
+    }
+
+    const char *spool = rp_getAsyncSpoolDir(env, props);
+    char path[SP_JOB_PATH_LEN];
+    axiom_node_t *resp_node = NULL;
+
+    if (job.ctype[0])
+    {
+    	// Streamed from the file by Axis2 as the response is sent.
+    	sp_job_path(path, spool, job.id, SP_JOB_BIN_NAME);
+    	axiom_data_handler_t *dh =
+    			axiom_data_handler_create(env, path, job.ctype);
+    	if (dh)
+    	{
+    		resp_node = sp_make_MTOM_dh_node20(env, dh, "Coverage", "wcs",
+    				"http://www.opengis.net/wcs/2.0");
+    	}
+    }
+    else
+    {
+    	sp_job_path(path, spool, job.id, SP_JOB_XML_NAME);
+    	FILE *fp = fopen(path, "r");
+    	if (fp)
+    	{
+    		resp_node = rp_process_xml(env, fp, NULL);
+    		fclose(fp);
+    	}
+    	if (resp_node && sp_job_load_parts(env, spool, job.id, resp_node))
+    	{
+    		axiom_node_free_tree(resp_node, env);
+    		resp_node = NULL;
+    	}
+    }
+
+    if (NULL == resp_node)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) cannot load the result of job %s\n",
+    			__FILE__, __LINE__, job.id);
+    }
+    return resp_node;
+}
@@ -0,0 +1,730 @@
+/*
+ * Soap Proxy.
+ *
+ * Logging: leveled, structured, asynchronous.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_log.c
+ *
+ * Log records are formatted by the calling thread straight into a slot
+ * of a per-thread ring buffer; there is no malloc and no lock on that
+ * path.  A background thread wakes up every SP_LOG_FLUSH_USECS, collects
+ * the records of all rings and writes them out in batches, either with
+ * one write() to the log file (stderr by default) or, with
+ * LogFile=axis2, through the Axis2 log of the service.
+ *
+ * Each record is a line of key=value pairs:
+ *   time=... level=... msg="..." req_id=... op=... backend=... elapsed_ms=...
+ *   src=...
+ * followed by any fields given with SP_LOG_KV.  req_id, op, backend and
+ * elapsed_ms are taken from the request being served in the thread, see
+ * sp_stats_current().
+ *
+ * A ring holds SP_LOG_RING_SLOTS records.  If the flusher falls behind
+ * and a ring is full, new records of that thread are dropped and counted,
+ * the count is reported by the flusher.  Rings of finished threads are
+ * handed over to new threads, so thread-per-connection servers do not
+ * accumulate them.
+ *
+ * Repeated messages are rate limited per call site: at most LogRateLimit
+ * records per second are let through, the rest are counted and the count
+ * is attached to the next record from the same site as 'suppressed=N'.
+ *
+ * The flusher is joinable: sp_log_shutdown(), called from the free hook
+ * of the service and again when the library is unloaded, stops and joins
+ * it and writes out what is left, so no thread keeps running in code
+ * that is about to be unmapped.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <axutil_log.h>
+
+#include "soap_proxy.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_LOG_RING_SLOTS   64          // must be a power of 2
+#define SP_LOG_REC_LEN      1000        // text bytes per record
+#define SP_LOG_FLUSH_USECS  50000
+#define SP_LOG_BATCH_LEN    32768
+#define SP_LOG_NSITES       256         // must be a power of 2
+#define SP_LOG_DEF_RATE     20
+
+#define SP_LOG_DEST_FD      0
+#define SP_LOG_DEST_AXIS2   1
+
+static const char *sp_log_level_names[SP_LOG_NLEVELS] =
+{
+    "error",
+    "warning",
+    "info",
+    "debug"
+};
+
+struct sp_log_rec_struct
+{
+    int64_t  t_wall;                  // usecs since the epoch
+    int      level;
+    int      len;
+    char     text[SP_LOG_REC_LEN];
+};
+
+//
+// Single producer (the owning thread), single consumer (whoever holds
+// sp_log_drain_lock).  head and tail run freely, the slot is index & mask.
+//
+struct sp_log_ring_struct
+{
+    volatile unsigned int      head;
+    volatile unsigned int      tail;
+    volatile unsigned int      dropped;
+    volatile int               in_use;
+    struct sp_log_ring_struct *next;
+
+    struct sp_log_rec_struct   recs[SP_LOG_RING_SLOTS];
+};
+
+typedef struct sp_log_ring_struct sp_log_ring;
+
+struct sp_log_site_struct
+{
+    volatile uint32_t second;
+    volatile uint32_t count;
+    volatile uint32_t suppressed;
+};
+
+static sp_log_ring *volatile sp_log_rings = NULL;
+static __thread sp_log_ring *sp_log_my_ring = NULL;
+
+static pthread_once_t  sp_log_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   sp_log_ring_key;
+static volatile int    sp_log_key_made   = 0;
+
+static pthread_mutex_t sp_log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int    sp_log_started    = 0;
+static volatile int    sp_log_configured = 0;
+static int             sp_log_async      = 0;
+static volatile int    sp_log_stop       = 0;
+static pthread_t       sp_log_flusher_tid;
+
+static volatile int    sp_log_level      = SP_LOG_LEVEL_INFO;
+static volatile int    sp_log_rate       = SP_LOG_DEF_RATE;
+static volatile int    sp_log_dest       = SP_LOG_DEST_FD;
+static volatile int    sp_log_fd         = STDERR_FILENO;
+static axutil_log_t   *sp_log_axis2_log  = NULL;
+
+static struct sp_log_site_struct sp_log_sites[SP_LOG_NSITES];
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static int64_t sp_log_wall_usecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Thread exit: give the ring back for reuse.  Records still in it are
+// written out by the flusher as usual.
+static void sp_log_release_ring(void *arg)
+{
+    sp_log_ring *r = (sp_log_ring *) arg;
+    __sync_synchronize();
+    r->in_use = 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_log_make_key(void)
+{
+    sp_log_key_made = (0 == pthread_key_create(&sp_log_ring_key,
+                                               sp_log_release_ring));
+}
+
+//-----------------------------------------------------------------------------
+/** Find the ring of the calling thread, claiming a free one or allocating
+ * a new one on the first call in a thread.
+ * @return the ring, NULL if out of memory.
+ */
+static sp_log_ring *sp_log_get_ring(void)
+{
+    sp_log_ring *r = sp_log_my_ring;
+    if (NULL != r) return r;
+
+    for (r = sp_log_rings; NULL != r; r = r->next)
+    {
+        if (0 == r->in_use && __sync_bool_compare_and_swap(&r->in_use, 0, 1))
+            break;
+    }
+
+    if (NULL == r)
+    {
+        // Lives for the life of the process, so not from env->allocator.
+        r = (sp_log_ring *) calloc(1, sizeof(sp_log_ring));
+        if (NULL == r) return NULL;
+        r->in_use = 1;
+        do
+        {
+            r->next = sp_log_rings;
+        } while (! __sync_bool_compare_and_swap(&sp_log_rings, r->next, r));
+    }
+
+    pthread_once(&sp_log_key_once, sp_log_make_key);
+    pthread_setspecific(sp_log_ring_key, r);
+    sp_log_my_ring = r;
+    return r;
+}
+
+//-----------------------------------------------------------------------------
+/** Rate limit check for one call site.
+ * @param site
+ * @param line
+ * @param suppressed set to the number of records from this site suppressed
+ *        since the last one let through.
+ * @return 1 if the record may be written, 0 if it is to be suppressed.
+ */
+static int sp_log_allow(
+    const void   *site,
+    const int     line,
+    unsigned int *suppressed)
+{
+    *suppressed = 0;
+
+    const int limit = sp_log_rate;
+    if (limit <= 0) return 1;
+
+    uintptr_t h = ((uintptr_t) site >> 3) ^ ((uintptr_t) line * 2654435761u);
+    h ^= h >> 11;
+    struct sp_log_site_struct *s = &sp_log_sites[h & (SP_LOG_NSITES - 1)];
+
+    const uint32_t now = (uint32_t) time(NULL);
+    const uint32_t old = s->second;
+    if (old != now && __sync_bool_compare_and_swap(&s->second, old, now))
+    {
+        s->count = 0;
+    }
+
+    if (__sync_add_and_fetch(&s->count, 1) > (uint32_t) limit)
+    {
+        __sync_fetch_and_add(&s->suppressed, 1);
+        return 0;
+    }
+
+    *suppressed = __sync_lock_test_and_set(&s->suppressed, 0);
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+/** Append src to dst as a quoted logfmt value: double quotes become single
+ * quotes, control characters become spaces, trailing white space is
+ * dropped.
+ * @return the new length of dst.
+ */
+static int sp_log_append_quoted(
+    char       *dst,
+    int         len,
+    const int   max,
+    const char *src)
+{
+    int end = strlen(src);
+    while (end > 0 && (unsigned char) src[end-1] <= ' ') end--;
+
+    if (len < max - 1) dst[len++] = '"';
+    for (int i = 0; i < end && len < max - 2; i++)
+    {
+        char c = src[i];
+        if      ('"' == c)                 c = '\'';
+        else if ((unsigned char) c < ' ') c = ' ';
+        dst[len++] = c;
+    }
+    if (len < max - 1) dst[len++] = '"';
+    dst[len] = '\0';
+    return len;
+}
+
+//-----------------------------------------------------------------------------
+// snprintf that appends at dst+len and returns the new length, clamped.
+static int sp_log_append(
+    char       *dst,
+    int         len,
+    const int   max,
+    const char *format,
+    ...) __attribute__ ((format (printf, 4, 5)));
+
+static int sp_log_append(
+    char       *dst,
+    int         len,
+    const int   max,
+    const char *format,
+    ...)
+{
+    if (len >= max - 1) return len;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(dst + len, max - len, format, args);
+    va_end(args);
+
+    if (n < 0) return len;
+    return (len + n >= max) ? max - 1 : len + n;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_log_write_fd(const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(sp_log_fd, buf, len);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+//-----------------------------------------------------------------------------
+static void sp_log_to_axis2(const int level, const char *text)
+{
+    axutil_log_t *log = sp_log_axis2_log;
+    if (NULL == log) return;
+
+    switch (level)
+    {
+    case SP_LOG_LEVEL_ERROR:
+        AXIS2_LOG_ERROR(log, AXIS2_LOG_SI, "%s", text);
+        break;
+    case SP_LOG_LEVEL_WARNING:
+        AXIS2_LOG_WARNING(log, AXIS2_LOG_SI, "%s", text);
+        break;
+    case SP_LOG_LEVEL_INFO:
+        AXIS2_LOG_INFO(log, "%s", text);
+        break;
+    default:
+        AXIS2_LOG_DEBUG(log, AXIS2_LOG_SI, "%s", text);
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Write out all records waiting in the rings.
+ * Must be called with sp_log_drain_lock held.
+ */
+static void sp_log_drain(void)
+{
+    static char batch[SP_LOG_BATCH_LEN];
+    int len = 0;
+
+    const int to_axis2 = (SP_LOG_DEST_AXIS2 == sp_log_dest);
+
+    for (sp_log_ring *r = sp_log_rings; NULL != r; r = r->next)
+    {
+        unsigned int t = r->tail;
+        const unsigned int h = r->head;
+        __sync_synchronize();
+
+        for (; t != h; t++)
+        {
+            struct sp_log_rec_struct *rec = &r->recs[t & (SP_LOG_RING_SLOTS-1)];
+
+            if (to_axis2)
+            {
+                sp_log_to_axis2(rec->level, rec->text);
+                continue;
+            }
+
+            if (len + rec->len + 40 > SP_LOG_BATCH_LEN)
+            {
+                sp_log_write_fd(batch, len);
+                len = 0;
+            }
+
+            time_t secs = (time_t) (rec->t_wall / 1000000);
+            struct tm tm;
+            gmtime_r(&secs, &tm);
+            len += strftime(batch + len, SP_LOG_BATCH_LEN - len,
+                            "time=%Y-%m-%dT%H:%M:%S", &tm);
+            len += sprintf(batch + len, ".%06dZ ",
+                           (int) (rec->t_wall % 1000000));
+            memcpy(batch + len, rec->text, rec->len);
+            len += rec->len;
+            batch[len++] = '\n';
+        }
+
+        __sync_synchronize();
+        r->tail = t;
+
+        unsigned int dropped = r->dropped;
+        if (dropped > 0)
+        {
+            __sync_fetch_and_sub(&r->dropped, dropped);
+
+            char note[128];
+            snprintf(note, sizeof(note),
+                     "level=warning msg=\"log ring full\" dropped=%u",
+                     dropped);
+            if (to_axis2)
+            {
+                sp_log_to_axis2(SP_LOG_LEVEL_WARNING, note);
+            }
+            else
+            {
+                if (len + sizeof(note) + 1 > SP_LOG_BATCH_LEN)
+                {
+                    sp_log_write_fd(batch, len);
+                    len = 0;
+                }
+                len += sprintf(batch + len, "%s\n", note);
+            }
+        }
+    }
+
+    if (len > 0) sp_log_write_fd(batch, len);
+}
+
+//-----------------------------------------------------------------------------
+static void *sp_log_flusher(void *arg)
+{
+    while (! sp_log_stop)
+    {
+        usleep(SP_LOG_FLUSH_USECS);
+        pthread_mutex_lock(&sp_log_drain_lock);
+        sp_log_drain();
+        pthread_mutex_unlock(&sp_log_drain_lock);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// In a forked child only the forking thread survives; the records of the
+// parent are the parent's to write, and the flusher has to be restarted.
+static void sp_log_atfork_child(void)
+{
+    pthread_mutex_init(&sp_log_drain_lock, NULL);
+    for (sp_log_ring *r = sp_log_rings; NULL != r; r = r->next)
+    {
+        r->tail    = r->head;
+        r->dropped = 0;
+    }
+    sp_log_started = 0;
+    sp_log_async   = 0;
+    sp_log_stop    = 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_log_start(void)
+{
+    static volatile int registered = 0;
+
+    pthread_mutex_lock(&sp_log_drain_lock);
+    if (! sp_log_started)
+    {
+        if (! registered)
+        {
+            registered = 1;
+            pthread_atfork(NULL, NULL, sp_log_atfork_child);
+            atexit(sp_log_flush);
+        }
+
+        sp_log_stop  = 0;
+        sp_log_async = (0 == pthread_create(&sp_log_flusher_tid, NULL,
+                                            sp_log_flusher, NULL));
+
+        __sync_synchronize();
+        sp_log_started = 1;
+    }
+    pthread_mutex_unlock(&sp_log_drain_lock);
+}
+
+//-----------------------------------------------------------------------------
+/** Format one record into the ring of the calling thread.
+ * @param msg   message text, quoted in the output.
+ * @param fields additional key=value fields, or NULL.
+ * @return length of msg, 0 if the record was not written.
+ */
+static int sp_log_emit(
+    const int   level,
+    const char *file,
+    const int   line,
+    const void *site,
+    const char *msg,
+    const char *fields)
+{
+    if (! sp_log_started) sp_log_start();
+
+    unsigned int suppressed = 0;
+    if (! sp_log_allow(NULL == site ? file : site, line, &suppressed))
+        return 0;
+
+    sp_log_ring *r = sp_log_get_ring();
+    if (NULL == r) return 0;
+
+    const unsigned int h = r->head;
+    if (h - r->tail >= SP_LOG_RING_SLOTS)
+    {
+        __sync_fetch_and_add(&r->dropped, 1);
+        return 0;
+    }
+
+    struct sp_log_rec_struct *rec = &r->recs[h & (SP_LOG_RING_SLOTS-1)];
+    char *text = rec->text;
+    const int max = SP_LOG_REC_LEN;
+
+    rec->t_wall = sp_log_wall_usecs();
+    rec->level  = level;
+
+    int len = sp_log_append(text, 0, max, "level=%s msg=",
+                            sp_log_level_names[level]);
+    len = sp_log_append_quoted(text, len, max, msg);
+
+    const sp_req_stats *rs = sp_stats_current();
+    if (NULL != rs)
+    {
+        len = sp_log_append(text, len, max,
+                " req_id=%s op=%s backend=%s elapsed_ms=%.3f",
+                rs->req_id,
+                sp_stats_op_name(rs->op),
+                SP_BE_URL == rs->backend ? "url" : "exec",
+                (double) (sp_stats_now() - rs->t_start) / 1e6);
+    }
+    if (NULL != file)
+    {
+        const char *base = strrchr(file, '/');
+        len = sp_log_append(text, len, max, " src=%s:%d",
+                            NULL == base ? file : base + 1, line);
+    }
+    if (suppressed > 0)
+    {
+        len = sp_log_append(text, len, max, " suppressed=%u", suppressed);
+    }
+    if (NULL != fields && '\0' != fields[0])
+    {
+        len = sp_log_append(text, len, max, " %s", fields);
+    }
+    rec->len = len;
+
+    __sync_synchronize();
+    r->head = h + 1;
+
+    if (! sp_log_async) sp_log_flush();
+
+    return strlen(msg);
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Check whether records of a level would be written, e.g. to skip
+ * expensive preparation of debug output.
+ * @param level
+ * @return 1 if enabled, 0 otherwise.
+ */
+int sp_log_enabled(const int level)
+{
+    return level <= sp_log_level;
+}
+
+//-----------------------------------------------------------------------------
+/** Apply the logging parameters of the service.  Only the first call in a
+ * process has any effect.
+ * @param env
+ * @param props
+ */
+void sp_log_configure(const axutil_env_t *env, const sp_props *props)
+{
+    if (sp_log_configured ||
+        ! __sync_bool_compare_and_swap(&sp_log_configured, 0, 1))
+    {
+        return;
+    }
+
+    sp_log_level = rp_getLogLevel(env, props);
+    sp_log_rate  = rp_getLogRateLimit(env, props);
+
+    const axis2_char_t *path = rp_getLogFile(env, props);
+    if ('\0' == path[0] || 0 == strcmp(path, "stderr"))
+    {
+        return;
+    }
+
+    // Records queued so far go to the old destination.
+    sp_log_flush();
+
+    if (0 == axutil_strcasecmp(path, "axis2"))
+    {
+        sp_log_axis2_log = env->log;
+        sp_log_dest      = SP_LOG_DEST_AXIS2;
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        SP_LOG_ERROR("Cannot open %s %s: %s, logging to stderr.",
+                     SP_LOGFILE_STR, path, strerror(errno));
+        return;
+    }
+    sp_log_fd = fd;
+}
+
+//-----------------------------------------------------------------------------
+/** Write out all queued records now.  Called on exit.
+ */
+void sp_log_flush(void)
+{
+    pthread_mutex_lock(&sp_log_drain_lock);
+    sp_log_drain();
+    pthread_mutex_unlock(&sp_log_drain_lock);
+}
+
+//-----------------------------------------------------------------------------
+/** Stop and join the flusher and write out all queued records.  Records
+ * logged afterwards start a new flusher.  Called from the free hook of
+ * the service.
+ */
+void sp_log_shutdown(void)
+{
+    int join = 0;
+
+    pthread_mutex_lock(&sp_log_drain_lock);
+    if (sp_log_started && sp_log_async)
+    {
+        sp_log_stop  = 1;
+        sp_log_async = 0;
+        join = 1;
+    }
+    pthread_mutex_unlock(&sp_log_drain_lock);
+
+    if (join) pthread_join(sp_log_flusher_tid, NULL);
+
+    pthread_mutex_lock(&sp_log_drain_lock);
+    sp_log_drain();
+    if (join) sp_log_started = 0;
+    pthread_mutex_unlock(&sp_log_drain_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Library unload: the flusher and the ring destructor live in this object.
+static void __attribute__ ((destructor)) sp_log_unload(void)
+{
+    sp_log_shutdown();
+    if (sp_log_key_made)
+    {
+        sp_log_key_made = 0;
+        pthread_key_delete(sp_log_ring_key);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Log a printf-formatted message.  Normally used through the
+ * SP_LOG_xxx macros.
+ * @param level one of sp_log_levels.
+ * @param file source file, or NULL.
+ * @param line
+ * @param site key for rate limiting, NULL to use file and line.
+ * @param format
+ * @return length of the message, 0 if it was filtered, rate limited
+ *         or dropped.
+ */
+int sp_log_write(
+    const int   level,
+    const char *file,
+    const int   line,
+    const void *site,
+    const char *format,
+    ...)
+{
+    va_list args;
+    va_start(args, format);
+    int ret = sp_log_vwrite(level, file, line, site, format, args);
+    va_end(args);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+/** va_list variant of sp_log_write().
+ */
+int sp_log_vwrite(
+    const int   level,
+    const char *file,
+    const int   line,
+    const void *site,
+    const char *format,
+    va_list     args)
+{
+    if (level < 0 || level > sp_log_level) return 0;
+
+    char msg[SP_LOG_REC_LEN];
+    vsnprintf(msg, sizeof(msg), format, args);
+
+    return sp_log_emit(level, file, line, site, msg, NULL);
+}
+
+//-----------------------------------------------------------------------------
+/** Log a fixed message with printf-formatted key=value fields.
+ * Normally used through SP_LOG_KV.
+ * @param level
+ * @param file
+ * @param line
+ * @param msg
+ * @param fields_format e.g. "bytes=%d status=%d"
+ * @return length of msg, 0 if the record was not written.
+ */
+int sp_log_kv(
+    const int   level,
+    const char *file,
+    const int   line,
+    const char *msg,
+    const char *fields_format,
+    ...)
+{
+    if (level < 0 || level > sp_log_level) return 0;
+
+    char fields[SP_LOG_REC_LEN];
+    va_list args;
+    va_start(args, fields_format);
+    vsnprintf(fields, sizeof(fields), fields_format, args);
+    va_end(args);
+
+    return sp_log_emit(level, file, line, msg, msg, fields);
+}
@@ -0,0 +1,105 @@
+/*
+ * Soap Proxy - logging header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_log.h
+ *
+ */
+
+#ifndef SPLOG_H_INCLUDED
+#define SPLOG_H_INCLUDED
+
+#include <stdarg.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+/**
+ * Log levels, in order of decreasing severity.
+ */
+enum sp_log_levels
+{
+	SP_LOG_LEVEL_ERROR = 0,
+	SP_LOG_LEVEL_WARNING,
+	SP_LOG_LEVEL_INFO,
+	SP_LOG_LEVEL_DEBUG,
+
+	SP_LOG_NLEVELS
+};
+
+//
+// Convenience macros.  The message is printf-formatted.
+//
+#define SP_LOG_ERROR(...)   \
+	sp_log_write(SP_LOG_LEVEL_ERROR,   __FILE__, __LINE__, NULL, __VA_ARGS__)
+#define SP_LOG_WARNING(...) \
+	sp_log_write(SP_LOG_LEVEL_WARNING, __FILE__, __LINE__, NULL, __VA_ARGS__)
+#define SP_LOG_INFO(...)    \
+	sp_log_write(SP_LOG_LEVEL_INFO,    __FILE__, __LINE__, NULL, __VA_ARGS__)
+#define SP_LOG_DEBUG(...)   \
+	sp_log_write(SP_LOG_LEVEL_DEBUG,   __FILE__, __LINE__, NULL, __VA_ARGS__)
+
+//
+// A fixed message plus printf-formatted key=value fields, e.g.
+//   SP_LOG_KV(SP_LOG_LEVEL_INFO, "backend done", "bytes=%d status=%d", n, s);
+//
+#define SP_LOG_KV(level, msg, ...) \
+	sp_log_kv(level, __FILE__, __LINE__, msg, __VA_ARGS__)
+
+int  sp_log_enabled  (const int level);
+
+void sp_log_configure(const axutil_env_t *env, const sp_props *props);
+void sp_log_flush    (void);
+void sp_log_shutdown (void);
+
+int  sp_log_write(
+    const int   level,
+    const char *file,
+    const int   line,
+    const void *site,
+    const char *format,
+    ...) __attribute__ ((format (printf, 5, 6)));
+
+int  sp_log_vwrite(
+    const int   level,
+    const char *file,
+    const int   line,
+    const void *site,
+    const char *format,
+    va_list     args);
+
+int  sp_log_kv(
+    const int   level,
+    const char *file,
+    const int   line,
+    const char *msg,
+    const char *fields_format,
+    ...) __attribute__ ((format (printf, 5, 6)));
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Soap Proxy.
+ *
+ * Streaming decoder of multipart responses.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_mime.c
+ *
+ * The multipart/mixed response of a GetCoverage request holds the GML
+ * description of the coverage and the coverage data, e.g. a GeoTIFF, as
+ * separate parts.  The decoder reads them in a single pass from the
+ * sp_reader that read the response headers: the delimiter is searched for
+ * in the reader's buffer, and the bytes in front of it are handed out
+ * without being copied anywhere else first.
+ *
+ * The mapserver patch omits the line break in front of the delimiter
+ * after binary data (see SP_MS_BOUNDARIES_BUG in sp_process_mime.c), so a
+ * delimiter is recognised anywhere, not only at the start of a line; a
+ * line break in front of it is dropped from the data as usual.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sp_mime.h"
+#include "sp_log.h"
+#include "sp_stats.h"
+
+#define SP_MIME_LOAD_INIT  (64*1024)
+
+// =========================  public functions ===============================
+//-----------------------------------------------------------------------------
+/** Set up a decoder for the body that follows in rd.
+ * @param mm
+ * @param rd positioned behind the headers of the response.
+ * @param content_type value of the Content-Type header, with the
+ *   boundary parameter.
+ * @return 0, or -1 if there is no usable boundary.
+ */
+int sp_mime_init(
+    sp_mime    *mm,
+    sp_reader  *rd,
+    const char *content_type)
+{
+    const char *b   = content_type;
+    size_t      len = 0;
+
+    mm->rd        = rd;
+    mm->state     = SP_MIME_PREAMBLE;
+    mm->truncated = 0;
+    mm->dlen      = 0;
+    mm->delim[0]  = '\0';
+
+    while (b && (b = strchr(b, ';')))
+    {
+        b++;
+        while (' ' == *b || '\t' == *b) b++;
+        if (0 == strncasecmp(b, "boundary=", 9))
+        {
+            b += 9;
+            break;
+        }
+    }
+    if (NULL == b) return -1;
+
+    if ('"' == *b)
+    {
+        const char *q = strchr(++b, '"');
+        len = q ? (size_t) (q - b) : 0;
+    }
+    else
+    {
+        len = strcspn(b, " \t;");
+    }
+    if (0 == len || len > SP_HTTP_BOUNDLEN) return -1;
+
+    mm->delim[0] = mm->delim[1] = '-';
+    memcpy(mm->delim + 2, b, len);
+    mm->dlen = len + 2;
+    mm->delim[mm->dlen] = '\0';
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Read up to n bytes of the body of the current part.
+ * @param mm
+ * @param dst
+ * @param n
+ * @return the number of bytes read, 0 at the end of the part.
+ */
+int sp_mime_read(
+    sp_mime *mm,
+    void    *dst,
+    size_t   n)
+{
+    sp_reader *rd = mm->rd;
+
+    if (SP_MIME_BODY != mm->state && SP_MIME_PREAMBLE != mm->state) return 0;
+    if (0 == n) return 0;
+
+    while ( 1 )
+    {
+        char   *w    = rd->buf + rd->pos;
+        size_t  wlen = rd->end - rd->pos;
+        size_t  safe = 0;
+        char   *d    = memmem(w, wlen, mm->delim, mm->dlen);
+
+        if (d)
+        {
+            safe = d - w;
+            if (safe > 0 && '\n' == w[safe-1])
+            {
+                safe--;
+                if (safe > 0 && '\r' == w[safe-1]) safe--;
+            }
+            if (0 == safe)
+            {
+                rd->pos   = (d - rd->buf) + mm->dlen;
+                mm->state = SP_MIME_DELIM;
+                return 0;
+            }
+        }
+        else if (rd->eof)
+        {
+            safe = wlen;
+            if (0 == safe)
+            {
+                mm->state     = SP_MIME_DONE;
+                mm->truncated = 1;
+                return 0;
+            }
+        }
+        else
+        {
+            // hold back what could be the start of a delimiter
+            if (wlen > mm->dlen + 2) safe = wlen - (mm->dlen + 2);
+            if (0 == safe)
+            {
+                // 0 without eof: the buffer could not grow
+                if (0 == sp_reader_fill(rd) && ! rd->eof)
+                {
+                    mm->state     = SP_MIME_DONE;
+                    mm->truncated = 1;
+                    return 0;
+                }
+                continue;
+            }
+        }
+
+        if (n > safe) n = safe;
+        memcpy(dst, w, n);
+        rd->pos += n;
+        sp_stats_add_bytes_in(n);
+        return (int) n;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Read call-back for axiom_xml_reader_create_for_io(), reads the body of
+ *  the current part.
+ * @param ctx the sp_mime decoder.
+ */
+int sp_mime_read_CB(
+    char *buffer,
+    int   size,
+    void *ctx)
+{
+    if (size <= 0) return 0;
+    return sp_mime_read((sp_mime *) ctx, buffer, size);
+}
+
+//-----------------------------------------------------------------------------
+/** Move on to the next part, skipping what is left of the current one.
+ * @param env
+ * @param mm
+ * @param hh set to the headers of the part; they point into the
+ *   reader's buffer and are valid until the next call.
+ * @return 1 if there is a part, 0 at the end, -1 on error.
+ */
+int sp_mime_next(
+    const axutil_env_t *env,
+    sp_mime            *mm,
+    sp_headers         *hh)
+{
+    char   skip[SP_IMG_BUF_SIZE];
+    size_t len = 0;
+    int    c;
+
+    while (sp_mime_read(mm, skip, sizeof(skip)) > 0)
+        ;
+    if (SP_MIME_DELIM != mm->state) return 0;
+
+    // close delimiter, or transport padding and the line break
+    c = sp_reader_getc(mm->rd);
+    if ('-' == c && '-' == (c = sp_reader_getc(mm->rd)))
+    {
+        mm->state = SP_MIME_DONE;
+        return 0;
+    }
+    while (EOF != c && '\n' != c) c = sp_reader_getc(mm->rd);
+    if (EOF == c)
+    {
+        mm->state     = SP_MIME_DONE;
+        mm->truncated = 1;
+        return 0;
+    }
+
+    char *block = sp_reader_header_block(mm->rd, &len);
+    if (NULL == block) return -1;
+
+    sp_stats_add_bytes_in(mm->dlen + len);
+
+    hh->n = 0;
+    if (sp_headers_parse(env, hh, block, len) < 0) return -1;
+
+    mm->state = SP_MIME_BODY;
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+/** Read the rest of the current part into one buffer.
+ * @param env
+ * @param mm
+ * @param size_hint expected size, e.g. from Content-Length; <= 0 if unknown.
+ * @param len set to the number of bytes read.
+ * @return the data (owned by the caller), NULL when empty, out of memory
+ *  or longer than INT_MAX.
+ */
+char *sp_mime_load(
+    const axutil_env_t *env,
+    sp_mime            *mm,
+    const long          size_hint,
+    int                *len)
+{
+    const size_t max  = (size_t) INT_MAX + 1;   // one more to tell
+    size_t       size = size_hint > 0 ? (size_t) size_hint + 1 : SP_MIME_LOAD_INIT;
+    size_t       n    = 0;
+    char        *data = NULL;
+    int          r;
+
+    *len = 0;
+    if (size_hint > INT_MAX)
+    {
+        SP_LOG_ERROR("part of %ld bytes too large", size_hint);
+        return NULL;
+    }
+    data = (char *) AXIS2_MALLOC(env->allocator, size);
+    if (NULL == data) return NULL;
+
+    while ( 1 )
+    {
+        if (n == size)
+        {
+            if (size >= max)
+            {
+                SP_LOG_ERROR("part of more than %d bytes too large", INT_MAX);
+                AXIS2_FREE(env->allocator, data);
+                return NULL;
+            }
+            const size_t more_size = size < max / 2 ? size * 2 : max;
+            char *more = (char *) AXIS2_MALLOC(env->allocator, more_size);
+            if (NULL == more)
+            {
+                SP_LOG_ERROR("out of memory loading a part of %lu bytes",
+                             (unsigned long) n);
+                AXIS2_FREE(env->allocator, data);
+                return NULL;
+            }
+            memcpy(more, data, n);
+            AXIS2_FREE(env->allocator, data);
+            data = more;
+            size = more_size;
+        }
+        r = sp_mime_read(mm, data + n, size - n);
+        if (r <= 0) break;
+        n += r;
+    }
+
+    if (0 == n || n > INT_MAX)
+    {
+        if (n) SP_LOG_ERROR("part of more than %d bytes too large", INT_MAX);
+        AXIS2_FREE(env->allocator, data);
+        return NULL;
+    }
+    *len = (int) n;
+    return data;
+}
@@ -0,0 +1,90 @@
+/*
+ * Soap Proxy - streaming multipart decoder header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_mime.h
+ *
+ */
+
+#ifndef SPMIME_H_INCLUDED
+#define SPMIME_H_INCLUDED
+
+#include "soap_proxy.h"
+
+enum sp_mime_states
+{
+    SP_MIME_PREAMBLE = 0,   // before the first delimiter
+    SP_MIME_BODY,           // inside the body of a part
+    SP_MIME_DELIM,          // just behind a delimiter
+    SP_MIME_DONE            // close delimiter or end of input seen
+};
+
+//
+// Decoder of a multipart body (RFC 2046, section 5.1) read from an
+// sp_reader.  Parts are yielded one at a time by sp_mime_next(), their
+// bodies are read with sp_mime_read(); nothing is kept of earlier parts.
+//
+struct sp_mime_struct
+{
+    sp_reader *rd;
+    int        state;
+    int        truncated;   // input ended before the close delimiter
+    size_t     dlen;
+    char       delim[SP_HTTP_BOUNDLEN + 3];   // "--" boundary
+};
+
+typedef struct sp_mime_struct sp_mime;
+
+int sp_mime_init(
+    sp_mime    *mm,
+    sp_reader  *rd,
+    const char *content_type);
+
+int sp_mime_next(
+    const axutil_env_t *env,
+    sp_mime            *mm,
+    sp_headers         *hh);
+
+int sp_mime_read(
+    sp_mime *mm,
+    void    *dst,
+    size_t   n);
+
+int sp_mime_read_CB(
+    char *buffer,
+    int   size,
+    void *ctx);
+
+char *sp_mime_load(
+    const axutil_env_t *env,
+    sp_mime            *mm,
+    const long          size_hint,
+    int                *len);
+
+#endif
@@ -29,15 +29,38 @@
 
 /**
  * @file sp_ms_version.c
- * 
+ *
+ * GetMsVersion is polled by monitoring, so its answer is computed once and
+ * kept in a shared memory segment for all processes of the service.
+ *
+ * With MapServ the answer is the output of 'mapserv -v', the svnversion
+ * of the directory holding the executable, and its modification time.
+ * The cached answer is keyed by the path, device, inode, size and mtime
+ * of the executable, so replacing mapserv invalidates it; checking this
+ * costs one stat() per request.
+ *
+ * With BackendURL the backend is asked for the ServiceIdentification
+ * section of its capabilities, and the answer is kept for
+ * SP_MSVERS_URL_TTL seconds.
+ *
+ * The entry is protected by a sequence counter: readers retry if it
+ * changed (or is odd) while they copied.  Only the process which claims
+ * the 'busy' flag stores a new answer; others compute their own answer
+ * meanwhile but do not store it.
+ *
  */
 
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <time.h>
 #include "soap_proxy.h"
+#include "sp_canon.h"
+#include "sp_log.h"
+#include "sp_stats.h"
 
 #define SP_TMSTR_LEN 28
 #define SP_SVNVSTR_LEN 20
@@ -45,6 +68,242 @@
 #define SP_TOTAL_RESP_STR_LEN \
 	SP_TMSTR_LEN+SP_SVNVSTR_LEN+SP_VERSSTR_LEN
 
+#define SP_MSVERS_URL_TTL   3600   // seconds a backend's answer is used
+#define SP_MSVERS_BUSY_SECS 60     // a claim older than this was abandoned
+#define SP_MSVERS_TRIES     8
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int          wcs_version);
+
+struct sp_msvers_struct
+{
+    volatile uint32_t seq;     // odd while the entry is being updated
+    volatile time_t   busy;    // time a process claimed the update, or 0
+    uint64_t          key[2];
+    time_t            stamp;   // time the answer was computed
+    char              text[SP_TOTAL_RESP_STR_LEN];
+};
+
+static struct sp_msvers_struct  sp_msvers_local;
+static struct sp_msvers_struct *volatile sp_msvers = NULL;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+// Map the shared entry on first use, falling back to process memory.
+static struct sp_msvers_struct *sp_msvers_segment(const axutil_env_t *env)
+{
+    static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    if (NULL == sp_msvers)
+    {
+    	pthread_mutex_lock(&map_lock);
+    	if (NULL == sp_msvers)
+    	{
+    		struct sp_msvers_struct *seg = sp_map_shared(
+    				env, "msvers", sizeof(struct sp_msvers_struct));
+    		sp_msvers = seg ? seg : &sp_msvers_local;
+    	}
+    	pthread_mutex_unlock(&map_lock);
+    }
+    return sp_msvers;
+}
+
+//-----------------------------------------------------------------------------
+/** Copy the cached answer if it is for 'key' and not older than ttl.
+ * @return 1 if text was set, 0 otherwise.
+ */
+static int sp_msvers_get(
+    struct sp_msvers_struct *seg,
+    const uint64_t           key[2],
+    const time_t             ttl,
+    char                    *text)
+{
+    for (int tries = 0; tries < SP_MSVERS_TRIES; tries++)
+    {
+    	const uint32_t seq = seg->seq;
+    	if (seq & 1)
+    	{
+    		sched_yield();
+    		continue;
+    	}
+    	__sync_synchronize();
+
+    	int found = seg->key[0] == key[0] && seg->key[1] == key[1] &&
+    			seg->stamp != 0 &&
+    			(0 == ttl || time(NULL) - seg->stamp < ttl);
+    	if (found)
+    	{
+    		memcpy(text, seg->text, SP_TOTAL_RESP_STR_LEN);
+    		text[SP_TOTAL_RESP_STR_LEN - 1] = '\0';
+    	}
+
+    	__sync_synchronize();
+    	if (seg->seq == seq) return found;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Claim the right to store a new answer.
+ * @return non-zero if claimed; release with sp_msvers_put().
+ */
+static int sp_msvers_claim(struct sp_msvers_struct *seg)
+{
+    const time_t now  = time(NULL);
+    const time_t busy = seg->busy;
+
+    if (0 != busy && now - busy < SP_MSVERS_BUSY_SECS) return 0;
+    return __sync_bool_compare_and_swap(&seg->busy, busy, now);
+}
+
+//-----------------------------------------------------------------------------
+/** Store an answer (text may be NULL if it could not be computed) and
+ * release the claim.
+ */
+static void sp_msvers_put(
+    struct sp_msvers_struct *seg,
+    const uint64_t           key[2],
+    const char              *text)
+{
+    if (text)
+    {
+    	__sync_fetch_and_add(&seg->seq, 1);
+    	__sync_synchronize();
+
+    	seg->key[0] = key[0];
+    	seg->key[1] = key[1];
+    	seg->stamp  = time(NULL);
+    	strncpy(seg->text, text, SP_TOTAL_RESP_STR_LEN - 1);
+    	seg->text[SP_TOTAL_RESP_STR_LEN - 1] = '\0';
+
+    	__sync_synchronize();
+    	__sync_fetch_and_add(&seg->seq, 1);
+    }
+    seg->busy = 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Version of the mapserv executable: svnversion, mtime and 'mapserv -v'.
+ * @return 0 on success, -1 on failure.
+ */
+static int sp_msvers_exec(
+    const axutil_env_t *env,
+    const char         *msexec,
+    const struct stat  *sb,
+    char               *resp_str)
+{
+    char vers_str [SP_VERSSTR_LEN];
+    char mtime    [SP_TMSTR_LEN  ];
+    char svnvers  [SP_SVNVSTR_LEN];
+
+    mtime[0] = svnvers[0] = '\0';
+
+    if (sp_execMs_dashV(env, msexec, vers_str, SP_VERSSTR_LEN) < 0)
+    {
+    	return -1;
+    }
+
+    // get path component of msexec
+    char mspath[SP_MAX_MPATHS_LEN];
+    strncpy(mspath, msexec, SP_MAX_MPATHS_LEN - 1);
+    mspath[SP_MAX_MPATHS_LEN - 1] = '\0';
+    char *xx = rindex(mspath, '/');
+    if (xx) *xx = '\0';
+
+    // Get svn version.
+    // Optimistically assume that the mapserver executable is still
+    // located in the same svn directory as its corresponding source.
+    char *const svn_argv[] = { "svnversion", mspath, NULL };
+    if (sp_exec_capture(env, svn_argv, svnvers, SP_SVNVSTR_LEN) < 0)
+    {
+    	svnvers[0] = '\0';
+    }
+
+    ctime_r(&sb->st_mtime, mtime);
+
+    snprintf(resp_str, SP_TOTAL_RESP_STR_LEN, "%s%s%s",
+    		svnvers, mtime, vers_str);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Ask the backend for the ServiceIdentification of its capabilities.
+ * @return 0 on success, -1 on failure.
+ */
+static int sp_msvers_backend(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    char               *resp_str)
+{
+    axiom_node_t    *req_node = NULL;
+    axiom_node_t    *node     = NULL;
+    axiom_element_t *el       = NULL;
+
+    axiom_namespace_t *wcs_ns = axiom_namespace_create(
+    		env, "http://www.opengis.net/wcs/2.0", "wcs");
+    axiom_namespace_t *ows_ns = axiom_namespace_create(
+    		env, "http://www.opengis.net/ows/2.0", "ows");
+
+    el = axiom_element_create(env, NULL, "GetCapabilities", wcs_ns, &req_node);
+    axiom_element_add_attribute(el, env,
+    		axiom_attribute_create(env, "service", "WCS", NULL), req_node);
+    axiom_element_declare_namespace(el, env, req_node, ows_ns);
+    el = axiom_element_create(env, req_node, "Sections", ows_ns, &node);
+    el = axiom_element_create(env, node, "Section", ows_ns, &node);
+    axiom_element_set_text(el, env, "ServiceIdentification", node);
+
+    axiom_node_t *resp_node = rp_invokeBackend(env, req_node, props, SP_WCS_V200);
+    axiom_node_free_tree(req_node, env);
+    if (NULL == resp_node) return -1;
+
+    axiom_node_t *svc_node =
+    		rp_find_named_node(env, resp_node, "ServiceIdentification", 1);
+    if (NULL == svc_node)
+    {
+    	axiom_node_free_tree(resp_node, env);
+    	return -1;
+    }
+
+    const axis2_char_t *title   = NULL;
+    char                versions[SP_VERSSTR_LEN / 4];
+    versions[0] = '\0';
+
+    for (node = axiom_node_get_first_child(svc_node, env);
+    	 node;
+    	 node = axiom_node_get_next_sibling(node, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(node, env)) continue;
+    	el = axiom_node_get_data_element(node, env);
+    	const axis2_char_t *name = axiom_element_get_localname(el, env);
+
+    	if (NULL == title && 0 == axutil_strcmp(name, "Title"))
+    	{
+    		title = sp_get_text_el(node, env);
+    	}
+    	else if (0 == axutil_strcmp(name, "ServiceTypeVersion"))
+    	{
+    		const axis2_char_t *v = sp_get_text_el(node, env);
+    		const size_t n = strlen(versions);
+    		if (v) snprintf(versions + n, sizeof(versions) - n, "%s%s",
+    				n ? " " : "", v);
+    	}
+    }
+
+    snprintf(resp_str, SP_TOTAL_RESP_STR_LEN,
+    		"Backend: %s\nTitle: %s\nServiceTypeVersion: %s\n",
+    		rp_getBackendURL(env, props), title ? title : "", versions);
+
+    axiom_node_free_tree(resp_node, env);
+    return 0;
+}
+
+// =========================  public functions = ===============================
+
 //-----------------------------------------------------------------------------
 axiom_node_t *
 rp_getMsVers(
@@ -52,69 +311,68 @@ rp_getMsVers(
     const sp_props     *props)
 {
     axiom_node_t *return_node = NULL;
+    char          resp_str[SP_TOTAL_RESP_STR_LEN];
+    char          ident[SP_MAX_MPATHS_LEN * 2 + 96];
+    uint64_t      key[2];
+    struct stat   sb;
+    time_t        ttl;
 
-    if (rp_getUrlMode(env, props))
-    {
-    	SP_ERROR(env, SP_SYS_ERR_NOT_IMPLEMENTED);
-    	rp_log_error(env, "getMsVersion not implemented with backend_url.\n");
-    	return NULL;
-    }
-
-    const axis2_char_t *msexec = rp_getMapserverExec(env, props);
+    const int           url_mode = rp_getUrlMode(env, props);
+    const axis2_char_t *msexec   = rp_getMapserverExec(env, props);
 
-    int resp_fd = rp_execMs_dashV(env, msexec);
-    if (resp_fd < 0)
+    if (url_mode)
     {
-    	SP_ERROR(env, SP_SYS_ERR_MS_EXEC);
-    	rp_log_error(env, "%s:%d: Mapserver -v exec fail - msexec='%s'\n",
-    			__FILE__, __LINE__, msexec);
+    	snprintf(ident, sizeof(ident), "url|%s|%s",
+    			rp_getBackendURL(env, props), rp_getMapfile(env, props));
+    	ttl = SP_MSVERS_URL_TTL;
     }
     else
     {
-    	char vers_str [SP_VERSSTR_LEN];
-    	char mtime    [SP_TMSTR_LEN  ];
-    	char svnvers  [SP_SVNVSTR_LEN];
-    	char resp_str [SP_TOTAL_RESP_STR_LEN];
-
-    	vers_str[0] = mtime[0] = svnvers[0] = resp_str[0] = '\0';
-
-    	int n_read = read(resp_fd, vers_str, SP_VERSSTR_LEN);
-    	vers_str[n_read] = '\0';
-    	close(resp_fd);
-
-    	// get path component of msexec
-    	char mspath[SP_MAX_MPATHS_LEN];
-    	strncpy(mspath, msexec, SP_MAX_MPATHS_LEN);
-    	char *xx = rindex(mspath, '/');
-    	*xx = '\0';
-
-    	// Get svn version.
-    	// Optimistically assume that the mapserver executable is still
-    	// located in the same svn directory as its corresponding source.
-    	char svncmd[SP_MAX_MPATHS_LEN];
-    	snprintf(svncmd, SP_MAX_MPATHS_LEN, "%s %s", "svnversion", mspath);
-    	FILE *pp = popen(svncmd, "r");
-    	if (pp)
+    	if (stat(msexec, &sb))
     	{
-    		fgets(svnvers, SP_SVNVSTR_LEN, pp);
-    		pclose(pp);
+    		SP_ERROR(env, SP_SYS_ERR_MS_EXEC);
+    		rp_log_error(env, "%s:%d: cannot stat msexec='%s'\n",
+    				__FILE__, __LINE__, msexec);
+    		return NULL;
     	}
+    	snprintf(ident, sizeof(ident), "exec|%s|%llx|%llx|%lld|%lld.%09ld",
+    			msexec,
+    			(unsigned long long) sb.st_dev,
+    			(unsigned long long) sb.st_ino,
+    			(long long) sb.st_size,
+    			(long long) sb.st_mtim.tv_sec, (long) sb.st_mtim.tv_nsec);
+    	ttl = 0;
+    }
+    sp_murmur3_128(ident, strlen(ident), 0, key);
 
-    	struct stat buf;
-        if (0 == stat(msexec, &buf))
-        {
-        	ctime_r(&buf.st_mtime, mtime);
-        }
-
-        snprintf(resp_str, SP_TOTAL_RESP_STR_LEN, "%s%s%s",
-        		svnvers, mtime, vers_str);
+    struct sp_msvers_struct *seg = sp_msvers_segment(env);
+    const int hit = sp_msvers_get(seg, key, ttl, resp_str);
+    sp_stats_cache("msversion", hit);
 
-        axiom_namespace_t * ns =
-        		axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
-        axiom_element_t *resp_om_ele =  axiom_element_create(
-            env, NULL, "MapServerVersion", ns, &return_node);
+    if (! hit)
+    {
+    	const int claimed = sp_msvers_claim(seg);
+    	const int failed  = url_mode ?
+    			sp_msvers_backend(env, props, resp_str) :
+    			sp_msvers_exec(env, msexec, &sb, resp_str);
+    	if (claimed) sp_msvers_put(seg, key, failed ? NULL : resp_str);
 
-        axiom_element_set_text(resp_om_ele, env, resp_str, return_node);
+    	if (failed)
+    	{
+    		SP_ERROR(env, SP_SYS_ERR_MS_EXEC);
+    		rp_log_error(env, "%s:%d: version query failed - %s='%s'\n",
+    				__FILE__, __LINE__,
+    				url_mode ? "backend" : "msexec",
+    				url_mode ? rp_getBackendURL(env, props) : msexec);
+    		return NULL;
+    	}
     }
+
+    axiom_namespace_t * ns =
+    		axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    axiom_element_t *resp_om_ele =  axiom_element_create(
+    		env, NULL, "MapServerVersion", ns, &return_node);
+
+    axiom_element_set_text(resp_om_ele, env, resp_str, return_node);
     return return_node;
 }
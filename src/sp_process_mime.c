@@ -49,6 +49,7 @@
 #include <axutil_linked_list.h>
 
 #include "soap_proxy.h"
+#include "sp_stats.h"
 
 //  ===== call-backs and support for axiom_xml_reader_create_for_io() ========
 //-----------------------------------------------------------------------------
@@ -60,6 +61,10 @@ static void sp_cb_ctx_getchar(
 	{
 		*c = fgetc(ctx->fp);
 	}
+	else if (ctx->rd)
+	{
+		*c = sp_reader_getc(ctx->rd);
+	}
 	else
 	{
 		int n = axutil_stream_read (ctx->st, ctx->env, c, 1);
@@ -76,6 +81,10 @@ static char *sp_cb_ctx_getline(
 	{
 		return fgets(&(ctx->buf[1]), size, ctx->fp);
 	}
+	else if (ctx->rd)
+	{
+		return sp_reader_gets(ctx->rd, &(ctx->buf[1]), size, 0);
+	}
 	else
 	{
 		return sp_stream_getline(ctx->st, ctx->env, &(ctx->buf[1]), size, 0);
@@ -89,6 +98,7 @@ void init_rp_cb_ctx(
 {
     ctx->env      = env;
     ctx->fp       = NULL;
+    ctx->rd       = NULL;
     ctx->st       = NULL;
     ctx->bound    = NULL;
     ctx->done     = 0;
@@ -123,6 +133,10 @@ int rp_fill_buff_CB(
     	{
     		return fread(buffer, 1, size, rpctx->fp);
     	}
+    	else if (rpctx->rd)
+    	{
+    		return sp_reader_read(rpctx->rd, buffer, size);
+    	}
     	else
     	{
     		return axutil_stream_read (rpctx->st, rpctx->env, buffer, size);
@@ -279,6 +293,18 @@ int rp_fill_buff_CB(
     return size - n_to_read;
 }
 
+//-----------------------------------------------------------------------------
+// Same as rp_fill_buff_CB, but counts the response bytes for the statistics.
+static int sp_fill_buff_count_CB(
+    char *buffer,
+    int   size,
+    void *ctx)
+{
+    int n = rp_fill_buff_CB(buffer, size, ctx);
+    if (n > 0) sp_stats_add_bytes_in(n);
+    return n;
+}
+
 //-----------------------------------------------------------------------------
 int rp_close_CB(
     void *ctx)
@@ -290,10 +316,13 @@ int rp_close_CB(
 
 
 //-----------------------------------------------------------------------------
-static axiom_node_t *
-rp_process_xml_with_cbctx(
+// Parse the response, creating an om_element.
+// Input via a read call-back as for axiom_xml_reader_create_for_io().
+axiom_node_t *
+sp_process_xml_io(
     const axutil_env_t *env,
-    Rp_cb_ctx          *cbctx )
+    int (*read_cb)(char *buffer, int size, void *ctx),
+    void               *ctx)
 {
     axiom_document_t          *document      = NULL;
     axiom_node_t              *resp_om_node  = NULL;
@@ -303,7 +332,7 @@ rp_process_xml_with_cbctx(
     int                       success        = 1;
 
     xml_reader = axiom_xml_reader_create_for_io(
-        env, rp_fill_buff_CB, rp_close_CB, cbctx, NULL);
+        env, read_cb, rp_close_CB, ctx, NULL);
 
     om_builder = axiom_stax_builder_create(env, xml_reader);
 
@@ -352,6 +381,15 @@ rp_process_xml_with_cbctx(
     return resp_om_node;
 }
 
+//-----------------------------------------------------------------------------
+static axiom_node_t *
+rp_process_xml_with_cbctx(
+    const axutil_env_t *env,
+    Rp_cb_ctx          *cbctx )
+{
+    return sp_process_xml_io(env, sp_fill_buff_count_CB, cbctx);
+}
+
 //-----------------------------------------------------------------------------
 // Parse the response, creating an om_element.
 // Input via a FILE pointer.
@@ -369,6 +407,23 @@ rp_process_xml(
     return rp_process_xml_with_cbctx(env, &cbctx);
 }
 
+//-----------------------------------------------------------------------------
+// Parse the response, creating an om_element.
+// Input using a buffered reader, which may already hold part of it.
+axiom_node_t *
+sp_process_xml_rd(
+    const axutil_env_t *env,
+    sp_reader          *rd,
+    const char         *boundId)
+{
+    Rp_cb_ctx cbctx;
+    init_rp_cb_ctx(env, &cbctx);
+    cbctx.rd    = rd;
+    cbctx.bound = boundId;
+
+    return rp_process_xml_with_cbctx(env, &cbctx);
+}
+
 //-----------------------------------------------------------------------------
 // Parse the response, creating an om_element.
 // Input using an axutil_stream_t *.
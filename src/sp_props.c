@@ -47,12 +47,116 @@
  *    MapFile  - abs path to the mapserver configuration file
  *    MapServ  - abs path to the mapserver executable
  *
+ *  Logging is controlled by the optional parameters
+ *    LogFile      - path of the log file, 'axis2' to write to the Axis2
+ *                   log of the service, default stderr.
+ *    LogLevel     - error, warning, info (default) or debug.
+ *    LogRateLimit - max. records per second from any one place in the
+ *                   code, 0 for no limit, default 20.
+ *    SlowRequestMs - requests taking at least this many milliseconds are
+ *                   logged with their timing breakdown, 0 (default): off.
+ *
+ *  The GetCoverage result cache, and the DescribeCoverage one, see
+ *  sp_describe.c, are enabled by
+ *    CoverageCacheDir    - directory for the cached coverages.
+ *    CoverageCacheSizeMB - size budget of the cache, default 1024.
+ *
+ *  The administrative operations (PurgeCache, GetPoolStatus, DrainBackend,
+ *  PrewarmCache, DumpConfig) are only available if
+ *    AdminSecret    - value of the Secret element required in the request.
+ *  is set, and then also limited by
+ *    AdminAllowFrom - comma separated client addresses allowed, either
+ *                     single addresses or IPv4 networks as a.b.c.d/n.
+ *
+ *  The address of a client, for AdminAllowFrom and the rate limits, is
+ *  that of the peer, or, if the peer is one of
+ *    TrustedProxies - comma separated addresses or IPv4 networks of
+ *                     reverse proxies, e.g. the httpd of
+ *                     soap_proxy_httpd.conf,
+ *  the one the proxies report in X-Forwarded-For.
+ *
+ *  Coverages are returned as MTOM attachments, or inline as base64 to
+ *  clients that do not use MTOM.
+ *    MtomThreshold - coverages smaller than this many bytes are returned
+ *                    inline to all clients, default 0: off.
+ *
+ *  Requests to the backend are scheduled, see sp_sched.c, if
+ *    BackendSlots   - max. concurrent backend requests, default 0: off.
+ *    BackendLanes   - reserved slots and weight per lane, as
+ *                     "meta=1/8,search=0/4,coverage=1/2,bulk=0/1".
+ *    BackendQueueMs - max. wait for a slot, default 30000, 0: no limit.
+ *    BulkCoverageMB - GetCoverage responses expected to be at least this
+ *                     large go to the bulk lane, default 64.
+ *
+ *  Limits per client (authenticated user or address), see sp_client.c:
+ *    ClientRequestRate  - requests per second, default 0: no limit.
+ *    ClientRequestBurst - requests in a row above the rate, default 20.
+ *    ClientByteRateKB   - kilobytes per second from the backend,
+ *                         default 0: no limit.
+ *    ClientByteBurstMB  - megabytes in a row above the rate, default 256.
+ *    ClientUserProperty - message context property holding the user name
+ *                         a security module (e.g. Rampart) authenticated,
+ *                         default empty: clients are told by address.
+ *
+ *  Asynchronous GetCoverage jobs, see sp_job.c, are available if
+ *    AsyncSpoolDir  - directory for the jobs and their results.
+ *  is set.
+ *    AsyncMaxJobs   - max. jobs queued or running at a time, default 4.
+ *    AsyncKeepHours - finished jobs are removed after this, default 24.
+ *    AsyncNotifyHosts - hosts (host or host:port, comma separated) a
+ *                     ReplyTo may name, default empty: no notification.
+ *
+ *  DescribeEOCoverageSet is sent to several backends and the responses
+ *  merged, see sp_shard.c, if
+ *    BackendShards  - URLs of the backends, separated by commas.
+ *  is set.
+ *    ShardTimeoutMs - max. time for all of them to answer, default 60000,
+ *                     0: no limit.  Also for the strips of sp_tile.c and
+ *                     the rounds of sp_batch.c.
+ *
+ *  Large GetCoverage requests are split into strips fetched in parallel,
+ *  see sp_tile.c, if
+ *    TileStrips     - number of strips, default 0: off.
+ *  is set.
+ *    TileMinMB      - only for coverages expected to be larger than this,
+ *                     default 64, 0: all.
+ *
+ *  The Batch operation, see sp_batch.c:
+ *    BatchMaxItems  - max. requests in one Batch, default 32.
+ *    BatchParallel  - max. requests sent to the backend at once, default 4,
+ *                     1: one after the other.
+ *
+ *  GetCapabilities, see sp_caps.c:
+ *    CapabilitiesCacheSecs - seconds the full capabilities are kept to
+ *                     answer Sections and updateSequence locally,
+ *                     default 0: off.
+ *
+ *  DescribeEOCoverageSet, see sp_eoindex.c:
+ *    EOIndexSecs    - seconds a harvested index of a set of eoIds is used
+ *                     to answer subsets locally, needs CoverageCacheDir,
+ *                     default 0: off.
+ *
+ *  GetCoverage, see sp_estimate.c:
+ *    MaxCoverageMB  - requests estimated to return more than this many
+ *                     megabytes are refused, needs CoverageCacheDir,
+ *                     default 0: no limit.
+ *
+ *  Attachment compression, see sp_compress.c:
+ *    CompressLevel  - zlib level 1-9 of uncompressed TIFF coverages, which
+ *                     are then sent as Deflate compressed TIFFs to all
+ *                     clients, default 0: off.
+ *    CompressMinKB  - smaller coverages are sent as they are, default 64.
+ *    CompressThreads- threads compressing the strips of one coverage,
+ *                     default 4.
+ *
  */
 
 #include "soap_proxy.h"
 #include "sp_props.h"
 #include "sp_svc.h"
+#include "sp_log.h"
 
+#include <stdlib.h>
 #include <axutil_param.h>
 
 // =========================  local functions = ===============================
@@ -111,6 +215,25 @@ static int rp_load_boolean(
 
 }
 
+//-----------------------------------------------------------------------------
+/** Load a property with an integer value.
+ * @param env
+ * @param msg_ctx
+ * @param name
+ * @param def value returned if the property is not set.
+ * @return the value.
+ */
+static int rp_load_int(
+	    const axutil_env_t    *env,
+	    const axis2_msg_ctx_t *msg_ctx,
+	    const axis2_char_t    *name,
+	    const int              def
+)
+{
+    axis2_char_t val[SP_MAX_MPATHS_LEN];
+    return rp_load_prop(env, msg_ctx, val, name) ? def : atoi(val);
+}
+
 //-----------------------------------------------------------------------------
 // copy src to dst, and free src.
 static int rp_load_axis_str(
@@ -124,6 +247,39 @@ static int rp_load_axis_str(
     return 0;
 }
 
+//-----------------------------------------------------------------------------
+/** Load the logging properties.
+ * @param props
+ * @param env
+ * @param msg_ctx
+ */
+static void rp_load_log_props(
+	    sp_props              *props,
+	    const axutil_env_t    *env,
+	    const axis2_msg_ctx_t *msg_ctx)
+{
+    axis2_char_t val[SP_MAX_MPATHS_LEN];
+
+    rp_load_prop(env, msg_ctx, props->log_file, SP_LOGFILE_STR);
+
+    if ( ! rp_load_prop(env, msg_ctx, val, SP_LOGLEVEL_STR) )
+    {
+        if      (! axutil_strcasecmp(val, "error"))   props->log_level = SP_LOG_LEVEL_ERROR;
+        else if (! axutil_strcasecmp(val, "warning")) props->log_level = SP_LOG_LEVEL_WARNING;
+        else if (! axutil_strcasecmp(val, "info"))    props->log_level = SP_LOG_LEVEL_INFO;
+        else if (! axutil_strcasecmp(val, "debug"))   props->log_level = SP_LOG_LEVEL_DEBUG;
+        else
+        {
+            SP_LOG_WARNING("Unknown " SP_LOGLEVEL_STR " '%s' ignored.", val);
+        }
+    }
+
+    props->log_rate_limit =
+    		rp_load_int(env, msg_ctx, SP_LOGRATE_STR, props->log_rate_limit);
+    props->slow_request_ms =
+    		rp_load_int(env, msg_ctx, SP_SLOWREQ_STR, props->slow_request_ms);
+}
+
 // =========================  public functions = ===============================
 //-----------------------------------------------------------------------------
 /** init props
@@ -138,6 +294,32 @@ void  rp_init_props(sp_props *props)
     props->deleting_nonsoap = 0;
     props->debug_mode       = 0;
     props->backend_port     = -1;
+    props->log_level        = SP_LOG_LEVEL_INFO;
+    props->log_rate_limit   = 20;
+    props->slow_request_ms  = 0;
+    props->cache_size_mb    = 1024;
+    props->mtom_threshold   = 0;
+    props->backend_slots    = 0;
+    props->backend_queue_ms = 30000;
+    props->bulk_coverage_mb = 64;
+    props->client_req_rate      = 0;
+    props->client_user_prop [0] = '\0';
+    props->client_req_burst     = 20;
+    props->client_byte_rate_kb  = 0;
+    props->client_byte_burst_mb = 256;
+    props->async_max_jobs   = 4;
+    props->async_keep_hours = 24;
+    props->shard_timeout_ms = 60000;
+    props->tile_strips      = 0;
+    props->tile_min_mb      = 64;
+    props->batch_max_items  = 32;
+    props->batch_parallel   = 4;
+    props->caps_cache_secs  = 0;
+    props->eoindex_secs     = 0;
+    props->max_coverage_mb  = 0;
+    props->compress_level   = 0;
+    props->compress_min_kb  = 64;
+    props->compress_threads = 4;
 
     props->mapfile         [0] = '\0';
     props->mapserv         [0] = '\0';
@@ -145,6 +327,15 @@ void  rp_init_props(sp_props *props)
     props->soapops_url_str [0] = '\0';
     props->backend_host    [0] = '\0';
     props->backend_path    [0] = '\0';
+    props->log_file        [0] = '\0';
+    props->cache_dir       [0] = '\0';
+    props->async_spool_dir [0] = '\0';
+    props->async_notify_hosts[0] = '\0';
+    props->backend_shards  [0] = '\0';
+    props->admin_secret    [0] = '\0';
+    props->admin_allow     [0] = '\0';
+    props->trusted_proxies [0] = '\0';
+    props->backend_lanes   [0] = '\0';
 }
 
 //-----------------------------------------------------------------------------
@@ -262,6 +453,392 @@ const axis2_char_t *rp_getBackendHost( const axutil_env_t *env, const sp_props *
 	return props->backend_host;
 }
 
+//-----------------------------------------------------------------------------
+/** Get log file path.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getLogFile( const axutil_env_t *env, const sp_props *props )
+{
+	return props->log_file;
+}
+
+//-----------------------------------------------------------------------------
+/** Get log level.
+ * @param env
+ * @param props
+ * @return one of sp_log_levels.
+ */
+const int rp_getLogLevel( const axutil_env_t *env, const sp_props *props )
+{
+	return props->log_level;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the log rate limit.
+ * @param env
+ * @param props
+ * @return max. records per second per call site, 0 for no limit.
+ */
+const int rp_getLogRateLimit( const axutil_env_t *env, const sp_props *props )
+{
+	return props->log_rate_limit;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the slow request threshold.
+ * @param env
+ * @param props
+ * @return threshold in milliseconds, 0 if slow requests are not logged.
+ */
+const int rp_getSlowRequestMs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->slow_request_ms;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the coverage cache directory.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if the cache is off.
+ */
+const axis2_char_t *rp_getCacheDir( const axutil_env_t *env, const sp_props *props )
+{
+	return props->cache_dir;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the coverage cache size budget.
+ * @param env
+ * @param props
+ * @return size in megabytes.
+ */
+const int rp_getCacheSizeMB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->cache_size_mb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the shared secret for administrative operations.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getAdminSecret( const axutil_env_t *env, const sp_props *props )
+{
+	return props->admin_secret;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the client addresses allowed to use administrative operations.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getAdminAllowFrom( const axutil_env_t *env, const sp_props *props )
+{
+	return props->admin_allow;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the addresses of the reverse proxies trusted for X-Forwarded-For.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getTrustedProxies( const axutil_env_t *env, const sp_props *props )
+{
+	return props->trusted_proxies;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the size below which coverages are returned inline.
+ * @param env
+ * @param props
+ * @return size in bytes.
+ */
+const int rp_getMtomThreshold( const axutil_env_t *env, const sp_props *props )
+{
+	return props->mtom_threshold;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the number of backend slots of the scheduler.
+ * @param env
+ * @param props
+ * @return max. concurrent backend requests, 0 if not scheduled.
+ */
+const int rp_getBackendSlots( const axutil_env_t *env, const sp_props *props )
+{
+	return props->backend_slots;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the lane settings of the scheduler.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getBackendLanes( const axutil_env_t *env, const sp_props *props )
+{
+	return props->backend_lanes;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the max. time to wait for a backend slot.
+ * @param env
+ * @param props
+ * @return milliseconds, 0 for no limit.
+ */
+const int rp_getBackendQueueMs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->backend_queue_ms;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the expected GetCoverage size from which the bulk lane is used.
+ * @param env
+ * @param props
+ * @return size in megabytes.
+ */
+const int rp_getBulkCoverageMB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->bulk_coverage_mb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the request rate limit per client.
+ * @param env
+ * @param props
+ * @return requests per second, 0 for no limit.
+ */
+const int rp_getClientRequestRate( const axutil_env_t *env, const sp_props *props )
+{
+	return props->client_req_rate;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the number of requests a client may send in a row above its rate.
+ * @param env
+ * @param props
+ * @return number of requests.
+ */
+const int rp_getClientRequestBurst( const axutil_env_t *env, const sp_props *props )
+{
+	return props->client_req_burst;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the backend byte rate limit per client.
+ * @param env
+ * @param props
+ * @return kilobytes per second, 0 for no limit.
+ */
+const int rp_getClientByteRateKB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->client_byte_rate_kb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the amount a client may read in a row above its byte rate.
+ * @param env
+ * @param props
+ * @return size in megabytes.
+ */
+const int rp_getClientByteBurstMB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->client_byte_burst_mb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the message context property holding the authenticated user.
+ * @param env
+ * @param props
+ * @return pointer to a string, not a copy; empty if not set.
+ */
+const axis2_char_t *rp_getClientUserProperty( const axutil_env_t *env, const sp_props *props )
+{
+	return props->client_user_prop;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the spool directory of asynchronous jobs.
+ * @param env
+ * @param props
+ * @return path, empty if asynchronous jobs are off.
+ */
+const axis2_char_t *rp_getAsyncSpoolDir( const axutil_env_t *env, const sp_props *props )
+{
+	return props->async_spool_dir;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the max. number of asynchronous jobs queued or running at a time.
+ * @param env
+ * @param props
+ * @return number of jobs.
+ */
+const int rp_getAsyncMaxJobs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->async_max_jobs;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how long finished asynchronous jobs are kept.
+ * @param env
+ * @param props
+ * @return hours.
+ */
+const int rp_getAsyncKeepHours( const axutil_env_t *env, const sp_props *props )
+{
+	return props->async_keep_hours;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the hosts that may be notified of finished asynchronous jobs.
+ * @param env
+ * @param props
+ * @return comma separated host or host:port, empty if none.
+ */
+const axis2_char_t *rp_getAsyncNotifyHosts( const axutil_env_t *env, const sp_props *props )
+{
+	return props->async_notify_hosts;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the URLs of the sharded backends for DescribeEOCoverageSet.
+ * @param env
+ * @param props
+ * @return comma separated URLs, empty if not sharded.
+ */
+const axis2_char_t *rp_getBackendShards( const axutil_env_t *env, const sp_props *props )
+{
+	return props->backend_shards;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how long the sharded backends, the strips of a tiled GetCoverage
+ *  or the requests of a Batch sent ahead have to answer.
+ * @param env
+ * @param props
+ * @return milliseconds, 0 for no limit.
+ */
+const int rp_getShardTimeoutMs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->shard_timeout_ms;
+}
+
+//-----------------------------------------------------------------------------
+/** Get into how many strips a large GetCoverage is split.
+ * @param env
+ * @param props
+ * @return the number of strips, 0 if not split.
+ */
+const int rp_getTileStrips( const axutil_env_t *env, const sp_props *props )
+{
+	return props->tile_strips;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the expected size from which on a GetCoverage is split.
+ * @param env
+ * @param props
+ * @return megabytes, 0 to split all.
+ */
+const int rp_getTileMinMB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->tile_min_mb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how many requests a Batch may hold.
+ * @param env
+ * @param props
+ * @return the max. number of requests.
+ */
+const int rp_getBatchMaxItems( const axutil_env_t *env, const sp_props *props )
+{
+	return props->batch_max_items;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how many requests of a Batch are sent to the backend at once.
+ * @param env
+ * @param props
+ * @return the number of requests, 1 or less for one after the other.
+ */
+const int rp_getBatchParallel( const axutil_env_t *env, const sp_props *props )
+{
+	return props->batch_parallel;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how long the capabilities document is kept.
+ * @param env
+ * @param props
+ * @return seconds, 0 or less for not at all.
+ */
+const int rp_getCapabilitiesCacheSecs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->caps_cache_secs;
+}
+
+//-----------------------------------------------------------------------------
+/** Get how long an index of EO coverage metadata is used.
+ * @param env
+ * @param props
+ * @return seconds, 0 or less for no index.
+ */
+const int rp_getEOIndexSecs( const axutil_env_t *env, const sp_props *props )
+{
+	return props->eoindex_secs;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the size limit of a GetCoverage response, see sp_estimate.c.
+ * @param env
+ * @param props
+ * @return megabytes, 0 or less for no limit.
+ */
+const int rp_getMaxCoverageMB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->max_coverage_mb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the zlib level of coverage compression, see sp_compress.c.
+ * @param env
+ * @param props
+ * @return 1-9, 0 or less for no compression.
+ */
+const int rp_getCompressLevel( const axutil_env_t *env, const sp_props *props )
+{
+	return props->compress_level;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the size below which coverages are not compressed.
+ * @param env
+ * @param props
+ * @return kilobytes.
+ */
+const int rp_getCompressMinKB( const axutil_env_t *env, const sp_props *props )
+{
+	return props->compress_min_kb;
+}
+
+//-----------------------------------------------------------------------------
+/** Get the number of threads compressing one coverage.
+ * @param env
+ * @param props
+ * @return at least 1.
+ */
+const int rp_getCompressThreads( const axutil_env_t *env, const sp_props *props )
+{
+	return props->compress_threads > 0 ? props->compress_threads : 1;
+}
+
 //-----------------------------------------------------------------------------
 /**  Loads the WCS-SOAP-To-POST specific properties, which have been read
  * by the axis2 framework on start-up from one of the config files
@@ -282,6 +859,73 @@ int rp_load_props(
     props->debug_mode       = rp_load_boolean(env, msg_ctx, SP_DEBUG_STR);
     props->deleting_nonsoap = rp_load_boolean(env, msg_ctx, SP_DELNONSOAP_STR);
 
+    rp_load_log_props(props, env, msg_ctx);
+
+    rp_load_prop(env, msg_ctx, props->cache_dir, SP_CACHEDIR_STR);
+    props->cache_size_mb =
+    		rp_load_int(env, msg_ctx, SP_CACHESIZE_STR, props->cache_size_mb);
+
+    rp_load_prop(env, msg_ctx, props->admin_secret, SP_ADMINSEC_STR);
+    rp_load_prop(env, msg_ctx, props->admin_allow,  SP_ADMINIPS_STR);
+    rp_load_prop(env, msg_ctx, props->trusted_proxies, SP_PROXIES_STR);
+
+    props->mtom_threshold =
+    		rp_load_int(env, msg_ctx, SP_MTOMMIN_STR, props->mtom_threshold);
+
+    props->backend_slots =
+    		rp_load_int(env, msg_ctx, SP_BESLOTS_STR, props->backend_slots);
+    rp_load_prop(env, msg_ctx, props->backend_lanes, SP_BELANES_STR);
+    props->backend_queue_ms =
+    		rp_load_int(env, msg_ctx, SP_BEQUEUE_STR, props->backend_queue_ms);
+    props->bulk_coverage_mb =
+    		rp_load_int(env, msg_ctx, SP_BULKMB_STR, props->bulk_coverage_mb);
+
+    props->client_req_rate = rp_load_int(env, msg_ctx,
+    		SP_CLREQRATE_STR, props->client_req_rate);
+    props->client_req_burst = rp_load_int(env, msg_ctx,
+    		SP_CLREQBURST_STR, props->client_req_burst);
+    props->client_byte_rate_kb = rp_load_int(env, msg_ctx,
+    		SP_CLBYTERATE_STR, props->client_byte_rate_kb);
+    props->client_byte_burst_mb = rp_load_int(env, msg_ctx,
+    		SP_CLBYTEBURST_STR, props->client_byte_burst_mb);
+    rp_load_prop(env, msg_ctx, props->client_user_prop, SP_CLUSERPROP_STR);
+
+    rp_load_prop(env, msg_ctx, props->async_spool_dir, SP_ASYNCDIR_STR);
+    props->async_max_jobs =
+    		rp_load_int(env, msg_ctx, SP_ASYNCMAX_STR, props->async_max_jobs);
+    props->async_keep_hours =
+    		rp_load_int(env, msg_ctx, SP_ASYNCKEEP_STR, props->async_keep_hours);
+    rp_load_prop(env, msg_ctx, props->async_notify_hosts, SP_ASYNCNOTIFY_STR);
+
+    rp_load_prop(env, msg_ctx, props->backend_shards, SP_SHARDS_STR);
+    props->shard_timeout_ms =
+    		rp_load_int(env, msg_ctx, SP_SHARDTMO_STR, props->shard_timeout_ms);
+
+    props->tile_strips =
+    		rp_load_int(env, msg_ctx, SP_TILESTRIPS_STR, props->tile_strips);
+    props->tile_min_mb =
+    		rp_load_int(env, msg_ctx, SP_TILEMIN_STR, props->tile_min_mb);
+
+    props->batch_max_items =
+    		rp_load_int(env, msg_ctx, SP_BATCHMAX_STR, props->batch_max_items);
+    props->batch_parallel =
+    		rp_load_int(env, msg_ctx, SP_BATCHPAR_STR, props->batch_parallel);
+
+    props->caps_cache_secs =
+    		rp_load_int(env, msg_ctx, SP_CAPSSECS_STR, props->caps_cache_secs);
+    props->eoindex_secs =
+    		rp_load_int(env, msg_ctx, SP_EOINDEXSECS_STR, props->eoindex_secs);
+
+    props->max_coverage_mb =
+    		rp_load_int(env, msg_ctx, SP_MAXCOVMB_STR, props->max_coverage_mb);
+
+    props->compress_level =
+    		rp_load_int(env, msg_ctx, SP_COMPLEVEL_STR, props->compress_level);
+    props->compress_min_kb =
+    		rp_load_int(env, msg_ctx, SP_COMPMINKB_STR, props->compress_min_kb);
+    props->compress_threads =
+    		rp_load_int(env, msg_ctx, SP_COMPTHREADS_STR, props->compress_threads);
+
     if ( rp_load_prop(env, msg_ctx, props->soapops_url_str, SP_SOAPOPSURL_STR) )
     {
         // Try get the endpoint URL.
@@ -290,9 +934,8 @@ int rp_load_props(
         axis2_endpoint_ref_t *xaddr = axis2_msg_ctx_get_from (msg_ctx, env);
         if (NULL==xaddr)
         {
-            rp_log_error(env,
-                    " SP: **WARNING: NULL==xaddr."
-                    " Could not determine URL of service.\n");
+            SP_LOG_WARNING("NULL==xaddr."
+                    " Could not determine URL of service.");
             strcpy(props->soapops_url_str, "ERROR: URL-UNKNOWN");
         }
         else
@@ -300,9 +943,7 @@ int rp_load_props(
             if (strlen(axis2_endpoint_ref_get_address(xaddr, env))
                     > SP_MAX_MPATHS_LEN)
             {
-                rp_log_error(env,
-                        " SP: **WARNING: xaddr exceeds %d \n",
-                        SP_MAX_MPATHS_LEN);
+                SP_LOG_WARNING("xaddr exceeds %d", SP_MAX_MPATHS_LEN);
             }
             strncpy(props->soapops_url_str,
                     axis2_endpoint_ref_get_address(xaddr, env),
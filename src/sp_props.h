@@ -50,6 +50,41 @@
 #define SP_SOAPOPSURL_STR "SOAPOperationsURL"
 #define SP_DELNONSOAP_STR "DeleteNonSoapURLs"
 #define SP_DEBUG_STR      "DebugSoapProxy"
+#define SP_LOGFILE_STR    "LogFile"
+#define SP_LOGLEVEL_STR   "LogLevel"
+#define SP_LOGRATE_STR    "LogRateLimit"
+#define SP_SLOWREQ_STR    "SlowRequestMs"
+#define SP_CACHEDIR_STR   "CoverageCacheDir"
+#define SP_CACHESIZE_STR  "CoverageCacheSizeMB"
+#define SP_ADMINSEC_STR   "AdminSecret"
+#define SP_ADMINIPS_STR   "AdminAllowFrom"
+#define SP_PROXIES_STR    "TrustedProxies"
+#define SP_MTOMMIN_STR    "MtomThreshold"
+#define SP_BESLOTS_STR    "BackendSlots"
+#define SP_BELANES_STR    "BackendLanes"
+#define SP_BEQUEUE_STR    "BackendQueueMs"
+#define SP_BULKMB_STR     "BulkCoverageMB"
+#define SP_CLREQRATE_STR  "ClientRequestRate"
+#define SP_CLREQBURST_STR "ClientRequestBurst"
+#define SP_CLBYTERATE_STR "ClientByteRateKB"
+#define SP_CLBYTEBURST_STR "ClientByteBurstMB"
+#define SP_CLUSERPROP_STR "ClientUserProperty"
+#define SP_ASYNCDIR_STR   "AsyncSpoolDir"
+#define SP_ASYNCMAX_STR   "AsyncMaxJobs"
+#define SP_ASYNCKEEP_STR  "AsyncKeepHours"
+#define SP_ASYNCNOTIFY_STR "AsyncNotifyHosts"
+#define SP_SHARDS_STR     "BackendShards"
+#define SP_SHARDTMO_STR   "ShardTimeoutMs"
+#define SP_TILESTRIPS_STR "TileStrips"
+#define SP_TILEMIN_STR    "TileMinMB"
+#define SP_BATCHMAX_STR   "BatchMaxItems"
+#define SP_BATCHPAR_STR   "BatchParallel"
+#define SP_CAPSSECS_STR   "CapabilitiesCacheSecs"
+#define SP_EOINDEXSECS_STR "EOIndexSecs"
+#define SP_MAXCOVMB_STR   "MaxCoverageMB"
+#define SP_COMPLEVEL_STR  "CompressLevel"
+#define SP_COMPMINKB_STR  "CompressMinKB"
+#define SP_COMPTHREADS_STR "CompressThreads"
 
 // 
 //  WCS-SOAP-To-POST specific properties.
@@ -65,6 +100,41 @@ struct sp_props_struct
     axis2_char_t mapserv         [SP_MAX_MPATHS_LEN];
     axis2_char_t backend_url_str [SP_MAX_MPATHS_LEN];
     axis2_char_t soapops_url_str [SP_MAX_MPATHS_LEN];
+    axis2_char_t log_file        [SP_MAX_MPATHS_LEN];
+    int          log_level;
+    int          log_rate_limit;
+    int          slow_request_ms;
+    axis2_char_t cache_dir       [SP_MAX_MPATHS_LEN];
+    int          cache_size_mb;
+    axis2_char_t admin_secret    [SP_MAX_MPATHS_LEN];
+    axis2_char_t admin_allow     [SP_MAX_MPATHS_LEN];
+    axis2_char_t trusted_proxies [SP_MAX_MPATHS_LEN];
+    int          mtom_threshold;
+    int          backend_slots;
+    axis2_char_t backend_lanes   [SP_MAX_MPATHS_LEN];
+    int          backend_queue_ms;
+    int          bulk_coverage_mb;
+    int          client_req_rate;
+    int          client_req_burst;
+    int          client_byte_rate_kb;
+    int          client_byte_burst_mb;
+    axis2_char_t client_user_prop[SP_MAX_MPATHS_LEN];
+    axis2_char_t async_spool_dir [SP_MAX_MPATHS_LEN];
+    axis2_char_t async_notify_hosts[SP_MAX_MPATHS_LEN];
+    int          async_max_jobs;
+    int          async_keep_hours;
+    axis2_char_t backend_shards  [SP_MAX_MPATHS_LEN];
+    int          shard_timeout_ms;
+    int          tile_strips;
+    int          tile_min_mb;
+    int          batch_max_items;
+    int          batch_parallel;
+    int          caps_cache_secs;
+    int          eoindex_secs;
+    int          max_coverage_mb;
+    int          compress_level;
+    int          compress_min_kb;
+    int          compress_threads;
 
     // Derived values.
 
@@ -87,6 +157,41 @@ const axis2_char_t *rp_getBackendURL     (const axutil_env_t *env, const sp_prop
 const axis2_char_t *rp_getBackendPath    (const axutil_env_t *env, const sp_props *props);
 const int           rp_getBackendPort    (const axutil_env_t *env, const sp_props *props);
 const axis2_char_t *rp_getBackendHost    (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getLogFile        (const axutil_env_t *env, const sp_props *props);
+const int           rp_getLogLevel       (const axutil_env_t *env, const sp_props *props);
+const int           rp_getLogRateLimit   (const axutil_env_t *env, const sp_props *props);
+const int           rp_getSlowRequestMs  (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getCacheDir       (const axutil_env_t *env, const sp_props *props);
+const int           rp_getCacheSizeMB    (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getAdminSecret    (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getAdminAllowFrom (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getTrustedProxies (const axutil_env_t *env, const sp_props *props);
+const int           rp_getMtomThreshold  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getBackendSlots   (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getBackendLanes   (const axutil_env_t *env, const sp_props *props);
+const int           rp_getBackendQueueMs (const axutil_env_t *env, const sp_props *props);
+const int           rp_getBulkCoverageMB (const axutil_env_t *env, const sp_props *props);
+const int           rp_getClientRequestRate (const axutil_env_t *env, const sp_props *props);
+const int           rp_getClientRequestBurst(const axutil_env_t *env, const sp_props *props);
+const int           rp_getClientByteRateKB  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getClientByteBurstMB (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getClientUserProperty(const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getAsyncSpoolDir  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getAsyncMaxJobs   (const axutil_env_t *env, const sp_props *props);
+const int           rp_getAsyncKeepHours (const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getAsyncNotifyHosts(const axutil_env_t *env, const sp_props *props);
+const axis2_char_t *rp_getBackendShards  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getShardTimeoutMs (const axutil_env_t *env, const sp_props *props);
+const int           rp_getTileStrips     (const axutil_env_t *env, const sp_props *props);
+const int           rp_getTileMinMB      (const axutil_env_t *env, const sp_props *props);
+const int           rp_getBatchMaxItems  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getBatchParallel  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getCapabilitiesCacheSecs(const axutil_env_t *env, const sp_props *props);
+const int           rp_getEOIndexSecs    (const axutil_env_t *env, const sp_props *props);
+const int           rp_getMaxCoverageMB  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getCompressLevel  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getCompressMinKB  (const axutil_env_t *env, const sp_props *props);
+const int           rp_getCompressThreads(const axutil_env_t *env, const sp_props *props);
 
 
 #endif
@@ -0,0 +1,491 @@
+/*
+ * Soap Proxy.
+ *
+ * Buffered stream reader and in-place HTTP header parser.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_reader.c
+ *
+ * The backend response used to be read one byte per axutil_stream_read()
+ * call, the header lines copied into a stack buffer of fixed size, copied
+ * once more line by line and the few values of interest strdup'ed.
+ *
+ * sp_reader reads the stream in large blocks.  sp_reader_header_block()
+ * returns the header block where it lies in the reader's buffer, growing
+ * the buffer as needed, and keeps it there; sp_headers_parse() then
+ * records every header as a pair of slices into the block, NUL terminating
+ * names and values in place, without copying.  The body that follows the
+ * headers is read through the same reader, so that what was read ahead
+ * together with the headers is not lost.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sp_reader.h"
+#include "sp_log.h"
+
+// =========================  local functions ================================
+//-----------------------------------------------------------------------------
+/** Double the size of the buffer, moving it to the heap.
+ * @return 0 on success, -1 when out of memory.
+ */
+static int sp_reader_grow(sp_reader *rd)
+{
+    const axutil_env_t *env = rd->env;
+
+    size_t size = rd->size * 2;
+    char  *buf  = (char *) AXIS2_MALLOC(env->allocator, size);
+    if (NULL == buf)
+    {
+        SP_LOG_ERROR("cannot grow the read buffer to %lu bytes",
+                     (unsigned long) size);
+        return -1;
+    }
+    memcpy(buf, rd->buf, rd->end);
+    if (rd->buf != rd->local) AXIS2_FREE(env->allocator, rd->buf);
+    rd->buf  = buf;
+    rd->size = size;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_headers_grow(
+    const axutil_env_t *env,
+    sp_headers         *hh)
+{
+    int        max = hh->max * 2;
+    sp_header *h   =
+        (sp_header *) AXIS2_MALLOC(env->allocator, max * sizeof(sp_header));
+    if (NULL == h) return -1;
+
+    memcpy(h, hh->h, hh->n * sizeof(sp_header));
+    if (hh->h != hh->local) AXIS2_FREE(env->allocator, hh->h);
+    hh->h   = h;
+    hh->max = max;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static inline int sp_is_blank(const char c)
+{
+    return ' ' == c || '\t' == c;
+}
+
+// =========================  public functions ===============================
+//-----------------------------------------------------------------------------
+/** Set up a reader on the stream st.  The stream stays owned by the caller.
+ * @param env
+ * @param rd
+ * @param st
+ */
+void sp_reader_init(
+    const axutil_env_t *env,
+    sp_reader          *rd,
+    axutil_stream_t    *st)
+{
+    rd->env  = env;
+    rd->st   = st;
+    rd->buf  = rd->local;
+    rd->size = SP_READER_INIT_LEN;
+    rd->pos  = 0;
+    rd->end  = 0;
+    rd->pin  = 0;
+    rd->eof  = (NULL == st);
+}
+
+//-----------------------------------------------------------------------------
+/** Release the heap memory of a reader, if any.  Slices into the reader's
+ *  buffer become invalid.
+ * @param rd
+ */
+void sp_reader_free(sp_reader *rd)
+{
+    if (rd->buf != rd->local) AXIS2_FREE(rd->env->allocator, rd->buf);
+    rd->buf  = rd->local;
+    rd->size = SP_READER_INIT_LEN;
+    rd->pos  = rd->end = rd->pin = 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Read more input from the stream into the buffer, keeping what has not
+ *  been read yet.  For look-ahead, e.g. by the multipart decoder, which
+ *  works on rd->buf[rd->pos .. rd->end) directly.
+ * @param rd
+ * @return the number of bytes added, 0 at the end of the input or, with
+ *  rd->eof still 0, when the buffer is full and cannot grow.
+ */
+int sp_reader_fill(sp_reader *rd)
+{
+    if (rd->eof) return 0;
+
+    if (rd->pos == rd->end)
+    {
+        rd->pos = rd->end = rd->pin;
+    }
+    if (rd->end == rd->size)
+    {
+        if (rd->pos > rd->pin)
+        {
+            memmove(rd->buf + rd->pin, rd->buf + rd->pos, rd->end - rd->pos);
+            rd->end -= rd->pos - rd->pin;
+            rd->pos  = rd->pin;
+        }
+        if (rd->end == rd->size && sp_reader_grow(rd) < 0) return 0;
+    }
+
+    int n = axutil_stream_read(
+        rd->st, rd->env, rd->buf + rd->end, rd->size - rd->end);
+    if (n <= 0)
+    {
+        rd->eof = 1;
+        return 0;
+    }
+    rd->end += n;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+/** Read up to n bytes, like axutil_stream_read().  Reads at least as big
+ *  as the buffer go straight to dst once the buffered bytes are used up.
+ * @param rd
+ * @param dst
+ * @param n
+ * @return the number of bytes read, 0 at the end of the input.
+ */
+int sp_reader_read(
+    sp_reader *rd,
+    void      *dst,
+    size_t     n)
+{
+    if (0 == n) return 0;
+
+    if (rd->pos == rd->end)
+    {
+        if (rd->eof) return 0;
+        if (n >= rd->size - rd->pin)
+        {
+            int r = axutil_stream_read(rd->st, rd->env, dst, n);
+            if (r <= 0)
+            {
+                rd->eof = 1;
+                return 0;
+            }
+            return r;
+        }
+        if (0 == sp_reader_fill(rd)) return 0;
+    }
+
+    size_t avail = rd->end - rd->pos;
+    if (n > avail) n = avail;
+    memcpy(dst, rd->buf + rd->pos, n);
+    rd->pos += n;
+    return (int) n;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the next byte as an unsigned char, or EOF.
+ */
+int sp_reader_getc(sp_reader *rd)
+{
+    if (rd->pos == rd->end && 0 == sp_reader_fill(rd)) return EOF;
+    return (unsigned char) rd->buf[rd->pos++];
+}
+
+//-----------------------------------------------------------------------------
+/** Emulates fgets() on the reader.
+ * @param rd
+ * @param buf
+ * @param size
+ * @param delete_cr if non-zero carriage returns are dropped.
+ * @return buf, or NULL when the end of the input occurs before any
+ *  characters have been read.
+ */
+char *sp_reader_gets(
+    sp_reader *rd,
+    char      *buf,
+    size_t     size,
+    const int  delete_cr)
+{
+    size_t n = 0;
+
+    if (NULL == buf || size < 1) return NULL;
+
+    while (n + 1 < size)
+    {
+        if (rd->pos == rd->end && 0 == sp_reader_fill(rd)) break;
+
+        const char *src   = rd->buf + rd->pos;
+        size_t      avail = rd->end - rd->pos;
+        if (avail > size - 1 - n) avail = size - 1 - n;
+
+        const char *nl   = memchr(src, '\n', avail);
+        size_t      take = nl ? (size_t) (nl - src) + 1 : avail;
+        memcpy(buf + n, src, take);
+        rd->pos += take;
+        n       += take;
+        if (nl) break;
+    }
+    if (0 == n) return NULL;
+
+    if (delete_cr)
+    {
+        size_t i, j;
+        for (i = j = 0; i < n; i++)
+        {
+            if ('\r' != buf[i]) buf[j++] = buf[i];
+        }
+        n = j;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Read up to and including the empty line that ends a header block.
+ *  The block is left in the reader's buffer and stays valid until the next
+ *  call of this function or sp_reader_free(), whatever is read from the
+ *  reader in between.  There is no limit on the size of the block other
+ *  than memory.  If the input ends before the empty line, everything up to
+ *  the end is the block.
+ * @param rd
+ * @param len set to the length of the block, including the empty line.
+ * @return the block (not NUL terminated), or NULL if there is no input
+ *  or no memory.
+ */
+char *sp_reader_header_block(
+    sp_reader *rd,
+    size_t    *len)
+{
+    size_t scan = 0;        // start of the current line
+
+    *len = 0;
+
+    // release a previous block, start this one at the front
+    rd->pin = 0;
+    if (rd->pos > 0)
+    {
+        memmove(rd->buf, rd->buf + rd->pos, rd->end - rd->pos);
+        rd->end -= rd->pos;
+        rd->pos  = 0;
+    }
+
+    while ( 1 )
+    {
+        char *line = rd->buf + scan;
+        char *nl   = memchr(line, '\n', rd->end - scan);
+        if (NULL == nl)
+        {
+            if (sp_reader_fill(rd) > 0) continue;
+            if (rd->end == 0) return NULL;
+            scan = rd->end;
+            break;
+        }
+        scan = nl - rd->buf + 1;
+        if (nl == line || (nl == line + 1 && '\r' == *line)) break;
+    }
+
+    // Keep room behind the block: sp_headers_parse may write a NUL there,
+    // and reading on must not need to grow the buffer, which would move
+    // the block.
+    while (rd->size - scan < SP_READER_INIT_LEN / 2)
+    {
+        if (sp_reader_grow(rd) < 0) return NULL;
+    }
+
+    rd->pos = rd->pin = scan;
+    *len    = scan;
+    return rd->buf;
+}
+
+//-----------------------------------------------------------------------------
+/** Initialise hh to hold no headers.
+ * @param hh
+ */
+void sp_headers_init(sp_headers *hh)
+{
+    hh->n   = 0;
+    hh->max = SP_HEADERS_LOCAL;
+    hh->h   = hh->local;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param hh
+ */
+void sp_headers_free(
+    const axutil_env_t *env,
+    sp_headers         *hh)
+{
+    if (hh->h != hh->local) AXIS2_FREE(env->allocator, hh->h);
+    sp_headers_init(hh);
+}
+
+//-----------------------------------------------------------------------------
+/** Parse a header block as returned by sp_reader_header_block(), in place.
+ *  Names and values are trimmed and NUL terminated inside the block, which
+ *  therefore must have one writable byte behind it.  Folded values are
+ *  joined with blanks.  Lines without a colon, e.g. an HTTP status line,
+ *  are skipped.
+ * @param env
+ * @param hh initialised by sp_headers_init(), headers are appended.
+ * @param block
+ * @param len
+ * @return the number of headers in hh, or -1 when out of memory.
+ */
+int sp_headers_parse(
+    const axutil_env_t *env,
+    sp_headers         *hh,
+    char               *block,
+    const size_t        len)
+{
+    char      *p     = block;
+    char      *end   = block + len;
+    sp_header *last  = NULL;
+    int        first = hh->n;
+    int        i;
+
+    while (p < end)
+    {
+        char *eol  = memchr(p, '\n', end - p);
+        char *next = eol ? eol + 1 : end;
+        char *le   = eol ? eol     : end;
+        if (le > p && '\r' == le[-1]) le--;
+
+        // the empty line at the end of the block
+        if (le == p) break;
+
+        if (sp_is_blank(*p))
+        {
+            if (last)
+            {
+                char *c;
+                char *v = (char *) last->value.ptr;
+                for (c = v + last->value.len; c < p; c++) *c = ' ';
+                while (le > p && sp_is_blank(le[-1])) le--;
+                if (le > p) last->value.len = le - v;
+            }
+            p = next;
+            continue;
+        }
+
+        char *colon = memchr(p, ':', le - p);
+        if (NULL == colon || colon == p)
+        {
+            last = NULL;
+            p    = next;
+            continue;
+        }
+
+        char *ne = colon;
+        while (ne > p && sp_is_blank(ne[-1])) ne--;
+        char *v  = colon + 1;
+        while (v < le && sp_is_blank(*v)) v++;
+        char *ve = le;
+        while (ve > v && sp_is_blank(ve[-1])) ve--;
+
+        if (hh->n == hh->max && sp_headers_grow(env, hh) < 0)
+        {
+            SP_LOG_ERROR("out of memory parsing %d headers", hh->n);
+            return -1;
+        }
+        last = &hh->h[hh->n++];
+        last->name.ptr  = p;
+        last->name.len  = ne - p;
+        last->value.ptr = v;
+        last->value.len = ve - v;
+
+        p = next;
+    }
+
+    // Terminate only now: a folded value may still have moved its end.
+    for (i = first; i < hh->n; i++)
+    {
+        ((char *) hh->h[i].name.ptr )[hh->h[i].name.len ] = '\0';
+        ((char *) hh->h[i].value.ptr)[hh->h[i].value.len] = '\0';
+    }
+
+    return hh->n;
+}
+
+//-----------------------------------------------------------------------------
+/** Find a header by name, ignoring case.
+ * @param hh
+ * @param name without the colon, e.g. "Content-Length".
+ * @return the value of the first header of that name, NULL if none.
+ */
+const sp_slice *sp_headers_get(
+    const sp_headers *hh,
+    const char       *name)
+{
+    size_t len = strlen(name);
+    int    i;
+
+    for (i = 0; i < hh->n; i++)
+    {
+        const sp_header *h = &hh->h[i];
+        if (h->name.len == len && 0 == strncasecmp(h->name.ptr, name, len))
+        {
+            return &h->value;
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the NUL terminated value of the header name, NULL if none.
+ */
+const char *sp_headers_value(
+    const sp_headers *hh,
+    const char       *name)
+{
+    const sp_slice *s = sp_headers_get(hh, name);
+    return s ? s->ptr : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the value of the header name as a non-negative number, dflt if
+ *  it is absent or not a number, e.g. for Content-Length.
+ */
+long sp_headers_long(
+    const sp_headers *hh,
+    const char       *name,
+    const long        dflt)
+{
+    const char *v   = sp_headers_value(hh, name);
+    char       *end = NULL;
+
+    if (NULL == v || *v < '0' || *v > '9') return dflt;
+
+    long n = strtol(v, &end, 10);
+    if (n < 0 || '\0' != *end) return dflt;
+    return n;
+}
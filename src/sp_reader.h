@@ -0,0 +1,150 @@
+/*
+ * Soap Proxy - buffered stream reader and HTTP header parser
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_reader.h
+ *
+ */
+
+#ifndef SPREADER_H_INCLUDED
+#define SPREADER_H_INCLUDED
+
+#include <stddef.h>
+
+#include "sp_svc.h"
+
+#define SP_READER_INIT_LEN  8192
+#define SP_HEADERS_LOCAL    16
+
+//
+// Buffered reader over an axutil_stream_t.  The buffer starts out in
+// 'local' and moves to the heap (env->allocator) if a header block does
+// not fit.  Bytes [0, pin) hold a header block that has been handed out
+// by sp_reader_header_block(), they are never moved or overwritten.
+//
+struct sp_reader_struct
+{
+    const axutil_env_t *env;
+    axutil_stream_t    *st;
+    char               *buf;
+    size_t              size;
+    size_t              pos;    // next unread byte
+    size_t              end;    // end of the valid data
+    size_t              pin;
+    int                 eof;
+    char                local[SP_READER_INIT_LEN];
+};
+
+typedef struct sp_reader_struct sp_reader;
+
+//
+// A piece of memory owned by someone else, usually by an sp_reader.
+//
+struct sp_slice_struct
+{
+    const char *ptr;
+    size_t      len;
+};
+
+typedef struct sp_slice_struct sp_slice;
+
+struct sp_header_struct
+{
+    sp_slice name;
+    sp_slice value;
+};
+
+typedef struct sp_header_struct sp_header;
+
+//
+// All headers of one header block, in the order received.  The names and
+// values point into the block itself and are NUL terminated in place.
+//
+struct sp_headers_struct
+{
+    int        n;
+    int        max;
+    sp_header *h;       // 'local' or heap
+    sp_header  local[SP_HEADERS_LOCAL];
+};
+
+typedef struct sp_headers_struct sp_headers;
+
+void sp_reader_init(
+    const axutil_env_t *env,
+    sp_reader          *rd,
+    axutil_stream_t    *st);
+
+void sp_reader_free(sp_reader *rd);
+
+int  sp_reader_fill(sp_reader *rd);
+
+int  sp_reader_read(
+    sp_reader *rd,
+    void      *dst,
+    size_t     n);
+
+int  sp_reader_getc(sp_reader *rd);
+
+char *sp_reader_gets(
+    sp_reader *rd,
+    char      *buf,
+    size_t     size,
+    const int  delete_cr);
+
+char *sp_reader_header_block(
+    sp_reader *rd,
+    size_t    *len);
+
+void sp_headers_init(sp_headers *hh);
+
+void sp_headers_free(
+    const axutil_env_t *env,
+    sp_headers         *hh);
+
+int  sp_headers_parse(
+    const axutil_env_t *env,
+    sp_headers         *hh,
+    char               *block,
+    const size_t        len);
+
+const sp_slice *sp_headers_get(
+    const sp_headers *hh,
+    const char       *name);
+
+const char *sp_headers_value(
+    const sp_headers *hh,
+    const char       *name);
+
+long sp_headers_long(
+    const sp_headers *hh,
+    const char       *name,
+    const long        dflt);
+
+#endif
@@ -0,0 +1,999 @@
+/*
+ * Soap Proxy.
+ *
+ * Backend request scheduler: lanes with reserved slots and weighted
+ * fair sharing of the rest.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_sched.c
+ *
+ * Requests to the backend are admitted through a fixed number of slots,
+ * BackendSlots, shared by all processes hosting the service.  Without
+ * this a handful of multi-gigabyte GetCoverage requests can hold every
+ * backend worker, and a GetCapabilities that takes 20 ms on its own
+ * waits behind them for seconds.
+ *
+ * Each request is put into a lane by its operation, and GetCoverage
+ * additionally by the expected size of the response:
+ *
+ *    meta     - GetCapabilities, DescribeCoverage, GetMsVersion, others
+ *    search   - DescribeEOCoverageSet
+ *    coverage - GetCoverage expected to return less than BulkCoverageMB
+ *    bulk     - GetCoverage expected to return BulkCoverageMB or more
+ *
+ * The expected size is the estimate made from the description of the
+ * coverage, see sp_estimate.c, or failing that the running average of
+ * the responses seen so far for the same CoverageId, kept in a small
+ * shared table; a coverage not seen before goes to the coverage lane.
+ * The table is kept up to date even without BackendSlots, see
+ * sp_sched_expected().
+ *
+ * Every lane has a number of reserved slots which no other lane may
+ * take, and a weight.  The remaining slots are shared: when several
+ * lanes have requests waiting, slots are handed out in stride order
+ * (start-time fair queueing), so over time each busy lane gets a share
+ * proportional to its weight.  A lane which has been idle starts at the
+ * current virtual time and does not build up credit.
+ *
+ * Within a lane the clients (see sp_client.c) waiting take turns by
+ * deficit round robin: each turn credits a client with a quantum of
+ * bytes, and a request is charged with the expected size of its
+ * response, so a client fetching large coverages gets fewer turns than
+ * one asking for small ones.  The requests of one client are served in
+ * the order of the wake-ups, which is roughly first come first served.
+ *
+ * A request sent as several backend requests at once, see sp_tile.c and
+ * sp_batch.c, takes one more slot for each further part with
+ * sp_sched_acquire_more(), as far as slots are free with nobody waiting
+ * for them, and has no more parts under way than it holds slots.
+ *
+ * A request which does not get a slot within BackendQueueMs fails with
+ * SP_SYS_ERR_BACKEND_BUSY.  Slots held by processes which have exited
+ * (e.g. a killed Apache child) are taken back by the waiters.
+ *
+ * The state lives in its own shared memory segment and is protected by
+ * a process-shared robust mutex; waiters sleep on a process-shared
+ * condition variable, with a short timeout to cover wake-ups lost when
+ * a process dies in the middle of an update.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "soap_proxy.h"
+#include "sp_sched.h"
+#include "sp_stats.h"
+#include "sp_client.h"
+#include "sp_estimate.h"
+#include "sp_log.h"
+
+// Reserved slots and weight of each lane, overridden by BackendLanes.
+static const char *sp_sched_default_lanes =
+		"meta=1/8,search=0/4,coverage=1/2,bulk=0/1";
+
+static const char *sp_sched_lane_names[] =
+{
+    "meta",
+    "search",
+    "coverage",
+    "bulk"
+};
+
+#define SP_SCHED_STRIDE   (1 << 20)
+#define SP_SCHED_POLL_NS  100000000ULL    // max. sleep between checks
+#define SP_SCHED_REAP_NS  1000000000ULL   // min. time between reaps
+#define SP_SCHED_NEST     512             // size estimate table entries
+#define SP_SCHED_NFLOWS   64              // clients waiting per lane
+#define SP_SCHED_QUANTUM  (1LL << 20)     // bytes credited per DRR turn
+#define SP_SCHED_META_COST (SP_SCHED_QUANTUM / 16)
+
+// Upper bounds (seconds) of the wait time buckets exported to Prometheus.
+static const double sp_sched_prom_le[] =
+{
+    0.001, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0
+};
+#define SP_SCHED_PROM_NLE 10
+
+struct sp_flow_struct
+{
+    uint64_t key;              // client, see sp_client_current()
+    int      waiting;
+    int64_t  deficit;          // bytes
+};
+
+typedef struct sp_flow_struct sp_flow;
+
+struct sp_lane_struct
+{
+    int      in_use;
+    int      waiting;
+    uint64_t pass;             // virtual time of the next grant
+    uint64_t admitted;
+    uint64_t timeouts;
+    uint64_t wait_sum;         // microseconds
+    uint64_t wait_max;
+    uint64_t wait_buckets[SP_SCHED_PROM_NLE + 1];
+    int      cursor;           // DRR position in flows
+    sp_flow  flows[SP_SCHED_NFLOWS];
+};
+
+typedef struct sp_lane_struct sp_lane;
+
+struct sp_sched_est_struct
+{
+    uint64_t key;
+    uint64_t bytes;
+};
+
+struct sp_sched_struct
+{
+    volatile int    init_state;   // see sp_setup_shared()
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             in_use;
+    uint64_t        vtime;        // pass of the last grant
+    sp_stamp_t      last_reap;
+    pid_t           owner     [SP_SCHED_MAX_SLOTS];
+    int             owner_lane[SP_SCHED_MAX_SLOTS];
+    sp_lane         lanes[SP_LANE_NLANES];
+    struct sp_sched_est_struct est[SP_SCHED_NEST];
+};
+
+static struct sp_sched_struct  sp_sched_local;
+static struct sp_sched_struct *sp_sched = &sp_sched_local;
+
+struct sp_sched_conf_struct
+{
+    int      slots;
+    int      max_wait_ms;
+    uint64_t bulk_bytes;
+    int      reserve[SP_LANE_NLANES];
+    int      weight [SP_LANE_NLANES];
+};
+
+typedef struct sp_sched_conf_struct sp_sched_conf;
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Set up the mutex and condition variable, see sp_sched_setup().
+ * @param arg the sp_sched_struct.
+ */
+static void sp_sched_setup_once(void *arg)
+{
+    struct sp_sched_struct *s = arg;
+    pthread_mutexattr_t     ma;
+    pthread_condattr_t      ca;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&s->mutex, &ma);
+    pthread_mutexattr_destroy(&ma);
+
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &ca);
+    pthread_condattr_destroy(&ca);
+}
+
+//-----------------------------------------------------------------------------
+/** Set up the mutex and condition variable, once for all processes.
+ * @param s
+ */
+static void sp_sched_setup(struct sp_sched_struct *s)
+{
+    if (SP_SHARED_READY == s->init_state) return;
+    sp_setup_shared(&s->init_state, sp_sched_setup_once, s);
+}
+
+//-----------------------------------------------------------------------------
+/** Lock the scheduler state, recovering it from a process that died
+ *  holding the lock.  The state itself stays consistent enough: at worst
+ *  a slot is leaked until sp_sched_reap() finds it.
+ * @param s
+ * @return 0 on success.
+ */
+static int sp_sched_lock(struct sp_sched_struct *s)
+{
+    int rc = pthread_mutex_lock(&s->mutex);
+    if (EOWNERDEAD == rc)
+    {
+    	pthread_mutex_consistent(&s->mutex);
+    	rc = 0;
+    }
+    return rc;
+}
+
+//-----------------------------------------------------------------------------
+/** Parse lane settings of the form "name=reserved/weight,...".
+ * @param env
+ * @param spec
+ * @param conf updated with the lanes found in spec.
+ */
+static void sp_sched_parse_lanes(
+    const axutil_env_t *env,
+    const char         *spec,
+    sp_sched_conf      *conf)
+{
+    while (spec && *spec)
+    {
+    	const char *end = strchr(spec, ',');
+    	size_t      len = end ? (size_t) (end - spec) : strlen(spec);
+    	const char *eq  = memchr(spec, '=', len);
+    	int lane = -1, reserve, weight;
+
+    	for (int l = 0; eq && l < SP_LANE_NLANES; l++)
+    	{
+    		if (strlen(sp_sched_lane_names[l]) == (size_t) (eq - spec) &&
+    			0 == strncmp(spec, sp_sched_lane_names[l], eq - spec))
+    		{
+    			lane = l;
+    		}
+    	}
+
+    	if (lane >= 0 && 2 == sscanf(eq + 1, "%d/%d", &reserve, &weight) &&
+    		reserve >= 0 && weight > 0)
+    	{
+    		conf->reserve[lane] = reserve;
+    		conf->weight [lane] = weight;
+    	}
+    	else if (len > 0)
+    	{
+    		SP_LOG_WARNING("Bad " SP_BELANES_STR " entry '%.*s' ignored.",
+    				(int) len, spec);
+    	}
+
+    	spec = end ? end + 1 : NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Get the scheduler settings.
+ * @param env
+ * @param props
+ * @param conf
+ * @return 0 if requests are to be scheduled, 1 if the scheduler is off.
+ */
+static int sp_sched_conf_load(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_sched_conf      *conf)
+{
+    conf->slots = rp_getBackendSlots(env, props);
+    if (conf->slots <= 0) return 1;
+    if (conf->slots > SP_SCHED_MAX_SLOTS) conf->slots = SP_SCHED_MAX_SLOTS;
+
+    conf->max_wait_ms = rp_getBackendQueueMs(env, props);
+    conf->bulk_bytes  = (uint64_t) rp_getBulkCoverageMB(env, props) << 20;
+
+    sp_sched_parse_lanes(env, sp_sched_default_lanes, conf);
+    sp_sched_parse_lanes(env, rp_getBackendLanes(env, props), conf);
+
+    // Reservations beyond the number of slots are cut back, last lane first.
+    int reserved = 0;
+    for (int l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	if (reserved + conf->reserve[l] > conf->slots)
+    	{
+    		conf->reserve[l] = conf->slots - reserved;
+    	}
+    	reserved += conf->reserve[l];
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// FNV-1a, never 0.
+static uint64_t sp_sched_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++)
+    {
+    	h ^= (unsigned char) *s;
+    	h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+//-----------------------------------------------------------------------------
+/** Choose the lane of a backend request.
+ * @param env
+ * @param conf
+ * @param node the request.
+ * @param cov_key set to the hash of the CoverageId of a GetCoverage.
+ * @param cost set to the expected size of the response.
+ * @return one of sp_sched_lanes.
+ */
+static int sp_sched_classify(
+    const axutil_env_t  *env,
+    const sp_sched_conf *conf,
+    axiom_node_t        *node,
+    uint64_t            *cov_key,
+    int64_t             *cost)
+{
+    const sp_req_stats *rs = sp_stats_current();
+    int                 op = rs ? rs->op : SP_OP_OTHER;
+    *cov_key = 0;
+    *cost    = SP_SCHED_META_COST;
+
+    // Requests are scheduled as what they are: those of a Batch, or the
+    // DescribeCoverage a GetCoverage may need first, see sp_estimate.c.
+    axiom_element_t *el      = axiom_node_get_data_element(node, env);
+    const int        node_op = sp_stats_op_id(
+    		el ? axiom_element_get_localname(el, env) : NULL);
+    if (SP_OP_BATCH == op || SP_OP_OTHER != node_op) op = node_op;
+
+    switch (op)
+    {
+    case SP_OP_DESCRIBEEOCOVERAGESET:
+    	return SP_LANE_SEARCH;
+    case SP_OP_GETCOVERAGE:
+    case SP_OP_PREWARMCACHE:
+    	break;
+    default:
+    	return SP_LANE_META;
+    }
+
+    *cost = SP_SCHED_QUANTUM;
+    const axis2_char_t *cov_id = sp_get_text_el(
+    		rp_find_named_child(env, node, "CoverageId", 0), env);
+    if (NULL == cov_id) return SP_LANE_COVERAGE;
+
+    *cov_key = sp_sched_hash(cov_id);
+    const struct sp_sched_est_struct *e =
+    		&sp_sched->est[*cov_key % SP_SCHED_NEST];
+    uint64_t bytes = sp_estimate_bytes(node);
+    if (0 == bytes && e->key == *cov_key) bytes = e->bytes;
+    if (bytes > 0) *cost = (int64_t) bytes;
+
+    return (conf->bulk_bytes > 0 && bytes >= conf->bulk_bytes) ?
+    		SP_LANE_BULK : SP_LANE_COVERAGE;
+}
+
+//-----------------------------------------------------------------------------
+/** Fold the size of a response into the estimate for its CoverageId.
+ *  Updates race harmlessly: the worst case is a wrong lane once.
+ * @param key
+ * @param bytes
+ */
+static void sp_sched_observe(const uint64_t key, const uint64_t bytes)
+{
+    struct sp_sched_est_struct *e = &sp_sched->est[key % SP_SCHED_NEST];
+    if (e->key == key)
+    {
+    	e->bytes = (3 * e->bytes + bytes) / 4;
+    }
+    else
+    {
+    	e->bytes = bytes;
+    	e->key   = key;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return non-zero if a request of 'lane' may take a slot now, leaving
+ *         enough free slots for the unused reservations of the others.
+ */
+static int sp_sched_can_run(
+    const struct sp_sched_struct *s,
+    const sp_sched_conf          *conf,
+    const int                     lane)
+{
+    if (s->in_use >= conf->slots) return 0;
+    if (s->lanes[lane].in_use < conf->reserve[lane]) return 1;
+
+    int owed = 0;
+    for (int l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	if (l != lane && s->lanes[l].in_use < conf->reserve[l])
+    	{
+    		owed += conf->reserve[l] - s->lanes[l].in_use;
+    	}
+    }
+    return conf->slots - s->in_use > owed;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the lane to get the next slot: of the lanes with waiting
+ *         requests that may run, the one with the lowest pass; -1 if none.
+ */
+static int sp_sched_pick(
+    const struct sp_sched_struct *s,
+    const sp_sched_conf          *conf)
+{
+    int best = -1;
+    for (int l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	if (s->lanes[l].waiting > 0 && sp_sched_can_run(s, conf, l) &&
+    		(best < 0 || s->lanes[l].pass < s->lanes[best].pass))
+    	{
+    		best = l;
+    	}
+    }
+    return best;
+}
+
+//-----------------------------------------------------------------------------
+/** Add a waiting request of client 'key' to the flows of a lane.
+ *  Called with the lock held.
+ * @param ln
+ * @param key
+ * @return index of the flow.
+ */
+static int sp_sched_join_flow(sp_lane *ln, const uint64_t key)
+{
+    int f, free_f = -1;
+    for (f = 0; f < SP_SCHED_NFLOWS; f++)
+    {
+    	if (ln->flows[f].waiting > 0 && ln->flows[f].key == key) break;
+    	if (free_f < 0 && 0 == ln->flows[f].waiting) free_f = f;
+    }
+
+    if (SP_SCHED_NFLOWS == f)
+    {
+    	// New flow, or if there are too many clients share one.
+    	f = (free_f >= 0) ? free_f : (int) (key % SP_SCHED_NFLOWS);
+    	if (0 == ln->flows[f].waiting)
+    	{
+    		ln->flows[f].key     = key;
+    		ln->flows[f].deficit = 0;
+    	}
+    }
+    ln->flows[f].waiting++;
+    return f;
+}
+
+//-----------------------------------------------------------------------------
+/** The flow to be served next in a lane by deficit round robin: starting
+ *  at the cursor, the first with waiting requests and credit left.  If no
+ *  flow has credit, as many turns are given as the flow closest to it
+ *  needs.  Called with the lock held.
+ * @param ln
+ * @return index of the flow, -1 if none is waiting.
+ */
+static int sp_sched_pick_flow(sp_lane *ln)
+{
+    int64_t best = INT64_MIN;
+    int     f, i;
+
+    for (f = 0; f < SP_SCHED_NFLOWS; f++)
+    {
+    	if (ln->flows[f].waiting > 0 && ln->flows[f].deficit > best)
+    	{
+    		best = ln->flows[f].deficit;
+    	}
+    }
+    if (INT64_MIN == best) return -1;
+
+    if (best <= 0)
+    {
+    	const int64_t turns = -best / SP_SCHED_QUANTUM + 1;
+    	for (f = 0; f < SP_SCHED_NFLOWS; f++)
+    	{
+    		if (ln->flows[f].waiting > 0)
+    		{
+    			ln->flows[f].deficit += turns * SP_SCHED_QUANTUM;
+    		}
+    	}
+    }
+
+    for (i = 0; i < SP_SCHED_NFLOWS; i++)
+    {
+    	f = (ln->cursor + i) % SP_SCHED_NFLOWS;
+    	if (ln->flows[f].waiting > 0 && ln->flows[f].deficit > 0)
+    	{
+    		ln->cursor = f;
+    		return f;
+    	}
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_sched_free_slot(struct sp_sched_struct *s, const int slot)
+{
+    const int lane = s->owner_lane[slot];
+    s->owner[slot] = 0;
+    if (lane >= 0 && lane < SP_LANE_NLANES && s->lanes[lane].in_use > 0)
+    {
+    	s->lanes[lane].in_use--;
+    }
+    if (s->in_use > 0) s->in_use--;
+}
+
+//-----------------------------------------------------------------------------
+/** Give a free slot to this process, in lane.  Called with the lock held,
+ *  after sp_sched_can_run().
+ * @return the slot.
+ */
+static int sp_sched_take_slot(struct sp_sched_struct *s, const int lane)
+{
+    int slot = 0;
+    while (slot < SP_SCHED_MAX_SLOTS - 1 && s->owner[slot]) slot++;
+    s->owner[slot]      = getpid();
+    s->owner_lane[slot] = lane;
+    s->in_use++;
+    s->lanes[lane].in_use++;
+    return slot;
+}
+
+//-----------------------------------------------------------------------------
+/** Take back the slots of processes which no longer exist.
+ *  Called with the lock held.
+ * @param s
+ * @param now
+ * @return the number of slots released.
+ */
+static int sp_sched_reap(struct sp_sched_struct *s, const sp_stamp_t now)
+{
+    if (now - s->last_reap < SP_SCHED_REAP_NS) return 0;
+    s->last_reap = now;
+
+    int n = 0;
+    for (int i = 0; i < SP_SCHED_MAX_SLOTS; i++)
+    {
+    	const pid_t pid = s->owner[i];
+    	if (pid > 0 && 0 != kill(pid, 0) && ESRCH == errno)
+    	{
+    		sp_sched_free_slot(s, i);
+    		n++;
+    	}
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// Record the time a request waited for its slot, with the lock held.
+static void sp_sched_record_wait(sp_lane *ln, const uint64_t usec)
+{
+    int b = 0;
+    while (b < SP_SCHED_PROM_NLE && usec > sp_sched_prom_le[b] * 1e6) b++;
+    ln->wait_buckets[b]++;
+    ln->wait_sum += usec;
+    if (usec > ln->wait_max) ln->wait_max = usec;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_sched_add_attr_u64(
+    const axutil_env_t *env,
+    axiom_element_t    *el,
+    axiom_node_t       *node,
+    const axis2_char_t *name,
+    uint64_t            val)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) val);
+    axiom_attribute_t *attr = axiom_attribute_create(env, name, buf, NULL);
+    axiom_element_add_attribute(el, env, attr, node);
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Called once per process from rpSvc_init.
+ * @param env
+ */
+void sp_sched_init(const axutil_env_t *env)
+{
+    if (sp_sched == &sp_sched_local)
+    {
+    	struct sp_sched_struct *shared =
+    			sp_map_shared(env, "sched", sizeof(struct sp_sched_struct));
+    	if (shared) sp_sched = shared;
+    }
+
+    sp_sched_setup(sp_sched);
+}
+
+//-----------------------------------------------------------------------------
+const char *sp_sched_lane_name(const int lane)
+{
+    return (lane >= 0 && lane < SP_LANE_NLANES) ?
+    		sp_sched_lane_names[lane] : "unknown";
+}
+
+//-----------------------------------------------------------------------------
+/** Wait for a backend slot for the request 'node'.  The lane is chosen
+ * from the operation of the current request (see sp_stats_current()).
+ * If BackendSlots is not set it does not wait, but the size of the
+ * response is still noted by sp_sched_release().
+ * Every successful call must be matched by sp_sched_release().
+ * @param env
+ * @param props
+ * @param node the request to be sent to the backend.
+ * @param ticket filled in, to be passed to sp_sched_release().
+ * @return 0 if the request may go ahead, non-zero (and the error set)
+ *         if no slot became free within BackendQueueMs.
+ */
+int sp_sched_acquire(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    axiom_node_t       *node,
+    sp_sched_ticket    *ticket)
+{
+    struct sp_sched_struct *s = sp_sched;
+    sp_sched_conf conf;
+
+    ticket->lane     = -1;
+    ticket->slot     = -1;
+    ticket->cov_key  = 0;
+    ticket->bytes_in = 0;
+
+    memset(&conf, 0, sizeof(conf));
+    const int  off     = sp_sched_conf_load(env, props, &conf);
+    int64_t    cost    = 0;
+    const int  lane    = sp_sched_classify(env, &conf, node,
+    		&ticket->cov_key, &cost);
+
+    // Off, but the size of the response is still noted, see
+    // sp_sched_expected().
+    const sp_req_stats *rs = sp_stats_current();
+    ticket->bytes_in = rs ? rs->bytes_in : 0;
+    if (off) return 0;
+
+    sp_sched_setup(s);
+
+    sp_lane   *ln      = &s->lanes[lane];
+    sp_stamp_t t0      = sp_stats_now();
+    sp_stamp_t timeout = t0 + (sp_stamp_t) conf.max_wait_ms * 1000000ULL;
+    int        granted = 0;
+    int        reaped  = 0;
+
+    if (sp_sched_lock(s))
+    {
+    	// Never seen in practice; rather go ahead than refuse everything.
+    	SP_LOG_ERROR("scheduler lock failed, request not scheduled");
+    	return 0;
+    }
+
+    if (0 == ln->waiting && ln->pass < s->vtime) ln->pass = s->vtime;
+    ln->waiting++;
+    const int flow = sp_sched_join_flow(ln, sp_client_current());
+
+    for (;;)
+    {
+    	if (sp_sched_can_run(s, &conf, lane) &&
+    		lane == sp_sched_pick(s, &conf) &&
+    		flow == sp_sched_pick_flow(ln))
+    	{
+    		granted = 1;
+    		break;
+    	}
+
+    	sp_stamp_t now = sp_stats_now();
+    	if (conf.max_wait_ms > 0 && now >= timeout) break;
+
+    	int n = sp_sched_reap(s, now);
+    	if (n > 0)
+    	{
+    		reaped += n;
+    		continue;
+    	}
+
+    	sp_stamp_t wake = now + SP_SCHED_POLL_NS;
+    	if (conf.max_wait_ms > 0 && wake > timeout) wake = timeout;
+    	struct timespec ts;
+    	ts.tv_sec  = (time_t) (wake / 1000000000ULL);
+    	ts.tv_nsec = (long)   (wake % 1000000000ULL);
+    	if (EOWNERDEAD == pthread_cond_timedwait(&s->cond, &s->mutex, &ts))
+    	{
+    		pthread_mutex_consistent(&s->mutex);
+    	}
+    }
+
+    ln->waiting--;
+    ln->flows[flow].waiting--;
+    const uint64_t wait_usec = (sp_stats_now() - t0) / 1000;
+    if (granted)
+    {
+    	const int slot = sp_sched_take_slot(s, lane);
+    	ln->admitted++;
+    	s->vtime  = ln->pass;
+    	ln->pass += SP_SCHED_STRIDE / conf.weight[lane];
+    	sp_sched_record_wait(ln, wait_usec);
+
+    	ln->flows[flow].deficit -= cost;
+    	if (ln->flows[flow].deficit <= 0)
+    	{
+    		ln->cursor = (flow + 1) % SP_SCHED_NFLOWS;
+    	}
+
+    	ticket->lane = lane;
+    	ticket->slot = slot;
+    }
+    else
+    {
+    	ln->timeouts++;
+    }
+
+    // The next lane in turn may be a different one now.
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    sp_stats_phase(SP_PH_QUEUE, t0);
+    if (reaped)
+    {
+    	SP_LOG_WARNING("%d backend slot(s) of exited processes released",
+    			reaped);
+    }
+
+    if (! granted)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_BACKEND_BUSY);
+    	SP_LOG_WARNING("no backend slot within %d ms, lane %s, %d slots",
+    			conf.max_wait_ms, sp_sched_lane_names[lane], conf.slots);
+    	return 1;
+    }
+
+    SP_LOG_DEBUG("backend slot %d, lane %s, waited %llu us",
+    		ticket->slot, sp_sched_lane_names[lane],
+    		(unsigned long long) wait_usec);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Take up to max more slots for a request which holds one from
+ *  sp_sched_acquire(), for the parallel parts of a fan-out.  It does not
+ *  wait: only slots which are free while no request is waiting are taken,
+ *  in the lane of the first.  Each of them must be given back with
+ *  sp_sched_release().
+ * @param env
+ * @param props
+ * @param first the ticket of the request.
+ * @param more max tickets, filled in.
+ * @param max
+ * @return the number of slots taken, max if BackendSlots is not set.
+ */
+int sp_sched_acquire_more(
+    const axutil_env_t    *env,
+    const sp_props        *props,
+    const sp_sched_ticket *first,
+    sp_sched_ticket       *more,
+    const int              max)
+{
+    struct sp_sched_struct *s = sp_sched;
+    sp_sched_conf conf;
+    int           got = 0;
+
+    for (int i = 0; i < max; i++)
+    {
+    	more[i].lane     = -1;
+    	more[i].slot     = -1;
+    	more[i].cov_key  = 0;
+    	more[i].bytes_in = 0;
+    }
+
+    memset(&conf, 0, sizeof(conf));
+    if (sp_sched_conf_load(env, props, &conf)) return max;
+    if (first->lane < 0 || sp_sched_lock(s)) return 0;
+
+    const int lane    = first->lane;
+    sp_lane  *ln      = &s->lanes[lane];
+    int       waiting = 0;
+    for (int l = 0; l < SP_LANE_NLANES; l++) waiting += s->lanes[l].waiting;
+
+    while (got < max && 0 == waiting && sp_sched_can_run(s, &conf, lane))
+    {
+    	more[got].lane = lane;
+    	more[got].slot = sp_sched_take_slot(s, lane);
+    	ln->pass += SP_SCHED_STRIDE / conf.weight[lane];
+    	got++;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    if (got < max)
+    {
+    	SP_LOG_DEBUG("%d of %d more backend slots, lane %s",
+    			got, max, sp_sched_lane_names[lane]);
+    }
+    return got;
+}
+
+//-----------------------------------------------------------------------------
+/** Give back the slot taken by sp_sched_acquire(), and note the size of
+ *  the response for the next request for the same coverage.
+ * @param env
+ * @param ticket
+ */
+void sp_sched_release(
+    const axutil_env_t *env,
+    sp_sched_ticket    *ticket)
+{
+    struct sp_sched_struct *s = sp_sched;
+
+    const sp_req_stats *rs = sp_stats_current();
+    if (ticket->cov_key && rs && rs->bytes_in > ticket->bytes_in)
+    {
+    	sp_sched_observe(ticket->cov_key, rs->bytes_in - ticket->bytes_in);
+    }
+    ticket->cov_key = 0;
+
+    if (ticket->lane < 0) return;
+
+    if (0 == sp_sched_lock(s))
+    {
+    	if (s->owner[ticket->slot] == getpid())
+    	{
+    		sp_sched_free_slot(s, ticket->slot);
+    	}
+    	pthread_cond_broadcast(&s->cond);
+    	pthread_mutex_unlock(&s->mutex);
+    }
+
+    ticket->lane = -1;
+}
+
+//-----------------------------------------------------------------------------
+/** The expected size of the response to a GetCoverage request, as
+ *  estimated by sp_estimate_check(), or from the responses seen for the
+ *  same CoverageId.
+ * @param env
+ * @param node the GetCoverage request.
+ * @return bytes, 0 if not known.
+ */
+uint64_t sp_sched_expected(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    const uint64_t bytes = sp_estimate_bytes(node);
+    if (bytes > 0) return bytes;
+
+    const axis2_char_t *cov_id = sp_get_text_el(
+    		rp_find_named_child(env, node, "CoverageId", 0), env);
+    if (NULL == cov_id) return 0;
+
+    const uint64_t key = sp_sched_hash(cov_id);
+    const struct sp_sched_est_struct *e = &sp_sched->est[key % SP_SCHED_NEST];
+    return (e->key == key) ? e->bytes : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Print the per-lane metrics in the Prometheus text format,
+ *  see rp_getProxyMetrics().
+ * @param fp
+ */
+void sp_sched_metrics(FILE *fp)
+{
+    const struct sp_sched_struct *s = sp_sched;
+    int l, i;
+
+    fprintf(fp,
+    		"# HELP soap_proxy_lane_slots_in_use Backend slots held, by scheduler lane.\n"
+    		"# TYPE soap_proxy_lane_slots_in_use gauge\n");
+    for (l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	fprintf(fp, "soap_proxy_lane_slots_in_use{lane=\"%s\"} %d\n",
+    			sp_sched_lane_names[l], s->lanes[l].in_use);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_lane_queue_depth Requests waiting for a backend slot.\n"
+    		"# TYPE soap_proxy_lane_queue_depth gauge\n");
+    for (l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	fprintf(fp, "soap_proxy_lane_queue_depth{lane=\"%s\"} %d\n",
+    			sp_sched_lane_names[l], s->lanes[l].waiting);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_lane_clients_waiting Clients with requests waiting.\n"
+    		"# TYPE soap_proxy_lane_clients_waiting gauge\n");
+    for (l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	int n = 0;
+    	for (i = 0; i < SP_SCHED_NFLOWS; i++)
+    	{
+    		if (s->lanes[l].flows[i].waiting > 0) n++;
+    	}
+    	fprintf(fp, "soap_proxy_lane_clients_waiting{lane=\"%s\"} %d\n",
+    			sp_sched_lane_names[l], n);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_lane_timeouts_total Requests refused after BackendQueueMs.\n"
+    		"# TYPE soap_proxy_lane_timeouts_total counter\n");
+    for (l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	fprintf(fp, "soap_proxy_lane_timeouts_total{lane=\"%s\"} %llu\n",
+    			sp_sched_lane_names[l],
+    			(unsigned long long) s->lanes[l].timeouts);
+    }
+
+    fprintf(fp,
+    		"# HELP soap_proxy_lane_wait_seconds Time waited for a backend slot.\n"
+    		"# TYPE soap_proxy_lane_wait_seconds histogram\n");
+    for (l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	const sp_lane *ln    = &s->lanes[l];
+    	uint64_t       cumul = 0;
+    	for (i = 0; i < SP_SCHED_PROM_NLE; i++)
+    	{
+    		cumul += ln->wait_buckets[i];
+    		fprintf(fp, "soap_proxy_lane_wait_seconds_bucket{lane=\"%s\","
+    				"le=\"%g\"} %llu\n", sp_sched_lane_names[l],
+    				sp_sched_prom_le[i], (unsigned long long) cumul);
+    	}
+    	fprintf(fp, "soap_proxy_lane_wait_seconds_bucket{lane=\"%s\","
+    			"le=\"+Inf\"} %llu\n", sp_sched_lane_names[l],
+    			(unsigned long long) ln->admitted);
+    	fprintf(fp, "soap_proxy_lane_wait_seconds_sum{lane=\"%s\"} %.6f\n",
+    			sp_sched_lane_names[l], (double) ln->wait_sum / 1e6);
+    	fprintf(fp, "soap_proxy_lane_wait_seconds_count{lane=\"%s\"} %llu\n",
+    			sp_sched_lane_names[l], (unsigned long long) ln->admitted);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Add the state of the lanes to the GetPoolStatus response, e.g.:
+ *
+ *    <sopr:Lane name="meta" inUse="1" queued="0" admitted="420"
+ *               timeouts="0" waitMean="35" waitMax="1800"/>
+ *
+ * Wait times are in microseconds.
+ * @param env
+ * @param parent
+ * @param ns
+ */
+void sp_sched_add_status(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    axiom_namespace_t  *ns)
+{
+    const struct sp_sched_struct *s = sp_sched;
+
+    for (int l = 0; l < SP_LANE_NLANES; l++)
+    {
+    	const sp_lane   *ln   = &s->lanes[l];
+    	axiom_node_t    *node = NULL;
+    	axiom_element_t *el   =
+    			axiom_element_create(env, parent, "Lane", ns, &node);
+    	axiom_attribute_t *attr =
+    			axiom_attribute_create(env, "name", sp_sched_lane_names[l], NULL);
+    	axiom_element_add_attribute(el, env, attr, node);
+
+    	sp_sched_add_attr_u64(env, el, node, "inUse",
+    			ln->in_use > 0 ? (uint64_t) ln->in_use : 0);
+    	sp_sched_add_attr_u64(env, el, node, "queued",
+    			ln->waiting > 0 ? (uint64_t) ln->waiting : 0);
+    	sp_sched_add_attr_u64(env, el, node, "admitted", ln->admitted);
+    	sp_sched_add_attr_u64(env, el, node, "timeouts", ln->timeouts);
+    	sp_sched_add_attr_u64(env, el, node, "waitMean",
+    			ln->admitted ? ln->wait_sum / ln->admitted : 0);
+    	sp_sched_add_attr_u64(env, el, node, "waitMax", ln->wait_max);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Soap Proxy - backend request scheduler header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_sched.h
+ *
+ */
+
+#ifndef SPSCHED_H_INCLUDED
+#define SPSCHED_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+/**
+ * Lanes of the backend scheduler, see sp_sched.c.
+ */
+enum sp_sched_lanes
+{
+	SP_LANE_META = 0,    // GetCapabilities, DescribeCoverage, GetMsVersion
+	SP_LANE_SEARCH,      // DescribeEOCoverageSet
+	SP_LANE_COVERAGE,    // GetCoverage expected below BulkCoverageMB
+	SP_LANE_BULK,        // GetCoverage expected at or above BulkCoverageMB
+
+	SP_LANE_NLANES
+};
+
+#define SP_SCHED_MAX_SLOTS 256
+
+//
+// A backend slot held by one request, from sp_sched_acquire() to
+// sp_sched_release().
+//
+struct sp_sched_ticket_struct
+{
+    int      lane;      // -1 if no slot is held
+    int      slot;
+    uint64_t cov_key;   // hash of the CoverageId, 0 if none
+    uint64_t bytes_in;  // bytes read by the request before admission
+};
+
+typedef struct sp_sched_ticket_struct sp_sched_ticket;
+
+void        sp_sched_init     (const axutil_env_t *env);
+const char *sp_sched_lane_name(const int lane);
+int         sp_sched_acquire  (const axutil_env_t *env,
+                               const sp_props     *props,
+                               axiom_node_t       *node,
+                               sp_sched_ticket    *ticket);
+int         sp_sched_acquire_more(const axutil_env_t    *env,
+                               const sp_props        *props,
+                               const sp_sched_ticket *first,
+                               sp_sched_ticket       *more,
+                               const int              max);
+void        sp_sched_release  (const axutil_env_t *env,
+                               sp_sched_ticket    *ticket);
+uint64_t    sp_sched_expected (const axutil_env_t *env,
+                               axiom_node_t       *node);
+void        sp_sched_metrics  (FILE *fp);
+void        sp_sched_add_status(const axutil_env_t *env,
+                               axiom_node_t       *parent,
+                               axiom_namespace_t  *ns);
+
+#endif
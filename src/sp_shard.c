@@ -0,0 +1,831 @@
+/*
+ * Soap Proxy.
+ *
+ * DescribeEOCoverageSet scattered over sharded backends.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_shard.c
+ *
+ * An archive may be split over several backends, each serving its own
+ * dataset series.  If BackendShards lists their URLs, a
+ * DescribeEOCoverageSet request is sent to all of them at once and the
+ * answers are merged into one EOCoverageSetDescription:
+ *
+ *  - the CoverageDescription and DatasetSeriesDescription elements of
+ *    all shards are gathered, in the order the shards are listed,
+ *  - numberMatched is the sum over the shards,
+ *  - if the request has a count, no more than that many descriptions
+ *    are returned, and numberReturned is set to what is returned.
+ *
+ * A shard answering with an ExceptionReport, e.g. because it does not
+ * know the requested eoId, has matched nothing.  Only if all shards do
+ * so is the first ExceptionReport returned.  A shard that cannot be
+ * reached, or does not answer within ShardTimeoutMs, fails the request:
+ * a partial answer would look complete to the client.
+ *
+ * The requests are written and the responses read on non-blocking
+ * sockets in a single poll() loop, so the time taken is that of the
+ * slowest shard, not the sum.  Each response is spooled to an unlinked
+ * temporary file, as the exec mode does with mapserver's output, and
+ * parsed with sp_build_response20() once all are in.  The fan-out takes
+ * one backend slot, see sp_sched.c.  Other operations still go to
+ * BackendURL or MapServ.  sp_tile.c sends the strips of a large
+ * GetCoverage with the same sp_shard_scatter().
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <axutil_url.h>
+
+#include "soap_proxy.h"
+#include "sp_shard.h"
+#include "sp_log.h"
+#include "sp_sched.h"
+#include "sp_stats.h"
+
+#define SP_SHARD_BUF_LEN  65536
+#define SP_SHARD_MAX_RESP (1024L * 1024 * 1024)
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Set up a shard for each of the BackendShards.
+ * @param env
+ * @param props
+ * @param req the request for all of them.
+ * @param req_len
+ * @param shards
+ * @return the number of shards, -1 if one of the URLs is malformed.
+ */
+static int sp_shard_parse(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    const char         *req,
+    const size_t        req_len,
+    sp_shard           *shards)
+{
+    const char *p = rp_getBackendShards(env, props);
+    int         n = 0;
+
+    while (*p && n < SP_SHARD_MAX)
+    {
+    	p += strspn(p, ", \t\n");
+    	size_t len = strcspn(p, ", \t\n");
+    	if (0 == len) break;
+
+    	char buf[SP_SHARD_URL_LEN];
+    	snprintf(buf, SP_SHARD_URL_LEN, "%.*s", (int) len, p);
+    	p += len;
+
+    	axutil_url_t *url = axutil_url_parse_string(env, buf);
+    	const axis2_char_t *host = url ? axutil_url_get_host(url, env) : NULL;
+    	const axis2_char_t *path = url ? axutil_url_get_path(url, env) : NULL;
+    	if (NULL == host || NULL == path || axutil_strlen(host) < 1)
+    	{
+    		if (url) axutil_url_free(url, env);
+    		rp_log_error(env, "Malformed " SP_SHARDS_STR " entry '%s'.\n", buf);
+    		while (n-- > 0) sp_shard_cleanup(env, &shards[n]);
+    		return -1;
+    	}
+    	sp_shard_setup(env, props, &shards[n], buf,
+    			host, axutil_url_get_port(url, env), path, req, req_len);
+    	axutil_url_free(url, env);
+    	n++;
+    }
+
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_shard_fail(sp_shard *sh, const char *why)
+{
+    sh->state = SP_SHARD_FAILED;
+    sh->why   = why;
+    if (sh->fd >= 0) close(sh->fd);
+    sh->fd = -1;
+}
+
+//-----------------------------------------------------------------------------
+/** Start connecting to a shard.
+ * @param sh
+ */
+static void sp_shard_connect(sp_shard *sh)
+{
+    struct addrinfo  hints;
+    struct addrinfo *ai = NULL, *a;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(sh->host, sh->port, &hints, &ai))
+    {
+    	sp_shard_fail(sh, "cannot resolve host");
+    	return;
+    }
+
+    for (a = ai; a; a = a->ai_next)
+    {
+    	sh->fd = socket(a->ai_family,
+    			a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+    	if (sh->fd < 0) continue;
+    	if (0 == connect(sh->fd, a->ai_addr, a->ai_addrlen) ||
+    		EINPROGRESS == errno)
+    	{
+    		break;
+    	}
+    	close(sh->fd);
+    	sh->fd = -1;
+    }
+    freeaddrinfo(ai);
+
+    sp_stats_count_connect(sh->fd >= 0);
+    if (sh->fd < 0) sp_shard_fail(sh, "cannot connect");
+}
+
+//-----------------------------------------------------------------------------
+/** Write as much of the request to a shard as the socket takes.
+ * @param sh
+ */
+static void sp_shard_send(sp_shard *sh)
+{
+    const char  *req     = sh->req;
+    const size_t req_len = sh->req_len;
+
+    if (0 == sh->sent)
+    {
+    	int       err = 0;
+    	socklen_t len = sizeof(err);
+    	if (getsockopt(sh->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+    	{
+    		sp_shard_fail(sh, "cannot connect");
+    		return;
+    	}
+    }
+
+    while (sh->sent < sh->head_len + req_len)
+    {
+    	const char *data;
+    	size_t      n;
+    	if (sh->sent < sh->head_len)
+    	{
+    		data = sh->head + sh->sent;
+    		n    = sh->head_len - sh->sent;
+    	}
+    	else
+    	{
+    		data = req + (sh->sent - sh->head_len);
+    		n    = req_len - (sh->sent - sh->head_len);
+    	}
+
+    	ssize_t w = send(sh->fd, data, n, MSG_NOSIGNAL);
+    	if (w < 0)
+    	{
+    		if (EINTR == errno) continue;
+    		if (EAGAIN != errno) sp_shard_fail(sh, "write error");
+    		return;
+    	}
+    	sh->sent += w;
+    }
+
+    sp_stats_add_bytes_out(sh->sent);
+    sh->state = SP_SHARD_READING;
+}
+
+//-----------------------------------------------------------------------------
+/** Spool what a shard has sent.
+ * @param sh
+ * @param buf
+ */
+static void sp_shard_recv(sp_shard *sh, char *buf)
+{
+    for (;;)
+    {
+    	ssize_t r = recv(sh->fd, buf, SP_SHARD_BUF_LEN, 0);
+    	if (r < 0)
+    	{
+    		if (EINTR == errno) continue;
+    		if (EAGAIN != errno) sp_shard_fail(sh, "read error");
+    		return;
+    	}
+    	if (0 == r)
+    	{
+    		close(sh->fd);
+    		sh->fd    = -1;
+    		sh->state = SP_SHARD_DONE;
+    		return;
+    	}
+
+    	if (0 == sh->received) sp_stats_first_byte();
+    	sh->received += r;
+    	if (sh->received > SP_SHARD_MAX_RESP ||
+    		write(sh->tmp_fd, buf, r) != r)
+    	{
+    		sp_shard_fail(sh, "cannot spool the response");
+    		return;
+    	}
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+/** Parse the spooled response of a shard.
+ * @param env
+ * @param props
+ * @param sh
+ * @param wcs_version
+ */
+static void sp_shard_parse_resp(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_shard           *sh,
+    const int           wcs_version)
+{
+    lseek(sh->tmp_fd, 0, SEEK_SET);
+    FILE *fp = fdopen(sh->tmp_fd, "r");
+    if (NULL == fp) return;
+    sh->tmp_fd = -1;
+
+    axutil_stream_t *st = axutil_stream_create_file(env, fp);
+    if (NULL == st)
+    {
+    	fclose(fp);
+    	return;
+    }
+    if (SP_WCS_V200 == wcs_version)
+    {
+    	sh->resp = sp_build_response20(env, props, st);
+    }
+    sp_stream_cleanup(env, st);
+}
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_shard_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    if (NULL == node || AXIOM_ELEMENT != axiom_node_get_node_type(node, env))
+    {
+    	return NULL;
+    }
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+static long sp_shard_attr_long(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char         *name)
+{
+    axiom_element_t    *el  = axiom_node_get_data_element(node, env);
+    const axis2_char_t *val = el ?
+    		axiom_element_get_attribute_value_by_name(el, env, (axis2_char_t *) name) :
+    		NULL;
+    return val ? atol(val) : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Replace the value of an attribute, adding the attribute if missing.
+static void sp_shard_set_attr_long(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char         *name,
+    const long          value)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    char             buf[24];
+
+    snprintf(buf, sizeof(buf), "%ld", value);
+
+    axutil_qname_t *qn = axutil_qname_create(env, name, NULL, NULL);
+    axiom_attribute_t *attr = axiom_element_get_attribute(el, env, qn);
+    axutil_qname_free(qn, env);
+
+    if (attr)
+    {
+    	axiom_attribute_set_value(attr, env, buf);
+    }
+    else
+    {
+    	axiom_element_add_attribute(el, env,
+    			axiom_attribute_create(env, name, buf, NULL), node);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Declare the namespaces of an element of a shard's response on an element
+ *  being moved out of it, unless it declares the prefix itself.  Namespaces
+ *  are reference counted, so the elements moved keep them alive once the
+ *  rest of the response is freed.
+ * @param env
+ * @param child detached, so that declarations above it are not seen.
+ * @param from the element whose declarations are taken.
+ */
+static void sp_shard_keep_ns(
+    const axutil_env_t *env,
+    axiom_node_t       *child,
+    axiom_node_t       *from)
+{
+    axiom_element_t *el      = axiom_node_get_data_element(child, env);
+    axiom_element_t *from_el = axiom_node_get_data_element(from, env);
+    axutil_hash_t   *nss     = from_el ?
+    		axiom_element_get_namespaces(from_el, env) : NULL;
+    if (NULL == el || NULL == nss) return;
+
+    axutil_hash_index_t *hi;
+    for (hi = axutil_hash_first(nss, env); hi; hi = axutil_hash_next(env, hi))
+    {
+    	void *val = NULL;
+    	axutil_hash_this(hi, NULL, NULL, &val);
+    	axiom_namespace_t *ns = (axiom_namespace_t *) val;
+    	if (NULL == ns) continue;
+
+    	const axis2_char_t *prefix = axiom_namespace_get_prefix(ns, env);
+    	axutil_hash_t      *own    = axiom_element_get_namespaces(el, env);
+    	if (own && axutil_hash_get(own, prefix ? prefix : "", AXIS2_HASH_KEY_STRING))
+    	{
+    		continue;
+    	}
+    	axiom_element_declare_namespace(el, env, child, ns);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Move the element children of one CoverageDescriptions or
+ *  DatasetSeriesDescriptions element into the same element of the merged
+ *  response.
+ * @param env
+ * @param merged the EOCoverageSetDescription returned.
+ * @param resp that of another shard.
+ * @param name of the element.
+ */
+static void sp_shard_merge_section(
+    const axutil_env_t *env,
+    axiom_node_t       *merged,
+    axiom_node_t       *resp,
+    const char         *name)
+{
+    axiom_node_t *src = rp_find_named_child(env, resp, (axis2_char_t *) name, 0);
+    if (NULL == src) return;
+
+    axiom_node_t *dst = rp_find_named_child(env, merged, (axis2_char_t *) name, 0);
+    if (NULL == dst)
+    {
+    	// CoverageDescriptions comes before DatasetSeriesDescriptions.
+    	axiom_node_detach(src, env);
+    	sp_shard_keep_ns(env, src, resp);
+    	axiom_node_t *dsd = 0 == strcmp(name, "CoverageDescriptions") ?
+    			rp_find_named_child(env, merged, "DatasetSeriesDescriptions", 0) :
+    			NULL;
+    	if (dsd)
+    	{
+    		axiom_node_insert_sibling_before(dsd, env, src);
+    	}
+    	else
+    	{
+    		axiom_node_add_child(merged, env, src);
+    	}
+    	return;
+    }
+
+    axiom_node_t *child = axiom_node_get_first_child(src, env);
+    while (child)
+    {
+    	axiom_node_t *next = axiom_node_get_next_sibling(child, env);
+    	if (AXIOM_ELEMENT == axiom_node_get_node_type(child, env))
+    	{
+    		axiom_node_detach(child, env);
+    		sp_shard_keep_ns(env, child, src);
+    		sp_shard_keep_ns(env, child, resp);
+    		axiom_node_add_child(dst, env, child);
+    	}
+    	child = next;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Keep at most 'left' element children of a section, drop the rest.
+ * @param env
+ * @param merged
+ * @param name of the section.
+ * @param left in: how many more may be kept, out: reduced by those kept.
+ * @return the number kept.
+ */
+static long sp_shard_trim_section(
+    const axutil_env_t *env,
+    axiom_node_t       *merged,
+    const char         *name,
+    long               *left)
+{
+    axiom_node_t *sec = rp_find_named_child(env, merged, (axis2_char_t *) name, 0);
+    long          kept = 0;
+    if (NULL == sec) return 0;
+
+    axiom_node_t *child = axiom_node_get_first_child(sec, env);
+    while (child)
+    {
+    	axiom_node_t *next = axiom_node_get_next_sibling(child, env);
+    	if (AXIOM_ELEMENT == axiom_node_get_node_type(child, env))
+    	{
+    		if (*left > 0)
+    		{
+    			(*left)--;
+    			kept++;
+    		}
+    		else
+    		{
+    			axiom_node_free_tree(axiom_node_detach(child, env), env);
+    		}
+    	}
+    	child = next;
+    }
+    return kept;
+}
+
+//-----------------------------------------------------------------------------
+/** Merge the shards' responses.
+ * @param env
+ * @param req_node the DescribeEOCoverageSet request.
+ * @param shards
+ * @param n
+ * @return the merged EOCoverageSetDescription, or if no shard returned one
+ *         the first response, NULL if there is none.
+ */
+static axiom_node_t *sp_shard_gather(
+    const axutil_env_t *env,
+    axiom_node_t       *req_node,
+    sp_shard           *shards,
+    const int           n)
+{
+    axiom_node_t *merged  = NULL;
+    axiom_node_t *first   = NULL;
+    long          matched = 0;
+    int           i;
+
+    for (i = 0; i < n; i++)
+    {
+    	axiom_node_t *resp = shards[i].resp;
+    	if (NULL == resp) continue;
+
+    	const axis2_char_t *name = sp_shard_localname(env, resp);
+    	if (NULL == name || strcmp(name, "EOCoverageSetDescription"))
+    	{
+    		if (NULL == first)
+    		{
+    			first = resp;
+    		}
+    		else
+    		{
+    			axiom_node_free_tree(resp, env);
+    		}
+    		SP_LOG_DEBUG("shard %s: %s", shards[i].url, name ? name : "no XML");
+    		continue;
+    	}
+
+    	const long m = sp_shard_attr_long(env, resp, "numberMatched");
+    	if (m > 0) matched += m;
+
+    	if (NULL == merged)
+    	{
+    		merged = resp;
+    	}
+    	else
+    	{
+    		sp_shard_merge_section(env, merged, resp, "CoverageDescriptions");
+    		sp_shard_merge_section(env, merged, resp, "DatasetSeriesDescriptions");
+    		axiom_node_free_tree(resp, env);
+    	}
+    }
+
+    if (NULL == merged) return first;
+    if (first) axiom_node_free_tree(first, env);
+
+    axiom_element_t    *req_el = axiom_node_get_data_element(req_node, env);
+    const axis2_char_t *count  = req_el ?
+    		axiom_element_get_attribute_value_by_name(req_el, env, "count") : NULL;
+    long left = count && atol(count) >= 0 ? atol(count) : -1;
+    if (left < 0) left = 0x7fffffffL;
+
+    long returned = 0;
+    returned += sp_shard_trim_section(env, merged, "CoverageDescriptions", &left);
+    returned += sp_shard_trim_section(env, merged, "DatasetSeriesDescriptions", &left);
+
+    sp_shard_set_attr_long(env, merged, "numberMatched",  matched);
+    sp_shard_set_attr_long(env, merged, "numberReturned", returned);
+
+    return merged;
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Prepare a request to one backend.
+ * @param env
+ * @param props
+ * @param sh
+ * @param label naming the shard in the log, e.g. its URL.
+ * @param host
+ * @param port
+ * @param path
+ * @param req the request, kept by reference until sp_shard_cleanup().
+ * @param req_len
+ */
+void sp_shard_setup(
+    const axutil_env_t *env,
+    const sp_props     *props,
+    sp_shard           *sh,
+    const char         *label,
+    const char         *host,
+    const int           port,
+    const char         *path,
+    const char         *req,
+    const size_t        req_len)
+{
+    memset(sh, 0, sizeof(*sh));
+    sh->fd      = -1;
+    sh->tmp_fd  = -1;
+    sh->req     = req;
+    sh->req_len = req_len;
+    snprintf(sh->url,  SP_SHARD_URL_LEN, "%s", label);
+    snprintf(sh->host, SP_SHARD_URL_LEN, "%s", host);
+    snprintf(sh->port, sizeof(sh->port), "%d", port);
+    sh->head     = sp_backend_head(env, path, req_len, rp_getMapfile(env, props));
+    sh->head_len = strlen(sh->head);
+}
+
+//-----------------------------------------------------------------------------
+/** Send their requests to all shards and spool the responses, all at once.
+ * Gives up as soon as one of the shards fails.
+ * @param env
+ * @param shards set up with sp_shard_setup().
+ * @param n
+ * @param timeout_ms for all of them together, 0 for no limit.
+ * @return 0 if all shards have answered, else -1 (and the error logged).
+ */
+int sp_shard_scatter(
+    const axutil_env_t *env,
+    sp_shard           *shards,
+    const int           n,
+    const int           timeout_ms)
+{
+    struct pollfd pfd[SP_SHARD_MAX];
+    int          i, pending;
+
+    sp_stamp_t t0 = sp_stats_now();
+    for (i = 0; i < n; i++)
+    {
+    	char tmp_name[32];
+    	strcpy(tmp_name, "/tmp/msshXXXXXX");
+    	shards[i].tmp_fd = mkostemp(tmp_name, O_CLOEXEC);
+    	if (shards[i].tmp_fd < 0)
+    	{
+    		sp_shard_fail(&shards[i], "cannot create a temporary file");
+    		continue;
+    	}
+    	unlink(tmp_name);
+    	sp_shard_connect(&shards[i]);
+    }
+    sp_stats_phase(SP_PH_CONNECT, t0);
+
+    char *buf = AXIS2_MALLOC(env->allocator, SP_SHARD_BUF_LEN);
+    int   all_sent = 0;
+    const sp_stamp_t deadline = sp_stats_now() + (sp_stamp_t) timeout_ms * 1000000ULL;
+
+    for (;;)
+    {
+    	pending = 0;
+    	int sending = 0, failed = 0;
+    	for (i = 0; i < n; i++)
+    	{
+    		sp_shard *sh = &shards[i];
+    		failed += SP_SHARD_FAILED == sh->state;
+    		if (SP_SHARD_SENDING != sh->state && SP_SHARD_READING != sh->state)
+    		{
+    			continue;
+    		}
+    		sending += SP_SHARD_SENDING == sh->state;
+    		pfd[pending].fd     = sh->fd;
+    		pfd[pending].events =
+    				SP_SHARD_SENDING == sh->state ? POLLOUT : POLLIN;
+    		pfd[pending].revents = 0;
+    		pending++;
+    	}
+    	if (! sending && ! all_sent)
+    	{
+    		all_sent = 1;
+    		sp_stats_mark_sent();
+    	}
+    	if (0 == pending || failed) break;
+
+    	int wait_ms = -1;
+    	if (timeout_ms > 0)
+    	{
+    		const sp_stamp_t now = sp_stats_now();
+    		if (now >= deadline) break;
+    		wait_ms = (int) ((deadline - now + 999999) / 1000000);
+    	}
+
+    	int r = poll(pfd, pending, wait_ms);
+    	if (r < 0 && EINTR != errno) break;
+    	if (r <= 0) continue;
+
+    	int k = 0;
+    	for (i = 0; i < n; i++)
+    	{
+    		sp_shard *sh = &shards[i];
+    		if (SP_SHARD_SENDING != sh->state && SP_SHARD_READING != sh->state)
+    		{
+    			continue;
+    		}
+    		const short rev = pfd[k++].revents;
+    		if (0 == rev) continue;
+
+    		if (SP_SHARD_SENDING == sh->state)
+    		{
+    			sp_shard_send(sh);
+    		}
+    		else
+    		{
+    			sp_shard_recv(sh, buf);
+    		}
+    	}
+    }
+    AXIS2_FREE(env->allocator, buf);
+
+    int failed = 0;
+    for (i = 0; i < n; i++)
+    {
+    	sp_shard *sh = &shards[i];
+    	if (SP_SHARD_FAILED == sh->state)
+    	{
+    		rp_log_error(env, "(%s:%d) shard %s: %s\n",
+    				__FILE__, __LINE__, sh->url, sh->why);
+    		failed = 1;
+    	}
+    	else if (SP_SHARD_DONE != sh->state)
+    	{
+    		// Timed out, or given up on since another shard failed.
+    		sp_shard_fail(sh, "no answer");
+    		SP_LOG_WARNING("shard %s: no answer", sh->url);
+    		failed = 1;
+    	}
+    }
+    return failed ? -1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Release what sp_shard_setup() and sp_shard_scatter() took, except the
+ *  parsed response.
+ * @param env
+ * @param sh
+ */
+void sp_shard_cleanup(const axutil_env_t *env, sp_shard *sh)
+{
+    if (sh->fd     >= 0) close(sh->fd);
+    if (sh->tmp_fd >= 0) close(sh->tmp_fd);
+    sh->fd     = -1;
+    sh->tmp_fd = -1;
+    if (sh->head) AXIS2_FREE(env->allocator, sh->head);
+    sh->head = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if DescribeEOCoverageSet goes to sharded backends.
+ */
+int sp_shard_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return '\0' != rp_getBackendShards(env, props)[0];
+}
+
+//-----------------------------------------------------------------------------
+/** Send a DescribeEOCoverageSet request to all shards and merge their
+ *  responses, in place of rp_invokeBackend().
+ * @param env
+ * @param node the request.
+ * @param props
+ * @param wcs_version
+ * @return the merged response, NULL on error.
+ */
+axiom_node_t *sp_shard_invoke(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version)
+{
+    // DrainBackend: fail fast rather than queue up on the backend.
+    if (sp_stats_drain_since())
+    {
+    	SP_ERROR(env, SP_SYS_ERR_BACKEND_DRAINING);
+    	SP_LOG_DEBUG("backend draining, request refused");
+    	return NULL;
+    }
+
+    sp_sched_ticket ticket;
+    if (sp_sched_acquire(env, props, node, &ticket))
+    {
+    	return NULL;
+    }
+
+    sp_stamp_t    t0          = sp_stats_now();
+    axiom_node_t *return_node = NULL;
+    axis2_char_t *req_string  = axiom_node_to_string(node, env);
+    sp_shard      shards[SP_SHARD_MAX];
+    int           i;
+
+    sp_stats_phase(SP_PH_SERIALIZE, t0);
+
+    const int n = req_string ?
+    		sp_shard_parse(env, props, req_string, strlen(req_string), shards) : -1;
+    if (req_string) sp_stats_note_request(req_string, strlen(req_string));
+
+    if (n <= 0)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_MS_EXEC);
+    	rp_log_error(env, "(%s:%d) no usable " SP_SHARDS_STR "\n",
+    			__FILE__, __LINE__);
+    }
+    else if (sp_shard_scatter(env, shards, n, rp_getShardTimeoutMs(env, props)))
+    {
+    	SP_ERROR(env, SP_SYS_ERR_MS_EXEC);
+    }
+    else
+    {
+    	int parsed = 0;
+    	for (i = 0; i < n; i++)
+    	{
+    		sp_shard_parse_resp(env, props, &shards[i], wcs_version);
+    		if (shards[i].resp)
+    		{
+    			parsed++;
+    		}
+    		else
+    		{
+    			rp_log_error(env, "(%s:%d) shard %s: bad response\n",
+    					__FILE__, __LINE__, shards[i].url);
+    		}
+    	}
+
+    	if (parsed < n)
+    	{
+    		// The error is that of sp_build_response20().
+    		for (i = 0; i < n; i++)
+    		{
+    			if (shards[i].resp) axiom_node_free_tree(shards[i].resp, env);
+    		}
+    	}
+    	else
+    	{
+    		return_node = sp_shard_gather(env, node, shards, n);
+    		SP_LOG_DEBUG("DescribeEOCoverageSet merged from %d shards", n);
+    	}
+    }
+
+    for (i = 0; i < n; i++)
+    {
+    	sp_shard_cleanup(env, &shards[i]);
+    }
+    if (req_string) AXIS2_FREE(env->allocator, req_string);
+    sp_sched_release(env, &ticket);
+
+    return return_node;
+}
@@ -0,0 +1,104 @@
+/*
+ * Soap Proxy - sharded backends header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_shard.h
+ *
+ */
+
+#ifndef SPSHARD_H_INCLUDED
+#define SPSHARD_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+#define SP_SHARD_MAX     32
+#define SP_SHARD_URL_LEN 512
+
+enum sp_shard_states
+{
+	SP_SHARD_SENDING = 0,   // connecting, or writing the request
+	SP_SHARD_READING,
+	SP_SHARD_DONE,
+	SP_SHARD_FAILED
+};
+
+//
+// One backend request of a fan-out, see sp_shard_scatter().
+//
+struct sp_shard_struct
+{
+    char          url [SP_SHARD_URL_LEN];
+    char          host[SP_SHARD_URL_LEN];
+    char          port[8];
+    const char   *req;
+    size_t        req_len;
+    char         *head;      // HTTP request head
+    size_t        head_len;
+    size_t        sent;      // of head and request
+    int           fd;        // socket
+    int           tmp_fd;    // the response, spooled
+    uint64_t      received;
+    int           state;
+    const char   *why;       // if SP_SHARD_FAILED
+    axiom_node_t *resp;
+};
+
+typedef struct sp_shard_struct sp_shard;
+
+void          sp_shard_setup  (const axutil_env_t *env,
+                               const sp_props     *props,
+                               sp_shard           *sh,
+                               const char         *label,
+                               const char         *host,
+                               const int           port,
+                               const char         *path,
+                               const char         *req,
+                               const size_t        req_len);
+
+int           sp_shard_scatter(const axutil_env_t *env,
+                               sp_shard           *shards,
+                               const int           n,
+                               const int           timeout_ms);
+
+void          sp_shard_cleanup(const axutil_env_t *env,
+                               sp_shard           *sh);
+
+int           sp_shard_enabled(const axutil_env_t *env,
+                               const sp_props     *props);
+
+axiom_node_t *sp_shard_invoke (const axutil_env_t *env,
+                               axiom_node_t       *node,
+                               const sp_props     *props,
+                               const int           wcs_version);
+
+#endif
@@ -0,0 +1,1169 @@
+/*
+ * Soap Proxy.
+ *
+ * Request statistics: per-phase latency histograms and counters.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_stats.c
+ *
+ * Each request is timed phase by phase with the monotonic clock; the
+ * durations are accumulated into one histogram per
+ * (operation, backend mode, phase).  The histograms are updated with
+ * atomic adds only, so concurrent requests in the same process never
+ * take a lock.  Readers (GetProxyStats) see a slightly fuzzy snapshot,
+ * which is fine for monitoring purposes.
+ *
+ * The per-request state is kept in a thread-local pointer so that the
+ * low level functions (sp_backend_socket, sp_build_response20, ...)
+ * can report their phase without passing an extra argument around.
+ *
+ * With Apache prefork every child process runs its own copy of the
+ * service, so the counters live in a POSIX shared memory segment which
+ * all processes hosting the same service map.  The segment is named
+ * after the directory the service library was loaded from, so that two
+ * services deployed in one Apache do not mix their numbers.  Should the
+ * segment not be available the counters fall back to process memory.
+ *
+ * GetProxyMetrics exposes the same data in the Prometheus text format.
+ *
+ * Every request gets an id, which is passed on to the backend (as the
+ * X-Request-Id header, or HTTP_X_REQUEST_ID in the environment of
+ * mapserv) and is attached to all log records of the request.  Requests
+ * taking longer than SlowRequestMs are logged with their phase
+ * breakdown, a hash of the request sent to the backend, and the start of
+ * the response headers.
+ *
+ * The segment also holds the drain flag set by the DrainBackend
+ * operation, so that it takes effect in all processes at once, and the
+ * time of the last PurgeCache, for the caches kept by each process.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "soap_proxy.h"
+#include "sp_stats.h"
+#include "sp_log.h"
+#include "sp_sched.h"
+#include "sp_client.h"
+
+// Percentiles reported by GetProxyStats.
+static const double sp_stats_quantiles[]      = { 0.5, 0.9, 0.99, 0.999 };
+static const char  *sp_stats_quantile_names[] = { "p50", "p90", "p99", "p999" };
+#define SP_STATS_NQUANTILES 4
+
+struct sp_hist_struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[SP_HIST_NBUCKETS];
+};
+
+typedef struct sp_hist_struct sp_hist;
+
+struct sp_op_stats_struct
+{
+    uint64_t requests;
+    uint64_t faults;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    sp_hist  phases[SP_PH_NPHASES];
+};
+
+typedef struct sp_op_stats_struct sp_op_stats;
+
+#define SP_STATS_MAX_CACHES     8
+#define SP_STATS_CACHE_NAME_LEN 32
+
+struct sp_cache_stats_struct
+{
+    char     name[SP_STATS_CACHE_NAME_LEN];
+    uint64_t hits;
+    uint64_t misses;
+};
+
+typedef struct sp_cache_stats_struct sp_cache_stats;
+
+struct sp_stats_struct
+{
+    time_t         start_time;
+    volatile int   init_state;     // see sp_setup_shared()
+    pthread_mutex_t cache_lock;    // registration of cache names
+    int64_t        in_flight;
+    uint64_t       spawns;
+    uint64_t       connects;
+    uint64_t       connect_errors;
+    time_t         drain_since;    // DrainBackend on, 0 if off
+    time_t         purged;         // last PurgeCache, 0 if none
+    sp_op_stats    ops[SP_OP_NOPS][SP_BE_NMODES];
+    uint64_t       faults[SP_ERR_NCODES + 1];  // last slot: not one of ours
+    sp_cache_stats caches[SP_STATS_MAX_CACHES];
+};
+
+static struct sp_stats_struct  sp_stats_local;
+static struct sp_stats_struct *sp_stats = &sp_stats_local;
+
+static __thread sp_req_stats *sp_curr_rs = NULL;
+
+static volatile uint32_t sp_req_seq = 0;
+
+static const char *sp_stats_op_names[] =
+{
+    "GetCapabilities",
+    "DescribeCoverage",
+    "DescribeEOCoverageSet",
+    "GetCoverage",
+    "GetMsVersion",
+    "GetProxyStats",
+    "GetProxyMetrics",
+    "PurgeCache",
+    "GetPoolStatus",
+    "DrainBackend",
+    "PrewarmCache",
+    "DumpConfig",
+    "AsyncGetCoverage",
+    "GetJobStatus",
+    "FetchJobResult",
+    "Batch",
+    "Other"
+};
+
+static const char *sp_stats_phase_names[] =
+{
+    "props",
+    "queue",
+    "serialize",
+    "connect",
+    "ttfb",
+    "headers",
+    "xmlBuild",
+    "rewrite",
+    "mtomLoad",
+    "total"
+};
+
+static const char *sp_stats_backend_names[] = { "Exec", "URL" };
+
+// Upper bounds (seconds) of the buckets exported to Prometheus.
+static const double sp_stats_prom_le[] =
+{
+    0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0, 300.0
+};
+#define SP_STATS_PROM_NLE 12
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+static int sp_hist_index(uint64_t v)
+{
+    if (v < 2*SP_HIST_SUB_COUNT) return (int) v;
+
+    int mag = 63 - __builtin_clzll(v);
+    if (mag > SP_HIST_MAX_MAG) return SP_HIST_NBUCKETS-1;
+
+    int shift = mag - SP_HIST_SUB_BITS;
+    return (int) ((mag - SP_HIST_SUB_BITS) * SP_HIST_SUB_COUNT + (v >> shift));
+}
+
+//-----------------------------------------------------------------------------
+// Highest value which falls into bucket idx.
+static uint64_t sp_hist_value(int idx)
+{
+    if (idx < 2*SP_HIST_SUB_COUNT) return (uint64_t) idx;
+
+    int      mag = idx / SP_HIST_SUB_COUNT + SP_HIST_SUB_BITS - 1;
+    uint64_t sub = idx % SP_HIST_SUB_COUNT + SP_HIST_SUB_COUNT;
+    int    shift = mag - SP_HIST_SUB_BITS;
+    return ((sub + 1) << shift) - 1;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_hist_record(sp_hist *h, uint64_t v)
+{
+    __sync_fetch_and_add(&h->buckets[sp_hist_index(v)], 1);
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum,   v);
+
+    uint64_t old_max = h->max;
+    while (v > old_max)
+    {
+    	uint64_t prev = __sync_val_compare_and_swap(&h->max, old_max, v);
+    	if (prev == old_max) break;
+    	old_max = prev;
+    }
+}
+
+//-----------------------------------------------------------------------------
+static uint64_t sp_hist_quantile(const sp_hist *h, uint64_t count, double q)
+{
+    uint64_t target = (uint64_t) (q * (double) count + 0.5);
+    uint64_t seen   = 0;
+    int i;
+
+    if (target < 1) target = 1;
+    for (i = 0; i < SP_HIST_NBUCKETS; i++)
+    {
+    	seen += h->buckets[i];
+    	if (seen >= target)
+    	{
+    		uint64_t v = sp_hist_value(i);
+    		return (v > h->max) ? h->max : v;
+    	}
+    }
+    return h->max;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_add_attr_u64(
+    const axutil_env_t *env,
+    axiom_element_t    *el,
+    axiom_node_t       *node,
+    const axis2_char_t *name,
+    uint64_t            val)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long) val);
+    axiom_attribute_t *attr = axiom_attribute_create(env, name, buf, NULL);
+    axiom_element_add_attribute(el, env, attr, node);
+}
+
+//-----------------------------------------------------------------------------
+static axiom_node_t *sp_add_stats_el(
+    const axutil_env_t *env,
+    axiom_node_t       *parent,
+    axiom_namespace_t  *ns,
+    const axis2_char_t *el_name,
+    const axis2_char_t *name_attr,
+    axiom_element_t   **el)
+{
+    axiom_node_t *node = NULL;
+    *el = axiom_element_create(env, parent, el_name, ns, &node);
+    if (name_attr)
+    {
+    	axiom_attribute_t *attr =
+    			axiom_attribute_create(env, "name", name_attr, NULL);
+    	axiom_element_add_attribute(*el, env, attr, node);
+    }
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+// Find (or register) the slot of the named cache.
+static sp_cache_stats *sp_stats_cache_slot(const char *cache_name)
+{
+    int i;
+    for (i = 0; i < SP_STATS_MAX_CACHES; i++)
+    {
+    	sp_cache_stats *cs = &sp_stats->caches[i];
+    	if ('\0' == cs->name[0]) break;
+    	if (0 == strncmp(cs->name, cache_name, SP_STATS_CACHE_NAME_LEN)) return cs;
+    }
+
+    // Not found: register it.  A process that died holding the lock
+    //  leaves at worst a name half written.
+    sp_cache_stats *ret = NULL;
+    if (EOWNERDEAD == pthread_mutex_lock(&sp_stats->cache_lock))
+    {
+    	pthread_mutex_consistent(&sp_stats->cache_lock);
+    }
+    for (i = 0; i < SP_STATS_MAX_CACHES; i++)
+    {
+    	sp_cache_stats *cs = &sp_stats->caches[i];
+    	if ('\0' == cs->name[0])
+    	{
+    		strncpy(cs->name, cache_name, SP_STATS_CACHE_NAME_LEN-1);
+    		ret = cs;
+    		break;
+    	}
+    	if (0 == strncmp(cs->name, cache_name, SP_STATS_CACHE_NAME_LEN))
+    	{
+    		ret = cs;
+    		break;
+    	}
+    }
+    pthread_mutex_unlock(&sp_stats->cache_lock);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+/** Set up the lock of the cache names, see sp_stats_init().
+ * @param arg the sp_stats_struct.
+ */
+static void sp_stats_setup_once(void *arg)
+{
+    struct sp_stats_struct *st = arg;
+    pthread_mutexattr_t     ma;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&st->cache_lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+}
+
+//-----------------------------------------------------------------------------
+// splitmix64 finaliser.
+static uint64_t sp_stats_mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+//-----------------------------------------------------------------------------
+/** Make up a request id which is unique across the processes and threads
+ * of this host, and very likely across hosts.
+ * @param buf of SP_REQ_ID_LEN
+ */
+static void sp_stats_new_req_id(char *buf)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t x = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    x ^= sp_stats_mix64(((uint64_t) getpid() << 32) ^
+                        (uint64_t) (uintptr_t) pthread_self());
+    x += (uint64_t) __sync_add_and_fetch(&sp_req_seq, 1) * 0x9e3779b97f4a7c15ULL;
+
+    snprintf(buf, SP_REQ_ID_LEN, "%016llx",
+             (unsigned long long) sp_stats_mix64(x));
+}
+
+//-----------------------------------------------------------------------------
+/** Log a request which took longer than its slow_ms threshold.
+ * @param rs
+ * @param total_usec
+ * @param failed
+ */
+static void sp_stats_log_slow(
+    const sp_req_stats *rs,
+    const uint64_t      total_usec,
+    const int           failed)
+{
+    char phases[SP_PH_NPHASES * 32];
+    int  len = 0;
+    for (int ph = 0; ph < SP_PH_TOTAL; ph++)
+    {
+    	len += snprintf(phases + len, sizeof(phases) - len, "%s%s_ms=%.1f",
+    			0 == ph ? "" : " ",
+    			sp_stats_phase_name(ph), rs->phase_usecs[ph] / 1000.0);
+    }
+
+    // Keep the response headers on one line.
+    char head[SP_SLOW_HEAD_LEN * 2 + 1];
+    int  hlen = 0;
+    for (int i = 0; i < rs->resp_head_len; i++)
+    {
+    	unsigned char c = rs->resp_head[i];
+    	if      ('\r' == c) continue;
+    	else if ('\n' == c) { head[hlen++] = '\\'; head[hlen++] = 'n'; }
+    	else if ('"'  == c) head[hlen++] = '\'';
+    	else if (c < ' ' || c > '~') head[hlen++] = '.';
+    	else head[hlen++] = c;
+    }
+    head[hlen] = '\0';
+
+    SP_LOG_KV(SP_LOG_LEVEL_WARNING, "slow request",
+    		"total_ms=%.1f threshold_ms=%d failed=%d %s"
+    		" bytes_out=%llu bytes_in=%llu req_hash=%016llx resp_head=\"%s\"",
+    		total_usec / 1000.0, rs->slow_ms, failed ? 1 : 0, phases,
+    		(unsigned long long) rs->bytes_out,
+    		(unsigned long long) rs->bytes_in,
+    		(unsigned long long) rs->req_hash,
+    		head);
+}
+
+// =========================  public functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Map a shared memory segment of this service, creating it (zero filled)
+ * if necessary.  The name is derived from 'tag', the location of the
+ * service library and the size, so a rebuilt service never maps a stale
+ * layout and two services deployed in one Apache do not share segments.
+ * @param env
+ * @param tag short name of the segment's purpose.
+ * @param size
+ * @return the mapped segment, or NULL on failure.
+ */
+void *sp_map_shared(
+    const axutil_env_t *env,
+    const char         *tag,
+    const size_t        size)
+{
+    Dl_info dli;
+    const char *svc_path = "soap_proxy";
+    if (dladdr((void *) &sp_map_shared, &dli) && dli.dli_fname)
+    {
+    	svc_path = dli.dli_fname;
+    }
+
+    // FNV-1a of the service path
+    uint32_t h = 2166136261U;
+    const unsigned char *c;
+    for (c = (const unsigned char *) svc_path; *c; c++)
+    {
+    	h = (h ^ *c) * 16777619U;
+    }
+
+    char shm_name[64];
+    snprintf(shm_name, sizeof(shm_name), "/soap_proxy_%s_%08x_%lx",
+    		tag, h, (unsigned long) size);
+
+    int fd = shm_open(shm_name, O_RDWR|O_CREAT, 0600);
+    if (fd < 0)
+    {
+    	rp_log_error(env, "(%s:%d) shm_open('%s') failed, "
+    			"using process memory.\n", __FILE__, __LINE__, shm_name);
+    	return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+    	(st.st_size < (off_t) size && ftruncate(fd, size) != 0))
+    {
+    	rp_log_error(env, "(%s:%d) cannot size '%s', "
+    			"using process memory.\n", __FILE__, __LINE__, shm_name);
+    	close(fd);
+    	return NULL;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mem)
+    {
+    	rp_log_error(env, "(%s:%d) mmap of '%s' failed, "
+    			"using process memory.\n", __FILE__, __LINE__, shm_name);
+    	return NULL;
+    }
+
+    return mem;
+}
+
+//-----------------------------------------------------------------------------
+/** Set up a shared segment once, e.g. its process-shared mutex, by
+ *  whichever process comes first, the others waiting until it is done.
+ *  Should that process die half way, the next one to look takes over.
+ * @param state in the segment: 0 new, minus the pid of the process
+ *  setting it up, SP_SHARED_READY when done.
+ * @param setup
+ * @param arg passed to setup.
+ */
+void sp_setup_shared(
+    volatile int *state,
+    void        (*setup)(void *arg),
+    void         *arg)
+{
+    int s;
+
+    while (SP_SHARED_READY != (s = *state))
+    {
+    	if (0 == s && __sync_bool_compare_and_swap(state, 0, - (int) getpid()))
+    	{
+    		setup(arg);
+    		__sync_synchronize();
+    		*state = SP_SHARED_READY;
+    		return;
+    	}
+
+    	// Died setting it up, or left over from an older layout.
+    	if (s > 0 || (s < 0 && kill(-s, 0) < 0 && ESRCH == errno))
+    	{
+    		__sync_bool_compare_and_swap(state, s, 0);
+    		continue;
+    	}
+    	sched_yield();
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Called once per process from rpSvc_init.
+ * @param env
+ */
+void sp_stats_init(const axutil_env_t *env)
+{
+    if (sp_stats == &sp_stats_local)
+    {
+    	struct sp_stats_struct *shared =
+    			sp_map_shared(env, "stats", sizeof(struct sp_stats_struct));
+    	if (shared) sp_stats = shared;
+    }
+    if (SP_SHARED_READY != sp_stats->init_state)
+    {
+    	sp_setup_shared(&sp_stats->init_state, sp_stats_setup_once, sp_stats);
+    }
+
+    __sync_bool_compare_and_swap(&sp_stats->start_time, 0, time(NULL));
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return monotonic time stamp in nanoseconds.
+ */
+sp_stamp_t sp_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sp_stamp_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+/** Map an operation name to one of sp_stats_ops.
+ * @param op_name
+ * @return operation id, SP_OP_OTHER if not recognised.
+ */
+int sp_stats_op_id(const axis2_char_t *op_name)
+{
+    int i;
+    if (NULL == op_name) return SP_OP_OTHER;
+    for (i = 0; i < SP_OP_OTHER; i++)
+    {
+    	if (0 == strcmp(op_name, sp_stats_op_names[i])) return i;
+    }
+    return SP_OP_OTHER;
+}
+
+//-----------------------------------------------------------------------------
+const char *sp_stats_op_name(const int op)
+{
+    return (op >= 0 && op < SP_OP_NOPS) ? sp_stats_op_names[op] : "Other";
+}
+
+//-----------------------------------------------------------------------------
+const char *sp_stats_phase_name(const int phase)
+{
+    return (phase >= 0 && phase < SP_PH_NPHASES) ?
+    		sp_stats_phase_names[phase] : "unknown";
+}
+
+//-----------------------------------------------------------------------------
+/** Start timing a request, and make rs the current request of this thread.
+ * @param rs
+ * @param t_start time stamp taken on entry to rpSvc_invoke.
+ */
+void sp_stats_begin(sp_req_stats *rs, const sp_stamp_t t_start)
+{
+    rs->op        = SP_OP_OTHER;
+    rs->backend   = SP_BE_EXEC;
+    rs->t_start   = t_start;
+    rs->t_sent    = 0;
+    rs->bytes_in  = 0;
+    rs->bytes_out = 0;
+    rs->est_node  = NULL;
+    rs->est_bytes = 0;
+    rs->slow_ms   = 0;
+    rs->req_hash  = 0;
+    rs->resp_head_len = 0;
+    memset(rs->phase_usecs, 0, sizeof(rs->phase_usecs));
+    sp_stats_new_req_id(rs->req_id);
+    sp_curr_rs    = rs;
+
+    __sync_fetch_and_add(&sp_stats->in_flight, 1);
+}
+
+//-----------------------------------------------------------------------------
+/** Finish timing a request: records the total time, the byte counts and
+ *  if the request failed the error code found in env->error.
+ * @param env
+ * @param rs
+ * @param failed non-zero if no response node is returned.
+ */
+void sp_stats_end(
+    const axutil_env_t *env,
+    sp_req_stats       *rs,
+    const int           failed)
+{
+    sp_op_stats *os = &sp_stats->ops[rs->op][rs->backend];
+
+    sp_stats_phase(SP_PH_TOTAL, rs->t_start);
+
+    const uint64_t total_usec = rs->phase_usecs[SP_PH_TOTAL];
+    if (rs->slow_ms > 0 && total_usec >= (uint64_t) rs->slow_ms * 1000)
+    {
+    	sp_stats_log_slow(rs, total_usec, failed);
+    }
+
+    __sync_fetch_and_sub(&sp_stats->in_flight, 1);
+    __sync_fetch_and_add(&os->requests,  1);
+    __sync_fetch_and_add(&os->bytes_in,  rs->bytes_in);
+    __sync_fetch_and_add(&os->bytes_out, rs->bytes_out);
+
+    if (failed)
+    {
+    	__sync_fetch_and_add(&os->faults, 1);
+
+    	int code = env->error ? env->error->error_number : 0;
+    	int slot = code - SP_USER_ERR_NO_INPUT;
+    	if (slot < 0 || slot >= SP_ERR_NCODES) slot = SP_ERR_NCODES;
+    	__sync_fetch_and_add(&sp_stats->faults[slot], 1);
+    }
+
+    sp_curr_rs = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the request being timed in this thread, or NULL.
+ */
+sp_req_stats *sp_stats_current(void)
+{
+    return sp_curr_rs;
+}
+
+//-----------------------------------------------------------------------------
+/** Adopt rs as the current request of this thread, e.g. in a helper thread
+ * working on behalf of a request.  Pass NULL to detach.
+ * @param rs
+ */
+void sp_stats_set_current(sp_req_stats *rs)
+{
+    sp_curr_rs = rs;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the id of the current request of this thread, "" if none.
+ */
+const char *sp_stats_req_id(void)
+{
+    return sp_curr_rs ? sp_curr_rs->req_id : "";
+}
+
+//-----------------------------------------------------------------------------
+/** Record the time elapsed since t0 against 'phase' of the current request.
+ * Does nothing if no request is being timed in this thread.
+ * @param phase one of sp_stats_phases
+ * @param t0 time stamp from sp_stats_now() taken at the start of the phase.
+ */
+void sp_stats_phase(const int phase, const sp_stamp_t t0)
+{
+    sp_req_stats *rs = sp_curr_rs;
+    if (NULL == rs || phase < 0 || phase >= SP_PH_NPHASES) return;
+
+    sp_stamp_t now = sp_stats_now();
+    uint64_t usec  = (now > t0) ? (now - t0) / 1000 : 0;
+    rs->phase_usecs[phase] += usec;
+    sp_hist_record(&sp_stats->ops[rs->op][rs->backend].phases[phase], usec);
+}
+
+//-----------------------------------------------------------------------------
+/** Note that the request has been completely sent to the backend.
+ */
+void sp_stats_mark_sent(void)
+{
+    if (sp_curr_rs) sp_curr_rs->t_sent = sp_stats_now();
+}
+
+//-----------------------------------------------------------------------------
+/** Note the arrival of the first part of the response.  Only the first call
+ * after sp_stats_mark_sent() records anything.
+ */
+void sp_stats_first_byte(void)
+{
+    sp_req_stats *rs = sp_curr_rs;
+    if (rs && rs->t_sent)
+    {
+    	sp_stats_phase(SP_PH_TTFB, rs->t_sent);
+    	rs->t_sent = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void sp_stats_add_bytes_in(const uint64_t n)
+{
+    if (sp_curr_rs) sp_curr_rs->bytes_in += n;
+}
+
+//-----------------------------------------------------------------------------
+void sp_stats_add_bytes_out(const uint64_t n)
+{
+    if (sp_curr_rs) sp_curr_rs->bytes_out += n;
+}
+
+//-----------------------------------------------------------------------------
+/** Note the request sent to the backend for the slow request log.
+ *  Only hashed if the slow request log is on.
+ * @param req
+ * @param len
+ */
+void sp_stats_note_request(const char *req, const size_t len)
+{
+    sp_req_stats *rs = sp_curr_rs;
+    if (NULL == rs || rs->slow_ms <= 0) return;
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+    	h ^= (unsigned char) req[i];
+    	h *= 0x100000001b3ULL;
+    }
+    rs->req_hash = h;
+}
+
+//-----------------------------------------------------------------------------
+/** Keep the first bytes of the response for the slow request log.
+ *  Only the first call per request has any effect.
+ * @param buf
+ * @param len
+ */
+void sp_stats_note_response(const char *buf, const size_t len)
+{
+    sp_req_stats *rs = sp_curr_rs;
+    if (NULL == rs || rs->slow_ms <= 0 || rs->resp_head_len > 0) return;
+
+    rs->resp_head_len = len < SP_SLOW_HEAD_LEN ? (int) len : SP_SLOW_HEAD_LEN;
+    memcpy(rs->resp_head, buf, rs->resp_head_len);
+}
+
+//-----------------------------------------------------------------------------
+/** Count a fork/exec of the mapserver executable.
+ */
+void sp_stats_count_spawn(void)
+{
+    __sync_fetch_and_add(&sp_stats->spawns, 1);
+}
+
+//-----------------------------------------------------------------------------
+/** Count a connection attempt to the backend.
+ * @param ok non-zero if the connection was established.
+ */
+void sp_stats_count_connect(const int ok)
+{
+    __sync_fetch_and_add(ok ? &sp_stats->connects : &sp_stats->connect_errors, 1);
+}
+
+//-----------------------------------------------------------------------------
+/** Count a lookup in one of the caches.  Caches are identified by name,
+ *  up to SP_STATS_MAX_CACHES different names are kept.
+ * @param cache_name
+ * @param hit non-zero for a hit, zero for a miss.
+ */
+void sp_stats_cache(const char *cache_name, const int hit)
+{
+    sp_cache_stats *cs = sp_stats_cache_slot(cache_name);
+    if (cs) __sync_fetch_and_add(hit ? &cs->hits : &cs->misses, 1);
+}
+
+//-----------------------------------------------------------------------------
+/** Switch drain mode of the backend on or off, for all processes.
+ * @param on
+ */
+void sp_stats_set_drain(const int on)
+{
+    if (on)
+    {
+    	// Keep the original time if already draining.
+    	__sync_bool_compare_and_swap(&sp_stats->drain_since, 0, time(NULL));
+    }
+    else
+    {
+    	sp_stats->drain_since = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the time drain mode was switched on, 0 if it is off.
+ */
+time_t sp_stats_drain_since(void)
+{
+    return sp_stats->drain_since;
+}
+
+//-----------------------------------------------------------------------------
+/** Note a PurgeCache, for all processes.
+ */
+void sp_stats_set_purged(void)
+{
+    sp_stats->purged = time(NULL);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return the time of the last PurgeCache, 0 if none.  Anything a process
+ *  cached at or before then is to be dropped.
+ */
+time_t sp_stats_purged(void)
+{
+    return sp_stats->purged;
+}
+
+//-----------------------------------------------------------------------------
+/** Build the response of the GetPoolStatus and DrainBackend operations:
+ * the backend and the state of the connections to it, e.g.:
+ *
+ *  <sopr:PoolStatus mode="URL" address="http://127.0.0.1:8080/ows"
+ *                   draining="false" inFlight="3" connects="1200"
+ *                   connectErrors="2" spawns="0" slots="8">
+ *    <sopr:Lane name="meta" inUse="1" queued="0" .../>
+ *    ...
+ *  </sopr:PoolStatus>
+ *
+ * drainingSince (seconds since the epoch) is added in drain mode.
+ * slots is BackendSlots, and the Lane elements show the state of the
+ * backend scheduler, see sp_sched_add_status().
+ * There is no pool of persistent connections: every backend request
+ * opens a new socket or executes mapserv, so the counts of these stand
+ * for the pool state.
+ *
+ * @param env
+ * @param props
+ * @return the response node.
+ */
+axiom_node_t *
+rp_getPoolStatus(
+    const axutil_env_t *env,
+    const sp_props     *props)
+{
+    axiom_node_t    *return_node = NULL;
+    axiom_element_t *el          = NULL;
+    const int        url_mode    = rp_getUrlMode(env, props);
+    const time_t     drain_since = sp_stats->drain_since;
+
+    axiom_namespace_t *ns =
+    		axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    el = axiom_element_create(env, NULL, "PoolStatus", ns, &return_node);
+
+    axiom_attribute_t *attr = axiom_attribute_create(env, "mode",
+    		sp_stats_backend_names[url_mode ? SP_BE_URL : SP_BE_EXEC], NULL);
+    axiom_element_add_attribute(el, env, attr, return_node);
+    attr = axiom_attribute_create(env, "address",
+    		url_mode ? rp_getBackendURL(env, props) :
+    		           rp_getMapserverExec(env, props), NULL);
+    axiom_element_add_attribute(el, env, attr, return_node);
+    attr = axiom_attribute_create(env, "draining",
+    		drain_since ? "true" : "false", NULL);
+    axiom_element_add_attribute(el, env, attr, return_node);
+    if (drain_since)
+    {
+    	sp_add_attr_u64(env, el, return_node, "drainingSince",
+    			(uint64_t) drain_since);
+    }
+
+    int64_t in_flight = sp_stats->in_flight;
+    sp_add_attr_u64(env, el, return_node, "inFlight",
+    		in_flight > 0 ? (uint64_t) in_flight : 0);
+    sp_add_attr_u64(env, el, return_node, "connects",      sp_stats->connects);
+    sp_add_attr_u64(env, el, return_node, "connectErrors", sp_stats->connect_errors);
+    sp_add_attr_u64(env, el, return_node, "spawns",        sp_stats->spawns);
+    sp_add_attr_u64(env, el, return_node, "slots",
+    		(uint64_t) rp_getBackendSlots(env, props));
+
+    sp_sched_add_status(env, return_node, ns);
+
+    return return_node;
+}
+
+//-----------------------------------------------------------------------------
+/** Build the response of the GetProxyStats operation, e.g.:
+ *
+ *  <sopr:ProxyStats uptime="3600">
+ *    <sopr:Operation name="GetCoverage" backend="URL" requests="12"
+ *                    faults="0" bytesIn="1234567" bytesOut="5678">
+ *      <sopr:Phase name="connect" count="12" mean="310" max="1020"
+ *                  p50="287" p90="415" p99="1023" p999="1023"/>
+ *      ...
+ *    </sopr:Operation>
+ *    <sopr:Fault name="SP_USER_ERR_BAD_OP" count="1"/>
+ *  </sopr:ProxyStats>
+ *
+ * All times are in microseconds.  Operations and phases which have
+ * no samples are omitted.
+ *
+ * @param env
+ * @param props
+ * @return the response node.
+ */
+axiom_node_t *
+rp_getProxyStats(
+    const axutil_env_t *env,
+    const sp_props     *props)
+{
+    axiom_node_t    *return_node = NULL;
+    axiom_element_t *el          = NULL;
+    int op, be, ph, q;
+
+    axiom_namespace_t *ns =
+    		axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    el = axiom_element_create(env, NULL, "ProxyStats", ns, &return_node);
+    sp_add_attr_u64(env, el, return_node, "uptime",
+    		(uint64_t) (time(NULL) - sp_stats->start_time));
+
+    for (op = 0; op < SP_OP_NOPS; op++)
+    {
+    	for (be = 0; be < SP_BE_NMODES; be++)
+    	{
+    		const sp_op_stats *os = &sp_stats->ops[op][be];
+    		if (0 == os->requests) continue;
+
+    		axiom_element_t *op_el   = NULL;
+    		axiom_node_t    *op_node = sp_add_stats_el(env, return_node, ns,
+    				"Operation", sp_stats_op_names[op], &op_el);
+    		axiom_attribute_t *attr = axiom_attribute_create(
+    				env, "backend", sp_stats_backend_names[be], NULL);
+    		axiom_element_add_attribute(op_el, env, attr, op_node);
+    		sp_add_attr_u64(env, op_el, op_node, "requests", os->requests);
+    		sp_add_attr_u64(env, op_el, op_node, "faults",   os->faults);
+    		sp_add_attr_u64(env, op_el, op_node, "bytesIn",  os->bytes_in);
+    		sp_add_attr_u64(env, op_el, op_node, "bytesOut", os->bytes_out);
+
+    		for (ph = 0; ph < SP_PH_NPHASES; ph++)
+    		{
+    			const sp_hist *h = &os->phases[ph];
+    			uint64_t count   = h->count;
+    			if (0 == count) continue;
+
+    			axiom_element_t *ph_el   = NULL;
+    			axiom_node_t    *ph_node = sp_add_stats_el(env, op_node, ns,
+    					"Phase", sp_stats_phase_names[ph], &ph_el);
+    			sp_add_attr_u64(env, ph_el, ph_node, "count", count);
+    			sp_add_attr_u64(env, ph_el, ph_node, "mean",  h->sum / count);
+    			sp_add_attr_u64(env, ph_el, ph_node, "max",   h->max);
+    			for (q = 0; q < SP_STATS_NQUANTILES; q++)
+    			{
+    				sp_add_attr_u64(env, ph_el, ph_node,
+    						sp_stats_quantile_names[q],
+    						sp_hist_quantile(h, count, sp_stats_quantiles[q]));
+    			}
+    		}
+    	}
+    }
+
+    int i;
+    for (i = 0; i <= SP_ERR_NCODES; i++)
+    {
+    	if (0 == sp_stats->faults[i]) continue;
+
+    	axiom_element_t *f_el   = NULL;
+    	axiom_node_t    *f_node = sp_add_stats_el(env, return_node, ns,
+    			"Fault", sp_error_code_name(SP_USER_ERR_NO_INPUT + i), &f_el);
+    	sp_add_attr_u64(env, f_el, f_node, "count", sp_stats->faults[i]);
+    }
+
+    return return_node;
+}
+
+//-----------------------------------------------------------------------------
+// Print the histogram of one phase in the Prometheus format.
+static void sp_prom_histogram(
+    FILE          *fp,
+    const char    *labels,
+    const sp_hist *h)
+{
+    uint64_t count = h->count;
+    uint64_t cumul = 0;
+    int i, b = 0;
+
+    for (i = 0; i < SP_STATS_PROM_NLE; i++)
+    {
+    	// Add up all fine-grained buckets lying wholly below the bound.
+    	uint64_t le_us = (uint64_t) (sp_stats_prom_le[i] * 1e6);
+    	while (b < SP_HIST_NBUCKETS && sp_hist_value(b) <= le_us)
+    	{
+    		cumul += h->buckets[b++];
+    	}
+    	fprintf(fp, "soap_proxy_phase_duration_seconds_bucket{%s,le=\"%g\"} "
+    			"%llu\n", labels, sp_stats_prom_le[i], (unsigned long long) cumul);
+    }
+    fprintf(fp, "soap_proxy_phase_duration_seconds_bucket{%s,le=\"+Inf\"} "
+    		"%llu\n", labels, (unsigned long long) count);
+    fprintf(fp, "soap_proxy_phase_duration_seconds_sum{%s} %.6f\n",
+    		labels, (double) h->sum / 1e6);
+    fprintf(fp, "soap_proxy_phase_duration_seconds_count{%s} %llu\n",
+    		labels, (unsigned long long) count);
+}
+
+//-----------------------------------------------------------------------------
+/** Build the response of the GetProxyMetrics operation: the statistics of
+ * all processes hosting this service, as the text of a single element
+ * in the Prometheus text exposition format (version 0.0.4).
+ *
+ * @param env
+ * @param props
+ * @return the response node.
+ */
+axiom_node_t *
+rp_getProxyMetrics(
+    const axutil_env_t *env,
+    const sp_props     *props)
+{
+    axiom_node_t *return_node = NULL;
+    char         *text        = NULL;
+    size_t        text_len    = 0;
+    int op, be, ph, i;
+
+    FILE *fp = open_memstream(&text, &text_len);
+    if (NULL == fp)
+    {
+    	SP_ERROR(env, SP_SYS_ERR_INTERNAL);
+    	rp_log_error(env, "(%s:%d) open_memstream failed.\n", __FILE__, __LINE__);
+    	return NULL;
+    }
+
+    fprintf(fp,
+    		"# HELP soap_proxy_uptime_seconds Time since the statistics were started.\n"
+    		"# TYPE soap_proxy_uptime_seconds gauge\n"
+    		"soap_proxy_uptime_seconds %ld\n",
+    		(long) (time(NULL) - sp_stats->start_time));
+    fprintf(fp,
+    		"# HELP soap_proxy_requests_in_flight Requests currently being processed.\n"
+    		"# TYPE soap_proxy_requests_in_flight gauge\n"
+    		"soap_proxy_requests_in_flight %lld\n",
+    		(long long) sp_stats->in_flight);
+    fprintf(fp,
+    		"# HELP soap_proxy_backend_draining 1 if the backend is in drain mode.\n"
+    		"# TYPE soap_proxy_backend_draining gauge\n"
+    		"soap_proxy_backend_draining %d\n",
+    		sp_stats->drain_since ? 1 : 0);
+    fprintf(fp,
+    		"# HELP soap_proxy_backend_spawns_total Executions of mapserv.\n"
+    		"# TYPE soap_proxy_backend_spawns_total counter\n"
+    		"soap_proxy_backend_spawns_total %llu\n"
+    		"# HELP soap_proxy_backend_connects_total Connections to the BackendURL.\n"
+    		"# TYPE soap_proxy_backend_connects_total counter\n"
+    		"soap_proxy_backend_connects_total{result=\"ok\"} %llu\n"
+    		"soap_proxy_backend_connects_total{result=\"error\"} %llu\n",
+    		(unsigned long long) sp_stats->spawns,
+    		(unsigned long long) sp_stats->connects,
+    		(unsigned long long) sp_stats->connect_errors);
+
+    sp_sched_metrics(fp);
+    sp_client_metrics(fp);
+
+    fprintf(fp,
+    		"# HELP soap_proxy_requests_total Requests handled.\n"
+    		"# TYPE soap_proxy_requests_total counter\n");
+    for (op = 0; op < SP_OP_NOPS; op++)
+    	for (be = 0; be < SP_BE_NMODES; be++)
+    	{
+    		if (0 == sp_stats->ops[op][be].requests) continue;
+    		fprintf(fp, "soap_proxy_requests_total{op=\"%s\",backend=\"%s\"} %llu\n",
+    				sp_stats_op_names[op], sp_stats_backend_names[be],
+    				(unsigned long long) sp_stats->ops[op][be].requests);
+    	}
+
+    fprintf(fp,
+    		"# HELP soap_proxy_bytes_total Bytes proxied to and from the backend.\n"
+    		"# TYPE soap_proxy_bytes_total counter\n");
+    for (op = 0; op < SP_OP_NOPS; op++)
+    	for (be = 0; be < SP_BE_NMODES; be++)
+    	{
+    		const sp_op_stats *os = &sp_stats->ops[op][be];
+    		if (0 == os->requests) continue;
+    		fprintf(fp, "soap_proxy_bytes_total{op=\"%s\",backend=\"%s\","
+    				"direction=\"in\"} %llu\n",
+    				sp_stats_op_names[op], sp_stats_backend_names[be],
+    				(unsigned long long) os->bytes_in);
+    		fprintf(fp, "soap_proxy_bytes_total{op=\"%s\",backend=\"%s\","
+    				"direction=\"out\"} %llu\n",
+    				sp_stats_op_names[op], sp_stats_backend_names[be],
+    				(unsigned long long) os->bytes_out);
+    	}
+
+    fprintf(fp,
+    		"# HELP soap_proxy_faults_total Failed requests by error code.\n"
+    		"# TYPE soap_proxy_faults_total counter\n");
+    for (i = 0; i <= SP_ERR_NCODES; i++)
+    {
+    	if (0 == sp_stats->faults[i]) continue;
+    	fprintf(fp, "soap_proxy_faults_total{code=\"%s\"} %llu\n",
+    			sp_error_code_name(SP_USER_ERR_NO_INPUT + i),
+    			(unsigned long long) sp_stats->faults[i]);
+    }
+
+    fprintf(fp,
+    		"# HELP soap_proxy_cache_requests_total Cache lookups.\n"
+    		"# TYPE soap_proxy_cache_requests_total counter\n");
+    for (i = 0; i < SP_STATS_MAX_CACHES && sp_stats->caches[i].name[0]; i++)
+    {
+    	const sp_cache_stats *cs = &sp_stats->caches[i];
+    	fprintf(fp, "soap_proxy_cache_requests_total{cache=\"%s\",result=\"hit\"} %llu\n"
+    			"soap_proxy_cache_requests_total{cache=\"%s\",result=\"miss\"} %llu\n",
+    			cs->name, (unsigned long long) cs->hits,
+    			cs->name, (unsigned long long) cs->misses);
+    }
+    fprintf(fp,
+    		"# HELP soap_proxy_cache_hit_ratio Cache hits / lookups.\n"
+    		"# TYPE soap_proxy_cache_hit_ratio gauge\n");
+    for (i = 0; i < SP_STATS_MAX_CACHES && sp_stats->caches[i].name[0]; i++)
+    {
+    	const sp_cache_stats *cs = &sp_stats->caches[i];
+    	uint64_t lookups = cs->hits + cs->misses;
+    	fprintf(fp, "soap_proxy_cache_hit_ratio{cache=\"%s\"} %.4f\n", cs->name,
+    			lookups ? (double) cs->hits / (double) lookups : 0.0);
+    }
+
+    fprintf(fp,
+    		"# HELP soap_proxy_phase_duration_seconds Time spent per request phase.\n"
+    		"# TYPE soap_proxy_phase_duration_seconds histogram\n");
+    for (op = 0; op < SP_OP_NOPS; op++)
+    	for (be = 0; be < SP_BE_NMODES; be++)
+    		for (ph = 0; ph < SP_PH_NPHASES; ph++)
+    		{
+    			const sp_hist *h = &sp_stats->ops[op][be].phases[ph];
+    			if (0 == h->count) continue;
+
+    			char labels[128];
+    			snprintf(labels, sizeof(labels),
+    					"op=\"%s\",backend=\"%s\",phase=\"%s\"",
+    					sp_stats_op_names[op], sp_stats_backend_names[be],
+    					sp_stats_phase_names[ph]);
+    			sp_prom_histogram(fp, labels, h);
+    		}
+
+    fclose(fp);
+
+    axiom_namespace_t *ns =
+    		axiom_namespace_create (env, SP_WCSPROXY_NAMESPACE_STR, "sopr");
+    axiom_element_t *el =
+    		axiom_element_create(env, NULL, "ProxyMetrics", ns, &return_node);
+    axiom_attribute_t *attr = axiom_attribute_create(
+    		env, "contentType", "text/plain; version=0.0.4", NULL);
+    axiom_element_add_attribute(el, env, attr, return_node);
+    axiom_element_set_text(el, env, text, return_node);
+
+    free(text);
+    return return_node;
+}
@@ -0,0 +1,196 @@
+/*
+ * Soap Proxy - request statistics header
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_svc.c for general comments.
+ *
+ */
+
+/**
+ * @file sp_stats.h
+ *
+ */
+
+#ifndef SPSTATS_H_INCLUDED
+#define SPSTATS_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+
+#include "sp_svc.h"
+#include "sp_props.h"
+
+/**
+ * Operation classes for which statistics are kept.
+ */
+enum sp_stats_ops
+{
+	SP_OP_GETCAPABILITIES = 0,
+	SP_OP_DESCRIBECOVERAGE,
+	SP_OP_DESCRIBEEOCOVERAGESET,
+	SP_OP_GETCOVERAGE,
+	SP_OP_GETMSVERSION,
+	SP_OP_GETPROXYSTATS,
+	SP_OP_GETPROXYMETRICS,
+	SP_OP_PURGECACHE,
+	SP_OP_GETPOOLSTATUS,
+	SP_OP_DRAINBACKEND,
+	SP_OP_PREWARMCACHE,
+	SP_OP_DUMPCONFIG,
+	SP_OP_ASYNCGETCOVERAGE,
+	SP_OP_GETJOBSTATUS,
+	SP_OP_FETCHJOBRESULT,
+	SP_OP_BATCH,
+	SP_OP_OTHER,
+
+	SP_OP_NOPS
+};
+
+/**
+ * Backend modes, see rp_getUrlMode().
+ */
+#define SP_BE_EXEC   0
+#define SP_BE_URL    1
+#define SP_BE_NMODES 2
+
+/**
+ * Request processing phases which are timed.
+ */
+enum sp_stats_phases
+{
+	SP_PH_PROPS = 0,     // rp_load_props
+	SP_PH_QUEUE,         // waiting for a backend slot, see sp_sched.c
+	SP_PH_SERIALIZE,     // axiom_node_to_string of the request
+	SP_PH_CONNECT,       // socket connect, or pipe+fork of mapserv
+	SP_PH_TTFB,          // request sent -> first response headers read
+	SP_PH_HEADERS,       // parsing of the response headers
+	SP_PH_XML_BUILD,     // building the AXIOM tree of an xml response
+	SP_PH_REWRITE,       // rp_inject_soap_cap20, sp_update_lineage etc.
+	SP_PH_MTOM_LOAD,     // loading binary data for an MTOM attachment
+	SP_PH_TOTAL,         // whole of rpSvc_invoke
+
+	SP_PH_NPHASES
+};
+
+/**
+ * Histogram layout: log-linear buckets in the style of HdrHistogram,
+ * values in microseconds.  Values below 2^(SUB_BITS+1) have their own
+ * bucket, above that each power of two is split into 2^SUB_BITS
+ * sub-buckets, giving a relative precision of about 6%.
+ * The largest bucket starts at about 9 hours.
+ */
+// init_state of a shared segment when set up, see sp_setup_shared().
+#define SP_SHARED_READY 2
+
+#define SP_HIST_SUB_BITS  4
+#define SP_HIST_SUB_COUNT (1 << SP_HIST_SUB_BITS)
+#define SP_HIST_MAX_MAG   34
+#define SP_HIST_NBUCKETS  \
+	((SP_HIST_MAX_MAG - SP_HIST_SUB_BITS + 2) * SP_HIST_SUB_COUNT)
+
+typedef uint64_t sp_stamp_t;
+
+#define SP_REQ_ID_LEN     17    // 16 hex digits
+#define SP_SLOW_HEAD_LEN  160   // response bytes kept for the slow log
+
+//
+// Per-request timing state.  One of these lives on the stack of
+// rpSvc_invoke for the duration of a request, and is reachable from
+// anywhere in the same thread via sp_stats_current().
+//
+struct sp_req_stats_struct
+{
+    int        op;
+    int        backend;
+
+    sp_stamp_t t_start;    // rpSvc_invoke entered
+    sp_stamp_t t_sent;     // request fully handed to the backend, 0 if n/a
+
+    uint64_t   bytes_in;   // response bytes read from the backend
+    uint64_t   bytes_out;  // request bytes sent to the backend
+
+    char       req_id[SP_REQ_ID_LEN];
+
+    // Size of a GetCoverage response estimated ahead, see sp_estimate.c.
+    const void *est_node;  // the request estimated
+    uint64_t   est_bytes;  // 0 if not known
+
+    // Slow request log, see sp_stats_end().
+    int        slow_ms;    // threshold, 0 if off
+    uint64_t   req_hash;   // FNV-1a of the request sent to the backend
+    uint64_t   phase_usecs[SP_PH_NPHASES];
+    int        resp_head_len;
+    char       resp_head[SP_SLOW_HEAD_LEN];
+};
+
+typedef struct sp_req_stats_struct sp_req_stats;
+
+void          sp_stats_init     (const axutil_env_t *env);
+void         *sp_map_shared     (const axutil_env_t *env,
+                                 const char *tag,
+                                 const size_t size);
+void          sp_setup_shared   (volatile int *state,
+                                 void (*setup)(void *arg),
+                                 void *arg);
+sp_stamp_t    sp_stats_now      (void);
+int           sp_stats_op_id    (const axis2_char_t *op_name);
+const char   *sp_stats_op_name  (const int op);
+const char   *sp_stats_phase_name(const int phase);
+
+void          sp_stats_begin    (sp_req_stats *rs, const sp_stamp_t t_start);
+void          sp_stats_end      (const axutil_env_t *env,
+                                 sp_req_stats *rs,
+                                 const int failed);
+sp_req_stats *sp_stats_current  (void);
+void          sp_stats_set_current(sp_req_stats *rs);
+const char   *sp_stats_req_id   (void);
+
+void          sp_stats_phase    (const int phase, const sp_stamp_t t0);
+void          sp_stats_mark_sent(void);
+void          sp_stats_first_byte(void);
+void          sp_stats_add_bytes_in (const uint64_t n);
+void          sp_stats_add_bytes_out(const uint64_t n);
+void          sp_stats_note_request (const char *req, const size_t len);
+void          sp_stats_note_response(const char *buf, const size_t len);
+void          sp_stats_count_spawn(void);
+void          sp_stats_count_connect(const int ok);
+void          sp_stats_cache    (const char *cache_name, const int hit);
+void          sp_stats_set_drain(const int on);
+time_t        sp_stats_drain_since(void);
+void          sp_stats_set_purged(void);
+time_t        sp_stats_purged(void);
+
+axiom_node_t *rp_getProxyStats(
+    const axutil_env_t *env,
+    const sp_props     *props);
+
+axiom_node_t *rp_getProxyMetrics(
+    const axutil_env_t *env,
+    const sp_props     *props);
+
+axiom_node_t *rp_getPoolStatus(
+    const axutil_env_t *env,
+    const sp_props     *props);
+
+#endif
@@ -68,6 +68,10 @@
 #include "sp_svc.h"
 #include "soap_proxy.h"
 #include "sp_props.h"
+#include "sp_stats.h"
+#include "sp_log.h"
+#include "sp_sched.h"
+#include "sp_client.h"
 #include <axis2_svc_skeleton.h>
 
 void rp_init_errors();
@@ -119,6 +123,10 @@ rpSvc_init(
     svc_skeleton->func_array = axutil_array_list_create(env, 0);
     axutil_array_list_add(svc_skeleton->func_array, env, "Post-To-Soap");
 
+    sp_stats_init(env);
+    sp_sched_init(env);
+    sp_client_init(env);
+
     return AXIS2_SUCCESS;
 }
 
@@ -134,16 +142,27 @@ rpSvc_invoke(
         axis2_msg_ctx_t * msg_ctx)
 {
     axiom_node_t *rt_node = NULL;
+    sp_req_stats  rs;
+
+    sp_stats_begin(&rs, sp_stats_now());
 
     rp_init_errors();
     sp_props props;
     rp_init_props(&props);
-    if (rp_load_props(&props, env, msg_ctx))
+    int props_failed = rp_load_props(&props, env, msg_ctx);
+
+    // The logging parameters are loaded even if others fail.
+    sp_log_configure(env, &props);
+
+    if (props_failed)
     {
         SP_ERROR(env, SP_SYS_ERR_PROPSLOAD);
         rp_log_error(env, "*** S2P: Failed to load properties.\n");
+        sp_stats_end(env, &rs, 1);
         return NULL;
     }
+    rs.backend = rp_getUrlMode(env, &props) ? SP_BE_URL : SP_BE_EXEC;
+    rs.slow_ms = rp_getSlowRequestMs(env, &props);
 
     if (node)
     {
@@ -165,7 +184,14 @@ rpSvc_invoke(
             if (el)
             {
                 axis2_char_t *op_name = axiom_element_get_localname(el, env);
-                rt_node = rp_dispatch_op(env, &props, op_name, node, protocol);
+                rs.op = sp_stats_op_id(op_name);
+                sp_stats_phase(SP_PH_PROPS, rs.t_start);
+                if (0 == sp_client_admit(env, &props, op_name))
+                {
+                    rt_node = rp_dispatch_op(env, &props, op_name, node, protocol);
+                    sp_client_end(rs.bytes_in);
+                }
+                sp_stats_end(env, &rs, NULL == rt_node);
                 return rt_node;
             }
         }
@@ -173,12 +199,14 @@ rpSvc_invoke(
         {
             rp_log_error(env, "*** S2P: invalid XML in request\n");
             SP_ERROR(env, AXIS2_ERROR_SVC_SKEL_INVALID_XML_FORMAT_IN_REQUEST);
+            sp_stats_end(env, &rs, 1);
             return NULL;
         }
     }
 
     // else
     SP_ERROR(env, SP_USER_ERR_NO_INPUT);
+    sp_stats_end(env, &rs, 1);
     return NULL;
 
 }
@@ -205,6 +233,8 @@ rpSvc_free(
     axis2_svc_skeleton_t * svc_skeleton,
     const axutil_env_t * env)
 {
+    sp_log_shutdown();
+
     if (svc_skeleton->func_array)
     {
         axutil_array_list_free(svc_skeleton->func_array, env);
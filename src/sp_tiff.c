@@ -0,0 +1,400 @@
+/*
+ * Soap Proxy.
+ *
+ * TIFF reading and writing.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_tiff.c
+ *
+ * Just enough of TIFF to take apart the uncompressed GeoTIFFs mapserver
+ * writes and to write them anew: the classic format, one IFD, strips.
+ * Used to stitch strips, see sp_tile.c, and to compress coverages, see
+ * sp_compress.c.
+ *
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "soap_proxy.h"
+#include "sp_tiff.h"
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** @return the size of one value of a TIFF field type, 0 if unknown.
+ */
+static size_t sp_tiff_type_size(const uint32_t type)
+{
+    static const unsigned char sizes[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+    return type < sizeof(sizes) ? sizes[type] : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the first n values of a DOUBLE tag, NULL if there are fewer.
+ */
+static const unsigned char *sp_tiff_doubles(
+    const sp_tiff  *t,
+    const uint32_t  tag,
+    const size_t    n)
+{
+    const unsigned char *e = sp_tiff_find(t, tag);
+    size_t len = 0;
+    const unsigned char *v = e ? sp_tiff_value(t, e, &len) : NULL;
+
+    return (v && SP_TIFF_DOUBLE == sp_tiff_16(t->be, e + 2) && len >= 8 * n) ?
+    		v : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Order IFD entries by tag, as TIFF requires.
+ */
+static void sp_tiff_sort(sp_tiff_entry *ee, const int n)
+{
+    int i, j;
+    for (i = 1; i < n; i++)
+    {
+    	sp_tiff_entry e = ee[i];
+    	for (j = i; j > 0 && ee[j - 1].tag > e.tag; j--) ee[j] = ee[j - 1];
+    	ee[j] = e;
+    }
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+uint32_t sp_tiff_16(const int be, const unsigned char *p)
+{
+    return be ? (uint32_t) p[0] << 8 | p[1] : (uint32_t) p[1] << 8 | p[0];
+}
+
+//-----------------------------------------------------------------------------
+uint32_t sp_tiff_32(const int be, const unsigned char *p)
+{
+    return be ?
+    	(uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | p[2] << 8 | p[3] :
+    	(uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | p[1] << 8 | p[0];
+}
+
+//-----------------------------------------------------------------------------
+double sp_tiff_double(const int be, const unsigned char *p)
+{
+    const uint64_t u = be ?
+    		(uint64_t) sp_tiff_32(be, p)     << 32 | sp_tiff_32(be, p + 4) :
+    		(uint64_t) sp_tiff_32(be, p + 4) << 32 | sp_tiff_32(be, p);
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+//-----------------------------------------------------------------------------
+void sp_tiff_put16(const int be, unsigned char *p, const uint32_t v)
+{
+    p[be ? 0 : 1] = v >> 8;
+    p[be ? 1 : 0] = v;
+}
+
+//-----------------------------------------------------------------------------
+void sp_tiff_put32(const int be, unsigned char *p, const uint32_t v)
+{
+    sp_tiff_put16(be, p + (be ? 0 : 2), v >> 16);
+    sp_tiff_put16(be, p + (be ? 2 : 0), v);
+}
+
+//-----------------------------------------------------------------------------
+/** @return the IFD entry of tag, NULL if none.
+ */
+const unsigned char *sp_tiff_find(const sp_tiff *t, const uint32_t tag)
+{
+    unsigned i;
+    for (i = 0; i < t->n_entries; i++)
+    {
+    	const unsigned char *e = t->ifd + 12 * i;
+    	if (sp_tiff_16(t->be, e) == tag) return e;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Locate the values of an IFD entry.
+ * @param t
+ * @param e
+ * @param len set to their length in bytes.
+ * @return the values, in the entry itself if they fit, NULL if they lie
+ *  outside the file.
+ */
+const unsigned char *sp_tiff_value(
+    const sp_tiff       *t,
+    const unsigned char *e,
+    size_t              *len)
+{
+    const size_t   size  = sp_tiff_type_size(sp_tiff_16(t->be, e + 2));
+    const uint32_t count = sp_tiff_32(t->be, e + 4);
+
+    if (0 == size || count > t->len / size) return NULL;
+    *len = size * count;
+    if (*len <= 4) return e + 8;
+
+    const uint32_t off = sp_tiff_32(t->be, e + 8);
+    return (off <= t->len && *len <= t->len - off) ? t->p + off : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return value i of a SHORT or LONG tag, dflt if there is no such tag,
+ *  -1 if it is of another type or has fewer values.
+ */
+long long sp_tiff_get(
+    const sp_tiff  *t,
+    const uint32_t  tag,
+    const uint32_t  i,
+    const long long dflt)
+{
+    const unsigned char *e = sp_tiff_find(t, tag);
+    if (NULL == e) return dflt;
+
+    size_t len;
+    const unsigned char *v    = sp_tiff_value(t, e, &len);
+    const uint32_t       type = sp_tiff_16(t->be, e + 2);
+    if (NULL == v) return -1;
+
+    if (SP_TIFF_SHORT == type && ((size_t) i + 1) * 2 <= len)
+    {
+    	return sp_tiff_16(t->be, v + 2 * (size_t) i);
+    }
+    if (SP_TIFF_LONG == type && ((size_t) i + 1) * 4 <= len)
+    {
+    	return sp_tiff_32(t->be, v + 4 * (size_t) i);
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+/** Check that a TIFF is one whose rows can be taken apart: classic,
+ *  uncompressed, in pixel interleaved strips of whole bytes per sample.
+ * @param t set up for the TIFF.
+ * @param p the TIFF file.
+ * @param len
+ * @return NULL if it is, else why not.
+ */
+const char *sp_tiff_open(
+    sp_tiff             *t,
+    const unsigned char *p,
+    const size_t         len)
+{
+    memset(t, 0, sizeof(*t));
+    t->p   = p;
+    t->len = len;
+
+    if (len < 8) return "not a TIFF";
+    if      (0 == memcmp(p, "II", 2)) t->be = 0;
+    else if (0 == memcmp(p, "MM", 2)) t->be = 1;
+    else return "not a TIFF";
+    if (42 != sp_tiff_16(t->be, p + 2)) return "not a classic TIFF";
+
+    const uint32_t ifd = sp_tiff_32(t->be, p + 4);
+    if (ifd > len - 2) return "bad IFD offset";
+    t->n_entries = sp_tiff_16(t->be, p + ifd);
+    t->ifd       = p + ifd + 2;
+    if ((size_t) t->n_entries * 12 > len - ifd - 2) return "bad IFD";
+
+    const long long width  = sp_tiff_get(t, SP_TIFF_WIDTH,       0, -1);
+    const long long height = sp_tiff_get(t, SP_TIFF_HEIGHT,      0, -1);
+    const long long spp    = sp_tiff_get(t, SP_TIFF_SPP,         0,  1);
+    const long long bps    = sp_tiff_get(t, SP_TIFF_BPS,         0,  1);
+    long long       rows   = sp_tiff_get(t, SP_TIFF_ROWS,        0, height);
+    uint32_t        i;
+
+    if (width <= 0 || height <= 0 || rows <= 0) return "bad size";
+    if (1 != sp_tiff_get(t, SP_TIFF_COMPRESSION, 0, 1)) return "compressed";
+    if (spp <= 0) return "bad SamplesPerPixel";
+    if (spp > 1 && 1 != sp_tiff_get(t, SP_TIFF_PLANAR, 0, 1))
+    {
+    	return "not pixel interleaved";
+    }
+    if (bps <= 0 || bps % 8) return "unsupported BitsPerSample";
+    for (i = 1; i < spp; i++)
+    {
+    	if (sp_tiff_get(t, SP_TIFF_BPS, i, bps) != bps) return "mixed BitsPerSample";
+    }
+    if (sp_tiff_find(t, SP_TIFF_TILEWIDTH)) return "tiled";
+
+    if (rows > height) rows = height;
+    t->width    = width;
+    t->height   = height;
+    t->spp      = spp;
+    t->bps      = bps;
+    t->rows     = rows;
+    t->n_strips = (height + rows - 1) / rows;
+    if ((uint64_t) width * spp * (bps / 8) > len) return "bad size";
+    t->row_len  = (size_t) width * spp * (bps / 8);
+
+    if (sp_tiff_get(t, SP_TIFF_OFFSETS, t->n_strips - 1, -1) < 0 ||
+    	sp_tiff_get(t, SP_TIFF_COUNTS,  t->n_strips - 1, -1) < 0)
+    {
+    	return "bad strips";
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Check that a TIFF opened with sp_tiff_open() is a north up GeoTIFF,
+ *  and set its pixel scale and tie point.
+ * @param t
+ * @return NULL if it is, else why not.
+ */
+const char *sp_tiff_geo(sp_tiff *t)
+{
+    if (sp_tiff_find(t, SP_TIFF_TRANSFORM)) return "not north up";
+
+    const unsigned char *scale = sp_tiff_doubles(t, SP_TIFF_SCALE,    2);
+    const unsigned char *tie   = sp_tiff_doubles(t, SP_TIFF_TIEPOINT, 6);
+    if (NULL == scale || NULL == tie) return "not a GeoTIFF";
+    t->scale[0] = sp_tiff_double(t->be, scale);
+    t->scale[1] = sp_tiff_double(t->be, scale + 8);
+    t->tie[0]   = sp_tiff_double(t->be, tie + 24);
+    t->tie[1]   = sp_tiff_double(t->be, tie + 32);
+    if (0 != sp_tiff_double(t->be, tie) || 0 != sp_tiff_double(t->be, tie + 8))
+    {
+    	return "unsupported tie point";
+    }
+    if (! (t->scale[0] > 0 && t->scale[1] > 0)) return "bad pixel scale";
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Write a classic TIFF with the tags of another, some of them replaced,
+ *  and room for the image data right after the header.
+ * @param env
+ * @param t the TIFF the tags are taken from.
+ * @param added entries replacing those of t with the same tag, or added,
+ *  with their values in the byte order of t.
+ * @param n_added
+ * @param data_len bytes of image data, to be put at offset 8 by the caller.
+ * @param len set to the length of the TIFF.
+ * @param why set on error.
+ * @return the TIFF, to be freed with AXIS2_FREE, NULL on error.
+ */
+unsigned char *sp_tiff_write(
+    const axutil_env_t  *env,
+    const sp_tiff       *t,
+    const sp_tiff_entry *added,
+    const int            n_added,
+    const uint64_t       data_len,
+    size_t              *len,
+    const char         **why)
+{
+    const int      be = t->be;
+    sp_tiff_entry *ee = AXIS2_MALLOC(env->allocator,
+    		(t->n_entries + n_added) * sizeof(sp_tiff_entry));
+    int            i, k, m = 0;
+
+    if (NULL == ee)
+    {
+    	*why = "out of memory";
+    	return NULL;
+    }
+
+    for (i = 0; i < t->n_entries; i++)
+    {
+    	const unsigned char *e   = t->ifd + 12 * i;
+    	const uint32_t       tag = sp_tiff_16(be, e);
+
+    	// Replaced, or pointing into the old file.
+    	for (k = 0; k < n_added && added[k].tag != tag; k++) ;
+    	if (k < n_added ||
+    		SP_TIFF_FREEOFFSETS == tag || SP_TIFF_FREECOUNTS == tag ||
+    		SP_TIFF_SUBIFDS == tag || SP_TIFF_EXIFIFD == tag ||
+    		SP_TIFF_GPSIFD == tag)
+    	{
+    		continue;
+    	}
+    	ee[m].tag   = tag;
+    	ee[m].type  = sp_tiff_16(be, e + 2);
+    	ee[m].count = sp_tiff_32(be, e + 4);
+    	ee[m].val   = sp_tiff_value(t, e, &ee[m].len);
+    	if (NULL == ee[m].val)
+    	{
+    		AXIS2_FREE(env->allocator, ee);
+    		*why = "bad TIFF tag";
+    		return NULL;
+    	}
+    	m++;
+    }
+    for (k = 0; k < n_added; k++) ee[m++] = added[k];
+    sp_tiff_sort(ee, m);
+
+    // Header, image data, IFD, and the values not fitting into the IFD.
+    const uint64_t ifd_off = (8 + data_len + 1) & ~1ULL;
+    uint64_t       size    = ifd_off + 2 + 12 * m + 4;
+    for (i = 0; i < m; i++)
+    {
+    	if (ee[i].len > 4) size = ((size + 1) & ~1ULL) + ee[i].len;
+    }
+
+    unsigned char *buf = size <= INT_MAX ?
+    		AXIS2_MALLOC(env->allocator, size) : NULL;
+    if (NULL == buf)
+    {
+    	AXIS2_FREE(env->allocator, ee);
+    	*why = size <= INT_MAX ? "out of memory" : "too large";
+    	return NULL;
+    }
+    // The image data is left to the caller.
+    memset(buf, 0, 8);
+    memset(buf + 8 + data_len, 0, size - 8 - data_len);
+
+    memcpy(buf, be ? "MM" : "II", 2);
+    sp_tiff_put16(be, buf + 2, 42);
+    sp_tiff_put32(be, buf + 4, ifd_off);
+
+    unsigned char *e    = buf + ifd_off;
+    uint64_t       data = ifd_off + 2 + 12 * m + 4;
+    sp_tiff_put16(be, e, m);
+    for (i = 0, e += 2; i < m; i++, e += 12)
+    {
+    	sp_tiff_put16(be, e,     ee[i].tag);
+    	sp_tiff_put16(be, e + 2, ee[i].type);
+    	sp_tiff_put32(be, e + 4, ee[i].count);
+    	if (ee[i].len <= 4)
+    	{
+    		memcpy(e + 8, ee[i].val, ee[i].len);
+    	}
+    	else
+    	{
+    		data = (data + 1) & ~1ULL;
+    		sp_tiff_put32(be, e + 8, data);
+    		memcpy(buf + data, ee[i].val, ee[i].len);
+    		data += ee[i].len;
+    	}
+    }
+
+    AXIS2_FREE(env->allocator, ee);
+    *len = size;
+    return buf;
+}
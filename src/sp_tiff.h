@@ -0,0 +1,139 @@
+/*
+ * Soap Proxy.
+ *
+ * TIFF reading and writing.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_tiff.h
+ *
+ */
+
+#ifndef SPTIFF_H_INCLUDED
+#define SPTIFF_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sp_svc.h"
+
+// TIFF tags
+#define SP_TIFF_WIDTH       256
+#define SP_TIFF_HEIGHT      257
+#define SP_TIFF_BPS         258
+#define SP_TIFF_COMPRESSION 259
+#define SP_TIFF_OFFSETS     273
+#define SP_TIFF_SPP         277
+#define SP_TIFF_ROWS        278
+#define SP_TIFF_COUNTS      279
+#define SP_TIFF_PLANAR      284
+#define SP_TIFF_FREEOFFSETS 288
+#define SP_TIFF_FREECOUNTS  289
+#define SP_TIFF_TILEWIDTH   322
+#define SP_TIFF_SUBIFDS     330
+#define SP_TIFF_SCALE       33550
+#define SP_TIFF_TIEPOINT    33922
+#define SP_TIFF_TRANSFORM   34264
+#define SP_TIFF_EXIFIFD     34665
+#define SP_TIFF_GPSIFD      34853
+
+// TIFF field types
+#define SP_TIFF_SHORT  3
+#define SP_TIFF_LONG   4
+#define SP_TIFF_DOUBLE 12
+
+// TIFF compression schemes
+#define SP_TIFF_NONE    1
+#define SP_TIFF_DEFLATE 8
+
+//
+// A classic TIFF, mapped, with what is needed of its first IFD.
+//
+struct sp_tiff_struct
+{
+    const unsigned char *p;
+    size_t               len;
+    int                  be;        // big endian
+    const unsigned char *ifd;       // the first entry
+    unsigned             n_entries;
+    uint32_t             width;
+    uint32_t             height;
+    uint32_t             spp;
+    uint32_t             bps;       // bits per sample
+    uint32_t             rows;      // per strip
+    uint32_t             n_strips;
+    size_t               row_len;
+    double               scale[2];  // see sp_tiff_geo()
+    double               tie[2];    // of the raster's top left corner
+};
+
+typedef struct sp_tiff_struct sp_tiff;
+
+//
+// An IFD entry of a TIFF written, see sp_tiff_write().
+//
+struct sp_tiff_entry_struct
+{
+    uint16_t             tag;
+    uint16_t             type;
+    uint32_t             count;
+    const unsigned char *val;       // in the byte order of the output
+    size_t               len;
+};
+
+typedef struct sp_tiff_entry_struct sp_tiff_entry;
+
+uint32_t             sp_tiff_16     (const int be, const unsigned char *p);
+uint32_t             sp_tiff_32     (const int be, const unsigned char *p);
+double               sp_tiff_double (const int be, const unsigned char *p);
+void                 sp_tiff_put16  (const int be, unsigned char *p,
+                                     const uint32_t v);
+void                 sp_tiff_put32  (const int be, unsigned char *p,
+                                     const uint32_t v);
+
+const char          *sp_tiff_open   (sp_tiff             *t,
+                                     const unsigned char *p,
+                                     const size_t         len);
+const char          *sp_tiff_geo    (sp_tiff             *t);
+const unsigned char *sp_tiff_find   (const sp_tiff       *t,
+                                     const uint32_t       tag);
+const unsigned char *sp_tiff_value  (const sp_tiff       *t,
+                                     const unsigned char *e,
+                                     size_t              *len);
+long long            sp_tiff_get    (const sp_tiff       *t,
+                                     const uint32_t       tag,
+                                     const uint32_t       i,
+                                     const long long      dflt);
+
+unsigned char       *sp_tiff_write  (const axutil_env_t  *env,
+                                     const sp_tiff       *t,
+                                     const sp_tiff_entry *added,
+                                     const int            n_added,
+                                     const uint64_t       data_len,
+                                     size_t              *len,
+                                     const char         **why);
+
+#endif
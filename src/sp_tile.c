@@ -0,0 +1,664 @@
+/*
+ * Soap Proxy.
+ *
+ * GetCoverage split into strips fetched in parallel.
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ */
+
+/**
+ * @file sp_tile.c
+ *
+ * A GetCoverage of a large area keeps a single mapserver busy for a long
+ * time, while others are idle.  If TileStrips is set, such a request is
+ * split along its y trim into up to that many strips, each a GetCoverage
+ * of its own.  They are sent to BackendURL at once with sp_shard_scatter(),
+ * so that several backend processes work on the request, and the strip
+ * GeoTIFFs are stitched back into one, returned as the MTOM attachment
+ * like any other coverage.
+ *
+ * Only requests the stitching is sure to get right are split:
+ *
+ *  - in URL mode, not in exec mode,
+ *  - with format image/tiff, no mediaType (multipart) and no Extension,
+ *    e.g. scaling or a CRS, which might resample each strip differently,
+ *  - with a y trim, y being the axis named y, Lat, N etc., that has both
+ *    bounds,
+ *  - expected to be larger than TileMinMB, as estimated from the
+ *    description of the coverage or from the sizes seen before for the
+ *    same CoverageId, see sp_sched_expected().
+ *
+ * Mapserver snaps a trim to the pixel grid of the coverage, so strips
+ * meeting exactly might share or miss a row at the seam.  The strips are
+ * therefore requested overlapping a little, and the rows of a strip
+ * already covered by the one above, as found from their tie points, are
+ * dropped.  All strips must be uncompressed, pixel interleaved, north up
+ * classic TIFFs on the same grid.  If they are not, or a strip fails, the
+ * request is sent once more as a whole, as if it had not been split.
+ *
+ * The stitched GeoTIFF keeps the tags of the top strip, with its rows
+ * organised into strips of about 256 kB.  It is built in memory, as
+ * sp_make_MTOM_node20() does with a coverage from a single request, and
+ * a coverage larger than MaxCoverageMB is refused before that.
+ *
+ * Each strip takes a backend slot, see sp_sched_acquire_more(): with
+ * fewer free slots than TileStrips the request is split into fewer
+ * strips, and with only one it is not split.  All strips must have
+ * answered within ShardTimeoutMs.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "soap_proxy.h"
+#include "sp_tile.h"
+#include "sp_shard.h"
+#include "sp_reader.h"
+#include "sp_log.h"
+#include "sp_sched.h"
+#include "sp_stats.h"
+#include "sp_tiff.h"
+
+#define SP_TILE_OVERLAP   0.02
+#define SP_TILE_STRIP_LEN (256 * 1024)
+#define SP_TILE_HEAD_MAX  16384
+
+static const char sp_tile_too_large[] = "larger than " SP_MAXCOVMB_STR;
+
+//
+// The y trim of a request, rewritten for each strip.
+//
+struct sp_tile_trim_struct
+{
+    axiom_text_t *low;
+    axiom_text_t *high;
+    axis2_char_t *low_orig;
+    axis2_char_t *high_orig;
+    double        lo;
+    double        hi;
+};
+
+typedef struct sp_tile_trim_struct sp_tile_trim;
+
+//  ==================== Forward declarations ================================
+axiom_node_t *rp_invokeBackend(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version);
+
+// =========================  local functions = ===============================
+
+//-----------------------------------------------------------------------------
+/** Copy the rows of a TIFF, less the first ones.
+ * @param t
+ * @param skip the number of rows not copied.
+ * @param dst
+ * @return NULL on success, else what is wrong.
+ */
+static const char *sp_tiff_copy_rows(
+    const sp_tiff  *t,
+    const uint32_t  skip,
+    unsigned char  *dst)
+{
+    uint32_t s;
+
+    for (s = 0; s < t->n_strips; s++)
+    {
+    	const uint32_t  first = s * t->rows;
+    	const uint32_t  n     = t->height - first < t->rows ?
+    			t->height - first : t->rows;
+    	const long long off   = sp_tiff_get(t, SP_TIFF_OFFSETS, s, -1);
+    	const long long count = sp_tiff_get(t, SP_TIFF_COUNTS,  s, -1);
+    	const size_t    len   = (size_t) n * t->row_len;
+
+    	if (off < 0 || count < (long long) len ||
+    		(size_t) off > t->len || len > t->len - off)
+    	{
+    		return "strip out of the file";
+    	}
+    	if (first + n <= skip) continue;
+
+    	const uint32_t from = skip > first ? skip - first : 0;
+    	memcpy(dst, t->p + off + (size_t) from * t->row_len,
+    			(size_t) (n - from) * t->row_len);
+    	dst += (size_t) (n - from) * t->row_len;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Stitch the strips into one TIFF.
+ * @param env
+ * @param tt the strips, top to bottom.
+ * @param n
+ * @param max_len max. size of the pixel data, 0: no limit.
+ * @param why set if they cannot be stitched.
+ * @return a Coverage element with the TIFF attached, NULL on error.
+ */
+static axiom_node_t *sp_tile_stitch(
+    const axutil_env_t *env,
+    const sp_tiff      *tt,
+    const int           n,
+    const uint64_t      max_len,
+    const char        **why)
+{
+    const sp_tiff *t0   = &tt[0];
+    const double   sy   = t0->scale[1];
+    uint32_t       skip[SP_SHARD_MAX];
+    uint64_t       height = t0->height;
+    int            i, k;
+
+    skip[0] = 0;
+    for (k = 1; k < n; k++)
+    {
+    	const sp_tiff *t = &tt[k];
+    	if (t->width != t0->width || t->spp != t0->spp || t->bps != t0->bps ||
+    		(t->be != t0->be && t->bps > 8) ||
+    		fabs(t->scale[0] - t0->scale[0]) > 1e-9 * t0->scale[0] ||
+    		fabs(t->scale[1] - sy) > 1e-9 * sy ||
+    		fabs(t->tie[0] - t0->tie[0]) > 0.01 * t0->scale[0])
+    	{
+    		*why = "strips not on one grid";
+    		return NULL;
+    	}
+
+    	// Rows of this strip north of where the one above ends.
+    	const double f = (t->tie[1] - (tt[k - 1].tie[1] - tt[k - 1].height * sy)) / sy;
+    	const double r = floor(f + 0.5);
+    	if (fabs(f - r) > 0.01)
+    	{
+    		*why = "strips not on one grid";
+    		return NULL;
+    	}
+    	if (r < 0 || r >= t->height)
+    	{
+    		*why = "strips do not overlap";
+    		return NULL;
+    	}
+    	skip[k] = r;
+    	height += t->height - skip[k];
+    }
+
+    const size_t   row_len = t0->row_len;
+    const uint32_t rows    = row_len < SP_TILE_STRIP_LEN ?
+    		SP_TILE_STRIP_LEN / row_len : 1;
+    const uint64_t n_out   = (height + rows - 1) / rows;
+    const uint64_t pix_len = height * row_len;
+    const int      be      = t0->be;
+
+    if (max_len > 0 && pix_len > max_len)
+    {
+    	*why = sp_tile_too_large;
+    	return NULL;
+    }
+    if (pix_len > INT_MAX || n_out > INT_MAX / 8)
+    {
+    	*why = "too large";
+    	return NULL;
+    }
+
+    // The new values: height, rows per strip, strip offsets and counts.
+    unsigned char *vals = AXIS2_MALLOC(env->allocator, 8 + 8 * n_out);
+    if (NULL == vals)
+    {
+    	*why = "out of memory";
+    	return NULL;
+    }
+    sp_tiff_put32(be, vals,     height);
+    sp_tiff_put32(be, vals + 4, rows);
+    for (i = 0; i < n_out; i++)
+    {
+    	const uint64_t left = height - (uint64_t) i * rows;
+    	sp_tiff_put32(be, vals + 8 + 4 * i, 8 + (uint64_t) i * rows * row_len);
+    	sp_tiff_put32(be, vals + 8 + 4 * (n_out + i),
+    			(left < rows ? left : rows) * row_len);
+    }
+
+    const sp_tiff_entry added[4] = {
+    	{SP_TIFF_HEIGHT,  SP_TIFF_LONG, 1,     vals,                 4},
+    	{SP_TIFF_OFFSETS, SP_TIFF_LONG, n_out, vals + 8,             4 * n_out},
+    	{SP_TIFF_ROWS,    SP_TIFF_LONG, 1,     vals + 4,             4},
+    	{SP_TIFF_COUNTS,  SP_TIFF_LONG, n_out, vals + 8 + 4 * n_out, 4 * n_out}
+    };
+    size_t         len;
+    unsigned char *buf = sp_tiff_write(env, t0, added, 4, pix_len, &len, why);
+    AXIS2_FREE(env->allocator, vals);
+    if (NULL == buf) return NULL;
+
+    unsigned char *dst = buf + 8;
+    for (k = 0; k < n && NULL == *why; k++)
+    {
+    	*why = sp_tiff_copy_rows(&tt[k], skip[k], dst);
+    	dst += (size_t) (tt[k].height - skip[k]) * row_len;
+    }
+    if (*why)
+    {
+    	AXIS2_FREE(env->allocator, buf);
+    	return NULL;
+    }
+
+    // The buffer is freed with the data handler, see sp_make_MTOM_node20().
+    axiom_data_handler_t *dh =
+    		axiom_data_handler_create(env, NULL, "image/tiff");
+    axiom_data_handler_set_binary_data(dh, env, (axis2_byte_t *) buf, len);
+    return sp_make_MTOM_dh_node20(env, dh,
+    		"Coverage", "wcs", "http://www.opengis.net/wcs/2.0");
+}
+
+//-----------------------------------------------------------------------------
+/** Map the spooled response of a strip and check it is a GeoTIFF.
+ * @param env
+ * @param sh
+ * @param map set to the mapping, to be unmapped with sh->received.
+ * @param t set up for the TIFF.
+ * @return NULL if it is one that can be stitched, else why not.
+ */
+static const char *sp_tile_map(
+    const axutil_env_t *env,
+    const sp_shard     *sh,
+    unsigned char     **map,
+    sp_tiff            *t)
+{
+    *map = NULL;
+    if (0 == sh->received) return "empty response";
+    void *m = mmap(NULL, sh->received, PROT_READ, MAP_PRIVATE, sh->tmp_fd, 0);
+    if (MAP_FAILED == m) return "cannot map the response";
+    *map = m;
+
+    // The header block, copied as sp_headers_parse() writes into it.
+    const size_t   scan = sh->received < SP_TILE_HEAD_MAX ?
+    		sh->received : SP_TILE_HEAD_MAX - 1;
+    const char    *crlf = memmem(*map, scan, "\r\n\r\n", 4);
+    const char    *lf   = memmem(*map, scan, "\n\n", 2);
+    size_t         head_len;
+    if      (crlf && (NULL == lf || crlf < lf)) head_len = crlf + 4 - (char *) *map;
+    else if (lf)                                head_len = lf   + 2 - (char *) *map;
+    else return "no HTTP header";
+
+    char head[SP_TILE_HEAD_MAX];
+    memcpy(head, *map, head_len);
+    head[head_len] = '\0';
+    if (strncmp(head, "HTTP/", 5) || 200 != atoi(head + strcspn(head, " ")))
+    {
+    	return "backend error";
+    }
+
+    sp_headers hh;
+    sp_headers_init(&hh);
+    sp_headers_parse(env, &hh, head, head_len);
+    const char *ctype = sp_headers_value(&hh, "Content-Type");
+    const char *te    = sp_headers_value(&hh, "Transfer-Encoding");
+    const int   tiff  = ctype && 0 == strncasecmp(ctype, "image/tiff", 10) &&
+    		(NULL == te || 0 == strcasecmp(te, "identity"));
+    sp_headers_free(env, &hh);
+    if (! tiff) return "not image/tiff";
+
+    const char *why = sp_tiff_open(t, *map + head_len, sh->received - head_len);
+    return why ? why : sp_tiff_geo(t);
+}
+
+//-----------------------------------------------------------------------------
+static const axis2_char_t *sp_tile_localname(
+    const axutil_env_t *env,
+    axiom_node_t       *node)
+{
+    axiom_element_t *el = axiom_node_get_data_element(node, env);
+    return el ? axiom_element_get_localname(el, env) : NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return the text of an element, NULL if none.
+ */
+static axiom_text_t *sp_tile_text(
+    const axutil_env_t *env,
+    axiom_node_t       *el_node)
+{
+    axiom_node_t *t_node = el_node ?
+    		axiom_node_get_first_child(el_node, env) : NULL;
+    for (; t_node; t_node = axiom_node_get_next_sibling(t_node, env))
+    {
+    	if (AXIOM_TEXT == axiom_node_get_node_type(t_node, env))
+    	{
+    		return axiom_node_get_data_element(t_node, env);
+    	}
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** @return non-zero if a trim dimension is the northing axis.
+ */
+static int sp_tile_is_y(const axis2_char_t *dim)
+{
+    static const char *names[] =
+    	{"y", "Y", "lat", "Lat", "latitude", "Latitude", "N", "northing", NULL};
+    int i;
+
+    for (i = 0; dim && names[i]; i++)
+    {
+    	if (0 == strcmp(dim, names[i])) return 1;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/** @return non-zero if s is a number, set to v.
+ */
+static int sp_tile_number(const axis2_char_t *s, double *v)
+{
+    char *end = NULL;
+    if (NULL == s) return 0;
+    *v = strtod(s, &end);
+    while (end && *end && strchr(" \t\r\n", *end)) end++;
+    return end != s && end && '\0' == *end && isfinite(*v);
+}
+
+//-----------------------------------------------------------------------------
+/** Find out whether a GetCoverage request is to be split, see the top of
+ *  the file.
+ * @param env
+ * @param node the request.
+ * @param props
+ * @param trim set to its y trim if it is to be split, to be restored
+ *  with sp_tile_restore().
+ * @return the number of strips, 0 if it is not to be split.
+ */
+static int sp_tile_plan(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    sp_tile_trim       *trim)
+{
+    int n = rp_getTileStrips(env, props);
+    if (n > SP_SHARD_MAX) n = SP_SHARD_MAX;
+    if (n < 2 || ! rp_getUrlMode(env, props)) return 0;
+
+    const uint64_t min_len = (uint64_t) rp_getTileMinMB(env, props) << 20;
+    if (min_len > 0 && sp_sched_expected(env, node) < min_len) return 0;
+
+    memset(trim, 0, sizeof(*trim));
+    axiom_node_t *child = axiom_node_get_first_child(node, env);
+    int           tiff  = 0;
+
+    for (; child; child = axiom_node_get_next_sibling(child, env))
+    {
+    	if (AXIOM_ELEMENT != axiom_node_get_node_type(child, env)) continue;
+
+    	const axis2_char_t *name = sp_tile_localname(env, child);
+    	if (0 == axutil_strcmp(name, "CoverageId") ||
+    		0 == axutil_strcmp(name, "DimensionSlice"))
+    	{
+    		continue;
+    	}
+    	if (0 == axutil_strcmp(name, "format"))
+    	{
+    		tiff = 0 == axutil_strcmp(sp_get_text_el(child, env), "image/tiff");
+    		continue;
+    	}
+    	// mediaType, Extension
+    	if (axutil_strcmp(name, "DimensionTrim")) return 0;
+
+    	if (sp_tile_is_y(sp_get_text_el(
+    			rp_find_named_child(env, child, "Dimension", 0), env)))
+    	{
+    		trim->low  = sp_tile_text(env,
+    				rp_find_named_child(env, child, "TrimLow",  0));
+    		trim->high = sp_tile_text(env,
+    				rp_find_named_child(env, child, "TrimHigh", 0));
+    	}
+    }
+
+    if (! tiff || NULL == trim->low || NULL == trim->high ||
+    	! sp_tile_number(axiom_text_get_value(trim->low,  env), &trim->lo) ||
+    	! sp_tile_number(axiom_text_get_value(trim->high, env), &trim->hi) ||
+    	! (trim->lo < trim->hi))
+    {
+    	return 0;
+    }
+
+    trim->low_orig  = axutil_strdup(env, axiom_text_get_value(trim->low,  env));
+    trim->high_orig = axutil_strdup(env, axiom_text_get_value(trim->high, env));
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+/** Set the y trim of the request to that of strip k of n, strip 0 being
+ *  the northmost.  Inner bounds reach a little into the next strip.
+ */
+static void sp_tile_set(
+    const axutil_env_t *env,
+    const sp_tile_trim *trim,
+    const int           k,
+    const int           n)
+{
+    const double step   = (trim->hi - trim->lo) / n;
+    const double margin = step * SP_TILE_OVERLAP;
+    char         buf[32];
+
+    if (0 == k)
+    {
+    	axiom_text_set_value(trim->high, env, trim->high_orig);
+    }
+    else
+    {
+    	snprintf(buf, sizeof(buf), "%.17g", trim->hi - k * step + margin);
+    	axiom_text_set_value(trim->high, env, buf);
+    }
+
+    if (n - 1 == k)
+    {
+    	axiom_text_set_value(trim->low, env, trim->low_orig);
+    }
+    else
+    {
+    	snprintf(buf, sizeof(buf), "%.17g", trim->hi - (k + 1) * step - margin);
+    	axiom_text_set_value(trim->low, env, buf);
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Put the original y trim back into the request.
+ */
+static void sp_tile_restore(
+    const axutil_env_t *env,
+    sp_tile_trim       *trim)
+{
+    if (trim->low_orig)
+    {
+    	axiom_text_set_value(trim->low, env, trim->low_orig);
+    	AXIS2_FREE(env->allocator, trim->low_orig);
+    }
+    if (trim->high_orig)
+    {
+    	axiom_text_set_value(trim->high, env, trim->high_orig);
+    	AXIS2_FREE(env->allocator, trim->high_orig);
+    }
+    trim->low_orig  = NULL;
+    trim->high_orig = NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Fetch the strips of a request in parallel and stitch them.
+ * @param env
+ * @param node the request.
+ * @param props
+ * @param trim
+ * @param n the number of strips.
+ * @param why set if it did not work out.
+ * @return the stitched coverage, NULL on error.
+ */
+static axiom_node_t *sp_tile_fetch(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    sp_tile_trim       *trim,
+    const int           n,
+    const char        **why)
+{
+    axis2_char_t  *reqs [SP_SHARD_MAX];
+    sp_shard       strips[SP_SHARD_MAX];
+    sp_tiff        tiffs[SP_SHARD_MAX];
+    unsigned char *maps [SP_SHARD_MAX];
+    axiom_node_t  *return_node = NULL;
+    int            k;
+
+    sp_stamp_t t0 = sp_stats_now();
+    for (k = 0; k < n; k++)
+    {
+    	sp_tile_set(env, trim, k, n);
+    	reqs[k] = axiom_node_to_string(node, env);
+    	maps[k] = NULL;
+    }
+    sp_tile_restore(env, trim);
+    sp_stats_phase(SP_PH_SERIALIZE, t0);
+
+    for (k = 0; k < n; k++)
+    {
+    	char label[64];
+    	snprintf(label, sizeof(label), "strip %d of %d", k + 1, n);
+    	sp_shard_setup(env, props, &strips[k], label,
+    			rp_getBackendHost(env, props), rp_getBackendPort(env, props),
+    			rp_getBackendPath(env, props),
+    			reqs[k] ? reqs[k] : "", reqs[k] ? strlen(reqs[k]) : 0);
+    	if (NULL == reqs[k]) *why = "cannot serialize the request";
+    }
+    if (reqs[0]) sp_stats_note_request(reqs[0], strlen(reqs[0]));
+
+    if (NULL == *why &&
+    	sp_shard_scatter(env, strips, n, rp_getShardTimeoutMs(env, props)))
+    {
+    	*why = "a strip failed";
+    }
+
+    t0 = sp_stats_now();
+    for (k = 0; k < n; k++)
+    {
+    	sp_stats_add_bytes_in(strips[k].received);
+    	if (NULL == *why) *why = sp_tile_map(env, &strips[k], &maps[k], &tiffs[k]);
+    }
+    if (NULL == *why)
+    {
+    	const int max_mb = rp_getMaxCoverageMB(env, props);
+    	return_node = sp_tile_stitch(env, tiffs, n,
+    			max_mb > 0 ? (uint64_t) max_mb << 20 : 0, why);
+    }
+    sp_stats_phase(SP_PH_MTOM_LOAD, t0);
+
+    for (k = 0; k < n; k++)
+    {
+    	if (maps[k]) munmap(maps[k], strips[k].received);
+    	sp_shard_cleanup(env, &strips[k]);
+    	if (reqs[k]) AXIS2_FREE(env->allocator, reqs[k]);
+    }
+    return return_node;
+}
+
+// =========================  public functions  ===============================
+
+//-----------------------------------------------------------------------------
+/**
+ * @param env
+ * @param props
+ * @return non-zero if large GetCoverage requests may be split.
+ */
+int sp_tile_enabled(const axutil_env_t *env, const sp_props *props)
+{
+    return rp_getTileStrips(env, props) > 1 && rp_getUrlMode(env, props);
+}
+
+//-----------------------------------------------------------------------------
+/** Send a GetCoverage request as strips in parallel if it qualifies, see
+ *  the top of the file, in place of rp_invokeBackend().
+ * @param env
+ * @param node the request.
+ * @param props
+ * @param wcs_version
+ * @return the response, NULL on error.
+ */
+axiom_node_t *sp_tile_invoke(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const sp_props     *props,
+    const int           wcs_version)
+{
+    sp_tile_trim trim;
+    int          n = sp_tile_plan(env, node, props, &trim);
+
+    if (n < 2 || sp_stats_drain_since())
+    {
+    	if (n >= 2) sp_tile_restore(env, &trim);
+    	return rp_invokeBackend(env, node, props, wcs_version);
+    }
+
+    sp_sched_ticket ticket;
+    sp_sched_ticket more[SP_SHARD_MAX - 1];
+    if (sp_sched_acquire(env, props, node, &ticket))
+    {
+    	sp_tile_restore(env, &trim);
+    	return NULL;
+    }
+    const int extra = sp_sched_acquire_more(env, props, &ticket, more, n - 1);
+    int       k;
+
+    n = 1 + extra;
+    if (n < 2)
+    {
+    	sp_sched_release(env, &ticket);
+    	sp_tile_restore(env, &trim);
+    	SP_LOG_DEBUG("GetCoverage not split: no free backend slots");
+    	return rp_invokeBackend(env, node, props, wcs_version);
+    }
+
+    const char   *why         = NULL;
+    axiom_node_t *return_node = sp_tile_fetch(env, node, props, &trim, n, &why);
+    for (k = 0; k < extra; k++) sp_sched_release(env, &more[k]);
+    sp_sched_release(env, &ticket);
+
+    if (return_node)
+    {
+    	SP_LOG_DEBUG("GetCoverage stitched from %d strips", n);
+    	return return_node;
+    }
+    if (sp_tile_too_large == why)
+    {
+    	SP_ERROR(env, SP_USER_ERR_COVERAGE_TOO_LARGE);
+    	SP_LOG_WARNING("GetCoverage refused: %s", why);
+    	return NULL;
+    }
+
+    SP_LOG_WARNING("GetCoverage not split: %s", why ? why : "unknown");
+    return rp_invokeBackend(env, node, props, wcs_version);
+}
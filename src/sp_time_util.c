@@ -35,8 +35,11 @@
 
 
 #define _XOPEN_SOURCE
+#define _DEFAULT_SOURCE
+#include <ctype.h>
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <axiom_text.h>
 
@@ -96,3 +99,74 @@ sp_parse_time_str(
 		return 0;
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Parse an ISO 8601 date, optionally with a time and a time zone, e.g.
+//   2011-02-04, 2011-02-04T15:45:52.25Z, 2011-02-04T16:45:52+01:00
+// Without a time zone the time is taken to be UTC.
+// Returns 0 and the seconds since the epoch in t, or -1 if not parsable.
+int
+sp_parse_iso_time(
+    const axis2_char_t *time_str,
+    double             *t)
+{
+	int    year, mon, day, hour = 0, min = 0, n = 0;
+	double sec = 0.0;
+	long   offset = 0;
+	const char *p = time_str;
+
+	while (isspace((unsigned char) *p)) p++;
+	if (3 != sscanf(p, "%4d-%2d-%2d%n", &year, &mon, &day, &n)) return -1;
+	p += n;
+
+	if ('T' == *p || 't' == *p)
+	{
+		if (2 != sscanf(p + 1, "%2d:%2d%n", &hour, &min, &n)) return -1;
+		p += 1 + n;
+		if (':' == *p)
+		{
+			char *end;
+			if (! isdigit((unsigned char) p[1])) return -1;
+			sec = strtod(p + 1, &end);
+			if (sec < 0.0 || sec >= 61.0) return -1;
+			p = end;
+		}
+	}
+
+	if ('Z' == *p || 'z' == *p)
+	{
+		p++;
+	}
+	else if ('+' == *p || '-' == *p)
+	{
+		const int sign = '-' == *p ? -1 : 1;
+		int off_h, off_m = 0;
+		if (1 != sscanf(p + 1, "%2d%n", &off_h, &n)) return -1;
+		p += 1 + n;
+		if (':' == *p) p++;
+		if (isdigit((unsigned char) *p))
+		{
+			if (1 != sscanf(p, "%2d%n", &off_m, &n)) return -1;
+			p += n;
+		}
+		offset = sign * (off_h * 3600L + off_m * 60L);
+	}
+
+	while (isspace((unsigned char) *p)) p++;
+	if (*p || mon < 1 || mon > 12 || day < 1 || day > 31 ||
+			hour > 24 || min > 59)
+	{
+		return -1;
+	}
+
+	struct tm tm_s;
+	memset(&tm_s, 0, sizeof(tm_s));
+	tm_s.tm_year = year - 1900;
+	tm_s.tm_mon  = mon - 1;
+	tm_s.tm_mday = day;
+	tm_s.tm_hour = hour;
+	tm_s.tm_min  = min;
+
+	*t = (double) timegm(&tm_s) + sec - offset;
+	return 0;
+}
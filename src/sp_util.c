@@ -41,6 +41,7 @@
 
 #include "soap_proxy.h"
 #include "sp_svc.h"
+#include "sp_log.h"
 
 //-----------------------------------------------------------------------------
 // Characters which are legal in the boundary separator string 
@@ -1162,10 +1163,8 @@ axiom_node_t *sp_latest_named(
             		{
             			if (strlen(txt) >= MAX_LAST_TIMELEN)
             			{
-            				rp_log_error(env,
-            						"*WARNING sp_util.c(%s %d):"
-            						" timePosition text too long (%d)\n",
-            						__FILE__, __LINE__, strlen(txt));
+            				SP_LOG_WARNING("timePosition text too long (%d)",
+            						(int) strlen(txt));
             			}
 
             			strncpy(last_time, txt, MAX_LAST_TIMELEN-1);
@@ -1269,7 +1268,7 @@ void
 sp_dump_bad_content(
     const axutil_env_t *env,
     char               *contentTypeStr,
-    axutil_stream_t    *st,
+    sp_reader          *rd,
     char               *header_blob)
 {
     int data_len      = 0;
@@ -1278,7 +1277,7 @@ sp_dump_bad_content(
 
     if (rp_content_is_text_type(contentTypeStr))
     {
-    	bad_data = sp_load_binary_file(env, header_blob, st,  &data_len);
+    	bad_data = sp_load_binary_file(env, header_blob, rd,  &data_len);
     	if (data_len > max_len) data_len = max_len;
     	fprintf(stderr,"Start of bad data: (max %d):\n", max_len);
     	fwrite(bad_data, 1, data_len, stderr);
@@ -1335,3 +1334,126 @@ sp_get_last_text_node(
 
 
 
+
+//-----------------------------------------------------------------------------
+/** Find the start and end tag of the root of serialised XML, and the
+ *  elements directly below it, by a simple scan of the text.  Comments,
+ *  CDATA sections, processing instructions and quoted attribute values
+ *  are skipped, there is no further checking.
+ * @param xml
+ * @param len
+ * @param head_len set to the length of the start tag of the root,
+ *  including anything before it.
+ * @param tail_off set to the offset of the end tag of the root.
+ * @param child set to the ranges of the child elements.
+ * @param max size of child.
+ * @param n set to the number of children.
+ * @return 0 on success, -1 if the text cannot be made sense of or there
+ *  are more than max children.
+ */
+int sp_xml_children(
+    const char   *xml,
+    const size_t  len,
+    size_t       *head_len,
+    size_t       *tail_off,
+    sp_xml_range *child,
+    const int     max,
+    int          *n)
+{
+	const char *end   = xml + len;
+	const char *p     = xml;
+	const char *start = NULL;
+	int         depth = 0;
+
+	*n        = 0;
+	*head_len = 0;
+	*tail_off = 0;
+
+	while (p < end)
+	{
+		const char *q;
+		if ('<' != *p)
+		{
+			p++;
+			continue;
+		}
+
+		if (0 == strncmp(p, "<!--", 4))
+		{
+			q = strstr(p + 4, "-->");
+			if (NULL == q) return -1;
+			p = q + 3;
+			continue;
+		}
+		if (0 == strncmp(p, "<![CDATA[", 9))
+		{
+			q = strstr(p + 9, "]]>");
+			if (NULL == q) return -1;
+			p = q + 3;
+			continue;
+		}
+		if ('?' == p[1] || '!' == p[1])
+		{
+			q = strchr(p, '>');
+			if (NULL == q) return -1;
+			p = q + 1;
+			continue;
+		}
+
+		// An end tag.
+		if ('/' == p[1])
+		{
+			q = strchr(p, '>');
+			if (NULL == q || depth < 1) return -1;
+			if (1 == --depth)
+			{
+				if (*n >= max) return -1;
+				child[*n].off = start - xml;
+				child[*n].len = q + 1 - start;
+				(*n)++;
+			}
+			else if (0 == depth)
+			{
+				*tail_off = p - xml;
+				return 0;
+			}
+			p = q + 1;
+			continue;
+		}
+
+		// A start tag, '>' may be quoted in attribute values.
+		char quote = 0;
+		for (q = p + 1; q < end; q++)
+		{
+			if (quote)
+			{
+				if (*q == quote) quote = 0;
+			}
+			else if ('"' == *q || '\'' == *q) quote = *q;
+			else if ('>' == *q) break;
+		}
+		if (q >= end) return -1;
+		const int empty = '/' == q[-1];
+
+		if (0 == depth)
+		{
+			if (empty) return -1;
+			*head_len = q + 1 - xml;
+		}
+		else if (1 == depth)
+		{
+			start = p;
+			if (empty)
+			{
+				if (*n >= max) return -1;
+				child[*n].off = start - xml;
+				child[*n].len = q + 1 - start;
+				(*n)++;
+			}
+		}
+		if (! empty) depth++;
+		p = q + 1;
+	}
+
+	return -1;
+}
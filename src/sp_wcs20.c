@@ -40,6 +40,9 @@
 #include <axutil_linked_list.h>
 
 #include "soap_proxy.h"
+#include "sp_stats.h"
+#include "sp_log.h"
+#include "sp_mime.h"
 
 //-----------------------------------------------------------------------------
 /** f_add_PostEncodingSOAP
@@ -268,11 +271,40 @@ void rp_inject_soap_cap20(
 
 }
 
+//-----------------------------------------------------------------------------
+/** Wrap a data handler into a new element el_name, as an optimised (MTOM)
+ * text node.
+ * @return the element node.
+ */
+axiom_node_t *
+sp_make_MTOM_dh_node20(
+    const axutil_env_t   *env,
+    axiom_data_handler_t *data_handler,
+    axis2_char_t         *el_name,
+    axis2_char_t         *ns_prefix,
+    axis2_char_t         *ns_uri)
+{
+    axiom_node_t    *resp_om_node = NULL;
+    axiom_node_t    *data_om_node = NULL;
+    axiom_element_t *resp_om_ele  = NULL;
+    axiom_text_t    *data_text    = NULL;
+
+    axiom_namespace_t *ns = axiom_namespace_create(env, ns_uri, ns_prefix);
+    resp_om_ele =
+    		axiom_element_create (env, NULL, el_name, ns, &resp_om_node);
+    data_text =
+      axiom_text_create_with_data_handler
+      (env, resp_om_node, data_handler, &data_om_node);
+    axiom_text_set_optimize(data_text, env, AXIS2_TRUE);
+
+    return resp_om_node;
+}
+
 //-----------------------------------------------------------------------------
 axiom_node_t *
 sp_make_MTOM_node20(
     const axutil_env_t *env,
-    axutil_stream_t    *st,
+    sp_reader          *rd,
     char               *header_blob,
     axis2_char_t       *el_name,
     axis2_char_t       *content_type,
@@ -282,7 +314,7 @@ sp_make_MTOM_node20(
 	axiom_node_t         *resp_om_node = NULL;
 
     int data_len = 0;
-    char *bin_data = sp_load_binary_file(env, header_blob, st,  &data_len);
+    char *bin_data = sp_load_binary_file(env, header_blob, rd,  &data_len);
 
     if (NULL == bin_data)
     {
@@ -290,22 +322,12 @@ sp_make_MTOM_node20(
     }
     else
     {
-    	axiom_element_t      *resp_om_ele  = NULL;
-        axiom_data_handler_t *data_handler = NULL;
-        axiom_node_t         *data_om_node = NULL;
-        axiom_text_t            *data_text = NULL;
-
-    	axiom_namespace_t *ns = axiom_namespace_create(env, ns_uri, ns_prefix);
-    	resp_om_ele =
-    			axiom_element_create (env, NULL, el_name, ns, &resp_om_node);
-        data_handler =
+        axiom_data_handler_t *data_handler =
         		axiom_data_handler_create(env, NULL, content_type);
         axiom_data_handler_set_binary_data
             (data_handler, env, bin_data, data_len);
-        data_text =
-          axiom_text_create_with_data_handler
-          (env, resp_om_node, data_handler, &data_om_node);
-        axiom_text_set_optimize(data_text, env, AXIS2_TRUE);
+        resp_om_node = sp_make_MTOM_dh_node20
+        		(env, data_handler, el_name, ns_prefix, ns_uri);
     }
 
     // Note:  The buffer 'bin_data' gets freed when
@@ -350,11 +372,11 @@ axiom_node_t *
 sp_process_coverage20(
     const axutil_env_t *env,
     char               *header_blob,
-    axutil_stream_t    *st)
+    sp_reader          *rd)
 {
     return sp_make_MTOM_node20(
     		env,
-    		st,
+    		rd,
     		header_blob,
     		"Coverage",
     		"application/coverage",
@@ -367,19 +389,230 @@ sp_process_coverage20(
 axiom_node_t *
 sp_process_tiff20(
     const axutil_env_t *env,
-    axutil_stream_t    *st,
-    hh_values *hh)
+    sp_reader          *rd,
+    char               *content_type)
 {
     return sp_make_MTOM_node20(
     		env,
-    		st,
+    		rd,
     		NULL,
     		"Coverage",
-    		hh->values[SP_HH_CONTENTTYPE],
+    		content_type,
     		"wcs",
     		"http://www.opengis.net/wcs/2.0");
 }
 
+//-----------------------------------------------------------------------------
+// A binary part of a multipart response, waiting to be attached.
+struct sp_wcs_part_struct
+{
+    axiom_data_handler_t *dh;
+    axis2_char_t         *cid;     // Content-ID without <>, or NULL
+};
+
+typedef struct sp_wcs_part_struct sp_wcs_part;
+
+//-----------------------------------------------------------------------------
+// Find the text node below node (or its siblings) whose text is
+// "cid:<cid>", as in gml:fileReference.
+static axiom_node_t *sp_find_cid_ref(
+    const axutil_env_t *env,
+    axiom_node_t       *node,
+    const char         *cid)
+{
+    const size_t cid_len = strlen(cid);
+
+    for ( ; node; node = axiom_node_get_next_sibling(node, env))
+    {
+        axiom_types_t tt = axiom_node_get_node_type(node, env);
+        if (AXIOM_ELEMENT == tt)
+        {
+            axiom_node_t *found =
+                sp_find_cid_ref(env, axiom_node_get_first_child(node, env), cid);
+            if (found) return found;
+        }
+        else if (AXIOM_TEXT == tt)
+        {
+            axiom_text_t *text = axiom_node_get_data_element(node, env);
+            const char   *v    = text ? axiom_text_get_value(text, env) : NULL;
+            if (NULL == v) continue;
+
+            v = skipBlanks((char *) v);
+            if (strncmp(v, "cid:", 4) || strncmp(v + 4, cid, cid_len)) continue;
+            if ('\0' == *skipChars((char *) v + 4 + cid_len, " \t\r\n"))
+            {
+                return node;
+            }
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/** Attach a binary part to the coverage description: in place of the
+ * reference to it if there is one, keeping its Content-ID so that other
+ * references still resolve, else as an additional wcs:Coverage child.
+ * Also used to restore the parts of a spooled job result, see sp_job.c.
+ * @param env
+ * @param gml_node the coverage description.
+ * @param dh the data of the part, owned by the tree from here on.
+ * @param cid Content-ID of the part without <>, or NULL.
+ */
+void sp_attach_dh20(
+    const axutil_env_t   *env,
+    axiom_node_t         *gml_node,
+    axiom_data_handler_t *dh,
+    const axis2_char_t   *cid)
+{
+    axiom_node_t *ref = cid ? sp_find_cid_ref(env, gml_node, cid) : NULL;
+
+    if (ref)
+    {
+        axiom_node_t *parent    = axiom_node_get_parent(ref, env);
+        axiom_node_t *data_node = NULL;
+
+        axiom_node_free_tree(axiom_node_detach(ref, env), env);
+        axiom_text_t *data_text = axiom_text_create_with_data_handler(
+            env, parent, dh, &data_node);
+        axiom_text_set_optimize(data_text, env, AXIS2_TRUE);
+        axiom_text_set_content_id(data_text, env, cid);
+    }
+    else
+    {
+        SP_LOG_WARNING("coverage part '%s' is not referenced by the"
+                       " coverage description", cid ? cid : "");
+        axiom_node_add_child(gml_node, env,
+            sp_make_MTOM_dh_node20(env, dh,
+                                   "Coverage",
+                                   "wcs",
+                                   "http://www.opengis.net/wcs/2.0"));
+    }
+}
+
+//-----------------------------------------------------------------------------
+/*
+ * Decode a multipart/mixed coverage response in one pass, one part at
+ * a time.  The first XML part, the GML description of the coverage, is
+ * parsed straight from the stream and becomes the response; each other
+ * part becomes an MTOM attachment of its own (see sp_attach_dh20).
+ * Without a GML part a single binary part is returned as wcs:Coverage,
+ * as for a plain image response.  Without a usable boundary the whole
+ * body is returned as one attachment, as before.
+ */
+axiom_node_t *
+sp_process_multipart20(
+    const axutil_env_t *env,
+    sp_reader          *rd,
+    char               *content_type)
+{
+    axiom_node_t        *gml_node = NULL;
+    axutil_array_list_t *parts    = NULL;
+    sp_mime              mm;
+    sp_headers           hh;
+    int                  rc;
+    int                  i;
+
+    if (sp_mime_init(&mm, rd, content_type) < 0)
+    {
+        SP_LOG_WARNING("no boundary in '%s', coverage kept as one part",
+                       content_type);
+        return sp_process_coverage20(env, content_type, rd);
+    }
+
+    // content_type points into the reader's buffer; not valid from here on
+    parts = axutil_array_list_create(env, 4);
+    sp_headers_init(&hh);
+
+    while (1 == (rc = sp_mime_next(env, &mm, &hh)))
+    {
+        const char *ctype = sp_headers_value(&hh, "Content-Type");
+
+        if (NULL == gml_node && ctype && strstr(ctype, "xml"))
+        {
+            gml_node = sp_process_xml_io(env, sp_mime_read_CB, &mm);
+            if (NULL == gml_node)
+            {
+                rc = -2;    // error already set
+                break;
+            }
+            continue;
+        }
+
+        int   data_len = 0;
+        char *data     = sp_mime_load(env, &mm,
+            sp_headers_long(&hh, "Content-Length", -1), &data_len);
+        if (NULL == data)
+        {
+            SP_ERROR(env, SP_USER_ERR_DATA_LOAD);
+            rc = -2;
+            break;
+        }
+
+        sp_wcs_part *part =
+            (sp_wcs_part *) AXIS2_MALLOC(env->allocator, sizeof(sp_wcs_part));
+        if (NULL == part)
+        {
+            AXIS2_FREE(env->allocator, data);
+            SP_ERROR(env, SP_USER_ERR_DATA_LOAD);
+            rc = -2;
+            break;
+        }
+        part->dh = axiom_data_handler_create(
+            env, NULL, ctype ? ctype : "application/octet-stream");
+        axiom_data_handler_set_binary_data(
+            part->dh, env, (axis2_byte_t *) data, data_len);
+
+        part->cid = NULL;
+        const char *cid = sp_headers_value(&hh, "Content-ID");
+        if (cid)
+        {
+            if ('<' == *cid) cid++;
+            part->cid = axutil_strdup(env, cid);
+            char *gt  = strrchr(part->cid, '>');
+            if (gt) *gt = '\0';
+        }
+        axutil_array_list_add(parts, env, part);
+    }
+    sp_headers_free(env, &hh);
+
+    if (mm.truncated)
+    {
+        SP_LOG_WARNING("multipart response ends without a close delimiter");
+    }
+
+    const int n_parts = axutil_array_list_size(parts, env);
+    if (rc >= 0 && NULL == gml_node && n_parts > 0)
+    {
+        sp_wcs_part *part = axutil_array_list_get(parts, env, 0);
+        gml_node = sp_make_MTOM_dh_node20(env, part->dh,
+                                          "Coverage",
+                                          "wcs",
+                                          "http://www.opengis.net/wcs/2.0");
+        part->dh = NULL;
+    }
+    if (rc < 0 || NULL == gml_node)
+    {
+        if (gml_node) axiom_node_free_tree(gml_node, env);
+        gml_node = NULL;
+        if (-2 != rc) SP_ERROR(env, SP_USER_ERR_DATA_LOAD);
+    }
+
+    for (i = 0; i < n_parts; i++)
+    {
+        sp_wcs_part *part = axutil_array_list_get(parts, env, i);
+        if (part->dh)
+        {
+            if (gml_node) sp_attach_dh20(env, gml_node, part->dh, part->cid);
+            else          axiom_data_handler_free(part->dh, env);
+        }
+        if (part->cid) AXIS2_FREE(env->allocator, part->cid);
+        AXIS2_FREE(env->allocator, part);
+    }
+    axutil_array_list_free(parts, env);
+
+    return gml_node;
+}
+
 //-----------------------------------------------------------------------------
 axiom_node_t *
 sp_build_response20(
@@ -387,45 +620,58 @@ sp_build_response20(
     const sp_props     *props,
     axutil_stream_t    *st)
 {
-    char tmpBuf[255];
     axiom_node_t *return_node = NULL;
 
-    hh_values hh;
-    sp_initHttpHeaderStruct(&hh);
+    // The reader's buffer lives on the stack unless the headers are large;
+    // the headers are parsed where they lie in it.
+    sp_reader rd;
+    sp_reader_init(env, &rd, st);
 
-    char header_buf[2560];
-    if (sp_load_header_blob(env, st, header_buf, 2560) < 0)
+    sp_headers hh;
+    sp_headers_init(&hh);
+
+    size_t header_len = 0;
+    char  *header_blk = sp_reader_header_block(&rd, &header_len);
+    sp_stats_first_byte();
+    if (NULL == header_blk)
     {
-    	// TODO:  Could allocate a bigger buffer, copy chars, etc.
-    	// In practice we never expect the headers to be that big, or if
-    	//  it does come up then something is wrong.
+        sp_reader_free(&rd);
         SP_ERROR(env, SP_USER_ERR_CONTENTHEADERS);
         return NULL;
     }
-    sp_parseHttpHeaders_buf(env, &hh, header_buf);
+    sp_stats_add_bytes_in(header_len);
+    sp_stats_note_response(header_blk, header_len);
+
+    sp_stamp_t t0 = sp_stats_now();
+    sp_headers_parse(env, &hh, header_blk, header_len);
+    sp_stats_phase(SP_PH_HEADERS, t0);
 
-    char *contentTypeStr = hh.values[SP_HH_CONTENTTYPE];
+    char *contentTypeStr = (char *) sp_headers_value(&hh, "Content-Type");
     if ( NULL == contentTypeStr)
     {
-        sp_freeHttpHeaders(env, &hh);
+        sp_headers_free(env, &hh);
+        sp_reader_free(&rd);
         SP_ERROR(env, SP_USER_ERR_CONTENTHEADERS);
         return NULL;
     }
+    t0 = sp_stats_now();
     switch(rp_get_contentType(contentTypeStr))
     {
     case SP_RESP_XML_TYPE:
     case SP_RESP_APP_SEXML_TYPE:
-        return_node =  sp_process_xml_st(env, st, NULL);
+        return_node =  sp_process_xml_rd(env, &rd, NULL);
+        sp_stats_phase(SP_PH_XML_BUILD, t0);
         break;
 
     case SP_RESP_MIXED_TYPE:
     	// A mixed type response generally signifies a coverage response.
-    	// TODO:  check that we really do have a coverage!
-        return_node =  sp_process_coverage20(env, contentTypeStr, st);
+        return_node =  sp_process_multipart20(env, &rd, contentTypeStr);
+        sp_stats_phase(SP_PH_MTOM_LOAD, t0);
         break;
 
     case SP_RESP_TIFF_TYPE:
-        return_node =  sp_process_tiff20(env, st, &hh);
+        return_node =  sp_process_tiff20(env, &rd, contentTypeStr);
+        sp_stats_phase(SP_PH_MTOM_LOAD, t0);
         break;
 
     default:
@@ -436,11 +682,12 @@ sp_build_response20(
     			contentTypeStr);
     	if (rp_getDebugMode(env, props))
     	{
-    		sp_dump_bad_content(env, contentTypeStr, st, header_buf);
+    		sp_dump_bad_content(env, contentTypeStr, &rd, NULL);
     	}
     }
 
-    sp_freeHttpHeaders(env, &hh);
+    sp_headers_free(env, &hh);
+    sp_reader_free(&rd);
     return return_node;
 
 }
@@ -516,8 +763,7 @@ sp_update_lineage(
     		rp_find_named_child(env, return_node, "EOMetadata", 1);
     if (NULL == eom_node)
     {
-    	rp_log_error(env, "*Warning S2P(%s:%d): %s node not found.\n",
-    			__FILE__, __LINE__,  "EOMetadata");
+    	SP_LOG_WARNING("%s node not found.", "EOMetadata");
     	return;
     }
 
@@ -540,8 +786,7 @@ sp_update_lineage(
     			axutil_strlen(lin_whsp_str) - axutil_strlen(eom_whsp_str);
     	if (whspace_indent < 0 || whspace_indent >12)
     	{
-    		rp_log_error(env,
-    				"*Warning S2P: funny whitespace indent (%d) calculated.\n",
+    		SP_LOG_WARNING("funny whitespace indent (%d) calculated.",
     				whspace_indent);
     		whspace_indent = SP_DEFAULT_WHSPACE;
     	}
@@ -0,0 +1,700 @@
+/*
+ * Soap Proxy - response parsing benchmark
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Replays backend responses through the response parsing code of the
+ * soap proxy, with an in-memory axutil_stream_t standing in for the
+ * backend socket or the mapserv pipe.  Reports throughput and allocator
+ * traffic per replayed response.
+ *
+ * Two kinds of input are used:
+ *   - recorded responses given on the command line (or the fixtures in
+ *     test/bench/fixtures), each file holding the response exactly as the
+ *     proxy reads it, i.e. the headers, an empty line, and the body;
+ *   - synthetic multipart/mixed coverages in the form produced by
+ *     mapserver, from 1K up to the size given with -m.  The payload of
+ *     these is generated on the fly, so only the proxy's own copy of the
+ *     data is held in memory.
+ *
+ * Each response is run through sp_build_response20 (mode 'response'), the
+ * same path used for live requests.  Multipart responses are also split
+ * into their parts with rp_fill_buff_CB (mode 'parts').
+ *
+ * See test/README.txt for usage.
+ */
+
+/**
+ * @file sp_bench.c
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <glob.h>
+
+#include <axiom_xml_reader.h>
+
+#include "soap_proxy.h"
+
+#define SP_BENCH_MODE_RESPONSE 0
+#define SP_BENCH_MODE_PARTS    1
+
+#define SP_BENCH_PATTERN_LEN   65536
+#define SP_BENCH_MIN_SIZE      1024
+
+//
+// A replayed response: 'head' and 'tail' are held in memory, between
+// them come 'body_len' bytes of generated payload.
+//
+struct sp_bench_src_struct
+{
+    char       *name;
+    int         multipart;
+    char       *head;
+    size_t      head_len;
+    size_t      body_len;
+    const char *tail;
+    size_t      tail_len;
+
+    size_t      pos;
+};
+
+typedef struct sp_bench_src_struct sp_bench_src;
+
+//
+// Allocation counters, maintained by the wrapped env allocator.
+//
+struct sp_bench_alloc_struct
+{
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long long bytes;
+
+    void *(AXIS2_CALL *malloc_fn)(axutil_allocator_t *a, size_t size);
+    void *(AXIS2_CALL *realloc_fn)(axutil_allocator_t *a, void *p, size_t size);
+    void  (AXIS2_CALL *free_fn)(axutil_allocator_t *a, void *p);
+};
+
+static struct sp_bench_alloc_struct sp_bench_alloc;
+
+// The stream read callback has no context pointer, the benchmark
+//  is single threaded so the current source is kept here.
+static sp_bench_src *sp_bench_cur = NULL;
+
+static char sp_bench_pattern[SP_BENCH_PATTERN_LEN];
+
+static const char *sp_bench_find_name = "CoverageId";
+static double      sp_bench_min_secs  = 1.0;
+static long        sp_bench_max_iter  = 100000;
+
+//-----------------------------------------------------------------------------
+static void *AXIS2_CALL sp_bench_malloc(
+    axutil_allocator_t *allocator,
+    size_t              size)
+{
+    sp_bench_alloc.allocs++;
+    sp_bench_alloc.bytes += size;
+    return sp_bench_alloc.malloc_fn(allocator, size);
+}
+
+//-----------------------------------------------------------------------------
+static void *AXIS2_CALL sp_bench_realloc(
+    axutil_allocator_t *allocator,
+    void               *ptr,
+    size_t              size)
+{
+    sp_bench_alloc.allocs++;
+    sp_bench_alloc.bytes += size;
+    if (NULL != ptr) sp_bench_alloc.frees++;
+    return sp_bench_alloc.realloc_fn(allocator, ptr, size);
+}
+
+//-----------------------------------------------------------------------------
+static void AXIS2_CALL sp_bench_free(
+    axutil_allocator_t *allocator,
+    void               *ptr)
+{
+    if (NULL != ptr) sp_bench_alloc.frees++;
+    sp_bench_alloc.free_fn(allocator, ptr);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Route all allocations made through env->allocator via the counters.
+ * @param env
+ */
+static void sp_bench_wrap_allocator(const axutil_env_t *env)
+{
+    axutil_allocator_t *a = env->allocator;
+
+    sp_bench_alloc.malloc_fn  = a->malloc_fn;
+    sp_bench_alloc.realloc_fn = a->realloc;
+    sp_bench_alloc.free_fn    = a->free_fn;
+
+    a->malloc_fn = sp_bench_malloc;
+    a->realloc   = sp_bench_realloc;
+    a->free_fn   = sp_bench_free;
+}
+
+//-----------------------------------------------------------------------------
+static double sp_bench_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+static size_t sp_bench_total_len(const sp_bench_src *src)
+{
+    return src->head_len + src->body_len + src->tail_len;
+}
+
+//-----------------------------------------------------------------------------
+// Read callback of the in-memory stream, serves sp_bench_cur.
+//
+static int AXIS2_CALL sp_bench_read(
+    axutil_stream_t    *st,
+    const axutil_env_t *env,
+    void               *buffer,
+    size_t              count)
+{
+    sp_bench_src *src    = sp_bench_cur;
+    char         *b      = (char *) buffer;
+    size_t        n_done = 0;
+
+    while (n_done < count)
+    {
+        size_t pos = src->pos;
+        size_t n   = count - n_done;
+
+        if (pos < src->head_len)
+        {
+            if (n > src->head_len - pos) n = src->head_len - pos;
+            memcpy(b, src->head + pos, n);
+        }
+        else if ((pos -= src->head_len) < src->body_len)
+        {
+            size_t off = pos % SP_BENCH_PATTERN_LEN;
+            if (n > src->body_len - pos)         n = src->body_len - pos;
+            if (n > SP_BENCH_PATTERN_LEN - off)  n = SP_BENCH_PATTERN_LEN - off;
+            memcpy(b, sp_bench_pattern + off, n);
+        }
+        else if ((pos -= src->body_len) < src->tail_len)
+        {
+            if (n > src->tail_len - pos) n = src->tail_len - pos;
+            memcpy(b, src->tail + pos, n);
+        }
+        else
+        {
+            break;
+        }
+
+        b         += n;
+        n_done    += n;
+        src->pos  += n;
+    }
+
+    return (int) n_done;
+}
+
+//-----------------------------------------------------------------------------
+static axutil_stream_t *sp_bench_open(
+    const axutil_env_t *env,
+    sp_bench_src       *src)
+{
+    axutil_stream_t *st = axutil_stream_create_basic(env);
+    if (NULL == st) return NULL;
+    axutil_stream_set_read(st, env, sp_bench_read);
+
+    src->pos     = 0;
+    sp_bench_cur = src;
+    return st;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Replay src once through sp_build_response20, as done by
+ * rp_invokeBackend for a live response.
+ * @return 0 on success, -1 if no response node was built.
+ */
+static int sp_bench_response(
+    const axutil_env_t *env,
+    sp_bench_src       *src)
+{
+    sp_props props;
+    memset(&props, 0, sizeof(props));
+
+    axutil_stream_t *st = sp_bench_open(env, src);
+    if (NULL == st) return -1;
+
+    axiom_node_t *node = sp_build_response20(env, &props, st);
+    if (NULL != node)
+    {
+        if (sp_bench_find_name)
+        {
+            rp_find_named_node_re(env, node, sp_bench_find_name, NULL);
+        }
+        axiom_node_free_tree(node, env);
+    }
+
+    axutil_stream_free(st, env);
+    return node ? 0 : -1;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Replay a multipart response once, splitting it into its parts with
+ * rp_fill_buff_CB.  XML parts are built into an AXIOM tree, the
+ * others are read and dropped.
+ * @return the number of parts, or -1 on error.
+ */
+static int sp_bench_parts(
+    const axutil_env_t *env,
+    sp_bench_src       *src)
+{
+    char header_buf[2560];
+    char boundId[SP_HTTP_BOUNDLEN+4];
+    char data_buf[SP_IMG_BUF_SIZE];
+    int  n_parts = 0;
+
+    axutil_stream_t *st = sp_bench_open(env, src);
+    if (NULL == st) return -1;
+
+    hh_values hh;
+    sp_initHttpHeaderStruct(&hh);
+    if (sp_load_header_blob(env, st, header_buf, 2560) < 0)
+    {
+        axutil_stream_free(st, env);
+        return -1;
+    }
+    sp_parseHttpHeaders_buf(env, &hh, header_buf);
+    if (NULL == hh.values[SP_HH_CONTENTTYPE] ||
+        SP_RESP_MIXED_TYPE != rp_get_contentType(hh.values[SP_HH_CONTENTTYPE]))
+    {
+        sp_freeHttpHeaders(env, &hh);
+        axutil_stream_free(st, env);
+        return -1;
+    }
+    scan_boundId(boundId, hh.values[SP_HH_CONTENTTYPE]);
+    sp_freeHttpHeaders(env, &hh);
+
+    // Skip the preamble, up to the first boundary
+    Rp_cb_ctx ctx;
+    init_rp_cb_ctx(env, &ctx);
+    ctx.st    = st;
+    ctx.bound = boundId;
+    while (rp_fill_buff_CB(data_buf, SP_IMG_BUF_SIZE, &ctx) > 0)
+        ;
+
+    while ( 1 )
+    {
+        // The stream is left immediately after the boundary string,
+        //  which is followed either by a newline or by the closing '--'.
+        char c = '\0';
+        if (axutil_stream_read(st, env, &c, 1) < 1 || '-' == c) break;
+
+        sp_initHttpHeaderStruct(&hh);
+        if (sp_load_header_blob(env, st, header_buf, 2560) < 0)
+        {
+            n_parts = -1;
+            break;
+        }
+        sp_parseHttpHeaders_buf(env, &hh, header_buf);
+
+        char *ctype = hh.values[SP_HH_CONTENTTYPE];
+        if (ctype && strstr(ctype, "xml"))
+        {
+            axiom_node_t *node = sp_process_xml_st(env, st, boundId);
+            if (NULL == node)
+            {
+                sp_freeHttpHeaders(env, &hh);
+                n_parts = -1;
+                break;
+            }
+            axiom_node_free_tree(node, env);
+        }
+        else
+        {
+            init_rp_cb_ctx(env, &ctx);
+            ctx.st    = st;
+            ctx.bound = boundId;
+            while (rp_fill_buff_CB(data_buf, SP_IMG_BUF_SIZE, &ctx) > 0)
+                ;
+        }
+        sp_freeHttpHeaders(env, &hh);
+        n_parts++;
+    }
+
+    axutil_stream_free(st, env);
+    return n_parts;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Replay src repeatedly for at least sp_bench_min_secs, and print one
+ * line of results.
+ */
+static void sp_bench_run(
+    const axutil_env_t *env,
+    sp_bench_src       *src,
+    const int           mode)
+{
+    unsigned long      allocs0 = sp_bench_alloc.allocs;
+    unsigned long      frees0  = sp_bench_alloc.frees;
+    unsigned long long bytes0  = sp_bench_alloc.bytes;
+
+    long   n_iter   = 0;
+    long   n_failed = 0;
+    double elapsed  = 0.0;
+    double t0       = sp_bench_secs();
+
+    do
+    {
+        int rc = (SP_BENCH_MODE_PARTS == mode) ?
+            sp_bench_parts(env, src) :
+            sp_bench_response(env, src);
+        if (rc < 0) n_failed++;
+        n_iter++;
+        elapsed = sp_bench_secs() - t0;
+    } while (elapsed < sp_bench_min_secs && n_iter < sp_bench_max_iter);
+
+    double total_mb = (double) sp_bench_total_len(src) * n_iter / 1e6;
+
+    printf("%-36.36s %-8s %11lu %7ld %9.1f %11.1f %11.1f %9.1f%s\n",
+           src->name,
+           (SP_BENCH_MODE_PARTS == mode) ? "parts" : "response",
+           (unsigned long) sp_bench_total_len(src),
+           n_iter,
+           elapsed > 0.0 ? total_mb / elapsed : 0.0,
+           (double)(sp_bench_alloc.allocs - allocs0) / n_iter,
+           (double)(sp_bench_alloc.bytes  - bytes0)  / n_iter / 1024.0,
+           ((double)(sp_bench_alloc.allocs - allocs0) -
+            (double)(sp_bench_alloc.frees  - frees0)) / n_iter,
+           n_failed ? "  FAILED" : "");
+    fflush(stdout);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Load a recorded response.  Lines in the header section are expected to
+ * be terminated as the backend sends them; a file saved with 'curl -i' or
+ * captured from mapserv can be used as is.
+ * @return 0 on success.
+ */
+static int sp_bench_load_file(
+    const char   *path,
+    sp_bench_src *src)
+{
+    memset(src, 0, sizeof(sp_bench_src));
+
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp)
+    {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+
+    src->head = malloc(len + 1);
+    if (NULL == src->head || fread(src->head, 1, len, fp) != (size_t) len)
+    {
+        perror(path);
+        fclose(fp);
+        free(src->head);
+        return -1;
+    }
+    fclose(fp);
+    src->head[len] = '\0';
+
+    // Look for a multipart Content-Type in the header section only.
+    char *hdr_end = strstr(src->head, "\n\n");
+    char *r_end   = strstr(src->head, "\r\n\r\n");
+    if (NULL == hdr_end || (r_end && r_end < hdr_end)) hdr_end = r_end;
+    char *mp = strcasestr(src->head, "multipart/mixed");
+    src->multipart = (mp && (NULL == hdr_end || mp < hdr_end));
+
+    const char *base = strrchr(path, '/');
+    src->name     = strdup(base ? base+1 : path);
+    src->head_len = len;
+    src->tail     = "";
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Build a synthetic multipart/mixed coverage response of total_len bytes,
+ * laid out as mapserver sends it: a GML coverage description followed by
+ * the image.
+ */
+static void sp_bench_make_multipart(
+    sp_bench_src *src,
+    const size_t  total_len)
+{
+    static const char *head_fmt =
+        "Content-Type: multipart/mixed; boundary=wcs\n"
+        "\n"
+        "--wcs\n"
+        "Content-Type: text/xml\n"
+        "Content-Description: coverage description\n"
+        "Content-Transfer-Encoding: 8bit\n"
+        "Content-ID: coverage/wcs.xml\n"
+        "Content-Disposition: inline\n"
+        "\n"
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<gmlcov:RectifiedGridCoverage"
+        " xmlns:gml=\"http://www.opengis.net/gml/3.2\""
+        " xmlns:gmlcov=\"http://www.opengis.net/gmlcov/1.0\""
+        " xmlns:swe=\"http://www.opengis.net/swe/2.0\""
+        " xmlns:xlink=\"http://www.w3.org/1999/xlink\""
+        " gml:id=\"bench_%lu\">\n"
+        "  <gml:boundedBy>\n"
+        "    <gml:Envelope srsName=\"http://www.opengis.net/def/crs/EPSG/0/4326\""
+        " axisLabels=\"lat long\" uomLabels=\"deg deg\" srsDimension=\"2\">\n"
+        "      <gml:lowerCorner>45.2530212402 13.7513494492</gml:lowerCorner>\n"
+        "      <gml:upperCorner>46.4069252014 15.2301635742</gml:upperCorner>\n"
+        "    </gml:Envelope>\n"
+        "  </gml:boundedBy>\n"
+        "  <gml:domainSet>\n"
+        "    <gml:RectifiedGrid dimension=\"2\" gml:id=\"bench_%lu_grid\">\n"
+        "      <gml:limits><gml:GridEnvelope>"
+        "<gml:low>0 0</gml:low><gml:high>8063 6307</gml:high>"
+        "</gml:GridEnvelope></gml:limits>\n"
+        "      <gml:axisLabels>lat long</gml:axisLabels>\n"
+        "    </gml:RectifiedGrid>\n"
+        "  </gml:domainSet>\n"
+        "  <gml:rangeSet>\n"
+        "    <gml:File>\n"
+        "      <gml:rangeParameters xlink:arcrole=\"fileReference\""
+        " xlink:href=\"cid:coverage/bench.tif\" xlink:role=\"image/tiff\"/>\n"
+        "      <gml:fileReference>cid:coverage/bench.tif</gml:fileReference>\n"
+        "      <gml:fileStructure/>\n"
+        "      <gml:mimeType>image/tiff</gml:mimeType>\n"
+        "    </gml:File>\n"
+        "  </gml:rangeSet>\n"
+        "  <gmlcov:rangeType><swe:DataRecord><swe:field name=\"1\">"
+        "<swe:Quantity><swe:uom code=\"W.m-2.Sr-1\"/></swe:Quantity>"
+        "</swe:field></swe:DataRecord></gmlcov:rangeType>\n"
+        "</gmlcov:RectifiedGridCoverage>\n"
+        "--wcs\n"
+        "Content-Type: image/tiff\n"
+        "Content-Description: coverage data\n"
+        "Content-Transfer-Encoding: binary\n"
+        "Content-ID: coverage/bench.tif\n"
+        "Content-Disposition: INLINE\n"
+        "\n";
+
+    memset(src, 0, sizeof(sp_bench_src));
+
+    src->head     = malloc(strlen(head_fmt) + 64);
+    sprintf(src->head, head_fmt,
+            (unsigned long) total_len, (unsigned long) total_len);
+    src->head_len = strlen(src->head);
+    src->tail     = "\n--wcs--\n";
+    src->tail_len = strlen(src->tail);
+    src->multipart = 1;
+
+    size_t fixed = src->head_len + src->tail_len;
+    src->body_len = (total_len > fixed) ? total_len - fixed : 0;
+
+    char name[64];
+    if (total_len >= 1024*1024*1024)
+        sprintf(name, "multipart-%luG", (unsigned long)
+                ((total_len + (1024*1024*1024)/2) / (1024*1024*1024)));
+    else if (total_len >= 1024*1024)
+        sprintf(name, "multipart-%luM", (unsigned long)(total_len/(1024*1024)));
+    else
+        sprintf(name, "multipart-%luK", (unsigned long)(total_len/1024));
+    src->name = strdup(name);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_bench_free_src(sp_bench_src *src)
+{
+    free(src->name);
+    free(src->head);
+}
+
+//-----------------------------------------------------------------------------
+// Fill the payload pattern with pseudo-random bytes, similar in
+// distribution to compressed or noisy image data.
+// 0xff is left out: rp_fill_buff_CB reads into a char and takes it for
+//  EOF, which would cut the 'parts' replay short.
+//
+static void sp_bench_init_pattern(void)
+{
+    unsigned int x = 2463534242U;
+    int i;
+    for (i = 0; i < SP_BENCH_PATTERN_LEN; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sp_bench_pattern[i] = (char)((x >> 24) % 255);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Parse a size with an optional k, M or G suffix.
+//
+static size_t sp_bench_parse_size(const char *str)
+{
+    char *end = NULL;
+    double val = strtod(str, &end);
+    switch (*end)
+    {
+    case 'k': case 'K': val *= 1024.0;               break;
+    case 'm': case 'M': val *= 1024.0*1024.0;        break;
+    case 'g': case 'G': val *= 1024.0*1024.0*1024.0; break;
+    default: break;
+    }
+    return val > 0.0 ? (size_t) val : 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_bench_replay_file(
+    const axutil_env_t *env,
+    const char         *path)
+{
+    sp_bench_src src;
+    if (0 != sp_bench_load_file(path, &src)) return;
+
+    sp_bench_run(env, &src, SP_BENCH_MODE_RESPONSE);
+    if (src.multipart)
+    {
+        sp_bench_run(env, &src, SP_BENCH_MODE_PARTS);
+    }
+    sp_bench_free_src(&src);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_bench_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-t secs] [-i max_iterations] [-m max_size] [-n name]\n"
+        "          [-x] [-d fixtures_dir] [response_file ...]\n"
+        "  -t  minimum time to spend on each input (default 1.0)\n"
+        "  -i  maximum number of replays of each input (default 100000)\n"
+        "  -m  largest synthetic multipart coverage, suffix k, M or G,\n"
+        "      at most 2G (default 64M)\n"
+        "  -n  element searched for with rp_find_named_node_re in xml\n"
+        "      responses, '-' for none (default CoverageId)\n"
+        "  -x  skip the synthetic coverages\n"
+        "  -d  replay all *.resp files in fixtures_dir\n",
+        prog);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    size_t      max_size     = 64*1024*1024;
+    int         no_synthetic = 0;
+    const char *fixtures_dir = NULL;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "t:i:m:n:xd:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': sp_bench_min_secs  = atof(optarg);                 break;
+        case 'i': sp_bench_max_iter  = atol(optarg);                 break;
+        case 'm': max_size           = sp_bench_parse_size(optarg);  break;
+        case 'n': sp_bench_find_name =
+                      strcmp(optarg, "-") ? optarg : NULL;           break;
+        case 'x': no_synthetic       = 1;                            break;
+        case 'd': fixtures_dir       = optarg;                       break;
+        default:
+            sp_bench_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (sp_bench_max_iter < 1) sp_bench_max_iter = 1;
+
+    // sp_load_binary_file keeps the length in an int.
+    if (max_size > INT_MAX) max_size = INT_MAX;
+
+    axutil_env_t *env =
+        axutil_env_create_all("sp_bench.log", AXIS2_LOG_LEVEL_ERROR);
+    if (NULL == env)
+    {
+        fprintf(stderr, "%s: cannot create axis2 environment\n", argv[0]);
+        return 1;
+    }
+    axiom_xml_reader_init();
+    sp_bench_wrap_allocator(env);
+    sp_bench_init_pattern();
+
+    printf("%-36s %-8s %11s %7s %9s %11s %11s %9s\n",
+           "input", "mode", "bytes", "iters", "MB/s",
+           "allocs/req", "KB/req", "live/req");
+
+    if (fixtures_dir)
+    {
+        char    pattern[1024];
+        glob_t  gl;
+        size_t  j;
+
+        snprintf(pattern, sizeof(pattern), "%s/*.resp", fixtures_dir);
+        if (0 == glob(pattern, 0, NULL, &gl))
+        {
+            for (j = 0; j < gl.gl_pathc; j++)
+            {
+                sp_bench_replay_file(env, gl.gl_pathv[j]);
+            }
+            globfree(&gl);
+        }
+    }
+
+    int i;
+    for (i = optind; i < argc; i++)
+    {
+        sp_bench_replay_file(env, argv[i]);
+    }
+
+    if (!no_synthetic)
+    {
+        sp_bench_src src;
+        size_t size = SP_BENCH_MIN_SIZE;
+        while (1)
+        {
+            sp_bench_make_multipart(&src, size);
+            sp_bench_run(env, &src, SP_BENCH_MODE_RESPONSE);
+            sp_bench_run(env, &src, SP_BENCH_MODE_PARTS);
+            sp_bench_free_src(&src);
+
+            if (size >= max_size) break;
+            size = (size > max_size / 16) ? max_size : size * 16;
+        }
+    }
+
+    axiom_xml_reader_cleanup();
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Soap Proxy - load test harness, stand-in for a BackendURL server
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * A minimal HTTP server answering the POST requests soap_proxy sends to
+ * its BackendURL (see sp_backend_socket) in the way EOxServer would.
+ * One thread per connection, one request per connection.
+ *
+ *  usage: fake_backend [-p port] [-c config_file] [-o key=value ...]
+ *
+ * The keys are those of fake_mapserv.conf.
+ *
+ */
+
+/**
+ * @file fake_backend.c
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "fake_common.h"
+
+#define FAKE_MAX_HEADERS  16384
+#define FAKE_MAX_BODY     (16*1024*1024)
+
+static fake_config fake_cfg;
+
+//-----------------------------------------------------------------------------
+// Read the request headers and body from fd.
+// @return the body, NUL terminated, or NULL on error.
+//
+static char *fake_read_request(int fd)
+{
+    char   *buf  = malloc(FAKE_MAX_HEADERS + 1);
+    size_t  n    = 0;
+    char   *body = NULL;
+
+    if (NULL == buf) return NULL;
+
+    while (n < FAKE_MAX_HEADERS)
+    {
+        ssize_t r = read(fd, buf + n, FAKE_MAX_HEADERS - n);
+        if (r < 0 && EINTR == errno) continue;
+        if (r <= 0) break;
+        n += r;
+        buf[n] = '\0';
+
+        char *eoh = strstr(buf, "\r\n\r\n");
+        int   eol = 4;
+        char *lf  = strstr(buf, "\n\n");
+        if (NULL == eoh || (lf && lf < eoh))
+        {
+            eoh = lf;
+            eol = 2;
+        }
+        if (NULL == eoh) continue;
+
+        size_t hdr_len = eoh + eol - buf;
+        size_t cont_len = 0;
+        char  *line = buf;
+        while (line && line < eoh)
+        {
+            if (0 == strncasecmp(line, "Content-Length:", 15))
+            {
+                cont_len = strtoul(line + 15, NULL, 10);
+            }
+            line = strchr(line, '\n');
+            if (line) line++;
+        }
+        if (cont_len > FAKE_MAX_BODY) break;
+
+        body = malloc(cont_len + 1);
+        if (NULL == body) break;
+
+        size_t have = n - hdr_len;
+        if (have > cont_len) have = cont_len;
+        memcpy(body, buf + hdr_len, have);
+        while (have < cont_len)
+        {
+            r = read(fd, body + have, cont_len - have);
+            if (r < 0 && EINTR == errno) continue;
+            if (r <= 0) break;
+            have += r;
+        }
+        body[have] = '\0';
+        break;
+    }
+
+    free(buf);
+    return body;
+}
+
+//-----------------------------------------------------------------------------
+static void *fake_serve(void *arg)
+{
+    int   fd  = (int)(long) arg;
+    char *req = fake_read_request(fd);
+
+    if (req)
+    {
+        fake_delay(&fake_cfg);
+        fake_respond(&fake_cfg, fd, req, "HTTP/1.0 200 OK\r\n");
+        free(req);
+    }
+    else
+    {
+        const char *bad = "HTTP/1.0 400 Bad Request\r\n\r\n";
+        if (write(fd, bad, strlen(bad)) < 0) { /* nothing to do */ }
+    }
+    close(fd);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+static void fake_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-p port] [-c config_file] [-o key=value ...]\n"
+        "  keys: fixtures, latency_ms, jitter_ms, coverage_size,"
+        " error_percent\n",
+        prog);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    int port = 8099;
+    int opt;
+
+    fake_config_init(&fake_cfg);
+
+    while ((opt = getopt(argc, argv, "p:c:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            if (0 != fake_config_load(&fake_cfg, optarg))
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+        {
+            char *eq = strchr(optarg, '=');
+            if (NULL == eq) { fake_usage(argv[0]); return 1; }
+            *eq = '\0';
+            if (0 != fake_config_set(&fake_cfg, optarg, eq+1))
+            {
+                fprintf(stderr, "%s: unknown key '%s'\n", argv[0], optarg);
+                return 1;
+            }
+            break;
+        }
+        default:
+            fake_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(port);
+
+    if (bind(ls, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(ls, 256) < 0)
+    {
+        perror("fake_backend: bind/listen");
+        return 1;
+    }
+    fprintf(stderr, "fake_backend: listening on 127.0.0.1:%d\n", port);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while ( 1 )
+    {
+        int fd = accept(ls, NULL, NULL);
+        if (fd < 0)
+        {
+            if (EINTR == errno) continue;
+            perror("fake_backend: accept");
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        pthread_t tid;
+        if (0 != pthread_create(&tid, &attr, fake_serve, (void *)(long) fd))
+        {
+            close(fd);
+        }
+    }
+
+    close(ls);
+    return 0;
+}
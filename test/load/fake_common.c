@@ -0,0 +1,395 @@
+/*
+ * Soap Proxy - load test harness, stand-in backend
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Canned and generated responses shared by fake_mapserv and fake_backend.
+ *
+ * The request is classified by the name of the WCS operation it contains.
+ * Capabilities, coverage descriptions and exception reports are taken
+ * from the *.resp files in the fixtures directory (by default those of the
+ * parsing benchmark, test/bench/fixtures).  Coverages are generated: an
+ * uncompressed 8-bit GeoTIFF-shaped image of about coverage_size bytes,
+ * either on its own or, if the request asks for multipart/mixed, preceded
+ * by a GML coverage description, as mapserver sends them.
+ *
+ */
+
+/**
+ * @file fake_common.c
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "fake_common.h"
+
+// Set by the Makefile to test/bench/fixtures
+#ifndef FAKE_FIXTURES_DIR
+#define FAKE_FIXTURES_DIR "."
+#endif
+
+#define FAKE_CHUNK        65536
+#define FAKE_TIFF_WIDTH   1024
+#define FAKE_TIFF_NTAGS   10
+#define FAKE_TIFF_HDRLEN  (8 + 2 + FAKE_TIFF_NTAGS*12 + 4)
+
+static __thread unsigned int fake_seed = 0;
+
+//-----------------------------------------------------------------------------
+static int fake_rand(int n)
+{
+    if (0 == fake_seed)
+    {
+        fake_seed = (unsigned int) time(NULL) ^
+            (unsigned int) getpid() ^ (unsigned int)(uintptr_t) pthread_self();
+    }
+    return n > 0 ? rand_r(&fake_seed) % n : 0;
+}
+
+//-----------------------------------------------------------------------------
+static size_t fake_parse_size(const char *str)
+{
+    char  *end = NULL;
+    double val = strtod(str, &end);
+    switch (*end)
+    {
+    case 'k': case 'K': val *= 1024.0;               break;
+    case 'm': case 'M': val *= 1024.0*1024.0;        break;
+    case 'g': case 'G': val *= 1024.0*1024.0*1024.0; break;
+    default: break;
+    }
+    return val > 0.0 ? (size_t) val : 0;
+}
+
+//-----------------------------------------------------------------------------
+void fake_config_init(fake_config *cfg)
+{
+    memset(cfg, 0, sizeof(fake_config));
+    snprintf(cfg->fixtures, FAKE_PATH_LEN, "%s", FAKE_FIXTURES_DIR);
+    cfg->coverage_size = 1024*1024;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @return 0 if key is known, -1 otherwise.
+ */
+int fake_config_set(
+    fake_config *cfg,
+    const char  *key,
+    const char  *val)
+{
+    if      (0 == strcasecmp(key, "fixtures"))
+        snprintf(cfg->fixtures, FAKE_PATH_LEN, "%s", val);
+    else if (0 == strcasecmp(key, "latency_ms"))
+        cfg->latency_ms = atoi(val);
+    else if (0 == strcasecmp(key, "jitter_ms"))
+        cfg->jitter_ms = atoi(val);
+    else if (0 == strcasecmp(key, "coverage_size"))
+        cfg->coverage_size = fake_parse_size(val);
+    else if (0 == strcasecmp(key, "error_percent"))
+        cfg->error_percent = atoi(val);
+    else
+        return -1;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Read 'key = value' lines from path.  Blank lines and lines starting
+ * with '#' are skipped.
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+int fake_config_load(
+    fake_config *cfg,
+    const char  *path)
+{
+    char  line[FAKE_PATH_LEN + 64];
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp) return -1;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *key = line + strspn(line, " \t");
+        if ('#' == *key || '\n' == *key || '\0' == *key) continue;
+
+        char *val = key + strcspn(key, " \t=");
+        if ('\0' != *val) *val++ = '\0';
+        val += strspn(val, " \t=");
+        val[strcspn(val, "\r\n")] = '\0';
+
+        if (0 != fake_config_set(cfg, key, val))
+        {
+            fprintf(stderr, "%s: unknown key '%s'\n", path, key);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+void fake_delay(const fake_config *cfg)
+{
+    int ms = cfg->latency_ms + fake_rand(cfg->jitter_ms + 1);
+    if (ms > 0) usleep(ms * 1000);
+}
+
+//-----------------------------------------------------------------------------
+static int fake_write(int fd, const void *buf, size_t len)
+{
+    const char *b = (const char *) buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, b, len);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+            return -1;
+        }
+        b   += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int fake_write_str(int fd, const char *str)
+{
+    return fake_write(fd, str, strlen(str));
+}
+
+//-----------------------------------------------------------------------------
+// Send a canned response.  A leading HTTP status line in the file is
+//  replaced by status_line.
+//
+static int fake_send_fixture(
+    const fake_config *cfg,
+    int                fd,
+    const char        *name,
+    const char        *status_line)
+{
+    char  path[FAKE_PATH_LEN + 64];
+    char  buf[FAKE_CHUNK];
+    snprintf(path, sizeof(path), "%s/%s", cfg->fixtures, name);
+
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "fake backend: cannot open %s\n", path);
+        return -1;
+    }
+
+    int    rc    = 0;
+    size_t n     = fread(buf, 1, sizeof(buf), fp);
+    char  *start = buf;
+    if (n > 5 && 0 == strncmp(buf, "HTTP/", 5))
+    {
+        char *nl = memchr(buf, '\n', n);
+        if (nl)
+        {
+            n    -= (nl + 1 - buf);
+            start = nl + 1;
+        }
+    }
+
+    if (status_line) rc = fake_write_str(fd, status_line);
+    while (0 == rc && n > 0)
+    {
+        rc    = fake_write(fd, start, n);
+        n     = fread(buf, 1, sizeof(buf), fp);
+        start = buf;
+    }
+    fclose(fp);
+    return rc;
+}
+
+//-----------------------------------------------------------------------------
+static void fake_tiff_tag(
+    unsigned char *p,
+    int            tag,
+    int            type,
+    uint32_t       value)
+{
+    p[0] = tag & 0xff;  p[1] = tag >> 8;
+    p[2] = type;        p[3] = 0;
+    p[4] = 1;           p[5] = p[6] = p[7] = 0;
+    if (3 == type)
+    {
+        p[8] = value & 0xff; p[9] = (value >> 8) & 0xff;
+        p[10] = p[11] = 0;
+    }
+    else
+    {
+        p[8]  = value & 0xff;         p[9]  = (value >> 8) & 0xff;
+        p[10] = (value >> 16) & 0xff; p[11] = (value >> 24) & 0xff;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write a single-strip uncompressed 8-bit greyscale TIFF of about
+// 'size' bytes.
+//
+static int fake_send_tiff(int fd, size_t size)
+{
+    unsigned char hdr[FAKE_TIFF_HDRLEN];
+    unsigned char buf[FAKE_CHUNK];
+
+    uint32_t height = (size > FAKE_TIFF_HDRLEN + FAKE_TIFF_WIDTH) ?
+        (uint32_t)((size - FAKE_TIFF_HDRLEN) / FAKE_TIFF_WIDTH) : 1;
+    size_t   n_data = (size_t) height * FAKE_TIFF_WIDTH;
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, "II*\0\x08\0\0\0", 8);
+    hdr[8] = FAKE_TIFF_NTAGS;
+
+    unsigned char *t = hdr + 10;
+    fake_tiff_tag(t, 256, 4, FAKE_TIFF_WIDTH);   t += 12;  // ImageWidth
+    fake_tiff_tag(t, 257, 4, height);            t += 12;  // ImageLength
+    fake_tiff_tag(t, 258, 3, 8);                 t += 12;  // BitsPerSample
+    fake_tiff_tag(t, 259, 3, 1);                 t += 12;  // Compression
+    fake_tiff_tag(t, 262, 3, 1);                 t += 12;  // Photometric
+    fake_tiff_tag(t, 273, 4, FAKE_TIFF_HDRLEN);  t += 12;  // StripOffsets
+    fake_tiff_tag(t, 277, 3, 1);                 t += 12;  // SamplesPerPixel
+    fake_tiff_tag(t, 278, 4, height);            t += 12;  // RowsPerStrip
+    fake_tiff_tag(t, 279, 4, (uint32_t) n_data); t += 12;  // StripByteCounts
+    fake_tiff_tag(t, 284, 3, 1);                           // PlanarConfig
+
+    if (fake_write(fd, hdr, sizeof(hdr))) return -1;
+
+    size_t i;
+    for (i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (unsigned char)((i * 31) ^ (i >> 10));
+    }
+    while (n_data > 0)
+    {
+        size_t n = n_data < sizeof(buf) ? n_data : sizeof(buf);
+        if (fake_write(fd, buf, n)) return -1;
+        n_data -= n;
+    }
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static int fake_send_coverage(
+    const fake_config *cfg,
+    int                fd,
+    const char        *req,
+    const char        *status_line)
+{
+    static const char *gml =
+        "--wcs\n"
+        "Content-Type: text/xml\n"
+        "Content-Description: coverage description\n"
+        "Content-Transfer-Encoding: 8bit\n"
+        "Content-ID: coverage/wcs.xml\n"
+        "Content-Disposition: inline\n"
+        "\n"
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<gmlcov:RectifiedGridCoverage"
+        " xmlns:gml=\"http://www.opengis.net/gml/3.2\""
+        " xmlns:gmlcov=\"http://www.opengis.net/gmlcov/1.0\""
+        " xmlns:xlink=\"http://www.w3.org/1999/xlink\""
+        " gml:id=\"fake_coverage\">\n"
+        "  <gml:domainSet>\n"
+        "    <gml:RectifiedGrid dimension=\"2\" gml:id=\"fake_coverage_grid\">\n"
+        "      <gml:axisLabels>lat long</gml:axisLabels>\n"
+        "    </gml:RectifiedGrid>\n"
+        "  </gml:domainSet>\n"
+        "  <gml:rangeSet>\n"
+        "    <gml:File>\n"
+        "      <gml:rangeParameters xlink:arcrole=\"fileReference\""
+        " xlink:href=\"cid:coverage/fake.tif\" xlink:role=\"image/tiff\"/>\n"
+        "      <gml:fileReference>cid:coverage/fake.tif</gml:fileReference>\n"
+        "      <gml:fileStructure/>\n"
+        "      <gml:mimeType>image/tiff</gml:mimeType>\n"
+        "    </gml:File>\n"
+        "  </gml:rangeSet>\n"
+        "</gmlcov:RectifiedGridCoverage>\n"
+        "--wcs\n"
+        "Content-Type: image/tiff\n"
+        "Content-Description: coverage data\n"
+        "Content-Transfer-Encoding: binary\n"
+        "Content-ID: coverage/fake.tif\n"
+        "Content-Disposition: INLINE\n"
+        "\n";
+
+    int multipart = (NULL != strstr(req, "multipart/mixed"));
+
+    if (status_line && fake_write_str(fd, status_line)) return -1;
+
+    if (multipart)
+    {
+        if (fake_write_str(fd,
+                "Content-Type: multipart/mixed; boundary=wcs\n\n")) return -1;
+        if (fake_write_str(fd, gml)) return -1;
+        if (fake_send_tiff(fd, cfg->coverage_size)) return -1;
+        return fake_write_str(fd, "\n--wcs--\n");
+    }
+    else
+    {
+        if (fake_write_str(fd, "Content-Type: image/tiff\n\n")) return -1;
+        return fake_send_tiff(fd, cfg->coverage_size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+int fake_respond(
+    const fake_config *cfg,
+    int                fd,
+    const char        *req,
+    const char        *status_line)
+{
+    if (NULL == req) req = "";
+
+    if (fake_rand(100) < cfg->error_percent || strstr(req, "BadId"))
+    {
+        return fake_send_fixture(cfg, fd, "exception.resp", status_line);
+    }
+    else if (strstr(req, "GetCapabilities"))
+    {
+        return fake_send_fixture(cfg, fd, "getcapabilities.resp", status_line);
+    }
+    else if (strstr(req, "DescribeEOCoverageSet"))
+    {
+        return fake_send_fixture(
+            cfg, fd, "describeeocoverageset.resp", status_line);
+    }
+    else if (strstr(req, "DescribeCoverage"))
+    {
+        return fake_send_fixture(cfg, fd, "describecoverage.resp", status_line);
+    }
+    else if (strstr(req, "GetCoverage"))
+    {
+        return fake_send_coverage(cfg, fd, req, status_line);
+    }
+    return fake_send_fixture(cfg, fd, "exception.resp", status_line);
+}
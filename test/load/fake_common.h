@@ -0,0 +1,75 @@
+/*
+ * Soap Proxy - load test harness, stand-in backend
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See test/load/README.txt.
+ *
+ */
+
+/**
+ * @file fake_common.h
+ *
+ */
+
+#ifndef FAKE_COMMON_H_INCLUDED
+#define FAKE_COMMON_H_INCLUDED
+
+#include <stddef.h>
+
+#define FAKE_PATH_LEN 1024
+
+//
+// Behaviour of the stand-in backend.  fake_mapserv reads these from the
+// file named by MS_MAPFILE, fake_backend takes them on the command line.
+//
+struct fake_config_struct
+{
+    char   fixtures[FAKE_PATH_LEN];  // dir with the canned *.resp files
+    int    latency_ms;               // delay before the response is sent
+    int    jitter_ms;                // random extra delay, 0..jitter_ms
+    size_t coverage_size;            // size of generated coverages
+    int    error_percent;            // share of requests answered with
+                                     //  an exception report
+};
+
+typedef struct fake_config_struct fake_config;
+
+void fake_config_init (fake_config *cfg);
+int  fake_config_set  (fake_config *cfg, const char *key, const char *val);
+int  fake_config_load (fake_config *cfg, const char *path);
+
+void fake_delay       (const fake_config *cfg);
+
+/**
+ * Write the response to the request 'req' to fd.
+ * 'status_line' is written first if not NULL, i.e. for HTTP.
+ * @return 0 on success, -1 on a write error.
+ */
+int  fake_respond(
+    const fake_config *cfg,
+    int                fd,
+    const char        *req,
+    const char        *status_line);
+
+#endif
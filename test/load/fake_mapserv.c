@@ -0,0 +1,86 @@
+/*
+ * Soap Proxy - load test harness, stand-in for the mapserv executable
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Configure as MapServ in services.xml.  It is run by soap_proxy the same
+ * way as mapserv (see do_child in sp_exec_ms.c): the request is POSTed on
+ * stdin, with REQUEST_METHOD, CONTENT_LENGTH and MS_MAPFILE set, and the
+ * CGI response is written to stdout.
+ *
+ * Since soap_proxy passes no other environment, the "mapfile" given by
+ * MapFile is read as the configuration of this program, see
+ * fake_mapserv.conf.
+ *
+ */
+
+/**
+ * @file fake_mapserv.c
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_common.h"
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && 0 == strcmp(argv[1], "-v"))
+    {
+        // Same form as the output of the real 'mapserv -v'
+        printf("MapServer version 6.0.1 (fake_mapserv) OUTPUT=GTIFF "
+               "SUPPORTS=PROJ SUPPORTS=WCS_SERVER INPUT=GDAL\n");
+        return 0;
+    }
+
+    fake_config cfg;
+    fake_config_init(&cfg);
+
+    const char *mapfile = getenv("MS_MAPFILE");
+    if (mapfile && 0 != fake_config_load(&cfg, mapfile))
+    {
+        fprintf(stderr, "fake_mapserv: cannot read %s\n", mapfile);
+    }
+
+    const char *cl  = getenv("CONTENT_LENGTH");
+    int         len = cl ? atoi(cl) : 0;
+    char       *req = malloc(len + 1);
+    int         n   = 0;
+
+    while (req && n < len)
+    {
+        ssize_t r = read(0, req + n, len - n);
+        if (r <= 0) break;
+        n += r;
+    }
+    if (req) req[n] = '\0';
+
+    fake_delay(&cfg);
+    int rc = fake_respond(&cfg, 1, req, NULL);
+
+    free(req);
+    return rc ? 1 : 0;
+}
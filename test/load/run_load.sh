@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+#  Soap Proxy load test: runs soap_proxy in the axis2 simple http server
+#  against a stand-in backend and replays the requests in requests/.
+#  See README.txt in this directory for the settings.
+#
+#  There is absolutely no warranty of any kind for this sofware.
+#
+
+if [ -z "${AXIS2C_HOME}" ] ; then
+  echo "AXIS2C_HOME must be set." ; exit 1
+fi
+
+HERE=`cd \`dirname $0\` && pwd`
+TOP=`cd ${HERE}/../.. && pwd`
+
+MODE=${MODE:-exec}                  # exec: fake_mapserv, url: fake_backend
+CONCURRENCY=${CONCURRENCY:-8}
+REQUESTS=${REQUESTS:-1000}
+DURATION=${DURATION:-}              # seconds, overrides REQUESTS
+WARMUP=${WARMUP:-20}
+LATENCY_MS=${LATENCY_MS:-0}
+JITTER_MS=${JITTER_MS:-0}
+COVERAGE_SIZE=${COVERAGE_SIZE:-1M}
+ERROR_PERCENT=${ERROR_PERCENT:-0}
+SP_PORT=${SP_PORT:-9090}
+BE_PORT=${BE_PORT:-8099}
+REQUEST_FILES=${REQUEST_FILES:-${HERE}/requests/*.xml}
+WORK=${WORK:-/tmp/sp_load.$$}
+
+make -C ${HERE} -s || exit 1
+make -C ${TOP}/src -s libsoapProxy.so || exit 1
+
+#
+# Private axis2 repository, sharing lib and modules with AXIS2C_HOME
+#
+SVC_DIR=${WORK}/services/soapProxy
+mkdir -p ${SVC_DIR} || exit 1
+ln -sf ${AXIS2C_HOME}/lib     ${WORK}/lib
+ln -sf ${AXIS2C_HOME}/modules ${WORK}/modules
+sed 's^<parameter name="enableMTOM"[^>]*>[a-z]*</parameter>^<parameter name="enableMTOM" locked="false">true</parameter>^' \
+    ${AXIS2C_HOME}/axis2.xml > ${WORK}/axis2.xml
+
+SP_URL=http://127.0.0.1:${SP_PORT}/axis2/services/soapProxy
+
+cat > ${WORK}/fake.conf <<EOC
+latency_ms    = ${LATENCY_MS}
+jitter_ms     = ${JITTER_MS}
+coverage_size = ${COVERAGE_SIZE}
+error_percent = ${ERROR_PERCENT}
+EOC
+
+if [ "url" = "${MODE}" ] ; then
+  BACKEND_SED='s^<parameter name="BackendURL">[^<]*^<parameter name="BackendURL">http://127.0.0.1:'${BE_PORT}'/ows^'
+else
+  BACKEND_SED='/<parameter name="BackendURL">/d'
+fi
+sed -e "${BACKEND_SED}" \
+    -e 's^<parameter name="MapServ">[^<]*^<parameter name="MapServ">'${HERE}'/fake_mapserv^' \
+    -e 's^<parameter name="MapFile">[^<]*^<parameter name="MapFile">'${WORK}'/fake.conf^' \
+    -e 's^<parameter name="SOAPOperationsURL">[^<]*^<parameter name="SOAPOperationsURL">'${SP_URL}'^' \
+    ${TOP}/service/TEMPLATE_services.xml > ${SVC_DIR}/services.xml
+sed 's^<soap:address location="http://www.your.server/sp_wcs"^<soap:address location="'${SP_URL}'"^' \
+    ${TOP}/service/SP_SERVICE_NAME.wsdl > ${SVC_DIR}/soapProxy.wsdl
+cp ${TOP}/src/libsoapProxy.so ${SVC_DIR}
+
+PIDS=""
+cleanup()
+{
+  [ -n "${PIDS}" ] && kill ${PIDS} 2>/dev/null
+  wait 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+if [ "url" = "${MODE}" ] ; then
+  ${HERE}/fake_backend -p ${BE_PORT} -c ${WORK}/fake.conf &
+  PIDS="$!"
+fi
+
+LD_LIBRARY_PATH=${AXIS2C_HOME}/lib:${LD_LIBRARY_PATH} \
+  ${AXIS2C_HOME}/bin/axis2_http_server -r ${WORK} -p ${SP_PORT} \
+    -l 1 -f ${WORK}/axis2.log &
+SRV_PID=$!
+PIDS="${PIDS} ${SRV_PID}"
+
+# Wait until the service answers
+n=0
+until ${HERE}/sp_load -u ${SP_URL} -c 1 -n 1 -t 2 \
+        ${HERE}/requests/getcapabilities.xml >/dev/null 2>&1 ; do
+  n=`expr $n + 1`
+  if [ $n -gt 50 ] ; then
+    echo "soapProxy at ${SP_URL} did not come up, see ${WORK}/axis2.log"
+    exit 1
+  fi
+  sleep 0.2
+done
+
+if [ -n "${DURATION}" ] ; then
+  COUNT="-d ${DURATION}"
+else
+  COUNT="-n ${REQUESTS}"
+fi
+
+echo "mode:         ${MODE}, latency ${LATENCY_MS}+${JITTER_MS} ms, coverage ${COVERAGE_SIZE}"
+${HERE}/sp_load -u ${SP_URL} -c ${CONCURRENCY} ${COUNT} -w ${WARMUP} \
+    -p ${SRV_PID} ${REQUEST_FILES}
+RC=$?
+echo "logs in ${WORK}"
+exit ${RC}
@@ -0,0 +1,565 @@
+/*
+ * Soap Proxy - load test driver
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Replays SOAP requests against a soap_proxy service at a fixed
+ * concurrency and reports throughput, latency percentiles and the
+ * resident memory of the server processes.
+ *
+ *  usage: sp_load -u url [-c concurrency] [-n requests | -d seconds]
+ *                 [-w warmup] [-t timeout] [-p pid ...] request.xml ...
+ *
+ * Each thread sends one request per connection, taking the request files
+ * in turn.  A response counts as ok for HTTP status 200 without a SOAP
+ * Fault, as a fault if it carries a Fault, and as an error otherwise.
+ *
+ * See test/load/README.txt.
+ *
+ */
+
+/**
+ * @file sp_load.c
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define SP_LOAD_MAX_PIDS   16
+#define SP_LOAD_PEEK_LEN   16384
+#define SP_LOAD_BUF_LEN    65536
+
+#define SP_LOAD_OK     0
+#define SP_LOAD_FAULT  1
+#define SP_LOAD_ERROR  2
+
+//
+// One request file.
+//
+struct sp_load_req_struct
+{
+    const char *name;
+    char       *msg;        // complete HTTP request
+    size_t      msg_len;
+};
+
+typedef struct sp_load_req_struct sp_load_req;
+
+//
+// One completed request.
+//
+struct sp_load_sample_struct
+{
+    uint32_t usecs;
+    uint16_t req;
+    uint16_t result;
+};
+
+typedef struct sp_load_sample_struct sp_load_sample;
+
+//
+// Per-thread results.
+//
+struct sp_load_thread_struct
+{
+    pthread_t       tid;
+    sp_load_sample *samples;
+    size_t          n_samples;
+    size_t          max_samples;
+    uint64_t        bytes_in;
+};
+
+typedef struct sp_load_thread_struct sp_load_thread;
+
+static sp_load_req     *sp_load_reqs      = NULL;
+static int              sp_load_nreqs     = 0;
+static struct addrinfo *sp_load_addr      = NULL;
+static int              sp_load_timeout   = 60;
+
+static long             sp_load_total     = 1000;
+static long             sp_load_warmup    = 0;
+static double           sp_load_duration  = 0.0;
+static double           sp_load_t_end     = 0.0;
+static long             sp_load_next      = 0;   // request counter
+static volatile int     sp_load_running   = 1;
+
+static pid_t            sp_load_pids[SP_LOAD_MAX_PIDS];
+static int              sp_load_npids     = 0;
+static long             sp_load_rss_start = 0;
+static long             sp_load_rss_peak  = 0;
+static long             sp_load_rss_end   = 0;
+
+//-----------------------------------------------------------------------------
+static double sp_load_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+// Sum of VmRSS of the watched processes, in kB.
+//
+static long sp_load_rss(void)
+{
+    long total = 0;
+    int  i;
+    for (i = 0; i < sp_load_npids; i++)
+    {
+        char  path[64];
+        char  line[256];
+        snprintf(path, sizeof(path), "/proc/%d/status", (int) sp_load_pids[i]);
+        FILE *fp = fopen(path, "r");
+        if (NULL == fp) continue;
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (0 == strncmp(line, "VmRSS:", 6))
+            {
+                total += atol(line + 6);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    return total;
+}
+
+//-----------------------------------------------------------------------------
+static void *sp_load_rss_thread(void *arg)
+{
+    while (sp_load_running)
+    {
+        long rss = sp_load_rss();
+        if (rss > sp_load_rss_peak) sp_load_rss_peak = rss;
+        usleep(100000);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Send request r and read the whole response.
+ * @return SP_LOAD_OK, SP_LOAD_FAULT or SP_LOAD_ERROR.
+ */
+static int sp_load_one(
+    const sp_load_req *r,
+    uint64_t          *bytes_in)
+{
+    static __thread char buf[SP_LOAD_BUF_LEN];
+    char   peek[SP_LOAD_PEEK_LEN + 1];
+    size_t n_peek = 0;
+
+    int fd = socket(sp_load_addr->ai_family, SOCK_STREAM, 0);
+    if (fd < 0) return SP_LOAD_ERROR;
+
+    struct timeval tv = { sp_load_timeout, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(fd, sp_load_addr->ai_addr, sp_load_addr->ai_addrlen) < 0)
+    {
+        close(fd);
+        return SP_LOAD_ERROR;
+    }
+
+    size_t sent = 0;
+    while (sent < r->msg_len)
+    {
+        ssize_t n = write(fd, r->msg + sent, r->msg_len - sent);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0)
+        {
+            close(fd);
+            return SP_LOAD_ERROR;
+        }
+        sent += n;
+    }
+
+    while ( 1 )
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && EINTR == errno) continue;
+        if (n < 0)
+        {
+            close(fd);
+            return SP_LOAD_ERROR;
+        }
+        if (0 == n) break;
+        *bytes_in += n;
+        if (n_peek < SP_LOAD_PEEK_LEN)
+        {
+            size_t c = SP_LOAD_PEEK_LEN - n_peek;
+            if (c > (size_t) n) c = n;
+            memcpy(peek + n_peek, buf, c);
+            n_peek += c;
+        }
+    }
+    close(fd);
+    peek[n_peek] = '\0';
+
+    int status = 0;
+    if (sscanf(peek, "HTTP/%*d.%*d %d", &status) != 1) return SP_LOAD_ERROR;
+
+    // The body may contain NULs (attachments), so search with memmem.
+    if (memmem(peek, n_peek, "Fault>", 6) || memmem(peek, n_peek, "Fault ", 6))
+    {
+        return SP_LOAD_FAULT;
+    }
+    return (200 == status) ? SP_LOAD_OK : SP_LOAD_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+static void *sp_load_worker(void *arg)
+{
+    sp_load_thread *th = (sp_load_thread *) arg;
+
+    while (sp_load_running)
+    {
+        long i = __sync_fetch_and_add(&sp_load_next, 1);
+        if (sp_load_duration <= 0.0 && i >= sp_load_warmup + sp_load_total)
+        {
+            break;
+        }
+        if (sp_load_duration > 0.0 && i >= sp_load_warmup &&
+            sp_load_secs() >= sp_load_t_end)
+        {
+            break;
+        }
+
+        int      r_idx    = i % sp_load_nreqs;
+        uint64_t bytes_in = 0;
+        double   t0       = sp_load_secs();
+        int      result   = sp_load_one(&sp_load_reqs[r_idx], &bytes_in);
+        double   t1       = sp_load_secs();
+
+        if (i < sp_load_warmup) continue;
+
+        if (th->n_samples == th->max_samples)
+        {
+            th->max_samples = th->max_samples ? 2 * th->max_samples : 1024;
+            th->samples = realloc(th->samples,
+                                  th->max_samples * sizeof(sp_load_sample));
+        }
+        sp_load_sample *s = &th->samples[th->n_samples++];
+        s->usecs    = (uint32_t)((t1 - t0) * 1e6);
+        s->req      = r_idx;
+        s->result   = result;
+        th->bytes_in += bytes_in;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+static int sp_load_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------
+// p is a fraction, lat is sorted.
+//
+static double sp_load_pct(const uint32_t *lat, size_t n, double p)
+{
+    if (0 == n) return 0.0;
+    size_t i = (size_t)(p * n);
+    if (i >= n) i = n - 1;
+    return lat[i] / 1000.0;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Print one line of latency statistics for the samples of request r_idx,
+ * or for all samples if r_idx < 0.
+ */
+static void sp_load_report_line(
+    const char           *label,
+    const sp_load_sample *all,
+    size_t                n_all,
+    int                   r_idx)
+{
+    uint32_t *lat = malloc((n_all ? n_all : 1) * sizeof(uint32_t));
+    size_t    n = 0, n_ok = 0, n_fault = 0, n_err = 0;
+    double    sum = 0.0;
+    size_t    i;
+
+    for (i = 0; i < n_all; i++)
+    {
+        if (r_idx >= 0 && all[i].req != r_idx) continue;
+        switch (all[i].result)
+        {
+        case SP_LOAD_OK:    n_ok++;    break;
+        case SP_LOAD_FAULT: n_fault++; break;
+        default:            n_err++;   break;
+        }
+        lat[n++] = all[i].usecs;
+        sum += all[i].usecs;
+    }
+    qsort(lat, n, sizeof(uint32_t), sp_load_cmp_u32);
+
+    printf("%-28.28s %7lu %7lu %6lu %6lu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+           label,
+           (unsigned long) n, (unsigned long) n_ok,
+           (unsigned long) n_fault, (unsigned long) n_err,
+           n ? sum / n / 1000.0 : 0.0,
+           sp_load_pct(lat, n, 0.50),
+           sp_load_pct(lat, n, 0.90),
+           sp_load_pct(lat, n, 0.99),
+           sp_load_pct(lat, n, 0.999),
+           n ? lat[n-1] / 1000.0 : 0.0);
+    free(lat);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * Load a request file and wrap it in a POST to host/path.
+ * @return 0 on success.
+ */
+static int sp_load_read_req(
+    sp_load_req *r,
+    const char  *file,
+    const char  *host_port,
+    const char  *path)
+{
+    FILE *fp = fopen(file, "rb");
+    if (NULL == fp)
+    {
+        perror(file);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+
+    char *body = malloc(len + 1);
+    if (NULL == body || fread(body, 1, len, fp) != (size_t) len)
+    {
+        perror(file);
+        fclose(fp);
+        free(body);
+        return -1;
+    }
+    fclose(fp);
+
+    size_t max_len = len + strlen(host_port) + strlen(path) + 256;
+    r->msg = malloc(max_len);
+    int hdr_len = snprintf(r->msg, max_len,
+        "POST %s HTTP/1.0\r\n"
+        "Host: %s\r\n"
+        "Content-Type: text/xml; charset=UTF-8\r\n"
+        "SOAPAction: \"\"\r\n"
+        "Content-Length: %ld\r\n"
+        "\r\n",
+        path, host_port, len);
+    memcpy(r->msg + hdr_len, body, len);
+    r->msg_len = hdr_len + len;
+    free(body);
+
+    const char *base = strrchr(file, '/');
+    r->name = base ? base + 1 : file;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_load_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s -u url [-c concurrency] [-n requests | -d seconds]\n"
+        "          [-w warmup] [-t timeout] [-p pid ...] request.xml ...\n"
+        "  -u  service url, e.g. http://127.0.0.1:9090/axis2/services/soapProxy\n"
+        "  -c  number of concurrent clients (default 4)\n"
+        "  -n  number of requests (default 1000)\n"
+        "  -d  run for this many seconds instead of -n\n"
+        "  -w  number of requests sent before measuring (default 0)\n"
+        "  -t  per-request socket timeout in seconds (default 60)\n"
+        "  -p  pid of a server process whose RSS is reported, repeatable\n",
+        prog);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *url         = NULL;
+    int         concurrency = 4;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "u:c:n:d:w:t:p:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u': url              = optarg;       break;
+        case 'c': concurrency      = atoi(optarg); break;
+        case 'n': sp_load_total    = atol(optarg); break;
+        case 'd': sp_load_duration = atof(optarg); break;
+        case 'w': sp_load_warmup   = atol(optarg); break;
+        case 't': sp_load_timeout  = atoi(optarg); break;
+        case 'p':
+            if (sp_load_npids < SP_LOAD_MAX_PIDS)
+            {
+                sp_load_pids[sp_load_npids++] = (pid_t) atoi(optarg);
+            }
+            break;
+        default:
+            sp_load_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (NULL == url || optind >= argc || concurrency < 1)
+    {
+        sp_load_usage(argv[0]);
+        return 1;
+    }
+
+    // Split http://host[:port]/path
+    char host[256];
+    char port[16] = "80";
+    const char *hp = strstr(url, "://");
+    hp = hp ? hp + 3 : url;
+    const char *path = strchr(hp, '/');
+    if (NULL == path) path = "/";
+    size_t hp_len = (path > hp && '/' == *path) ? (size_t)(path - hp) : strlen(hp);
+    char host_port[256];
+    snprintf(host_port, sizeof(host_port), "%.*s", (int) hp_len, hp);
+    snprintf(host, sizeof(host), "%s", host_port);
+    char *colon = strchr(host, ':');
+    if (colon)
+    {
+        *colon = '\0';
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(host, port, &hints, &sp_load_addr))
+    {
+        fprintf(stderr, "%s: cannot resolve %s\n", argv[0], host);
+        return 1;
+    }
+
+    sp_load_nreqs = argc - optind;
+    sp_load_reqs  = calloc(sp_load_nreqs, sizeof(sp_load_req));
+    int i;
+    for (i = 0; i < sp_load_nreqs; i++)
+    {
+        if (0 != sp_load_read_req(&sp_load_reqs[i], argv[optind + i],
+                                  host_port, path))
+        {
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t rss_tid;
+    if (sp_load_npids > 0)
+    {
+        sp_load_rss_start = sp_load_rss_peak = sp_load_rss();
+        pthread_create(&rss_tid, NULL, sp_load_rss_thread, NULL);
+    }
+
+    sp_load_thread *threads = calloc(concurrency, sizeof(sp_load_thread));
+    double t0 = sp_load_secs();
+    sp_load_t_end = t0 + sp_load_duration;
+
+    for (i = 0; i < concurrency; i++)
+    {
+        pthread_create(&threads[i].tid, NULL, sp_load_worker, &threads[i]);
+    }
+
+    size_t   n_all    = 0;
+    uint64_t bytes_in = 0;
+    for (i = 0; i < concurrency; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        n_all    += threads[i].n_samples;
+        bytes_in += threads[i].bytes_in;
+    }
+    double elapsed = sp_load_secs() - t0;
+
+    sp_load_running = 0;
+    if (sp_load_npids > 0)
+    {
+        pthread_join(rss_tid, NULL);
+        sp_load_rss_end = sp_load_rss();
+        if (sp_load_rss_end > sp_load_rss_peak)
+            sp_load_rss_peak = sp_load_rss_end;
+    }
+
+    sp_load_sample *all = malloc((n_all ? n_all : 1) * sizeof(sp_load_sample));
+    size_t k = 0;
+    for (i = 0; i < concurrency; i++)
+    {
+        memcpy(all + k, threads[i].samples,
+               threads[i].n_samples * sizeof(sp_load_sample));
+        k += threads[i].n_samples;
+    }
+
+    printf("url:          %s\n", url);
+    printf("concurrency:  %d\n", concurrency);
+    printf("elapsed:      %.2f s (warmup %ld requests not counted)\n",
+           elapsed, sp_load_warmup);
+    printf("throughput:   %.1f req/s, %.2f MB/s received\n",
+           elapsed > 0.0 ? n_all / elapsed : 0.0,
+           elapsed > 0.0 ? bytes_in / elapsed / 1e6 : 0.0);
+    if (sp_load_npids > 0)
+    {
+        printf("server RSS:   start %ld kB, peak %ld kB, end %ld kB\n",
+               sp_load_rss_start, sp_load_rss_peak, sp_load_rss_end);
+    }
+    printf("\n%-28s %7s %7s %6s %6s %8s %8s %8s %8s %8s %8s\n",
+           "request", "n", "ok", "fault", "error",
+           "mean_ms", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < sp_load_nreqs; i++)
+    {
+        sp_load_report_line(sp_load_reqs[i].name, all, n_all, i);
+    }
+    if (sp_load_nreqs > 1)
+    {
+        sp_load_report_line("all", all, n_all, -1);
+    }
+
+    size_t n_bad = 0;
+    for (k = 0; k < n_all; k++)
+    {
+        if (SP_LOAD_ERROR == all[k].result) n_bad++;
+    }
+    return n_bad ? 2 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Soap Proxy - unit checks
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * See sp_unit.h.
+ */
+
+/**
+ * @file sp_unit.c
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <axiom.h>
+#include <axiom_xml_reader.h>
+
+#include "soap_proxy.h"
+#include "sp_unit.h"
+
+int sp_unit_checks   = 0;
+int sp_unit_failures = 0;
+
+//
+// A string being parsed by sp_unit_parse().
+//
+struct sp_unit_src_struct
+{
+    const char *p;
+    size_t      left;
+};
+
+typedef struct sp_unit_src_struct sp_unit_src;
+
+//-----------------------------------------------------------------------------
+// Read callback for sp_process_xml_io().
+//
+static int sp_unit_read(char *buffer, int size, void *ctx)
+{
+    sp_unit_src *src = (sp_unit_src *) ctx;
+    size_t       n   = (size_t) size < src->left ? (size_t) size : src->left;
+
+    memcpy(buffer, src->p, n);
+    src->p    += n;
+    src->left -= n;
+    return (int) n;
+}
+
+//-----------------------------------------------------------------------------
+/** Set up the axis2 environment of a unit check program.
+ * @param name of the program, also names its log file.
+ * @return the environment, NULL on failure.
+ */
+axutil_env_t *sp_unit_init(const char *name)
+{
+    char log_name[256];
+    snprintf(log_name, sizeof(log_name), "%s.log", name);
+
+    axutil_env_t *env = axutil_env_create_all(log_name, AXIS2_LOG_LEVEL_ERROR);
+    if (NULL == env)
+    {
+        fprintf(stderr, "%s: cannot create axis2 environment\n", name);
+        return NULL;
+    }
+    axiom_xml_reader_init();
+    return env;
+}
+
+//-----------------------------------------------------------------------------
+/** Report the outcome.
+ * @param name of the program.
+ * @return the exit status, 0 if all checks passed.
+ */
+int sp_unit_done(const char *name)
+{
+    axiom_xml_reader_cleanup();
+    printf("%s: %d checks, %d failed\n", name, sp_unit_checks, sp_unit_failures);
+    return sp_unit_failures ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+/** Parse a document held in a string.
+ * @param env
+ * @param xml
+ * @return the root element, NULL on failure.
+ */
+axiom_node_t *sp_unit_parse(const axutil_env_t *env, const char *xml)
+{
+    sp_unit_src src;
+    src.p    = xml;
+    src.left = strlen(xml);
+    return sp_process_xml_io(env, sp_unit_read, &src);
+}
@@ -0,0 +1,68 @@
+/*
+ * Soap Proxy - unit checks
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Support for the unit checks in test/unit: a check macro that counts and
+ * reports failures, and the parsing of XML held in a string into an
+ * AXIOM tree, with the proxy's own parser entry point.
+ *
+ * Each sp_unit_<module>.c includes src/sp_<module>.c, so that the static
+ * functions of the module can be checked as well, and is linked with the
+ * rest of the proxy sources.  See test/README.txt for usage.
+ */
+
+/**
+ * @file sp_unit.h
+ *
+ */
+
+#ifndef SPUNIT_H_INCLUDED
+#define SPUNIT_H_INCLUDED
+
+#include <stdio.h>
+#include <math.h>
+
+#include <axiom.h>
+
+extern int sp_unit_checks;
+extern int sp_unit_failures;
+
+#define SP_UNIT_CHECK(cond) \
+    do { \
+        sp_unit_checks++; \
+        if (! (cond)) \
+        { \
+            sp_unit_failures++; \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define SP_UNIT_CLOSE(a, b) (fabs((a) - (b)) <= 1e-9 * (1.0 + fabs(b)))
+
+axutil_env_t *sp_unit_init (const char *name);
+int           sp_unit_done (const char *name);
+axiom_node_t *sp_unit_parse(const axutil_env_t *env, const char *xml);
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Soap Proxy - unit checks of sp_canon.c
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * The hash against the reference MurmurHash3_x64_128, the growth of the
+ * output buffer, and that requests which differ only in prefixes,
+ * attribute order, white space or the spelling of subset bounds hash the
+ * same, while requests which ask for something else do not.
+ */
+
+/**
+ * @file sp_unit_canon.c
+ *
+ */
+
+#include "sp_canon.c"
+#include "sp_unit.h"
+
+#define SP_UNIT_WCS "http://www.opengis.net/wcs/2.0"
+
+//-----------------------------------------------------------------------------
+static void sp_unit_murmur3(void)
+{
+    const char *fox = "The quick brown fox jumps over the lazy dog";
+    uint64_t    h[2];
+
+    sp_murmur3_128("", 0, 0, h);
+    SP_UNIT_CHECK(0 == h[0] && 0 == h[1]);
+
+    // tail only
+    sp_murmur3_128("hello", 5, 0, h);
+    SP_UNIT_CHECK(0xcbd8a7b341bd9b02ULL == h[0]);
+    SP_UNIT_CHECK(0x5b1e906a48ae1d19ULL == h[1]);
+
+    // two blocks and a tail of 11
+    sp_murmur3_128(fox, strlen(fox), 0, h);
+    SP_UNIT_CHECK(0xe34bbc7bbc071b6cULL == h[0]);
+    SP_UNIT_CHECK(0x7a433ca9c49a9347ULL == h[1]);
+
+    sp_murmur3_128(fox, strlen(fox), SP_CANON_SEED, h);
+    SP_UNIT_CHECK(0xdd8846ca8d167c01ULL == h[0]);
+    SP_UNIT_CHECK(0x1f043c2be2b7d2d1ULL == h[1]);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_append(const axutil_env_t *env)
+{
+    sp_canon_buf buf;
+    char         chunk[100];
+    int          i;
+
+    sp_canon_init(&buf);
+    for (i = 0; i < 100; i++)
+    {
+        memset(chunk, 'a' + i % 26, sizeof(chunk));
+        sp_canon_append(env, &buf, chunk, sizeof(chunk));
+    }
+    SP_UNIT_CHECK(! buf.failed);
+    SP_UNIT_CHECK(100 * sizeof(chunk) == buf.len);
+    SP_UNIT_CHECK(buf.data != buf.local);
+    SP_UNIT_CHECK(buf.size >= buf.len);
+    SP_UNIT_CHECK('a' == buf.data[0] && 'z' == buf.data[25 * 100]);
+    SP_UNIT_CHECK('v' == buf.data[buf.len - 1]);
+
+    sp_canon_free(env, &buf);
+    SP_UNIT_CHECK(buf.data == buf.local && 0 == buf.len);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_numeric(const axutil_env_t *env)
+{
+    const char  *txt = " 10.0\t-0  1e1 2012-01-01T00:00:00Z  ";
+    sp_canon_buf buf;
+
+    sp_canon_init(&buf);
+    sp_canon_numeric_text(env, &buf, txt, strlen(txt));
+    SP_UNIT_CHECK(! buf.failed);
+
+    const char *want = "T28:10 0 10 2012-01-01T00:00:00Z";
+    SP_UNIT_CHECK(strlen(want) == buf.len && 0 == memcmp(buf.data, want, buf.len));
+    sp_canon_free(env, &buf);
+}
+
+//-----------------------------------------------------------------------------
+/** Hash a request held in a string.
+ * @return 0 on success, -1 on failure.
+ */
+static int sp_unit_hash(
+    const axutil_env_t *env,
+    const char         *xml,
+    const char * const *extra,
+    uint64_t            h[2])
+{
+    axiom_node_t *node = sp_unit_parse(env, xml);
+    if (NULL == node) return -1;
+
+    int ret = sp_canon_hash(env, node, extra, h);
+    axiom_node_free_tree(node, env);
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+/** Whether two requests hash the same.
+ */
+static int sp_unit_same(
+    const axutil_env_t *env,
+    const char         *a,
+    const char         *b)
+{
+    uint64_t ha[2], hb[2];
+
+    if (sp_unit_hash(env, a, NULL, ha) || sp_unit_hash(env, b, NULL, hb))
+    {
+        return -1;
+    }
+    return ha[0] == hb[0] && ha[1] == hb[1];
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_requests(const axutil_env_t *env)
+{
+    const char *base =
+        "<wcs:GetCoverage xmlns:wcs=\"" SP_UNIT_WCS "\" service=\"WCS\" version=\"2.0.0\">"
+        "<wcs:CoverageId>cov1</wcs:CoverageId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Long</wcs:Dimension>"
+        "<wcs:TrimLow>10</wcs:TrimLow><wcs:TrimHigh>20.5</wcs:TrimHigh>"
+        "</wcs:DimensionTrim>"
+        "</wcs:GetCoverage>";
+
+    // Other prefix, attributes swapped, white space and a comment.
+    SP_UNIT_CHECK(1 == sp_unit_same(env, base,
+        "<x:GetCoverage version=\"2.0.0\" service=\"WCS\" xmlns:x=\"" SP_UNIT_WCS "\">\n"
+        "  <x:CoverageId> cov1 </x:CoverageId>\n"
+        "  <!-- a comment -->\n"
+        "  <x:DimensionTrim>\n    <x:Dimension>Long</x:Dimension>\n"
+        "    <x:TrimLow>1e1</x:TrimLow>\n    <x:TrimHigh>20.50</x:TrimHigh>\n"
+        "  </x:DimensionTrim>\n"
+        "</x:GetCoverage>"));
+
+    // Default namespace.
+    SP_UNIT_CHECK(1 == sp_unit_same(env, base,
+        "<GetCoverage xmlns=\"" SP_UNIT_WCS "\" service=\"WCS\" version=\"2.0.0\">"
+        "<CoverageId>cov1</CoverageId>"
+        "<DimensionTrim><Dimension>Long</Dimension>"
+        "<TrimLow>10.0</TrimLow><TrimHigh>20.5</TrimHigh>"
+        "</DimensionTrim>"
+        "</GetCoverage>"));
+
+    // Another coverage.
+    SP_UNIT_CHECK(0 == sp_unit_same(env, base,
+        "<wcs:GetCoverage xmlns:wcs=\"" SP_UNIT_WCS "\" service=\"WCS\" version=\"2.0.0\">"
+        "<wcs:CoverageId>cov2</wcs:CoverageId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Long</wcs:Dimension>"
+        "<wcs:TrimLow>10</wcs:TrimLow><wcs:TrimHigh>20.5</wcs:TrimHigh>"
+        "</wcs:DimensionTrim>"
+        "</wcs:GetCoverage>"));
+
+    // Another bound.
+    SP_UNIT_CHECK(0 == sp_unit_same(env, base,
+        "<wcs:GetCoverage xmlns:wcs=\"" SP_UNIT_WCS "\" service=\"WCS\" version=\"2.0.0\">"
+        "<wcs:CoverageId>cov1</wcs:CoverageId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Long</wcs:Dimension>"
+        "<wcs:TrimLow>10</wcs:TrimLow><wcs:TrimHigh>20.25</wcs:TrimHigh>"
+        "</wcs:DimensionTrim>"
+        "</wcs:GetCoverage>"));
+
+    // Another namespace.
+    SP_UNIT_CHECK(0 == sp_unit_same(env, base,
+        "<wcs:GetCoverage xmlns:wcs=\"http://www.opengis.net/wcs/1.1\" service=\"WCS\" version=\"2.0.0\">"
+        "<wcs:CoverageId>cov1</wcs:CoverageId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Long</wcs:Dimension>"
+        "<wcs:TrimLow>10</wcs:TrimLow><wcs:TrimHigh>20.5</wcs:TrimHigh>"
+        "</wcs:DimensionTrim>"
+        "</wcs:GetCoverage>"));
+
+    // Numbers are only rewritten in subset bounds.
+    SP_UNIT_CHECK(0 == sp_unit_same(env,
+        "<wcs:CoverageId xmlns:wcs=\"" SP_UNIT_WCS "\">10</wcs:CoverageId>",
+        "<wcs:CoverageId xmlns:wcs=\"" SP_UNIT_WCS "\">10.0</wcs:CoverageId>"));
+
+    // Text moved into an attribute.
+    SP_UNIT_CHECK(0 == sp_unit_same(env,
+        "<a xmlns=\"urn:x\" b=\"c\"/>",
+        "<a xmlns=\"urn:x\"><b>c</b></a>"));
+
+    // The extra strings count.
+    const char *extra1[] = { "http://backend1/", NULL };
+    const char *extra2[] = { "http://backend2/", NULL };
+    uint64_t    h0[2], h1[2], h2[2];
+    SP_UNIT_CHECK(0 == sp_unit_hash(env, base, NULL,   h0));
+    SP_UNIT_CHECK(0 == sp_unit_hash(env, base, extra1, h1));
+    SP_UNIT_CHECK(0 == sp_unit_hash(env, base, extra2, h2));
+    SP_UNIT_CHECK(h0[0] != h1[0] || h0[1] != h1[1]);
+    SP_UNIT_CHECK(h1[0] != h2[0] || h1[1] != h2[1]);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    axutil_env_t *env = sp_unit_init("sp_unit_canon");
+    if (NULL == env) return 1;
+
+    sp_unit_murmur3();
+    sp_unit_append(env);
+    sp_unit_numeric(env);
+    sp_unit_requests(env);
+
+    return sp_unit_done("sp_unit_canon");
+}
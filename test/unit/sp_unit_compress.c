@@ -0,0 +1,377 @@
+/*
+ * Soap Proxy - unit checks of sp_compress.c
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Striped GeoTIFFs, in both byte orders, are run through
+ * sp_compress_coverage() as the attachment of a wcs:Coverage.  Every strip
+ * of the result is inflated and compared with the pixels of the input,
+ * and the tags other than those of the strips must be kept as they were.
+ * Tiled, already compressed, too small and incompressible TIFFs must be
+ * left as they are.
+ */
+
+/**
+ * @file sp_unit_compress.c
+ *
+ */
+
+#include "sp_compress.c"
+#include "sp_unit.h"
+
+#define SP_UNIT_Z_WIDTH   1000
+#define SP_UNIT_Z_HEIGHT  700
+#define SP_UNIT_Z_ROWS    16        // per strip of the input
+#define SP_UNIT_Z_TAGS    11
+
+//-----------------------------------------------------------------------------
+/** Fill in an IFD entry.
+ * @param v the value if it fits in, else its offset.
+ */
+static void sp_unit_z_entry(
+    const int       be,
+    unsigned char  *e,
+    const uint16_t  tag,
+    const uint16_t  type,
+    const uint32_t  count,
+    const uint32_t  v)
+{
+    sp_tiff_put16(be, e,     tag);
+    sp_tiff_put16(be, e + 2, type);
+    sp_tiff_put32(be, e + 4, count);
+    if (SP_TIFF_SHORT == type && 1 == count) sp_tiff_put16(be, e + 8, v);
+    else                                     sp_tiff_put32(be, e + 8, v);
+}
+
+//-----------------------------------------------------------------------------
+/** Put an 8 bit grey GeoTIFF together: the header, the pixels at offset 8,
+ *  the IFD, then the strip offsets and counts and the GeoTIFF doubles.
+ * @param be
+ * @param width
+ * @param height
+ * @param rows per strip.
+ * @param noise non-zero for pixels that do not compress.
+ * @param tag Compression to set it to v, TileWidth to add it, else 0.
+ * @param v
+ * @param len set to the length of the TIFF.
+ * @return the TIFF, malloc()ed, NULL if out of memory.
+ */
+static unsigned char *sp_unit_z_make(
+    const int       be,
+    const uint32_t  width,
+    const uint32_t  height,
+    const uint32_t  rows,
+    const int       noise,
+    const uint16_t  tag,
+    const uint32_t  v,
+    size_t         *len)
+{
+    const double   scale[3] = { 0.01, 0.01, 0.0 };
+    const double   tie[6]   = { 0.0, 0.0, 0.0, 10.0, 50.0, 0.0 };
+    const uint32_t n_strips = (height + rows - 1) / rows;
+    const size_t   pix_len  = (size_t) width * height;
+    const int      tiled    = SP_TIFF_TILEWIDTH == tag;
+    const int      n        = SP_UNIT_Z_TAGS + tiled;
+    const size_t   ifd      = 8 + pix_len + (pix_len & 1);
+    const size_t   offs     = ifd + 2 + 12 * n + 4;
+    const size_t   counts   = offs + 4 * n_strips;
+    const size_t   dbls     = counts + 4 * n_strips;
+    uint32_t       rnd      = 2463534242u;
+    uint32_t       i, x, y;
+    int            k;
+
+    *len = dbls + sizeof(scale) + sizeof(tie);
+    unsigned char *buf = calloc(1, *len);
+    if (NULL == buf) return NULL;
+
+    memcpy(buf, be ? "MM" : "II", 2);
+    sp_tiff_put16(be, buf + 2, 42);
+    sp_tiff_put32(be, buf + 4, ifd);
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            buf[8 + (size_t) y * width + x] =
+                    noise ? rnd >> 24 : ((x / 8 + y / 4) & 0xff);
+        }
+    }
+
+    unsigned char *e = buf + ifd + 2;
+    sp_tiff_put16(be, buf + ifd, n);
+    sp_unit_z_entry(be, e, SP_TIFF_WIDTH,  SP_TIFF_LONG,  1, width);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_HEIGHT, SP_TIFF_LONG,  1, height);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_BPS,    SP_TIFF_SHORT, 1, 8);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_COMPRESSION, SP_TIFF_SHORT, 1,
+                    SP_TIFF_COMPRESSION == tag ? v : SP_TIFF_NONE);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_OFFSETS, SP_TIFF_LONG, n_strips,
+                    1 == n_strips ? 8 : offs);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_SPP,    SP_TIFF_SHORT, 1, 1);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_ROWS,   SP_TIFF_LONG,  1, rows);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_COUNTS, SP_TIFF_LONG,  n_strips,
+                    1 == n_strips ? pix_len : counts);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_PLANAR, SP_TIFF_SHORT, 1, 1);
+    if (tiled)
+    {
+        sp_unit_z_entry(be, e += 12, SP_TIFF_TILEWIDTH, SP_TIFF_SHORT, 1, v);
+    }
+    sp_unit_z_entry(be, e += 12, SP_TIFF_SCALE,    SP_TIFF_DOUBLE, 3, dbls);
+    sp_unit_z_entry(be, e += 12, SP_TIFF_TIEPOINT, SP_TIFF_DOUBLE, 6,
+                    dbls + sizeof(scale));
+
+    for (i = 0; i < n_strips; i++)
+    {
+        const uint32_t r = i + 1 < n_strips ? rows : height - i * rows;
+        sp_tiff_put32(be, buf + offs   + 4 * i, 8 + i * rows * width);
+        sp_tiff_put32(be, buf + counts + 4 * i, r * width);
+    }
+    for (k = 0; k < 9; k++)
+    {
+        const double d = k < 3 ? scale[k] : tie[k - 3];
+        uint64_t     u;
+        memcpy(&u, &d, sizeof(u));
+        sp_tiff_put32(be, buf + dbls + 8 * k + (be ? 0 : 4), u >> 32);
+        sp_tiff_put32(be, buf + dbls + 8 * k + (be ? 4 : 0), u);
+    }
+    return buf;
+}
+
+//-----------------------------------------------------------------------------
+/** A GetCoverage response with a copy of a TIFF as its attachment.
+ */
+static axiom_node_t *sp_unit_z_coverage(
+    const axutil_env_t  *env,
+    const unsigned char *tiff,
+    const size_t         len)
+{
+    axis2_byte_t *data = AXIS2_MALLOC(env->allocator, len);
+    if (NULL == data) return NULL;
+    memcpy(data, tiff, len);
+
+    axiom_data_handler_t *dh = axiom_data_handler_create(env, NULL, "image/tiff");
+    axiom_data_handler_set_binary_data(dh, env, data, len);
+    return sp_make_MTOM_dh_node20(env, dh, "Coverage", "wcs",
+                                  "http://www.opengis.net/wcs/2.0");
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_z_props(sp_props *props)
+{
+    memset(props, 0, sizeof(*props));
+    props->compress_level   = 6;
+    props->compress_min_kb  = 64;
+    props->compress_threads = 3;
+}
+
+//-----------------------------------------------------------------------------
+/** Check the strips and tags of a compressed TIFF against the input.
+ */
+static void sp_unit_z_check(
+    const sp_tiff       *t,
+    const unsigned char *data,
+    const size_t         len)
+{
+    sp_tiff  z;
+    uint32_t i, s;
+
+    // sp_tiff_open() takes no compressed TIFF, but indexes its IFD.
+    const char *why = sp_tiff_open(&z, data, len);
+    SP_UNIT_CHECK(NULL != why && 0 == strcmp(why, "compressed"));
+    SP_UNIT_CHECK(t->be == z.be);
+    SP_UNIT_CHECK(SP_TIFF_DEFLATE == sp_tiff_get(&z, SP_TIFF_COMPRESSION, 0, -1));
+
+    const long long rows = sp_tiff_get(&z, SP_TIFF_ROWS, 0, -1);
+    SP_UNIT_CHECK(SP_COMPRESS_STRIP_LEN / t->row_len == rows);
+    if (rows <= 0) return;
+
+    const uint32_t n_strips = (t->height + rows - 1) / rows;
+    SP_UNIT_CHECK(n_strips > 1);
+    SP_UNIT_CHECK(sp_tiff_get(&z, SP_TIFF_OFFSETS, n_strips - 1, -1) > 0);
+    SP_UNIT_CHECK(-1 == sp_tiff_get(&z, SP_TIFF_OFFSETS, n_strips, -1));
+    SP_UNIT_CHECK(-1 == sp_tiff_get(&z, SP_TIFF_COUNTS,  n_strips, -1));
+
+    const size_t   pix_len = t->row_len * t->height;
+    unsigned char *pix     = malloc(pix_len);
+    SP_UNIT_CHECK(NULL != pix);
+    if (NULL == pix) return;
+    memset(pix, 0, pix_len);
+
+    for (s = 0; s < n_strips; s++)
+    {
+        const long long off   = sp_tiff_get(&z, SP_TIFF_OFFSETS, s, -1);
+        const long long count = sp_tiff_get(&z, SP_TIFF_COUNTS,  s, -1);
+        const uint32_t  r     = s + 1 < n_strips ? rows : t->height - s * rows;
+        uLongf          n     = r * t->row_len;
+
+        SP_UNIT_CHECK(off > 0 && count > 0 && (size_t) (off + count) <= len);
+        if (off <= 0 || count <= 0 || (size_t) (off + count) > len) break;
+        SP_UNIT_CHECK(Z_OK == uncompress(pix + s * rows * t->row_len, &n,
+                                         data + off, count));
+        SP_UNIT_CHECK(r * t->row_len == n);
+    }
+    SP_UNIT_CHECK(0 == memcmp(pix, t->p + sp_tiff_get(t, SP_TIFF_OFFSETS, 0, 0),
+                              pix_len));
+    free(pix);
+
+    // The rest of the tags, type, count and value.
+    SP_UNIT_CHECK(t->n_entries == z.n_entries);
+    for (i = 0; i < t->n_entries; i++)
+    {
+        const unsigned char *e   = t->ifd + 12 * i;
+        const uint32_t       tag = sp_tiff_16(t->be, e);
+        if (SP_TIFF_COMPRESSION == tag || SP_TIFF_OFFSETS == tag ||
+            SP_TIFF_ROWS == tag || SP_TIFF_COUNTS == tag)
+        {
+            continue;
+        }
+
+        const unsigned char *ze = sp_tiff_find(&z, tag);
+        SP_UNIT_CHECK(NULL != ze);
+        if (NULL == ze) continue;
+        SP_UNIT_CHECK(0 == memcmp(e + 2, ze + 2, 6));
+
+        size_t               v_len = 0, zv_len = 0;
+        const unsigned char *v     = sp_tiff_value(t,  e,  &v_len);
+        const unsigned char *zv    = sp_tiff_value(&z, ze, &zv_len);
+        SP_UNIT_CHECK(NULL != v && NULL != zv && v_len == zv_len);
+        if (v && zv && v_len == zv_len) SP_UNIT_CHECK(0 == memcmp(v, zv, v_len));
+    }
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_compressed(const axutil_env_t *env, const int be)
+{
+    sp_props props;
+    sp_tiff  t;
+    size_t   len = 0;
+
+    sp_unit_z_props(&props);
+    unsigned char *tiff = sp_unit_z_make(be, SP_UNIT_Z_WIDTH, SP_UNIT_Z_HEIGHT,
+                                         SP_UNIT_Z_ROWS, 0, 0, 0, &len);
+    SP_UNIT_CHECK(NULL != tiff);
+    if (NULL == tiff) return;
+    SP_UNIT_CHECK(NULL == sp_tiff_open(&t, tiff, len));
+
+    axiom_node_t *node = sp_unit_z_coverage(env, tiff, len);
+    SP_UNIT_CHECK(1 == sp_compress_coverage(env, &props, node));
+
+    axiom_data_handler_t *dh = sp_cache_coverage_dh(env, node);
+    SP_UNIT_CHECK(NULL != dh);
+    if (dh)
+    {
+        const unsigned char *data = (const unsigned char *)
+                axiom_data_handler_get_input_stream(dh, env);
+        const size_t z_len = axiom_data_handler_get_input_stream_len(dh, env);
+
+        SP_UNIT_CHECK(0 == strcmp("image/tiff",
+                                  axiom_data_handler_get_content_type(dh, env)));
+        SP_UNIT_CHECK(NULL != data && z_len < len / 2);
+        if (data) sp_unit_z_check(&t, data, z_len);
+    }
+
+    if (node) axiom_node_free_tree(node, env);
+    free(tiff);
+}
+
+//-----------------------------------------------------------------------------
+/** Run a TIFF through sp_compress_coverage(), which must leave it alone.
+ */
+static void sp_unit_z_unchanged(
+    const axutil_env_t  *env,
+    const sp_props      *props,
+    const unsigned char *tiff,
+    const size_t         len)
+{
+    SP_UNIT_CHECK(NULL != tiff);
+    if (NULL == tiff) return;
+
+    axiom_node_t         *node = sp_unit_z_coverage(env, tiff, len);
+    axiom_data_handler_t *dh   = sp_cache_coverage_dh(env, node);
+    SP_UNIT_CHECK(NULL != dh);
+
+    SP_UNIT_CHECK(0 == sp_compress_coverage(env, props, node));
+    SP_UNIT_CHECK(dh == sp_cache_coverage_dh(env, node));
+    if (dh)
+    {
+        SP_UNIT_CHECK(len == axiom_data_handler_get_input_stream_len(dh, env));
+        SP_UNIT_CHECK(0 == memcmp(tiff,
+                axiom_data_handler_get_input_stream(dh, env), len));
+    }
+
+    if (node) axiom_node_free_tree(node, env);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_left_alone(const axutil_env_t *env, const int be)
+{
+    sp_props       props;
+    size_t         len  = 0;
+    unsigned char *tiff = NULL;
+
+    sp_unit_z_props(&props);
+
+    tiff = sp_unit_z_make(be, SP_UNIT_Z_WIDTH, SP_UNIT_Z_HEIGHT, SP_UNIT_Z_ROWS,
+                          0, SP_TIFF_TILEWIDTH, 256, &len);
+    sp_unit_z_unchanged(env, &props, tiff, len);
+    free(tiff);
+
+    tiff = sp_unit_z_make(be, SP_UNIT_Z_WIDTH, SP_UNIT_Z_HEIGHT, SP_UNIT_Z_ROWS,
+                          0, SP_TIFF_COMPRESSION, SP_TIFF_DEFLATE, &len);
+    sp_unit_z_unchanged(env, &props, tiff, len);
+    free(tiff);
+
+    // Below CompressMinKB, and with CompressLevel 0.
+    tiff = sp_unit_z_make(be, SP_UNIT_Z_WIDTH, SP_UNIT_Z_HEIGHT, SP_UNIT_Z_ROWS,
+                          0, 0, 0, &len);
+    props.compress_min_kb = len / 1024 + 1;
+    sp_unit_z_unchanged(env, &props, tiff, len);
+    sp_unit_z_props(&props);
+    props.compress_level = 0;
+    sp_unit_z_unchanged(env, &props, tiff, len);
+    free(tiff);
+
+    // Noise, one row per compressed strip: the zlib overhead of the strips
+    // outweighs what the strip offsets and counts of the input took.
+    sp_unit_z_props(&props);
+    tiff = sp_unit_z_make(be, SP_COMPRESS_STRIP_LEN + 1000, 8, 8, 1, 0, 0, &len);
+    sp_unit_z_unchanged(env, &props, tiff, len);
+    free(tiff);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    axutil_env_t *env = sp_unit_init("sp_unit_compress");
+    if (NULL == env) return 1;
+
+    for (int be = 0; be <= 1; be++)
+    {
+        sp_unit_compressed(env, be);
+        sp_unit_left_alone(env, be);
+    }
+
+    return sp_unit_done("sp_unit_compress");
+}
@@ -0,0 +1,409 @@
+/*
+ * Soap Proxy - unit checks of sp_eoindex.c
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * The geometry (boxes, segments and rings against rectangles), the
+ * parsing of bounds and of DescribeEOCoverageSet requests, and the
+ * packed R-tree: built over random coverages and laid out as a cache
+ * entry, every search must find what a test of each coverage in turn
+ * finds, in the same order.
+ */
+
+/**
+ * @file sp_unit_eoindex.c
+ *
+ */
+
+#include "sp_eoindex.c"
+#include "sp_unit.h"
+
+#define SP_UNIT_N_COV   2000
+#define SP_UNIT_N_QUERY 500
+#define SP_UNIT_T0      1325376000.0        // 2012-01-01T00:00:00Z
+
+#define SP_UNIT_EOWCS "http://www.opengis.net/wcseo/1.0"
+#define SP_UNIT_WCS   "http://www.opengis.net/wcs/2.0"
+
+//-----------------------------------------------------------------------------
+static double sp_unit_rand(const double lo, const double hi)
+{
+    return lo + (hi - lo) * rand() / ((double) RAND_MAX + 1.0);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_box_set(
+    sp_eoi_box  *b,
+    const double x0,
+    const double y0,
+    const double x1,
+    const double y1)
+{
+    b->x0 = x0;
+    b->y0 = y0;
+    b->x1 = x1;
+    b->y1 = y1;
+    b->t0 = -DBL_MAX;
+    b->t1 =  DBL_MAX;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_boxes(void)
+{
+    sp_eoi_box a, b, c;
+
+    sp_unit_box_set(&a, 0, 0, 10, 10);
+    sp_unit_box_set(&b, 10, 10, 20, 20);        // touches a at a corner
+    sp_unit_box_set(&c, 2, 2, 8, 8);
+
+    SP_UNIT_CHECK(sp_eoi_box_meets(&a, &b) && sp_eoi_box_meets(&b, &a));
+    SP_UNIT_CHECK(sp_eoi_box_within(&c, &a) && ! sp_eoi_box_within(&a, &c));
+    SP_UNIT_CHECK(! sp_eoi_box_within(&b, &a));
+
+    b.x0 = 10.5;
+    SP_UNIT_CHECK(! sp_eoi_box_meets(&a, &b));
+
+    // Time counts as well.
+    c.t0 = 0;
+    c.t1 = 10;
+    a.t0 = 11;
+    SP_UNIT_CHECK(! sp_eoi_box_meets(&a, &c));
+
+    sp_eoi_box_empty(&a);
+    sp_eoi_box_add(&a, &b);
+    sp_eoi_box_add(&a, &c);
+    SP_UNIT_CHECK(2 == a.x0 && 2 == a.y0 && 20 == a.x1 && 20 == a.y1);
+    SP_UNIT_CHECK(sp_eoi_box_within(&b, &a) && sp_eoi_box_within(&c, &a));
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_rings(void)
+{
+    // A triangle, and a square with a notch cut into its top.
+    const double tri[]   = { 0, 0,  10, 0,  0, 10 };
+    const double notch[] = { 0, 0,  10, 0,  10, 10,  6, 10,  5, 2,  4, 10,  0, 10 };
+    const double a[]     = { -5, 5 }, b[] = { 15, 5 }, c[] = { 5, 20 };
+    sp_eoi_box   r;
+
+    sp_unit_box_set(&r, 1, 1, 2, 2);
+    SP_UNIT_CHECK(sp_eoi_ring_meets(tri, 3, &r));           // inside
+    sp_unit_box_set(&r, 6, 6, 9, 9);
+    SP_UNIT_CHECK(! sp_eoi_ring_meets(tri, 3, &r));         // in its box only
+    sp_unit_box_set(&r, 4, 4, 6, 6);
+    SP_UNIT_CHECK(sp_eoi_ring_meets(tri, 3, &r));           // crossed by an edge
+    sp_unit_box_set(&r, -1, -1, 11, 11);
+    SP_UNIT_CHECK(sp_eoi_ring_meets(tri, 3, &r));           // all around it
+    sp_unit_box_set(&r, 4.8, 5, 5.2, 9);
+    SP_UNIT_CHECK(! sp_eoi_ring_meets(notch, 7, &r));       // in the notch
+    sp_unit_box_set(&r, 4.8, 1, 5.2, 9);
+    SP_UNIT_CHECK(sp_eoi_ring_meets(notch, 7, &r));         // the notch's tip
+
+    sp_unit_box_set(&r, 0, 0, 10, 10);
+    SP_UNIT_CHECK(sp_eoi_segment_meets(a, b, &r));
+    SP_UNIT_CHECK(! sp_eoi_segment_meets(a, c, &r));
+    SP_UNIT_CHECK(! sp_eoi_segment_meets(b, c, &r));        // past a corner
+    SP_UNIT_CHECK(! sp_eoi_segment_meets(a, a, &r));
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_values(void)
+{
+    double d;
+    char   tag[] = "<eo xmlns:a=\"x\" numberMatched=\"5\" xnumberReturned='3'>";
+
+    SP_UNIT_CHECK(0 == sp_eoi_time("2012-01-01T00:00:00Z", &d) && SP_UNIT_T0 == d);
+    SP_UNIT_CHECK(0 == sp_eoi_time(" \"2012-01-01T01:00:00Z\"\n", &d) &&
+                  SP_UNIT_T0 + 3600 == d);
+    SP_UNIT_CHECK(0 == sp_eoi_time("'2012-01-01'", &d) && SP_UNIT_T0 == d);
+    SP_UNIT_CHECK(0 != sp_eoi_time("\"2012-01-01T00:00:00Z'", &d));
+    SP_UNIT_CHECK(0 != sp_eoi_time("yesterday", &d));
+    SP_UNIT_CHECK(0 != sp_eoi_time(NULL, &d));
+
+    SP_UNIT_CHECK(0 == sp_eoi_number(" -12.5 \n", &d) && -12.5 == d);
+    SP_UNIT_CHECK(0 != sp_eoi_number("12 E", &d));
+    SP_UNIT_CHECK(0 != sp_eoi_number("", &d));
+    SP_UNIT_CHECK(0 != sp_eoi_number("inf", &d));
+
+    SP_UNIT_CHECK(30 == sp_eoi_find_attr(tag, strlen(tag), "numberMatched"));
+    SP_UNIT_CHECK('"' == tag[sp_eoi_find_attr(tag, strlen(tag), "numberMatched")]);
+    SP_UNIT_CHECK(0 == sp_eoi_find_attr(tag, strlen(tag), "numberReturned"));
+    SP_UNIT_CHECK(0 == sp_eoi_find_attr(tag, strlen(tag), "count"));
+}
+
+//-----------------------------------------------------------------------------
+/** Parse a DescribeEOCoverageSet.
+ * @return what sp_eoi_parse() does, -2 if the XML is bad.
+ */
+static int sp_unit_parse_query(
+    const axutil_env_t *env,
+    const char         *body,
+    const char         *attrs,
+    sp_eoi_query       *q)
+{
+    static axiom_node_t *last = NULL;
+    char                 xml[2048];
+
+    // The ids point into the tree, so it is kept until the next one.
+    if (last) axiom_node_free_tree(last, env);
+    snprintf(xml, sizeof(xml),
+             "<eowcs:DescribeEOCoverageSet xmlns:eowcs=\"" SP_UNIT_EOWCS "\""
+             " xmlns:wcs=\"" SP_UNIT_WCS "\" service=\"WCS\" version=\"2.0.0\"%s>"
+             "%s</eowcs:DescribeEOCoverageSet>", attrs, body);
+    last = sp_unit_parse(env, xml);
+    return last ? sp_eoi_parse(env, last, q) : -2;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_requests(const axutil_env_t *env)
+{
+    sp_eoi_query q;
+
+    SP_UNIT_CHECK(0 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S2</eowcs:eoId><eowcs:eoId>S1</eowcs:eoId>"
+        "<eowcs:containment>contains</eowcs:containment>"
+        "<eowcs:Sections><eowcs:Section>All</eowcs:Section></eowcs:Sections>"
+        "<wcs:DimensionTrim><wcs:Dimension>Long</wcs:Dimension>"
+        "<wcs:TrimLow>10</wcs:TrimLow><wcs:TrimHigh>20</wcs:TrimHigh></wcs:DimensionTrim>"
+        "<wcs:DimensionTrim><wcs:Dimension>phenomenonTime</wcs:Dimension>"
+        "<wcs:TrimLow>\"2012-01-01T00:00:00Z\"</wcs:TrimLow></wcs:DimensionTrim>",
+        " count=\"5\"", &q));
+    SP_UNIT_CHECK(2 == q.nids && 0 == strcmp("S2", q.ids[0]));
+    SP_UNIT_CHECK(q.contains && q.spatial && q.temporal && 5 == q.count);
+    SP_UNIT_CHECK(10 == q.box.x0 && 20 == q.box.x1);
+    SP_UNIT_CHECK(-DBL_MAX == q.box.y0 && DBL_MAX == q.box.y1);
+    SP_UNIT_CHECK(SP_UNIT_T0 == q.box.t0 && DBL_MAX == q.box.t1);
+
+    SP_UNIT_CHECK(0 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>", "", &q));
+    SP_UNIT_CHECK(! q.contains && ! q.spatial && ! q.temporal && -1 == q.count);
+
+    // Not to be answered locally.
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env, "", "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<wcs:DimensionSlice><wcs:Dimension>Lat</wcs:Dimension>"
+        "<wcs:SlicePoint>10</wcs:SlicePoint></wcs:DimensionSlice>", "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Lat</wcs:Dimension>"
+        "<wcs:TrimLow>north</wcs:TrimLow></wcs:DimensionTrim>", "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<wcs:DimensionTrim><wcs:Dimension>Lat</wcs:Dimension></wcs:DimensionTrim>"
+        "<wcs:DimensionTrim><wcs:Dimension>Lat</wcs:Dimension></wcs:DimensionTrim>",
+        "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<wcs:DimensionTrim><wcs:Dimension>height</wcs:Dimension></wcs:DimensionTrim>",
+        "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<eowcs:containment>touches</eowcs:containment>", "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>"
+        "<eowcs:Sections><eowcs:Section>CoverageDescriptions</eowcs:Section></eowcs:Sections>",
+        "", &q));
+    SP_UNIT_CHECK(-1 == sp_unit_parse_query(env,
+        "<eowcs:eoId>S1</eowcs:eoId>", " count=\"-1\"", &q));
+}
+
+//-----------------------------------------------------------------------------
+/** Random coverages, each with a quadrilateral footprint inside its box.
+ */
+static void sp_unit_fill(sp_eoi_build *b, const int n)
+{
+    int i, k;
+
+    b->cov  = calloc(n, sizeof(sp_eoi_cov));
+    b->ring = calloc(n, sizeof(sp_eoi_ring));
+    b->vert = calloc(n * 4 * 2, sizeof(double));
+    b->ncov = b->nring = n;
+    b->nvert = 4 * n;
+
+    for (i = 0; i < n; i++)
+    {
+        sp_eoi_cov *cov = &b->cov[i];
+        double     *v   = &b->vert[8 * i];
+        const double x  = sp_unit_rand(-180, 175), y = sp_unit_rand(-90, 85);
+        const double w  = sp_unit_rand(0.1, 5),    h = sp_unit_rand(0.1, 5);
+
+        // A diamond, the box is its hull.
+        v[0] = x + w / 2;  v[1] = y;
+        v[2] = x + w;      v[3] = y + h / 2;
+        v[4] = x + w / 2;  v[5] = y + h;
+        v[6] = x;          v[7] = y + h / 2;
+
+        sp_eoi_box_empty(&cov->box);
+        for (k = 0; k < 4; k++)
+        {
+            sp_eoi_box p;
+            p.x0 = p.x1 = v[2 * k];
+            p.y0 = p.y1 = v[2 * k + 1];
+            p.t0 = p.t1 = SP_UNIT_T0;
+            sp_eoi_box_add(&cov->box, &p);
+        }
+        cov->box.t0 = SP_UNIT_T0 + sp_unit_rand(0, 86400 * 365);
+        cov->box.t1 = cov->box.t0 + sp_unit_rand(0, 86400 * 30);
+        cov->off    = i;
+        cov->len    = 1;
+        cov->ring   = i;
+        cov->nring  = 1;
+        cov->exact  = 1;
+        b->ring[i].vert  = 4 * i;
+        b->ring[i].nvert = 4;
+    }
+}
+
+//-----------------------------------------------------------------------------
+/** Check that every node's box holds what is below it, and that each
+ *  coverage is in exactly one leaf.
+ */
+static void sp_unit_check_tree(const sp_eoi_view *v)
+{
+    const sp_eoi_head *h    = v->head;
+    char              *seen = calloc(h->ncov, 1);
+    uint32_t           i, k, in_leaves = 0, bad = 0;
+
+    for (i = 0; i < h->nnode; i++)
+    {
+        const sp_eoi_node *nd = &v->node[i];
+        for (k = nd->first; k < nd->first + nd->count; k++)
+        {
+            const sp_eoi_box *child = nd->leaf ?
+                    &v->cov[v->perm[k]].box : &v->node[k].box;
+            if (! sp_eoi_box_within(child, &nd->box)) bad++;
+            if (nd->leaf)
+            {
+                if (seen[v->perm[k]]++) bad++;
+                in_leaves++;
+            }
+            else if (k >= i)
+            {
+                bad++;      // children come before their parents
+            }
+        }
+        if (nd->count < 1 || nd->count > SP_EOI_FANOUT) bad++;
+    }
+    SP_UNIT_CHECK(0 == bad);
+    SP_UNIT_CHECK(h->ncov == in_leaves);
+    SP_UNIT_CHECK(h->root == h->nnode - 1);
+    free(seen);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_search(const int ncov)
+{
+    sp_eoi_build b;
+    sp_eoi_head  proto;
+    sp_eoi_view  view;
+    const char  *text = "<a>x</a>";
+    size_t       len  = 0;
+    int          nnode = 0, i, j, found = 0, failed = 0;
+
+    memset(&b, 0, sizeof(b));
+    memset(&proto, 0, sizeof(proto));
+    proto.text_len = strlen(text);
+    proto.head_len = 3;
+    proto.tail_off = 4;
+
+    sp_unit_fill(&b, ncov);
+    uint32_t    *perm = malloc(ncov * sizeof(uint32_t));
+    sp_eoi_node *node = sp_eoi_pack(b.cov, ncov, perm, &nnode);
+    SP_UNIT_CHECK(NULL != node && nnode >= 1);
+    if (NULL == node) return;
+
+    void *data = sp_eoi_layout(&b, &proto, node, nnode, perm, text, &len);
+    SP_UNIT_CHECK(NULL != data && 0 == sp_eoi_view_init(data, len, &view));
+    SP_UNIT_CHECK(0 == memcmp(view.text, text, proto.text_len));
+    sp_unit_check_tree(&view);
+
+    uint32_t *hits = malloc(ncov * sizeof(uint32_t));
+    uint32_t *want = malloc(ncov * sizeof(uint32_t));
+    for (i = 0; i < SP_UNIT_N_QUERY; i++)
+    {
+        sp_eoi_query q;
+        int          nwant = 0;
+
+        memset(&q, 0, sizeof(q));
+        const double x = sp_unit_rand(-185, 180), y = sp_unit_rand(-95, 90);
+        const double t = SP_UNIT_T0 + sp_unit_rand(-86400 * 30, 86400 * 365);
+        sp_unit_box_set(&q.box, x, y, x + sp_unit_rand(0, 40), y + sp_unit_rand(0, 20));
+        q.spatial  = 1;
+        q.contains = 0 == i % 3;
+        if (i % 2)
+        {
+            q.temporal = 1;
+            q.box.t0   = t;
+            q.box.t1   = t + sp_unit_rand(0, 86400 * 60);
+        }
+
+        for (j = 0; j < ncov; j++)
+        {
+            if (sp_eoi_match(&view, &view.cov[j], &q) > 0) want[nwant++] = j;
+        }
+        const int n = sp_eoi_search(&view, &q, hits);
+        if (n != nwant || memcmp(hits, want, n * sizeof(uint32_t))) failed++;
+        found += nwant;
+    }
+    SP_UNIT_CHECK(0 == failed);
+    SP_UNIT_CHECK(found > 0);
+
+    // Damaged entries are not used.
+    sp_eoi_head *h = data;
+    SP_UNIT_CHECK(0 != sp_eoi_view_init(data, sizeof(sp_eoi_head) - 1, &view));
+    SP_UNIT_CHECK(0 != sp_eoi_view_init(data, len - 1, &view));
+    h->magic++;
+    SP_UNIT_CHECK(0 != sp_eoi_view_init(data, len, &view));
+    h->magic--;
+    h->root = h->nnode;
+    SP_UNIT_CHECK(0 != sp_eoi_view_init(data, len, &view));
+
+    free(hits);
+    free(want);
+    free(data);
+    free(node);
+    free(perm);
+    free(b.cov);
+    free(b.ring);
+    free(b.vert);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    axutil_env_t *env = sp_unit_init("sp_unit_eoindex");
+    if (NULL == env) return 1;
+
+    srand(1);
+    sp_unit_boxes();
+    sp_unit_rings();
+    sp_unit_values();
+    sp_unit_requests(env);
+
+    // One leaf, one level above the leaves, and more.
+    sp_unit_search(1);
+    sp_unit_search(SP_EOI_FANOUT * SP_EOI_FANOUT);
+    sp_unit_search(SP_UNIT_N_COV);
+
+    return sp_unit_done("sp_unit_eoindex");
+}
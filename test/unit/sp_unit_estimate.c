@@ -0,0 +1,246 @@
+/*
+ * Soap Proxy - unit checks of sp_estimate.c
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * The parsing of numbers and names, the bytes guessed for a band from its
+ * interval, and the estimates of GetCoverage requests with trims,
+ * slices, scaling and range subsets against a CoverageDescription whose
+ * grid axes run in the other order than its Envelope axes.
+ */
+
+/**
+ * @file sp_unit_estimate.c
+ *
+ */
+
+#include "sp_estimate.c"
+#include "sp_unit.h"
+
+#define SP_UNIT_NS \
+    " xmlns:wcs=\"http://www.opengis.net/wcs/2.0\"" \
+    " xmlns:gml=\"http://www.opengis.net/gml/3.2\"" \
+    " xmlns:gmlcov=\"http://www.opengis.net/gmlcov/1.0\"" \
+    " xmlns:swe=\"http://www.opengis.net/swe/2.0\"" \
+    " xmlns:scal=\"http://www.opengis.net/wcs/scaling/1.0\"" \
+    " xmlns:rsub=\"http://www.opengis.net/wcs/range-subsetting/1.0\""
+
+#define SP_UNIT_BAND(name, interval) \
+    "<swe:field name=\"" name "\"><swe:Quantity><swe:constraint><swe:AllowedValues>" \
+    "<swe:interval>" interval "</swe:interval>" \
+    "</swe:AllowedValues></swe:constraint></swe:Quantity></swe:field>"
+
+#define SP_UNIT_TRIM(dim, lo, hi) \
+    "<wcs:DimensionTrim><wcs:Dimension>" dim "</wcs:Dimension>" \
+    "<wcs:TrimLow>" lo "</wcs:TrimLow><wcs:TrimHigh>" hi "</wcs:TrimHigh>" \
+    "</wcs:DimensionTrim>"
+
+//
+// 2000 pixels of Long by 1000 of Lat, the first grid axis along Long;
+// bands of 1, 2 and 4 bytes.
+//
+static const char *sp_unit_desc =
+    "<wcs:CoverageDescriptions" SP_UNIT_NS ">"
+    "<wcs:CoverageDescription gml:id=\"c1\">"
+    "<gml:boundedBy><gml:Envelope axisLabels=\"Lat Long\" srsDimension=\"2\">"
+    "<gml:lowerCorner>40 10</gml:lowerCorner>"
+    "<gml:upperCorner>50 30</gml:upperCorner>"
+    "</gml:Envelope></gml:boundedBy>"
+    "<wcs:CoverageId>c1</wcs:CoverageId>"
+    "<gml:domainSet><gml:RectifiedGrid gml:id=\"c1_grid\" dimension=\"2\">"
+    "<gml:limits><gml:GridEnvelope>"
+    "<gml:low>0 0</gml:low><gml:high>1999 999</gml:high>"
+    "</gml:GridEnvelope></gml:limits>"
+    "<gml:axisLabels>x y</gml:axisLabels>"
+    "<gml:origin><gml:Point gml:id=\"c1_origin\"><gml:pos>50 10</gml:pos></gml:Point></gml:origin>"
+    "<gml:offsetVector>0 0.01</gml:offsetVector>"
+    "<gml:offsetVector>-0.01 0</gml:offsetVector>"
+    "</gml:RectifiedGrid></gml:domainSet>"
+    "<gmlcov:rangeType><swe:DataRecord>"
+    SP_UNIT_BAND("red",  "0 255")
+    SP_UNIT_BAND("nir",  "0 65535")
+    SP_UNIT_BAND("temp", "-3.4028235e+38 3.4028235e+38")
+    "</swe:DataRecord></gmlcov:rangeType>"
+    "</wcs:CoverageDescription>"
+    "</wcs:CoverageDescriptions>";
+
+//-----------------------------------------------------------------------------
+static void sp_unit_parsing(void)
+{
+    const char *list[] = { "Lat", "Long", "lat" };
+    double      v[3];
+
+    SP_UNIT_CHECK(2 == sp_est_numbers(" 1.5\n-2e3 ", v, 3) && 1.5 == v[0] && -2000 == v[1]);
+    SP_UNIT_CHECK(0 == sp_est_numbers("  ", v, 3));
+    SP_UNIT_CHECK(-1 == sp_est_numbers("1 2 3 4", v, 3));
+    SP_UNIT_CHECK(-1 == sp_est_numbers("1 x", v, 3));
+    SP_UNIT_CHECK(-1 == sp_est_numbers("nan", v, 3));
+    SP_UNIT_CHECK(-1 == sp_est_numbers(NULL, v, 3));
+    SP_UNIT_CHECK(0 == sp_est_number("7", v) && 7 == v[0]);
+    SP_UNIT_CHECK(-1 == sp_est_number("7 8", v));
+
+    // Exact before ignoring case, white space around the name ignored.
+    SP_UNIT_CHECK(0 == sp_est_find(" Lat\n", list, 3));
+    SP_UNIT_CHECK(2 == sp_est_find("lat", list, 3));
+    SP_UNIT_CHECK(1 == sp_est_find("LONG", list, 3));
+    SP_UNIT_CHECK(-1 == sp_est_find("Lo", list, 3));
+    SP_UNIT_CHECK(-1 == sp_est_find(NULL, list, 3));
+
+    SP_UNIT_CHECK(1 == sp_est_band_bytes(NULL));
+    SP_UNIT_CHECK(1 == sp_est_band_bytes("0 255"));
+    SP_UNIT_CHECK(1 == sp_est_band_bytes("-128 127"));
+    SP_UNIT_CHECK(2 == sp_est_band_bytes("0 256"));
+    SP_UNIT_CHECK(2 == sp_est_band_bytes("65535 -32768"));
+    SP_UNIT_CHECK(4 == sp_est_band_bytes("0 4294967295"));
+    SP_UNIT_CHECK(4 == sp_est_band_bytes("0 0.5"));
+    SP_UNIT_CHECK(4 == sp_est_band_bytes("-3.4028235e+38 3.4028235e+38"));
+    SP_UNIT_CHECK(8 == sp_est_band_bytes("-1.7976931348623157e+308 1.7976931348623157e+308"));
+    SP_UNIT_CHECK(4 == sp_est_band_bytes("0 4294967296"));     // taken as float
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_total(void)
+{
+    sp_est est;
+
+    memset(&est, 0, sizeof(est));
+    est.n_axes      = 2;
+    est.pixels[0]   = 1000;
+    est.pixels[1]   = 3;
+    est.scale[0]    = 0.25;
+    est.scale[1]    = 0.1;      // never below one pixel
+    est.pixel_bytes = 2;
+    SP_UNIT_CHECK(250 * 1 * 2 == sp_est_total(&est));
+
+    est.size[0] = 64;           // a target size wins over the scale
+    SP_UNIT_CHECK(64 * 1 * 2 == sp_est_total(&est));
+
+    strcpy(est.labels[0], "Lat");
+    strcpy(est.labels[1], "Long");
+    SP_UNIT_CHECK(1 == sp_est_axis(&est, "http://www.opengis.net/def/axis/OGC/0/Long"));
+    SP_UNIT_CHECK(0 == sp_est_axis(&est, "Lat"));
+    SP_UNIT_CHECK(-1 == sp_est_axis(&est, "http://www.opengis.net/def/axis/OGC/0/h"));
+}
+
+//-----------------------------------------------------------------------------
+/** Estimate a GetCoverage of c1.
+ * @param body what follows its CoverageId.
+ * @return bytes, -1 if it cannot be estimated, -2 if the XML is bad.
+ */
+static double sp_unit_estimate(const axutil_env_t *env, const char *body)
+{
+    char   xml[4096];
+    sp_est est;
+    double bytes = -1;
+
+    snprintf(xml, sizeof(xml),
+             "<wcs:GetCoverage" SP_UNIT_NS " service=\"WCS\" version=\"2.0.1\">"
+             "<wcs:CoverageId>c1</wcs:CoverageId>%s</wcs:GetCoverage>", body);
+
+    axiom_node_t *root = sp_unit_parse(env, sp_unit_desc);
+    axiom_node_t *node = sp_unit_parse(env, xml);
+    axiom_node_t *desc = root ?
+            rp_find_named_child(env, root, "CoverageDescription", 0) : NULL;
+
+    if (NULL == desc || NULL == node)
+    {
+        bytes = -2;
+    }
+    else if (0 == sp_est_describe(env, desc, &est) &&
+             0 == sp_est_request(env, node, &est))
+    {
+        bytes = sp_est_total(&est);
+    }
+    if (root) axiom_node_free_tree(root, env);
+    if (node) axiom_node_free_tree(node, env);
+    return bytes;
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_requests(const axutil_env_t *env)
+{
+    // The whole coverage, 1 + 2 + 4 bytes per pixel.
+    SP_UNIT_CHECK(1000.0 * 2000 * 7 == sp_unit_estimate(env, ""));
+
+    // Half of Long, the Lat trim cut to the Envelope.
+    SP_UNIT_CHECK(500.0 * 1000 * 7 == sp_unit_estimate(env,
+        SP_UNIT_TRIM("Long", "10", "20") SP_UNIT_TRIM("Lat", "45", "60")));
+
+    SP_UNIT_CHECK(1.0 * 2000 * 7 == sp_unit_estimate(env,
+        "<wcs:DimensionSlice><wcs:Dimension>Lat</wcs:Dimension>"
+        "<wcs:SlicePoint>45</wcs:SlicePoint></wcs:DimensionSlice>"));
+
+    // Scaled and one band.
+    SP_UNIT_CHECK(250.0 * 500 * 2 == sp_unit_estimate(env,
+        SP_UNIT_TRIM("Long", "10", "20") SP_UNIT_TRIM("Lat", "45", "60")
+        "<wcs:Extension>"
+        "<scal:ScaleByFactor><scal:scaleFactor>0.5</scal:scaleFactor></scal:ScaleByFactor>"
+        "<rsub:RangeSubset><rsub:RangeItem><rsub:RangeComponent>nir</rsub:RangeComponent>"
+        "</rsub:RangeItem></rsub:RangeSubset>"
+        "</wcs:Extension>"));
+
+    // Axes by URI, a band interval.
+    SP_UNIT_CHECK(100.0 * 2000 * 3 == sp_unit_estimate(env,
+        "<wcs:Extension>"
+        "<scal:ScaleToSize><scal:TargetAxisSize>"
+        "<scal:axis>http://www.opengis.net/def/axis/OGC/0/Lat</scal:axis>"
+        "<scal:targetSize>100</scal:targetSize>"
+        "</scal:TargetAxisSize></scal:ScaleToSize>"
+        "<rsub:RangeSubset><rsub:RangeItem><rsub:RangeInterval>"
+        "<rsub:startComponent>red</rsub:startComponent>"
+        "<rsub:endComponent>nir</rsub:endComponent>"
+        "</rsub:RangeInterval></rsub:RangeItem></rsub:RangeSubset>"
+        "</wcs:Extension>"));
+
+    SP_UNIT_CHECK(1000.0 * 501 * 7 == sp_unit_estimate(env,
+        "<wcs:Extension><scal:ScaleToExtent><scal:TargetAxisExtent>"
+        "<scal:axis>Long</scal:axis><scal:low>0</scal:low><scal:high>500</scal:high>"
+        "</scal:TargetAxisExtent></scal:ScaleToExtent></wcs:Extension>"));
+
+    // Not estimated.
+    SP_UNIT_CHECK(-1 == sp_unit_estimate(env, SP_UNIT_TRIM("height", "0", "1")));
+    SP_UNIT_CHECK(-1 == sp_unit_estimate(env, SP_UNIT_TRIM("Lat", "north", "50")));
+    SP_UNIT_CHECK(-1 == sp_unit_estimate(env,
+        "<wcs:Extension><rsub:RangeSubset><rsub:RangeItem>"
+        "<rsub:RangeComponent>blue</rsub:RangeComponent>"
+        "</rsub:RangeItem></rsub:RangeSubset></wcs:Extension>"));
+    SP_UNIT_CHECK(-1 == sp_unit_estimate(env,
+        "<wcs:Extension><scal:ScaleByFactor><scal:scaleFactor>0</scal:scaleFactor>"
+        "</scal:ScaleByFactor></wcs:Extension>"));
+    SP_UNIT_CHECK(-1 == sp_unit_estimate(env,
+        "<wcs:Extension><wcs:subsettingCrs>"
+        "http://www.opengis.net/def/crs/EPSG/0/3857</wcs:subsettingCrs></wcs:Extension>"));
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    axutil_env_t *env = sp_unit_init("sp_unit_estimate");
+    if (NULL == env) return 1;
+
+    sp_unit_parsing();
+    sp_unit_total();
+    sp_unit_requests(env);
+
+    return sp_unit_done("sp_unit_estimate");
+}
@@ -0,0 +1,366 @@
+/*
+ * Soap Proxy - unit checks of sp_tiff.c
+ *
+ * Copyright (c) 2012, ANF DATA Spol. s r.o.
+ *
+ ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ******************************************************************************
+ *
+ * Small GeoTIFFs are put together here, in both byte orders, and taken
+ * apart with sp_tiff_open() and sp_tiff_geo(): what they find, and what
+ * they turn down.  sp_tiff_write() output is opened again to check that
+ * the tags are kept, replaced and dropped as they should be.
+ */
+
+/**
+ * @file sp_unit_tiff.c
+ *
+ */
+
+#include "sp_tiff.c"
+#include "sp_unit.h"
+
+#define SP_UNIT_TIFF_LEN    1024
+#define SP_UNIT_TIFF_WIDTH  3
+#define SP_UNIT_TIFF_HEIGHT 4
+#define SP_UNIT_TIFF_ROWS   2
+#define SP_UNIT_TIFF_PIXELS (SP_UNIT_TIFF_WIDTH * SP_UNIT_TIFF_HEIGHT)
+
+//
+// A tag of a TIFF put together by sp_unit_tiff_make(), values taken from
+// 'v' for SHORT and LONG, from 'd' for DOUBLE.
+//
+struct sp_unit_tag_struct
+{
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t v[6];
+    double   d[6];
+};
+
+typedef struct sp_unit_tag_struct sp_unit_tag;
+
+//-----------------------------------------------------------------------------
+/** The tags of a 3x4, 8 bit grey GeoTIFF in two strips, 0.5 degrees per
+ *  pixel with its top left corner at 10 E, 50 N.
+ * @param tags
+ * @return the number of tags.
+ */
+static int sp_unit_tiff_tags(sp_unit_tag *tags)
+{
+    const sp_unit_tag std[] =
+    {
+        { SP_TIFF_WIDTH,       SP_TIFF_SHORT,  1, { SP_UNIT_TIFF_WIDTH  }, { 0 } },
+        { SP_TIFF_HEIGHT,      SP_TIFF_SHORT,  1, { SP_UNIT_TIFF_HEIGHT }, { 0 } },
+        { SP_TIFF_BPS,         SP_TIFF_SHORT,  1, { 8 }, { 0 } },
+        { SP_TIFF_COMPRESSION, SP_TIFF_SHORT,  1, { SP_TIFF_NONE }, { 0 } },
+        { SP_TIFF_OFFSETS,     SP_TIFF_LONG,   2, { 8, 8 + SP_UNIT_TIFF_WIDTH * SP_UNIT_TIFF_ROWS }, { 0 } },
+        { SP_TIFF_SPP,         SP_TIFF_SHORT,  1, { 1 }, { 0 } },
+        { SP_TIFF_ROWS,        SP_TIFF_LONG,   1, { SP_UNIT_TIFF_ROWS }, { 0 } },
+        { SP_TIFF_COUNTS,      SP_TIFF_LONG,   2, { SP_UNIT_TIFF_WIDTH * SP_UNIT_TIFF_ROWS,
+                                                    SP_UNIT_TIFF_WIDTH * SP_UNIT_TIFF_ROWS }, { 0 } },
+        { SP_TIFF_SCALE,       SP_TIFF_DOUBLE, 3, { 0 }, { 0.5, 0.5, 0.0 } },
+        { SP_TIFF_TIEPOINT,    SP_TIFF_DOUBLE, 6, { 0 }, { 0.0, 0.0, 0.0, 10.0, 50.0, 0.0 } },
+    };
+    memcpy(tags, std, sizeof(std));
+    return sizeof(std) / sizeof(std[0]);
+}
+
+//-----------------------------------------------------------------------------
+/** Change the first value of a tag, or drop the tag with count 0.
+ * @return the new number of tags.
+ */
+static int sp_unit_tiff_set(
+    sp_unit_tag    *tags,
+    int             n,
+    const uint16_t  tag,
+    const uint32_t  count,
+    const uint32_t  v)
+{
+    int i;
+    for (i = 0; i < n && tags[i].tag != tag; i++) ;
+    if (0 == count)
+    {
+        if (i < n) memmove(&tags[i], &tags[i + 1], (n - i - 1) * sizeof(tags[0]));
+        return i < n ? n - 1 : n;
+    }
+    if (i == n)
+    {
+        memset(&tags[n++], 0, sizeof(tags[0]));
+        tags[i].tag  = tag;
+        tags[i].type = SP_TIFF_SHORT;
+    }
+    tags[i].count = count;
+    tags[i].v[0]  = v;
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+/** Put a TIFF together: the header, the pixels 0, 1, 2 ... at offset 8,
+ *  the IFD, then the values that do not fit into it.
+ * @param buf of SP_UNIT_TIFF_LEN bytes.
+ * @param be
+ * @param tags
+ * @param n
+ * @return the length of the TIFF.
+ */
+static size_t sp_unit_tiff_make(
+    unsigned char     *buf,
+    const int          be,
+    const sp_unit_tag *tags,
+    const int          n)
+{
+    int    i, k;
+    size_t ifd  = 8 + SP_UNIT_TIFF_PIXELS;
+    size_t data = ifd + 2 + 12 * n + 4;
+
+    memset(buf, 0, SP_UNIT_TIFF_LEN);
+    memcpy(buf, be ? "MM" : "II", 2);
+    sp_tiff_put16(be, buf + 2, 42);
+    sp_tiff_put32(be, buf + 4, ifd);
+    for (i = 0; i < SP_UNIT_TIFF_PIXELS; i++) buf[8 + i] = i;
+
+    sp_tiff_put16(be, buf + ifd, n);
+    for (i = 0; i < n; i++)
+    {
+        unsigned char *e    = buf + ifd + 2 + 12 * i;
+        const size_t   size = sp_tiff_type_size(tags[i].type);
+        const size_t   len  = size * tags[i].count;
+        unsigned char *v    = len <= 4 ? e + 8 : buf + data;
+
+        sp_tiff_put16(be, e,     tags[i].tag);
+        sp_tiff_put16(be, e + 2, tags[i].type);
+        sp_tiff_put32(be, e + 4, tags[i].count);
+        if (len > 4)
+        {
+            sp_tiff_put32(be, e + 8, data);
+            data += len;
+        }
+        for (k = 0; k < (int) tags[i].count; k++)
+        {
+            if (SP_TIFF_SHORT == tags[i].type)
+            {
+                sp_tiff_put16(be, v + 2 * k, tags[i].v[k]);
+            }
+            else if (SP_TIFF_LONG == tags[i].type)
+            {
+                sp_tiff_put32(be, v + 4 * k, tags[i].v[k]);
+            }
+            else if (SP_TIFF_DOUBLE == tags[i].type)
+            {
+                uint64_t u;
+                memcpy(&u, &tags[i].d[k], sizeof(u));
+                sp_tiff_put32(be, v + 8 * k + (be ? 0 : 4), u >> 32);
+                sp_tiff_put32(be, v + 8 * k + (be ? 4 : 0), u);
+            }
+        }
+    }
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+/** Open a TIFF of the standard tags with one of them changed.
+ * @return what sp_tiff_open() or sp_tiff_geo() says.
+ */
+static const char *sp_unit_tiff_open_with(
+    const int       be,
+    const uint16_t  tag,
+    const uint32_t  count,
+    const uint32_t  v)
+{
+    static unsigned char buf[SP_UNIT_TIFF_LEN];
+    sp_unit_tag          tags[16];
+    sp_tiff              t;
+
+    int n = sp_unit_tiff_tags(tags);
+    n = sp_unit_tiff_set(tags, n, tag, count, v);
+    const size_t len = sp_unit_tiff_make(buf, be, tags, n);
+
+    const char *why = sp_tiff_open(&t, buf, len);
+    return why ? why : sp_tiff_geo(&t);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_bytes(void)
+{
+    const unsigned char le[] = { 0x34, 0x12, 0x00, 0x00 };
+    const unsigned char be[] = { 0x12, 0x34, 0x56, 0x78 };
+    const unsigned char one_and_half_le[] = { 0, 0, 0, 0, 0, 0, 0xf8, 0x3f };
+    const unsigned char one_and_half_be[] = { 0x3f, 0xf8, 0, 0, 0, 0, 0, 0 };
+    unsigned char       out[4];
+
+    SP_UNIT_CHECK(0x1234 == sp_tiff_16(0, le));
+    SP_UNIT_CHECK(0x1234 == sp_tiff_16(1, be));
+    SP_UNIT_CHECK(0x1234 == sp_tiff_32(0, le));
+    SP_UNIT_CHECK(0x12345678 == sp_tiff_32(1, be));
+    SP_UNIT_CHECK(1.5 == sp_tiff_double(0, one_and_half_le));
+    SP_UNIT_CHECK(1.5 == sp_tiff_double(1, one_and_half_be));
+
+    sp_tiff_put32(1, out, 0x12345678);
+    SP_UNIT_CHECK(0 == memcmp(out, be, 4));
+    sp_tiff_put32(0, out, 0x1234);
+    SP_UNIT_CHECK(0 == memcmp(out, le, 4));
+    sp_tiff_put16(1, out, 0xabcd);
+    SP_UNIT_CHECK(0xab == out[0] && 0xcd == out[1]);
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_open(const int be)
+{
+    static unsigned char buf[SP_UNIT_TIFF_LEN];
+    sp_unit_tag          tags[16];
+    sp_tiff              t;
+    size_t               len = 0;
+
+    const int    n    = sp_unit_tiff_tags(tags);
+    const size_t size = sp_unit_tiff_make(buf, be, tags, n);
+
+    SP_UNIT_CHECK(NULL == sp_tiff_open(&t, buf, size));
+    SP_UNIT_CHECK(be == t.be);
+    SP_UNIT_CHECK(SP_UNIT_TIFF_WIDTH  == t.width);
+    SP_UNIT_CHECK(SP_UNIT_TIFF_HEIGHT == t.height);
+    SP_UNIT_CHECK(1 == t.spp && 8 == t.bps);
+    SP_UNIT_CHECK(SP_UNIT_TIFF_ROWS == t.rows && 2 == t.n_strips);
+    SP_UNIT_CHECK(SP_UNIT_TIFF_WIDTH == t.row_len);
+
+    SP_UNIT_CHECK(8 == sp_tiff_get(&t, SP_TIFF_OFFSETS, 0, -1));
+    SP_UNIT_CHECK(14 == sp_tiff_get(&t, SP_TIFF_OFFSETS, 1, -1));
+    SP_UNIT_CHECK(-1 == sp_tiff_get(&t, SP_TIFF_OFFSETS, 2, 0));    // no third
+    SP_UNIT_CHECK(-1 == sp_tiff_get(&t, SP_TIFF_SCALE, 0, 0));      // DOUBLE
+    SP_UNIT_CHECK(7 == sp_tiff_get(&t, SP_TIFF_PLANAR, 0, 7));      // default
+    SP_UNIT_CHECK(NULL == sp_tiff_find(&t, SP_TIFF_PLANAR));
+
+    const unsigned char *e = sp_tiff_find(&t, SP_TIFF_TIEPOINT);
+    SP_UNIT_CHECK(NULL != e && NULL != sp_tiff_value(&t, e, &len) && 48 == len);
+
+    SP_UNIT_CHECK(NULL == sp_tiff_geo(&t));
+    SP_UNIT_CHECK(0.5 == t.scale[0] && 0.5 == t.scale[1]);
+    SP_UNIT_CHECK(10.0 == t.tie[0] && 50.0 == t.tie[1]);
+
+    // Cut short: the tie point is out of the file.
+    SP_UNIT_CHECK(NULL == sp_tiff_open(&t, buf, size - 8));
+    e = sp_tiff_find(&t, SP_TIFF_TIEPOINT);
+    SP_UNIT_CHECK(NULL != e && NULL == sp_tiff_value(&t, e, &len));
+    SP_UNIT_CHECK(NULL != sp_tiff_geo(&t));
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_reject(const int be)
+{
+    static unsigned char buf[SP_UNIT_TIFF_LEN];
+    sp_unit_tag          tags[16];
+    sp_tiff              t;
+    const int            n    = sp_unit_tiff_tags(tags);
+    const size_t         size = sp_unit_tiff_make(buf, be, tags, n);
+
+    SP_UNIT_CHECK(NULL != sp_tiff_open(&t, buf, 4));
+    buf[0] = 'X';
+    SP_UNIT_CHECK(NULL != sp_tiff_open(&t, buf, size));
+    sp_unit_tiff_make(buf, be, tags, n);
+    sp_tiff_put16(be, buf + 2, 43);                 // BigTIFF
+    SP_UNIT_CHECK(NULL != sp_tiff_open(&t, buf, size));
+    sp_unit_tiff_make(buf, be, tags, n);
+    sp_tiff_put32(be, buf + 4, size);               // IFD past the end
+    SP_UNIT_CHECK(NULL != sp_tiff_open(&t, buf, size));
+    sp_unit_tiff_make(buf, be, tags, n);
+    sp_tiff_put16(be, buf + 8 + SP_UNIT_TIFF_PIXELS, 200);
+    SP_UNIT_CHECK(NULL != sp_tiff_open(&t, buf, size));
+
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_COMPRESSION, 1, SP_TIFF_DEFLATE));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_WIDTH,       0, 0));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_BPS,         1, 12));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_TILEWIDTH,   1, 16));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_ROWS,        1, 1));   // 4 strips
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_TRANSFORM,   1, 0));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_SCALE,       0, 0));
+    SP_UNIT_CHECK(NULL != sp_unit_tiff_open_with(be, SP_TIFF_SPP,         1, 3));   // but one BPS
+    SP_UNIT_CHECK(NULL == sp_unit_tiff_open_with(be, SP_TIFF_ROWS,        1, 100)); // one strip
+    SP_UNIT_CHECK(NULL == sp_unit_tiff_open_with(be, SP_TIFF_PLANAR,      1, 2));   // one sample
+}
+
+//-----------------------------------------------------------------------------
+static void sp_unit_write(const axutil_env_t *env, const int be)
+{
+    static unsigned char buf[SP_UNIT_TIFF_LEN];
+    sp_unit_tag          tags[16];
+    sp_tiff              t, w;
+    unsigned char        vals[8];
+    const char          *why = NULL;
+    size_t               len = 0;
+    int                  n   = sp_unit_tiff_tags(tags);
+
+    n = sp_unit_tiff_set(tags, n, SP_TIFF_FREEOFFSETS, 1, 100);
+    const size_t size = sp_unit_tiff_make(buf, be, tags, n);
+    SP_UNIT_CHECK(NULL == sp_tiff_open(&t, buf, size));
+
+    // One strip of all the rows, 13 bytes of data, so that the IFD
+    // offset needs padding.
+    sp_tiff_put32(be, vals,     8);
+    sp_tiff_put32(be, vals + 4, 13);
+    const sp_tiff_entry added[] =
+    {
+        { SP_TIFF_COUNTS,  SP_TIFF_LONG, 1, vals + 4, 4 },
+        { SP_TIFF_ROWS,    SP_TIFF_LONG, 1, vals + 4, 4 },
+        { SP_TIFF_OFFSETS, SP_TIFF_LONG, 1, vals,     4 },
+    };
+    unsigned char *out = sp_tiff_write(env, &t, added, 3, 13, &len, &why);
+    SP_UNIT_CHECK(NULL != out && NULL == why);
+    if (NULL == out) return;
+
+    SP_UNIT_CHECK(0 == sp_tiff_32(be, out + 4) % 2);
+    SP_UNIT_CHECK(NULL == sp_tiff_open(&w, out, len));
+    SP_UNIT_CHECK(be == w.be && SP_UNIT_TIFF_WIDTH == w.width);
+    SP_UNIT_CHECK(1 == w.n_strips);
+    SP_UNIT_CHECK(8 == sp_tiff_get(&w, SP_TIFF_OFFSETS, 0, -1));
+    SP_UNIT_CHECK(13 == sp_tiff_get(&w, SP_TIFF_COUNTS, 0, -1));
+    SP_UNIT_CHECK(NULL == sp_tiff_find(&w, SP_TIFF_FREEOFFSETS));
+    SP_UNIT_CHECK(NULL == sp_tiff_geo(&w));
+    SP_UNIT_CHECK(0.5 == w.scale[1] && 50.0 == w.tie[1]);
+
+    // Sorted by tag, the tag replaced only once.
+    uint32_t i, prev = 0;
+    for (i = 0; i < w.n_entries; i++)
+    {
+        const uint32_t tag = sp_tiff_16(be, w.ifd + 12 * i);
+        SP_UNIT_CHECK(tag > prev);
+        prev = tag;
+    }
+    SP_UNIT_CHECK(n - 1 == (int) w.n_entries);
+
+    AXIS2_FREE(env->allocator, out);
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    axutil_env_t *env = sp_unit_init("sp_unit_tiff");
+    if (NULL == env) return 1;
+
+    sp_unit_bytes();
+    for (int be = 0; be <= 1; be++)
+    {
+        sp_unit_open(be);
+        sp_unit_reject(be);
+        sp_unit_write(env, be);
+    }
+
+    return sp_unit_done("sp_unit_tiff");
+}